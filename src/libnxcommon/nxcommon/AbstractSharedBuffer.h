@@ -30,7 +30,10 @@
 #include <memory>
 #include <algorithm>
 #include <vector>
+#include <new>
 #include "util.h"
+#include "strutil.h"
+#include "SharedBufferHeader.h"
 
 using std::shared_ptr;
 using std::default_delete;
@@ -58,6 +61,18 @@ class AbstractSharedString;*/
  * 	actual data is always the terminator. _The size and capacity values are measured excluding the terminator_, which
  * 	means that the number of UnitTs allocated for the buffer is actually capacity+1.
  *
+ * 	Heap buffers are shared using an intrusive, atomic reference count (see SharedBufferHeader), so copies of the same
+ * 	buffer can safely be used and modified from different threads. Copy-on-write happens whenever the reference count
+ * 	isn't exactly 1.
+ *
+ * 	Small buffers are stored inline in the object instead of on the heap (small buffer optimization). The inline storage
+ * 	overlaps the pointer to the heap buffer header. Its capacity is InlineCapacity UnitTs
+ * 	(31 chars for CString, 32 bytes for ByteArray). Inline buffers are never shared, so copying them copies the data, but
+ * 	that is cheaper than the atomic reference counting of a shared buffer. When an inline buffer grows beyond
+ * 	InlineCapacity, it transparently moves to a shared heap buffer, and a shared buffer that is copied on write moves
+ * 	back to inline storage if it fits. Buffers that alias or take ownership of external arrays always use those arrays.
+ * 	Null buffers are inline, so they do not allocate.
+ *
  * 	This class is an abstract base class and can not be used on its own. It uses a form of static polymorphism by means
  * 	of the curiously recurring template pattern (CRTP), which means that the first template parameter is actually the
  * 	class that derives from this class. This way, many methods that are already implemented here actually work with
@@ -72,17 +87,16 @@ class AbstractSharedBuffer
 
 	friend class ByteArray;
 
-private:
-	// The empty pointers for terminated and unterminated buffers are different
-	struct _EmptyPtrTerm { static const shared_ptr<UnitT> value; };
-	struct _EmptyPtrNonterm { static const shared_ptr<UnitT> value; };
+	template <typename BufT>
+	friend class AbstractSharedBufferView;
 
+private:
 	// The length of the terminator (in UnitTs)
 	struct _TermLen0 { static const size_t value = 0; };
 	struct _TermLen1 { static const size_t value = 1; };
 
-	// Select one of the above structs, depending on whether the buffer is terminated.
-	typedef typename std::conditional<terminated, _EmptyPtrTerm, _EmptyPtrNonterm>::type EmptyPtr;
+	// Size of the inline storage in bytes
+	static const size_t InlineStorageSize = 32;
 
 protected:
 	struct MallocFreeDeleter
@@ -91,8 +105,14 @@ protected:
 	};
 
 public:
+	typedef UnitT unit_t;
+
 	typedef typename std::conditional<terminated, _TermLen1, _TermLen0>::type TermLen;
 
+	/**	\brief The number of UnitTs (excluding the terminator) that can be stored without allocating heap memory.
+	 */
+	static const size_t InlineCapacity = InlineStorageSize / sizeof(UnitT) - (terminated ? 1 : 0);
+
 public:
 
 	// The following will be disabled for a while because of a compiler bug in GCC, probably related to
@@ -143,6 +163,30 @@ public:
 	 */
 	bool isEmpty() const { return msize == 0; }
 
+	/**	\brief Determine whether the data is stored inline in this object instead of in a (shared) heap buffer.
+	 *
+	 * 	@see InlineCapacity
+	 */
+	bool isInline() const { return mdata == sso; }
+
+	/**	\brief Determine whether this buffer is a canonical interned instance.
+	 *
+	 * 	Interned buffers with equal content share the same storage, so they can be compared by pointer. Any modification
+	 * 	makes a private copy that isn't interned anymore.
+	 *
+	 * 	@see CString::intern()
+	 */
+	bool isInterned() const
+	{
+		if (isInline()  ||  !header->interned) {
+			return false;
+		}
+
+		// A slice might share the interned buffer without covering all of it.
+		const InternedSharedBufferHeader* ih = static_cast<const InternedSharedBufferHeader*>(header);
+		return mdata == ih->getData()  &&  msize*sizeof(UnitT) == ih->size;
+	}
+
 
 	/**	\brief Return the size (the number of valid UnitTs, _not_ the number of bytes) of this buffer.
 	 *
@@ -220,7 +264,7 @@ public:
 
 	/**	\brief Squeeze the buffer to be as small as possible.
 	 *
-	 * 	This will reallocate the internal buffer with a capacity equal to its size.
+	 * 	This will reallocate the internal buffer with a capacity equal to its size, or move it to inline storage if it fits.
 	 *
 	 * 	@see realloc(size_t)
 	 */
@@ -245,7 +289,7 @@ public:
 	 *
 	 * 	@return A pointer to the internal buffer.
 	 */
-	const UnitT* get() const { return d.get(); }
+	const UnitT* get() const { return mdata; }
 
 	/**	\brief Return a read-write pointer to the internal buffer.
 	 *
@@ -261,7 +305,18 @@ public:
 	 *
 	 *	@return A read-write pointer to the internal buffer.
 	 */
-	UnitT* mget() { ensureUniqueness(); return d.get(); }
+	UnitT* mget() { ensureUniqueness(); return mdata; }
+
+	/**	\brief Return the hash of the buffer's contents.
+	 *
+	 * 	The hash is computed by Hash() over the raw bytes of the valid data region. It is cached in this object, so
+	 * 	hashing the same buffer repeatedly (e.g. when it's used as a key in a hash map) costs a single computation. The
+	 * 	cached value is dropped whenever the buffer is modified through its methods. If you modify the buffer through a
+	 * 	pointer obtained from mget() after calling this method, call resize(size_t) afterwards to drop the cached value.
+	 *
+	 * 	@return The hash value.
+	 */
+	size_t getHash() const;
 
 
 	ptrdiff_t indexOf(UnitT u, size_t offset = 0) const;
@@ -323,7 +378,7 @@ public:
 	 *
 	 * 	@return A copy of the data as an std::vector, excluding the terminator (if any).
 	 */
-	operator std::vector<UnitT>() const { return std::vector<UnitT>(d.get(), d.get()+msize); }
+	operator std::vector<UnitT>() const { return std::vector<UnitT>(mdata, mdata+msize); }
 
 
 	/**	\brief Return the UnitT at the given index.
@@ -334,7 +389,7 @@ public:
 	 * 	@param idx The index of the UnitT in the buffer.
 	 * 	@return The UnitT at the given index.
 	 */
-	UnitT operator[](size_t idx) const { return d.get()[idx]; }
+	UnitT operator[](size_t idx) const { return mdata[idx]; }
 
 
 	/**	\brief Assignment operator.
@@ -344,7 +399,7 @@ public:
 	 * 	@param other New buffer value.
 	 * 	@return Reference to this buffer.
 	 */
-	DerivedT& operator=(const DerivedT& other);
+	DerivedT& operator=(const DerivedT& other) { assign(other); return *static_cast<DerivedT*>(this); }
 
 	/**	\brief Append another buffer to the end of this one.
 	 *
@@ -357,8 +412,8 @@ public:
 
 	DerivedT& operator+=(UnitT u) { append(u); return *static_cast<DerivedT*>(this); }
 
-	bool operator==(const DerivedT& other) const { return DerivedT::compare(*static_cast<const DerivedT*>(this), other) == 0; }
-	bool operator!=(const DerivedT& other) const { return DerivedT::compare(*static_cast<const DerivedT*>(this), other) != 0; }
+	bool operator==(const DerivedT& other) const { return equals(other); }
+	bool operator!=(const DerivedT& other) const { return !equals(other); }
 	bool operator<(const DerivedT& other) const { return DerivedT::compare(*static_cast<const DerivedT*>(this), other) < 0; }
 	bool operator<=(const DerivedT& other) const { return DerivedT::compare(*static_cast<const DerivedT*>(this), other) <= 0; }
 	bool operator>(const DerivedT& other) const { return DerivedT::compare(*static_cast<const DerivedT*>(this), other) > 0; }
@@ -379,6 +434,10 @@ protected:
 	 */
 	AbstractSharedBuffer(const AbstractSharedBuffer<DerivedT, UnitT, terminated, term>& other);
 
+	~AbstractSharedBuffer() { if (!isInline()) header->unref(); }
+
+	AbstractSharedBuffer& operator=(const AbstractSharedBuffer& other) { assign(other); return *this; }
+
 	/**	\brief Construct a new buffer as a copy of the given buffer.
 	 *
 	 * 	@param data Buffer data.
@@ -446,28 +505,9 @@ protected:
 	 */
 	AbstractSharedBuffer(const UnitT* data, size_t size, bool, bool);
 
-	/**	\brief Constructs a new buffer that aliases the array behind an external shared_ptr, sharing its reference count.
-	 *
-	 * 	Behavior is similar to either the read-aliasing or write-aliasing constructor, depending on the value used for
-	 * 	readAliasDummy. The advantage of using this constructor over either the read-aliasing or write-aliasing constructors
-	 * 	is that it shares a reference count with the given shared_ptr, which means that the data will remain valid even if
-	 * 	the shared_ptr passed in as an argument is later destroyed.
-	 *
-	 * 	\param sharedPtr The input buffer. The newly created AbstractSharedBuffer shares a reference count with it, so it is
-	 * 		guaranteed to remain valid for as long as the new object desires.
-	 * 	\param size The valid buffer data size.
-	 * 	\param capacity The current capacity of the input buffer, _excluding_ the terminator, if any.
-	 * 	\param readAliasDummy Set this to a copy of sharedPtr (the actual raw pointer does not matter, so shared_ptr's
-	 * 		aliasing constructor could be used) for read-aliasing, or an empty shared_ptr for write-aliasing. See comment
-	 * 		on readAliasDummy member variable for more info.
-	 * 	\param isnull Whether the new buffer is a null buffer. Must be given explicitly because a null AbstractSharedBuffer
-	 * 		actually uses a non-null pointer inside its shared_ptr.
-	 */
-	AbstractSharedBuffer(const shared_ptr<UnitT>& sharedPtr, size_t size, size_t capacity,
-			const shared_ptr<UnitT>& readAliasDummy, bool isnull);
-
-	void realloc(size_t newCapacity);
-	void reallocWithOffset(size_t newCapacity, size_t srcOffset, size_t destOffset);
+	void realloc(size_t newCapacity) { reallocWithSplit(newCapacity, 0, 0, 0, 0, 0); }
+	void reallocWithOffset(size_t newCapacity, size_t srcOffset, size_t destOffset)
+			{ reallocWithSplit(newCapacity, 0, 0, 0, srcOffset, destOffset); }
 	void reallocWithSplit(size_t newCapacity, size_t srcOffset1, size_t destOffset1, size_t copyLen1,
 			size_t srcOffset2, size_t destOffset2);
 
@@ -484,9 +524,61 @@ protected:
 
 	void assign(const AbstractSharedBuffer& other);
 
+	/**	\brief Make this a copy of other with its own storage, instead of sharing other's heap buffer.
+	 *
+	 * 	Used for buffers that escaped their BufferArena (see SharedBufferHeader::isEscapedFromArena()).
+	 */
+	void assignCopy(const AbstractSharedBuffer& other);
+
 	size_t resize();
 
+	/**	\brief Switch to the given heap buffer, releasing the current one (if any).
+	 *
+	 * 	Only the storage is changed. Size, capacity and null flag have to be set by the caller.
+	 *
+	 * 	@param h The header of the new buffer.
+	 * 	@param data The start of the data. This may point anywhere inside the buffer.
+	 * 	@param addRef If true, a new reference to h is taken. Otherwise, the reference held by the caller is adopted.
+	 */
+	void setHeap(SharedBufferHeader* h, UnitT* data, bool addRef = true);
+
+	/**	\brief Switch to inline storage, releasing the current heap buffer (if any).
+	 *
+	 * 	The content of the inline storage is left as it is.
+	 */
+	void releaseHeap();
+
+	/**	\brief Make this an empty buffer with fresh storage for at least the given capacity.
+	 *
+	 * 	The old content is discarded, and the terminator (if any) is written.
+	 */
+	void allocate(size_t capacity);
+
+	/**	\brief Return a buffer containing the given part of this buffer's data.
+	 *
+	 * 	If the part is too long to be stored inline, the result shares the heap buffer instead of copying it. For terminated
+	 * 	buffers, this is only possible for parts that extend to the end of the buffer, because the terminator is needed.
+	 */
+	DerivedT slice(size_t begin, size_t len) const;
+
 protected:
+	bool equals(const DerivedT& other) const
+	{
+		if (msize != other.msize) {
+			return false;
+		}
+		if (mdata == other.mdata) {
+			return true;
+		}
+
+		// There is only one interned buffer for each content, so different ones can't be equal.
+		if (isInterned()  &&  other.isInterned()) {
+			return false;
+		}
+
+		return DerivedT::compare(*static_cast<const DerivedT*>(this), other) == 0;
+	}
+
 	static int compare(const UnitT* a, const UnitT* b, size_t size)
 	{
 		return memcmp(a, b, size*sizeof(UnitT));
@@ -494,6 +586,13 @@ protected:
 
 	static UnitT* find(UnitT* beg, UnitT* end, UnitT c)
 	{
+		// Use the vectorized search functions for the common unit sizes
+		if (sizeof(UnitT) == 1) {
+			return (UnitT*) FindChar((const char*) beg, (const char*) end, (char) c);
+		} else if (sizeof(UnitT) == 2) {
+			return (UnitT*) FindChar16((const char16_t*) beg, (const char16_t*) end, (char16_t) c);
+		}
+
 		while (beg != end) {
 			if (*beg == c) {
 				return beg;
@@ -518,6 +617,10 @@ protected:
 
 	static UnitT* find(UnitT* beg, UnitT* end, const UnitT* data, size_t size)
 	{
+		if (sizeof(UnitT) == 1) {
+			return (UnitT*) FindSubstring((const char*) beg, (const char*) end, (const char*) data, size);
+		}
+
 		if (size == 0) {
 			return beg;
 		}
@@ -542,179 +645,259 @@ private:
 	static size_t getGrownCapacity(size_t newCapacity);
 
 protected:
-	shared_ptr<UnitT> d;
+	// The active member is header if mdata doesn't point to sso.
+	union
+	{
+		SharedBufferHeader* header;
+		UnitT sso[InlineStorageSize / sizeof(UnitT)];
+	};
+
+	// Either sso or a pointer into the heap buffer
+	UnitT* mdata;
+
 	size_t msize;
 	size_t mcapacity;
 	bool isnull;
 
-private:
-	// The sole purpose of this is to make read-aliasing work. Normally, this is an empty shared_ptr that
-	// isn't used for anything. If the read-aliasing constructor is used however, it will contain a copy
-	// if this->d, so that this->d.unique() == false and a copy will be made on the next write operation,
-	// which is the desired behavior for read-aliasing (see ensureUniqueness()).
-	// The actual pointer stored in here does not matter, so the aliasing constructor of shared_ptr could
-	// be used.
-	shared_ptr<UnitT> readAliasDummy;
+	// Cached result of getHash(), or 0 if it wasn't computed yet.
+	mutable size_t mhash;
 };
 
 
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
-const shared_ptr<UnitT> AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::_EmptyPtrTerm::value = shared_ptr<UnitT>(new UnitT[1] {term}, default_delete<UnitT[]>());
-
-// The UnitT array below used to be empty, but 0-length arrays aren't supported by all compilers. In particular, they
-// fail in MSVC with C++20 enabled...
-template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
-const shared_ptr<UnitT> AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::_EmptyPtrNonterm::value = shared_ptr<UnitT>(new UnitT[1] {term}, default_delete<UnitT[]>());
-
-
+const size_t AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::InlineCapacity;
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::AbstractSharedBuffer()
-		: d(EmptyPtr::value), msize(0), mcapacity(0), isnull(true)
+		: mdata(sso), msize(0), mcapacity(InlineCapacity), isnull(true), mhash(0)
 {
+	sso[0] = term;
 }
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::AbstractSharedBuffer(const AbstractSharedBuffer<DerivedT, UnitT, terminated, term>& other)
-		: d(other.d), msize(other.msize), mcapacity(other.mcapacity), isnull(other.isnull), readAliasDummy(other.readAliasDummy)
+		: mdata(sso), msize(other.msize), mcapacity(other.mcapacity), isnull(other.isnull), mhash(other.mhash)
 {
+	if (other.isInline()) {
+		memcpy(sso, other.sso, sizeof(sso));
+	} else if (other.header->isEscapedFromArena()) {
+		assignCopy(other);
+	} else {
+		setHeap(other.header, other.mdata);
+	}
 }
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::AbstractSharedBuffer(const UnitT* data, size_t size)
-		: d(data ? shared_ptr<UnitT>(new UnitT[size + TermLen::value], default_delete<UnitT[]>()) : EmptyPtr::value),
-		  msize(size), mcapacity(size), isnull(data == NULL)
+		: mdata(sso), msize(0), mcapacity(InlineCapacity), isnull(data == NULL), mhash(0)
 {
 	if (data) {
-		memcpy(d.get(), data, size*sizeof(UnitT));
+		allocate(size);
+		memcpy(mdata, data, size*sizeof(UnitT));
+		msize = size;
 
 		if (terminated) {
-			d.get()[size] = term;
+			mdata[size] = term;
 		}
+	} else {
+		sso[0] = term;
 	}
 }
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::AbstractSharedBuffer(const UnitT* data, size_t size, size_t capacity)
-		: d(data ? shared_ptr<UnitT>(new UnitT[capacity + TermLen::value], default_delete<UnitT[]>()) : EmptyPtr::value),
-		  msize(size), mcapacity(capacity), isnull(data == NULL)
+		: mdata(sso), msize(0), mcapacity(InlineCapacity), isnull(data == NULL), mhash(0)
 {
 	if (data) {
-		memcpy(d.get(), data, size*sizeof(UnitT));
+		allocate(capacity);
+		memcpy(mdata, data, size*sizeof(UnitT));
+		msize = size;
 
 		if (terminated) {
-			d.get()[size] = term;
+			mdata[size] = term;
 		}
+	} else {
+		sso[0] = term;
 	}
 }
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::AbstractSharedBuffer(size_t capacity)
-		: d(shared_ptr<UnitT>(new UnitT[capacity + TermLen::value], default_delete<UnitT[]>())), msize(0), mcapacity(capacity),
-		  isnull(false)
+		: mdata(sso), msize(0), mcapacity(InlineCapacity), isnull(false), mhash(0)
 {
-	if (terminated) {
-		d.get()[0] = term;
-	}
+	allocate(capacity);
 }
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 template <typename Deleter>
 AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::AbstractSharedBuffer(UnitT* data, size_t size, size_t capacity, Deleter del)
-		: d(data ? shared_ptr<UnitT>(data, del) : EmptyPtr::value), msize(size), mcapacity(capacity), isnull(data == NULL)
+		: mdata(sso), msize(0), mcapacity(InlineCapacity), isnull(data == NULL), mhash(0)
 {
+	// Ownership is taken, and the caller may rely on get() returning data, so this is never inline.
+	if (data) {
+		setHeap(new ExternalSharedBufferHeader<UnitT, Deleter>(data, del, false), data, false);
+		msize = size;
+		mcapacity = capacity;
+	} else {
+		sso[0] = term;
+	}
 }
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::AbstractSharedBuffer(UnitT* data, size_t size, size_t capacity, bool)
-		: d(data ? shared_ptr<UnitT>(data, NopDeleter<UnitT>()) : EmptyPtr::value), msize(size), mcapacity(capacity), isnull(data == NULL)
+		: mdata(sso), msize(0), mcapacity(InlineCapacity), isnull(data == NULL), mhash(0)
 {
+	if (data) {
+		setHeap(new ExternalSharedBufferHeader<UnitT, NopDeleter<UnitT> >(data, NopDeleter<UnitT>(), false), data, false);
+		msize = size;
+		mcapacity = capacity;
+	} else {
+		sso[0] = term;
+	}
 }
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::AbstractSharedBuffer(const UnitT* data, size_t size, bool, bool)
-		: d(data ? shared_ptr<UnitT>(const_cast<UnitT*>(data), NopDeleter<UnitT>()) : EmptyPtr::value), msize(size), mcapacity(size),
-		  isnull(data == NULL), readAliasDummy(d)
+		: mdata(sso), msize(0), mcapacity(InlineCapacity), isnull(data == NULL), mhash(0)
 {
+	if (data) {
+		UnitT* mutableData = const_cast<UnitT*>(data);
+		setHeap(new ExternalSharedBufferHeader<UnitT, NopDeleter<UnitT> >(mutableData, NopDeleter<UnitT>(), true),
+				mutableData, false);
+		msize = size;
+		mcapacity = size;
+	} else {
+		sso[0] = term;
+	}
 }
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
-AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::AbstractSharedBuffer(const shared_ptr<UnitT>& sharedPtr,
-		size_t size, size_t capacity, const shared_ptr<UnitT>& readAliasDummy, bool isnull)
-		: d(sharedPtr ? sharedPtr : EmptyPtr::value), msize(size), mcapacity(capacity), isnull(isnull),
-		  readAliasDummy(readAliasDummy)
+void AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::setHeap(SharedBufferHeader* h, UnitT* data, bool addRef)
 {
+	// Take the new reference first, in case h is the current header.
+	if (addRef) {
+		h->ref();
+	}
+
+	if (!isInline()) {
+		header->unref();
+	}
+
+	header = h;
+	mdata = data;
 }
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
-size_t AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::getGrownCapacity(size_t newCapacity)
+void AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::releaseHeap()
 {
-	return GetNextPowerOfTwo(newCapacity);
+	if (!isInline()) {
+		header->unref();
+		mdata = sso;
+	}
 }
 
 
-// Assumption: newCapacity >= size
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
-void AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::realloc(size_t newCapacity)
+void AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::allocate(size_t capacity)
 {
-	UnitT* newD = new UnitT[newCapacity + TermLen::value];
-	memcpy(newD, d.get(), msize*sizeof(UnitT));
-	// We don't copy the terminator in the above memcpy, because it might not be there yet. This situation can pop up temporarily
-	// in internal methods of this class, and these methods might use realloc() to fix that.
-	if (terminated) newD[msize] = term;
-	d = shared_ptr<UnitT>(newD, default_delete<UnitT[]>());
-	mcapacity = newCapacity;
-	isnull = false;
-	readAliasDummy.reset();
+	if (capacity <= InlineCapacity) {
+		releaseHeap();
+		mcapacity = InlineCapacity;
+	} else {
+		SharedBufferHeader* h = SharedBufferHeader::create((capacity + TermLen::value) * sizeof(UnitT));
+		setHeap(h, (UnitT*) h->getData(), false);
+		mcapacity = capacity;
+	}
+
+	msize = 0;
+	mhash = 0;
+
+	if (terminated) {
+		mdata[0] = term;
+	}
 }
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
-void AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::reallocWithOffset(size_t newCapacity, size_t srcOffset, size_t destOffset)
+DerivedT AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::slice(size_t begin, size_t len) const
 {
-	UnitT* newD = new UnitT[newCapacity + TermLen::value];
-	size_t cpySize = msize-srcOffset;
-	memcpy(newD+destOffset, d.get()+srcOffset, cpySize*sizeof(UnitT));
-	msize += destOffset-srcOffset;
-	// We don't copy the terminator in the above memcpy, because it might not be there yet. This situation can pop up temporarily
-	// in internal methods of this class, and these methods might use reallocWithOffset() to fix that.
-	if (terminated) newD[msize] = term;
-	d = shared_ptr<UnitT>(newD, default_delete<UnitT[]>());
-	mcapacity = newCapacity;
-	isnull = false;
-	readAliasDummy.reset();
+	if (begin == 0  &&  len == msize) {
+		return *static_cast<const DerivedT*>(this);
+	}
+
+	if (!isInline()  &&  len > InlineCapacity  &&  (!terminated  ||  begin+len == msize)  &&  !header->isEscapedFromArena()) {
+		// Share the buffer, pointing into the middle of it. The reference count is shared, so COW still works, and the
+		// capacity is limited to the slice, so the result never writes outside of it.
+		DerivedT res;
+		res.setHeap(header, mdata + begin);
+		res.msize = len;
+		res.mcapacity = len;
+		res.isnull = false;
+		return res;
+	}
+
+	return DerivedT(mdata + begin, len);
 }
 
 
+template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
+size_t AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::getGrownCapacity(size_t newCapacity)
+{
+	if (newCapacity <= InlineCapacity) {
+		return InlineCapacity;
+	}
+
+	return GetNextPowerOfTwo(newCapacity);
+}
+
+
+// Assumption: The new size (destOffset2 + size-srcOffset2) <= newCapacity
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 void AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::reallocWithSplit(size_t newCapacity,
 		size_t srcOffset1, size_t destOffset1, size_t copyLen1,
 		size_t srcOffset2, size_t destOffset2)
 {
-	UnitT* newD = new UnitT[newCapacity];
 	size_t copyLen2 = msize-srcOffset2;
-	memcpy(newD+destOffset1, d.get()+srcOffset1, copyLen1*sizeof(UnitT));
-	memcpy(newD+destOffset2, d.get()+srcOffset2, copyLen2*sizeof(UnitT));
-	msize = destOffset2+copyLen2;
+	size_t newSize = destOffset2+copyLen2;
+
+	if (newCapacity <= InlineCapacity) {
+		// The source might be the inline buffer itself, or overlap with it, so copy through a temporary buffer.
+		UnitT tmp[sizeof(sso) / sizeof(UnitT)];
+		memcpy(tmp+destOffset1, mdata+srcOffset1, copyLen1*sizeof(UnitT));
+		memcpy(tmp+destOffset2, mdata+srcOffset2, copyLen2*sizeof(UnitT));
+
+		releaseHeap();
+
+		memcpy(sso+destOffset1, tmp+destOffset1, copyLen1*sizeof(UnitT));
+		memcpy(sso+destOffset2, tmp+destOffset2, copyLen2*sizeof(UnitT));
+		mcapacity = InlineCapacity;
+	} else {
+		SharedBufferHeader* h = SharedBufferHeader::create((newCapacity + TermLen::value) * sizeof(UnitT));
+		UnitT* newD = (UnitT*) h->getData();
+		memcpy(newD+destOffset1, mdata+srcOffset1, copyLen1*sizeof(UnitT));
+		memcpy(newD+destOffset2, mdata+srcOffset2, copyLen2*sizeof(UnitT));
+		setHeap(h, newD, false);
+		mcapacity = newCapacity;
+	}
+
+	msize = newSize;
+	mhash = 0;
 	// We don't copy the terminator in the above memcpy, because it might not be there yet. This situation can pop up temporarily
 	// in internal methods of this class, and these methods might use reallocWithSplit() to fix that.
-	if (terminated) newD[msize] = term;
-	d = shared_ptr<UnitT>(newD, default_delete<UnitT[]>());
-	mcapacity = newCapacity;
+	if (terminated) mdata[msize] = term;
 	isnull = false;
-	readAliasDummy.reset();
 }
 
 
@@ -775,7 +958,7 @@ void AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::resize(size_t newS
 	msize = newSize;
 
 	if (terminated) {
-		d.get()[newSize] = term;
+		mdata[newSize] = term;
 	}
 }
 
@@ -798,11 +981,12 @@ void AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::growWithSplit(size
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 void AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::ensureUniqueness()
 {
-	// TODO: use_count() is dangerous in multithreaded environments. Let's be honest, this class was never thread-safe.
-    if (d.use_count() != 1) {
+	// Inline buffers are never shared.
+	if (!isInline()  &&  !header->isUnique()) {
 		realloc(mcapacity);
 	} else {
 		isnull = false;
+		mhash = 0;
 	}
 }
 
@@ -810,18 +994,18 @@ void AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::ensureUniqueness()
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 ptrdiff_t AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::indexOf(UnitT u, size_t offset) const
 {
-	UnitT* end = d.get() + msize;
-	UnitT* o = DerivedT::find(d.get() + offset, end, u);
-	return o != end ? (o - d.get()) : -1;
+	UnitT* end = mdata + msize;
+	UnitT* o = DerivedT::find(mdata + offset, end, u);
+	return o != end ? (o - mdata) : -1;
 }
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 ptrdiff_t AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::indexOf(const DerivedT& other, size_t offset) const
 {
-	UnitT* end = d.get() + msize;
-	UnitT* o = DerivedT::find(d.get() + offset, end, other.get(), other.length());
-	return o != end ? (o - d.get()) : -1;
+	UnitT* end = mdata + msize;
+	UnitT* o = DerivedT::find(mdata + offset, end, other.get(), other.length());
+	return o != end ? (o - mdata) : -1;
 }
 
 
@@ -829,7 +1013,7 @@ template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 DerivedT& AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::append(const DerivedT& other)
 {
 	grow(msize + other.msize);
-	memcpy(d.get() + msize, other.d.get(), (other.msize + TermLen::value)*sizeof(UnitT));
+	memcpy(mdata + msize, other.mdata, (other.msize + TermLen::value)*sizeof(UnitT));
 	msize += other.msize;
 	return *static_cast<DerivedT*>(this);
 }
@@ -839,11 +1023,11 @@ template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 DerivedT& AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::append(UnitT u)
 {
 	grow(msize + 1);
-	d.get()[msize] = u;
+	mdata[msize] = u;
 	msize++;
 
 	if (terminated) {
-		d.get()[msize] = term;
+		mdata[msize] = term;
 	}
 
 	return *static_cast<DerivedT*>(this);
@@ -854,7 +1038,7 @@ template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 DerivedT& AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::prepend(const DerivedT& other)
 {
 	growWithOffset(msize + other.msize, 0, other.msize);
-	memcpy(d.get(), other.d.get(), other.msize*sizeof(UnitT));
+	memcpy(mdata, other.mdata, other.msize*sizeof(UnitT));
 	return *static_cast<DerivedT*>(this);
 }
 
@@ -863,7 +1047,7 @@ template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 DerivedT& AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::prepend(UnitT u)
 {
 	growWithOffset(msize + 1, 0, 1);
-	d.get()[0] = u;
+	mdata[0] = u;
 	return *static_cast<DerivedT*>(this);
 }
 
@@ -872,7 +1056,7 @@ template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 DerivedT& AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::insert(size_t index, const DerivedT& other)
 {
 	growWithSplit(msize + other.msize, 0, 0, index, index, index+other.msize);
-	memcpy(d.get()+index, other.d.get(), other.msize*sizeof(UnitT));
+	memcpy(mdata+index, other.mdata, other.msize*sizeof(UnitT));
 	return *static_cast<DerivedT*>(this);
 }
 
@@ -881,37 +1065,89 @@ template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 DerivedT& AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::insert(size_t index, UnitT u)
 {
 	growWithSplit(msize + 1, 0, 0, index, index, index+1);
-	d.get()[index] = u;
+	mdata[index] = u;
 	return *static_cast<DerivedT*>(this);
 }
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
-DerivedT& AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::operator=(const DerivedT& other)
+void AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::assign(const AbstractSharedBuffer& other)
 {
-	if (this != &other) {
-		d = other.d;
-		msize = other.msize;
-		mcapacity = other.mcapacity;
-		isnull = other.isnull;
+	if (this == &other) {
+		return;
 	}
+
+	if (other.isInline()) {
+		releaseHeap();
+		memcpy(sso, other.sso, sizeof(sso));
+	} else if (other.header->isEscapedFromArena()) {
+		assignCopy(other);
+		return;
+	} else {
+		setHeap(other.header, other.mdata);
+	}
+
+	msize = other.msize;
+	mcapacity = other.mcapacity;
+	isnull = other.isnull;
+	mhash = other.mhash;
+}
+
+
+template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
+void AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::assignCopy(const AbstractSharedBuffer& other)
+{
+	// If this shares other's buffer, allocate() drops our reference, but other's keeps the data alive.
+	allocate(other.msize);
+	memcpy(mdata, other.mdata, other.msize*sizeof(UnitT));
+	msize = other.msize;
+
+	if (terminated) {
+		mdata[msize] = term;
+	}
+
+	isnull = other.isnull;
+	mhash = other.mhash;
 }
 
 
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 size_t AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::resize()
 {
-	UnitT* data = d.get();
+	UnitT* data = mdata;
 	for (msize = 0 ; msize < mcapacity  &&  data[msize] != term ; msize++);
+	mhash = 0;
 	return msize;
 }
 
 
+template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
+size_t AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::getHash() const
+{
+	if (mhash == 0) {
+		// A hash value of 0 simply won't be cached.
+		mhash = (size_t) Hash((const char*) mdata, msize*sizeof(UnitT));
+	}
+
+	return mhash;
+}
+
+
 template <typename DerivedT, typename UnitT, bool terminated, UnitT term>
 DerivedT AbstractSharedBuffer<DerivedT, UnitT, terminated, term>::join(const DerivedT& separator,
 		const DerivedT* bufs, size_t numBufs)
 {
-	DerivedT joined;
+	if (numBufs == 0) {
+		return DerivedT();
+	}
+
+	// Size the result up front, so that it's never reallocated
+	size_t joinedSize = (numBufs-1) * separator.msize;
+	for (size_t i = 0 ; i < numBufs ; i++) {
+		joinedSize += bufs[i].msize;
+	}
+
+	DerivedT joined(joinedSize);
 
 	for (size_t i = 0 ; i < numBufs ; i++) {
 		if (i != 0) {
@@ -0,0 +1,298 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_ABSTRACTSHAREDBUFFERVIEW_H_
+#define NXCOMMON_ABSTRACTSHAREDBUFFERVIEW_H_
+
+#include <nxcommon/config.h>
+#include "AbstractSharedBuffer.h"
+#include "strutil.h"
+#include <vector>
+#include <iterator>
+#include <functional>
+
+
+
+/**	\brief A read-only view of a part of an AbstractSharedBuffer.
+ *
+ * 	A view consists of a copy of the viewed buffer together with an offset and a length. Because the buffer classes use
+ * 	data sharing, creating a view never copies heap data, and neither do the slicing methods of the view: substr(),
+ * 	split() and the trim methods just create new views into the same buffer. This makes views well suited for parsing
+ * 	and tokenizing large inputs.
+ *
+ * 	The data of a view is _not_ terminated, even if the buffer type is, so get() can't be used as a C string. To get a
+ * 	real buffer object, use toBuffer() or the conversion operator. These share the underlying buffer whenever possible,
+ * 	and copy the viewed data otherwise (e.g. if the buffer type is terminated and the view doesn't extend to the end of
+ * 	the buffer).
+ *
+ * 	Because the view holds a copy of the buffer, the viewed data stays valid for the lifetime of the view, even if the
+ * 	original buffer object is modified or destroyed (as long as it doesn't alias external memory). Views of short buffers
+ * 	that are stored inline (see AbstractSharedBuffer) contain their own copy of the data, so get() of such a view is
+ * 	only valid for the lifetime of the view object itself.
+ *
+ * 	@see CStringView
+ * 	@see ByteArrayView
+ */
+template <typename BufT>
+class AbstractSharedBufferView
+{
+public:
+	typedef typename BufT::unit_t unit_t;
+
+	static const size_t npos = (size_t) -1;
+
+private:
+	typedef unit_t UnitT;
+
+public:
+	/**	\brief Constructs a view of a null buffer.
+	 */
+	AbstractSharedBufferView() : offset(0), len(0) {}
+
+	/**	\brief Constructs a view of the whole buffer.
+	 */
+	AbstractSharedBufferView(const BufT& buf) : buf(buf), offset(0), len(buf.length()) {}
+
+	/**	\brief Constructs a view of a part of a buffer.
+	 *
+	 * 	@param buf The buffer.
+	 * 	@param begin The index of the first UnitT of the view.
+	 * 	@param len The length of the view, or npos to view everything up to the end of the buffer.
+	 */
+	AbstractSharedBufferView(const BufT& buf, size_t begin, size_t len = npos)
+			: buf(buf), offset(begin), len(len == npos ? buf.length()-begin : len) {}
+
+	/**	\brief Determine whether the viewed buffer is a null buffer.
+	 */
+	bool isNull() const { return buf.isNull(); }
+
+	bool isEmpty() const { return len == 0; }
+
+	size_t getSize() const { return len; }
+	size_t size() const { return len; }
+	size_t length() const { return len; }
+
+	/**	\brief Return a pointer to the viewed data.
+	 *
+	 * 	NOTE: The data is not terminated.
+	 */
+	const UnitT* get() const { return buf.get() + offset; }
+
+	const UnitT* begin() const { return get(); }
+	const UnitT* end() const { return get() + len; }
+
+	UnitT operator[](size_t idx) const { return get()[idx]; }
+
+	/**	\brief Return the viewed buffer.
+	 *
+	 * 	This is the whole buffer, including the parts that are outside of this view.
+	 */
+	const BufT& getBuffer() const { return buf; }
+
+	/**	\brief Return the index of the first UnitT of this view inside the viewed buffer.
+	 */
+	size_t getOffset() const { return offset; }
+
+	/**	\brief Return a buffer containing the viewed data.
+	 *
+	 * 	The result shares the underlying buffer if possible, otherwise the viewed data is copied.
+	 */
+	BufT toBuffer() const { return buf.slice(offset, len); }
+
+	operator BufT() const { return toBuffer(); }
+
+	ptrdiff_t indexOf(UnitT u, size_t offset = 0) const;
+	ptrdiff_t indexOf(const AbstractSharedBufferView& other, size_t offset = 0) const;
+	ptrdiff_t lastIndexOf(UnitT u) const;
+
+	bool startsWith(const AbstractSharedBufferView& other) const
+			{ return other.len <= len  &&  BufT::compare(get(), other.get(), other.len) == 0; }
+	bool endsWith(const AbstractSharedBufferView& other) const
+			{ return other.len <= len  &&  BufT::compare(get() + (len-other.len), other.get(), other.len) == 0; }
+
+	AbstractSharedBufferView substr(size_t begin, size_t len = npos) const
+			{ return AbstractSharedBufferView(buf, offset+begin, len == npos ? this->len-begin : len); }
+
+	/**	\brief Split the view at each occurrence of separator into views of the parts.
+	 *
+	 * 	This works like AbstractSharedString::split(), but doesn't copy any data.
+	 */
+	template <typename OutputIterator>
+	void split(OutputIterator out, UnitT separator) const;
+
+	std::vector<AbstractSharedBufferView> split(UnitT separator) const
+			{ std::vector<AbstractSharedBufferView> v; split(std::back_inserter(v), separator); return v; }
+
+	/**	\brief Remove all leading UnitTs contained in the terminated array units from the view.
+	 *
+	 * 	Like the other trim methods, this only changes the bounds of the view, so the buffer is not modified.
+	 */
+	AbstractSharedBufferView& ltrim(const UnitT* units);
+	AbstractSharedBufferView& ltrim(UnitT u) { UnitT units[2] = { u, 0 }; return ltrim(units); }
+	AbstractSharedBufferView& ltrim() { return ltrim(getWhitespace()); }
+	AbstractSharedBufferView& rtrim(const UnitT* units);
+	AbstractSharedBufferView& rtrim(UnitT u) { UnitT units[2] = { u, 0 }; return rtrim(units); }
+	AbstractSharedBufferView& rtrim() { return rtrim(getWhitespace()); }
+	AbstractSharedBufferView& trim(const UnitT* units) { rtrim(units); return ltrim(units); }
+	AbstractSharedBufferView& trim(UnitT u) { rtrim(u); return ltrim(u); }
+	AbstractSharedBufferView& trim() { rtrim(); return ltrim(); }
+
+	/**	\brief Return the hash of the viewed data.
+	 *
+	 * 	The result is equal to the hash of a buffer with the same content (see AbstractSharedBuffer::getHash()).
+	 */
+	size_t getHash() const { return (size_t) Hash((const char*) get(), len*sizeof(UnitT)); }
+
+	bool operator==(const AbstractSharedBufferView& other) const { return compare(other) == 0; }
+	bool operator!=(const AbstractSharedBufferView& other) const { return compare(other) != 0; }
+	bool operator<(const AbstractSharedBufferView& other) const { return compare(other) < 0; }
+	bool operator<=(const AbstractSharedBufferView& other) const { return compare(other) <= 0; }
+	bool operator>(const AbstractSharedBufferView& other) const { return compare(other) > 0; }
+	bool operator>=(const AbstractSharedBufferView& other) const { return compare(other) >= 0; }
+
+private:
+	static const UnitT* getWhitespace()
+	{
+		static const UnitT ws[] = { ' ', '\t', '\r', '\n', 0 };
+		return ws;
+	}
+
+	static bool contains(const UnitT* units, UnitT u)
+	{
+		for (; *units != 0 ; units++) {
+			if (*units == u) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	int compare(const AbstractSharedBufferView& other) const
+			{ return BufT::compare(get(), other.get(), len, other.len); }
+
+private:
+	BufT buf;
+	size_t offset;
+	size_t len;
+};
+
+
+
+
+template <typename BufT>
+const size_t AbstractSharedBufferView<BufT>::npos;
+
+
+template <typename BufT>
+ptrdiff_t AbstractSharedBufferView<BufT>::indexOf(UnitT u, size_t offset) const
+{
+	UnitT* beg = const_cast<UnitT*>(get());
+	UnitT* end = beg + len;
+	UnitT* o = BufT::find(beg + offset, end, u);
+	return o == end ? -1 : o - beg;
+}
+
+
+template <typename BufT>
+ptrdiff_t AbstractSharedBufferView<BufT>::indexOf(const AbstractSharedBufferView& other, size_t offset) const
+{
+	UnitT* beg = const_cast<UnitT*>(get());
+	UnitT* end = beg + len;
+	UnitT* o = BufT::find(beg + offset, end, other.get(), other.len);
+	return o == end ? -1 : o - beg;
+}
+
+
+template <typename BufT>
+ptrdiff_t AbstractSharedBufferView<BufT>::lastIndexOf(UnitT u) const
+{
+	const UnitT* data = get();
+
+	for (size_t i = len ; i != 0 ; i--) {
+		if (data[i-1] == u) {
+			return i-1;
+		}
+	}
+
+	return -1;
+}
+
+
+template <typename BufT>
+template <typename OutputIterator>
+void AbstractSharedBufferView<BufT>::split(OutputIterator out, UnitT separator) const
+{
+	ptrdiff_t prevIdx = 0;
+	ptrdiff_t idx = 0;
+
+	while ((idx = indexOf(separator, prevIdx)) != -1) {
+		*out++ = substr(prevIdx, idx-prevIdx);
+		prevIdx = idx+1;
+	}
+
+	*out++ = substr(prevIdx);
+}
+
+
+template <typename BufT>
+AbstractSharedBufferView<BufT>& AbstractSharedBufferView<BufT>::ltrim(const UnitT* units)
+{
+	const UnitT* data = get();
+	size_t n = 0;
+
+	while (n < len  &&  contains(units, data[n])) n++;
+
+	offset += n;
+	len -= n;
+	return *this;
+}
+
+
+template <typename BufT>
+AbstractSharedBufferView<BufT>& AbstractSharedBufferView<BufT>::rtrim(const UnitT* units)
+{
+	const UnitT* data = get();
+
+	while (len != 0  &&  contains(units, data[len-1])) len--;
+
+	return *this;
+}
+
+
+
+
+namespace std
+{
+	template <typename BufT>
+	struct hash<AbstractSharedBufferView<BufT> >
+	{
+		typedef AbstractSharedBufferView<BufT> argument_type;
+		typedef size_t result_type;
+
+		result_type operator()(const argument_type& v) const
+		{
+			return v.getHash();
+		}
+	};
+}
+
+#endif /* NXCOMMON_ABSTRACTSHAREDBUFFERVIEW_H_ */
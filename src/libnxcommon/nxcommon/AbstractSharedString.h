@@ -85,7 +85,7 @@ public:
 	AbstractSharedString(const ByteArray& other);
 
 	using BaseClass::resize;
-	size_t resize() { resize(ImplT::strlen(BaseClass::d.get())); return this->msize; }
+	size_t resize() { resize(ImplT::strlen(this->mdata)); return this->msize; }
 
 	using BaseClass::append;
 	ImplT& append(long long val, unsigned int base = 10) { return append(ImplT::convertFromLongLong(val, base)); }
@@ -171,26 +171,40 @@ protected:
 
 template <typename ImplT, typename UnitT, UnitT term>
 AbstractSharedString<ImplT, UnitT, term>::AbstractSharedString(const ByteArray& other)
-		: BaseClass(shared_ptr<UnitT>(other.d, (UnitT*) other.d.get()),
-				(other.msize + sizeof(UnitT) - 1) / sizeof(UnitT),	// Round up, validity of this new size gets checked below.
-																	// If we rounded down here, the terminator might be written in
-																	// the valid data region of other, which would be illegal.
-				other.mcapacity / sizeof(UnitT) - 1,	// Round down, otherwise we would access the buffer out of bounds.
-														// Also, decrease by 1 because we need a slot for the null terminator.
-				shared_ptr<UnitT>(other.readAliasDummy, NULL),	// We don't care about the actual pointer in readAliasDummy
-				other.isnull)
+		: BaseClass()
 {
-	if (this->mcapacity < this->msize) {
-		// It could very well be that the capacity is lower than the size because of the rounding up and decrementing above.
-		// Here we have not enough capacity, so we have to fall back to copying the buffer
+	if (other.isnull) {
+		return;
+	}
+
+	// Round up, validity of this new size gets checked below. If we rounded down here, the terminator might be written in
+	// the valid data region of other, which would be illegal.
+	size_t size = (other.msize + sizeof(UnitT) - 1) / sizeof(UnitT);
+
+	// Round down, otherwise we would access the buffer out of bounds.
+	size_t capacity = other.mcapacity / sizeof(UnitT);
+
+	if (!other.isInline()  &&  capacity > size  &&  !other.header->isEscapedFromArena()) {
+		// Hooray, we have enough capacity (including a slot for the null terminator), so we can share the buffer.
+		this->setHeap(other.header, (UnitT*) other.mdata);
+		this->msize = size;
+		this->mcapacity = capacity - 1;
+		this->isnull = false;
 
-		// realloc() is guaranteed to actually append the terminator, even if it wasn't there before.
-		this->realloc(this->msize);
-	} else {
-		// Hooray, we have enough capacity!
 		// Now we just have to append the null terminator. We can do that because it lies outside the valid data region of other,
 		// so other doesn't care about it, and if either this or other want to change the buffer, COW copies them anyway.
-		this->d.get()[this->msize] = term;
+		this->mdata[size] = term;
+	} else {
+		// Either there's not enough capacity for the terminator, or other is inline and can't be shared. Fall back to copying.
+		this->allocate(size);
+		if (size != 0) {
+			// Padding, in case the size was rounded up
+			this->mdata[size-1] = 0;
+		}
+		memcpy(this->mdata, other.mdata, other.msize);
+		this->msize = size;
+		this->mdata[size] = term;
+		this->isnull = false;
 	}
 }
 
@@ -199,10 +213,7 @@ AbstractSharedString<ImplT, UnitT, term>::AbstractSharedString(const ByteArray&
 template <typename ImplT, typename UnitT, UnitT term>
 ImplT AbstractSharedString<ImplT, UnitT, term>::substr(size_t begin, size_t len) const
 {
-	UnitT* sub = new UnitT[len+1];
-	memcpy(sub, this->d.get() + begin, len * sizeof(UnitT));
-	sub[len] = term;
-	return ImplT::from(sub, len);
+	return this->slice(begin, len);
 }
 
 
@@ -229,7 +240,7 @@ bool AbstractSharedString<ImplT, UnitT, term>::startsWith(const ImplT& other)
 		return false;
 	}
 
-	return ImplT::compare(this->d.get(), other.get(), other.length()) == 0;
+	return ImplT::compare(this->mdata, other.get(), other.length()) == 0;
 	//return ImplT::strncmp(*static_cast<const ImplT*>(this), other, other.length()) == 0;
 }
 
@@ -246,7 +257,7 @@ bool AbstractSharedString<ImplT, UnitT, term>::endsWith(const ImplT& other)
 
 	// TODO: This should be done without a copy, but ImplT::strncmp() currently doesn't support offsets
 	//return substr(len-olen, olen) == other;
-	return ImplT::compare(this->d.get() + (len-olen), other.get(), olen) == 0;
+	return ImplT::compare(this->mdata + (len-olen), other.get(), olen) == 0;
 }
 
 
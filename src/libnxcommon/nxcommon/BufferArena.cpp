@@ -0,0 +1,181 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "BufferArena.h"
+#include <algorithm>
+
+
+
+// Heap buffers are aligned to this
+static const size_t ArenaAlignment = 16;
+
+
+
+struct BufferArena::Chunk
+{
+	Chunk(uint64_t arenaId) : refcount(1), arenaId(arenaId) {}
+
+	void unref()
+	{
+		if (refcount.fetch_sub(1, std::memory_order_release) == 1) {
+			std::atomic_thread_fence(std::memory_order_acquire);
+			this->~Chunk();
+			::operator delete(this);
+			liveChunkCount.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	// One reference for each buffer allocated from the chunk, plus one for the arena while it's the current chunk.
+	std::atomic<size_t> refcount;
+
+	// The id of the arena that allocated the chunk
+	uint64_t arenaId;
+};
+
+
+// The header of buffers allocated from an arena chunk.
+struct ArenaSharedBufferHeader : public SharedBufferHeader
+{
+	ArenaSharedBufferHeader(BufferArena::Chunk* chunk) : SharedBufferHeader(&releaseArena, false), chunk(chunk)
+			{ arena = true; }
+
+	BufferArena::Chunk* chunk;
+
+	static void releaseArena(SharedBufferHeader* header)
+	{
+		ArenaSharedBufferHeader* ah = static_cast<ArenaSharedBufferHeader*>(header);
+		BufferArena::Chunk* chunk = ah->chunk;
+		ah->~ArenaSharedBufferHeader();
+		chunk->unref();
+	}
+};
+
+static_assert(sizeof(ArenaSharedBufferHeader) <= SharedBufferHeader::PaddedSize,
+		"ArenaSharedBufferHeader doesn't fit into the padded header size");
+
+
+
+thread_local BufferArena* BufferArena::current = NULL;
+std::atomic<size_t> BufferArena::liveChunkCount(0);
+
+// Arena addresses are reused all the time (they usually live on the stack), so chunks remember their arena by an id.
+static std::atomic<uint64_t> nextArenaId(1);
+
+
+
+
+SharedBufferHeader* SharedBufferHeader::create(size_t dataSize)
+{
+	BufferArena* arena = BufferArena::getCurrent();
+
+	if (arena) {
+		SharedBufferHeader* header = arena->createHeader(dataSize);
+
+		if (header) {
+			return header;
+		}
+	}
+
+	void* mem = ::operator new(PaddedSize + dataSize);
+	return new (mem) SharedBufferHeader(&releaseCreated, false);
+}
+
+
+void SharedBufferHeader::releaseCreated(SharedBufferHeader* header)
+{
+	header->~SharedBufferHeader();
+	::operator delete(header);
+}
+
+
+bool SharedBufferHeader::isOutsideArenaScope() const
+{
+	uint64_t arenaId = static_cast<const ArenaSharedBufferHeader*>(this)->chunk->arenaId;
+
+	// Nested arenas are still inside the scopes of the outer ones.
+	for (BufferArena* arena = BufferArena::getCurrent() ; arena ; arena = arena->previous) {
+		if (arena->id == arenaId) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+
+
+BufferArena::BufferArena(size_t chunkSize)
+		: previous(current), id(nextArenaId.fetch_add(1, std::memory_order_relaxed)),
+		  chunkSize(std::max(chunkSize, (size_t) 1024)), chunk(NULL), cur(NULL), end(NULL), allocatedSize(0), chunkCount(0)
+{
+	current = this;
+}
+
+
+BufferArena::~BufferArena()
+{
+	current = previous;
+
+	if (chunk) {
+		chunk->unref();
+	}
+}
+
+
+void BufferArena::nextChunk()
+{
+	if (chunk) {
+		chunk->unref();
+	}
+
+	const size_t chunkHeaderSize = (sizeof(Chunk) + ArenaAlignment-1) & ~(ArenaAlignment-1);
+
+	char* mem = (char*) ::operator new(chunkSize);
+	chunk = new (mem) Chunk(id);
+	cur = mem + chunkHeaderSize;
+	end = mem + chunkSize;
+
+	chunkCount++;
+	liveChunkCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+SharedBufferHeader* BufferArena::createHeader(size_t dataSize)
+{
+	size_t size = (SharedBufferHeader::PaddedSize + dataSize + ArenaAlignment-1) & ~(ArenaAlignment-1);
+
+	if (size > chunkSize/4) {
+		return NULL;
+	}
+
+	if (size > (size_t) (end-cur)) {
+		nextChunk();
+	}
+
+	char* mem = cur;
+	cur += size;
+	allocatedSize += size;
+
+	chunk->refcount.fetch_add(1, std::memory_order_relaxed);
+	return new (mem) ArenaSharedBufferHeader(chunk);
+}
@@ -0,0 +1,144 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_BUFFERARENA_H_
+#define NXCOMMON_BUFFERARENA_H_
+
+#include <nxcommon/config.h>
+#include "SharedBufferHeader.h"
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+
+
+/**	\brief A scope in which the heap data of shared buffers (CString, ByteArray, UString) is taken from a bump allocator.
+ *
+ * 	Constructing a BufferArena makes it the current arena of the calling thread, until it is destroyed. While it is
+ * 	current, all heap buffers that AbstractSharedBuffer allocates in that thread are carved out of large chunks of memory
+ * 	instead of being allocated one by one. This is meant for request-scoped work that creates and drops lots of
+ * 	temporary strings, like building SQL queries or composing log lines:
+ *
+ * 	\code
+ * 	{
+ * 		BufferArena scope;
+ * 		CString query = BuildQuery(...);
+ * 		db.execute(query);
+ * 	}
+ * 	\endcode
+ *
+ * 	Memory in a chunk is never reused. Instead, each chunk counts the live buffers in it, and the whole chunk is freed
+ * 	at once when the arena is done with it and the last of its buffers is released. Releasing a buffer is therefore just
+ * 	an atomic decrement.
+ *
+ * 	Buffers may safely escape the scope, and can still be used and passed to other threads as usual. Copying a buffer
+ * 	outside of its arena's scope (i.e. while neither the calling thread's current arena nor one of the arenas
+ * 	enclosing it is the buffer's arena) gives the copy its own storage instead of sharing the arena's memory. The
+ * 	typical escape paths, like storing a result in a container or assigning it to a member, therefore leave nothing
+ * 	behind in the arena once the original objects are gone. When an escaped buffer has to reallocate, its new storage
+ * 	doesn't come from the arena either.
+ *
+ * 	<b>Retention cost:</b> Buffers can't be moved out of their chunk when the scope ends, because the arena doesn't
+ * 	know where the buffer objects are. A buffer object that itself outlives the scope without being copied (e.g. a
+ * 	local returned from the function that owns the arena, where the copy is elided) keeps its <i>whole chunk</i>
+ * 	allocated, i.e. up to chunkSize bytes (64 KiB by default) for a single short string. Each such buffer pins at
+ * 	most one chunk. Use a smaller chunkSize for scopes whose results are kept around, or copy the results after the
+ * 	scope has ended and drop the originals. getLiveChunkCount() shows how many chunks are kept alive.
+ *
+ * 	Buffers that are too large for the arena's chunks are allocated from the heap. Buffers that take ownership of or
+ * 	alias external arrays are not affected by arenas.
+ *
+ * 	Arenas can be nested. They must be destroyed in the reverse order of construction, in the thread that created them.
+ */
+class BufferArena
+{
+public:
+	enum
+	{
+		DefaultChunkSize = 64*1024
+	};
+
+public:
+	/**	\brief Return the current arena of the calling thread, or NULL if there is none.
+	 */
+	static BufferArena* getCurrent() { return current; }
+
+	/**	\brief Return the number of arena chunks that are currently allocated, in all threads.
+	 *
+	 * 	This includes chunks that are only kept alive by buffers that escaped their arena.
+	 */
+	static size_t getLiveChunkCount() { return liveChunkCount.load(std::memory_order_relaxed); }
+
+public:
+	/**	\brief Create an arena and make it the current arena of the calling thread.
+	 *
+	 * 	@param chunkSize The size of the chunks that memory is taken from. Buffers larger than a quarter of this are
+	 * 		allocated from the heap.
+	 */
+	BufferArena(size_t chunkSize = DefaultChunkSize);
+
+	BufferArena(const BufferArena&) = delete;
+	BufferArena& operator=(const BufferArena&) = delete;
+
+	/**	\brief Restore the previous arena and release this arena's reference to its current chunk.
+	 */
+	~BufferArena();
+
+	/**	\brief Allocate a SharedBufferHeader followed by dataSize bytes from the arena.
+	 *
+	 * 	@return The header, or NULL if the allocation is too large for the arena.
+	 */
+	SharedBufferHeader* createHeader(size_t dataSize);
+
+	/**	\brief Return the number of bytes that have been allocated from this arena, including headers and padding.
+	 */
+	size_t getAllocatedSize() const { return allocatedSize; }
+
+	/**	\brief Return the number of chunks this arena has allocated.
+	 */
+	size_t getChunkCount() const { return chunkCount; }
+
+private:
+	struct Chunk;
+	friend struct ArenaSharedBufferHeader;
+	friend struct SharedBufferHeader;
+
+private:
+	void nextChunk();
+
+private:
+	static thread_local BufferArena* current;
+	static std::atomic<size_t> liveChunkCount;
+
+	BufferArena* previous;
+	uint64_t id;
+	size_t chunkSize;
+
+	Chunk* chunk;
+	char* cur;
+	char* end;
+
+	size_t allocatedSize;
+	size_t chunkCount;
+};
+
+#endif /* NXCOMMON_BUFFERARENA_H_ */
@@ -25,6 +25,7 @@
 
 #include <nxcommon/config.h>
 #include "AbstractSharedBuffer.h"
+#include "AbstractSharedBufferView.h"
 #include <cstring>
 #include <stdint.h>
 
@@ -79,9 +80,7 @@ public:
 	ByteArray(const uint8_t* data, size_t size) : AbstractSharedBuffer(data, size) {}
 
 	template <typename ODerivedT, typename OUnitT, bool oterminated, OUnitT oterm>
-	ByteArray(const AbstractSharedBuffer<ODerivedT, OUnitT, oterminated, oterm>& other)
-			: AbstractSharedBuffer(std::reinterpret_pointer_cast<uint8_t>(other.d), other.msize*sizeof(OUnitT), other.mcapacity*sizeof(OUnitT),
-					std::reinterpret_pointer_cast<uint8_t>(other.readAliasDummy), other.isnull) {}
+	ByteArray(const AbstractSharedBuffer<ODerivedT, OUnitT, oterminated, oterm>& other);
 
 	ByteArray(const ByteArray& other) : AbstractSharedBuffer(other) {}
 
@@ -99,11 +98,11 @@ public:
 	ByteArray& prepend(const ByteArray& other) { AbstractSharedBuffer::prepend(other); return *this; }
 	ByteArray& prepend(uint8_t c) { AbstractSharedBuffer::prepend(c); return *this; }
 
-	bool operator<(const ByteArray& other) const { return memcmp(d.get(), other.d.get(), msize) < 0; }
-	bool operator>(const ByteArray& other) const { return memcmp(d.get(), other.d.get(), msize) > 0; }
+	bool operator<(const ByteArray& other) const { return memcmp(mdata, other.mdata, msize) < 0; }
+	bool operator>(const ByteArray& other) const { return memcmp(mdata, other.mdata, msize) > 0; }
 	bool operator<=(const ByteArray& other) const { return !(*this > other); }
 	bool operator>=(const ByteArray& other) const { return !(*this < other); }
-	bool operator==(const ByteArray& other) const { return memcmp(d.get(), other.d.get(), msize) == 0; }
+	bool operator==(const ByteArray& other) const { return memcmp(mdata, other.mdata, msize) == 0; }
 	bool operator!=(const ByteArray& other) const { return !(*this == other); }
 
 private:
@@ -124,4 +123,31 @@ private:
 	}
 };
 
+
+
+template <typename ODerivedT, typename OUnitT, bool oterminated, OUnitT oterm>
+ByteArray::ByteArray(const AbstractSharedBuffer<ODerivedT, OUnitT, oterminated, oterm>& other)
+		: AbstractSharedBuffer()
+{
+	if (other.isInline()  ||  other.header->isEscapedFromArena()) {
+		// The inline storage has the same size for all buffer types, so an inline buffer stays inline. Buffers that
+		// escaped their arena are copied so that they don't keep the arena's memory alive.
+		if (!other.isnull) {
+			allocate(other.msize*sizeof(OUnitT));
+			memcpy(mdata, other.mdata, other.msize*sizeof(OUnitT));
+			msize = other.msize*sizeof(OUnitT);
+			isnull = false;
+		}
+	} else {
+		setHeap(other.header, (uint8_t*) other.mdata);
+		msize = other.msize*sizeof(OUnitT);
+		mcapacity = other.mcapacity*sizeof(OUnitT);
+		isnull = other.isnull;
+	}
+}
+
+
+
+typedef AbstractSharedBufferView<ByteArray> ByteArrayView;
+
 #endif /* NXCOMMON_BYTEARRAY_H_ */
@@ -21,6 +21,8 @@
  */
 
 #include "CString.h"
+#include <mutex>
+#include <vector>
 
 
 
@@ -49,7 +51,7 @@ CString CString::fromFloatWithMaxPrecision(float val, int precision)
 
 CString& CString::ltrim(const char* chars)
 {
-	char* s = d.get();
+	char* s = mdata;
 
 	char* os = s;
 
@@ -71,30 +73,188 @@ CString& CString::ltrim(const char* chars)
 
 CString CString::convertFromLongLong(long long val, unsigned int base)
 {
-	CString str = convertFromULongLong(llabs(val), base);
+	char buf[sizeof(val)*8 + 2];
+	char* s = buf;
 
 	if (val < 0) {
-		str.prepend('-');
+		*s++ = '-';
 	}
 
-	return str;
+	// Negate in unsigned arithmetic, so that LLONG_MIN works as well
+	s += ULongLongToString(s, val < 0 ? 0 - (unsigned long long) val : (unsigned long long) val, base);
+	return CString(buf, s-buf);
 }
 
 
 CString CString::convertFromULongLong(unsigned long long val, unsigned int base)
 {
-	CString str(128);
-	str.resize(ULongLongToString(str.mget(), val, base));
-	return str;
+	char buf[sizeof(val)*8 + 1];
+	return CString(buf, ULongLongToString(buf, val, base));
 }
 
 
 CString CString::convertFromDouble(double val)
 {
-	CString str(64);
-	sprintf(str.mget(), "%f", val);
-	str.resize();
-	return str;
+	char buf[32];
+	return CString(buf, DoubleToString(buf, val));
+}
+
+
+
+
+
+// The global table behind CString::intern(). It is split into stripes with their own lock and chained hash table, so
+// that threads interning different strings rarely contend. Entries are weak: the table doesn't hold a reference, and a
+// header removes itself from its stripe when it is released.
+class CStringInternTable
+{
+private:
+	static const size_t NumStripes = 64;
+
+	struct alignas(64) Stripe
+	{
+		Stripe() : buckets(16, NULL), numEntries(0) {}
+
+		std::mutex mutex;
+		std::vector<InternedSharedBufferHeader*> buckets;
+		size_t numEntries;
+	};
+
+public:
+	static CStringInternTable& getInstance()
+	{
+		// Never destroyed, because static CStrings might release interned buffers during shutdown.
+		static CStringInternTable* inst = new CStringInternTable;
+		return *inst;
+	}
+
+	// Returns the interned header for the given string, with a new reference taken for the caller.
+	InternedSharedBufferHeader* intern(const char* str, size_t len, size_t hash)
+	{
+		Stripe& stripe = getStripe(hash);
+		std::lock_guard<std::mutex> lock(stripe.mutex);
+
+		InternedSharedBufferHeader*& bucket = stripe.buckets[getBucketIndex(stripe, hash)];
+
+		for (InternedSharedBufferHeader* h = bucket ; h ; h = h->next) {
+			if (h->hash == hash  &&  h->size == len  &&  memcmp(h->getData(), str, len) == 0  &&  tryRef(h)) {
+				return h;
+			}
+		}
+
+		void* mem = ::operator new(sizeof(InternedSharedBufferHeader) + len + 1);
+		InternedSharedBufferHeader* h = new (mem) InternedSharedBufferHeader(&releaseInterned, len, hash);
+		memcpy(h->getData(), str, len);
+		((char*) h->getData())[len] = '\0';
+
+		h->next = bucket;
+		bucket = h;
+
+		if (++stripe.numEntries > stripe.buckets.size()) {
+			rehash(stripe);
+		}
+
+		return h;
+	}
+
+	size_t getCount()
+	{
+		size_t count = 0;
+		for (Stripe& stripe : stripes) {
+			std::lock_guard<std::mutex> lock(stripe.mutex);
+			count += stripe.numEntries;
+		}
+		return count;
+	}
+
+private:
+	Stripe& getStripe(size_t hash) { return stripes[(hash ^ (hash >> 16)) % NumStripes]; }
+
+	static size_t getBucketIndex(const Stripe& stripe, size_t hash) { return (hash / NumStripes) & (stripe.buckets.size()-1); }
+
+	// Take a reference unless the entry is already being released. Once the count reached zero, the entry must not be
+	// revived, so the lookup continues as if the entry wasn't there.
+	static bool tryRef(InternedSharedBufferHeader* h)
+	{
+		size_t rc = h->refcount.load(std::memory_order_relaxed);
+		while (rc != 0) {
+			if (h->refcount.compare_exchange_weak(rc, rc+1, std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static void rehash(Stripe& stripe)
+	{
+		std::vector<InternedSharedBufferHeader*> oldBuckets(stripe.buckets.size()*2, NULL);
+		oldBuckets.swap(stripe.buckets);
+
+		for (InternedSharedBufferHeader* h : oldBuckets) {
+			while (h) {
+				InternedSharedBufferHeader* next = h->next;
+				InternedSharedBufferHeader*& bucket = stripe.buckets[getBucketIndex(stripe, h->hash)];
+				h->next = bucket;
+				bucket = h;
+				h = next;
+			}
+		}
+	}
+
+	static void releaseInterned(SharedBufferHeader* header)
+	{
+		InternedSharedBufferHeader* ih = static_cast<InternedSharedBufferHeader*>(header);
+		CStringInternTable& table = getInstance();
+		Stripe& stripe = table.getStripe(ih->hash);
+
+		{
+			std::lock_guard<std::mutex> lock(stripe.mutex);
+
+			InternedSharedBufferHeader** link = &stripe.buckets[getBucketIndex(stripe, ih->hash)];
+			while (*link != ih) {
+				link = &(*link)->next;
+			}
+			*link = ih->next;
+			stripe.numEntries--;
+		}
+
+		ih->~InternedSharedBufferHeader();
+		::operator delete(ih);
+	}
+
+private:
+	Stripe stripes[NumStripes];
+};
+
+
+CString CString::intern(const char* str, size_t len)
+{
+	size_t hash = (size_t) Hash(str, len);
+	InternedSharedBufferHeader* h = CStringInternTable::getInstance().intern(str, len, hash);
+
+	CString res;
+	res.setHeap(h, (char*) h->getData(), false);
+	res.msize = len;
+	res.mcapacity = len;
+	res.isnull = false;
+	res.mhash = hash;
+	return res;
+}
+
+
+size_t CString::getInternedCount()
+{
+	return CStringInternTable::getInstance().getCount();
+}
+
+
+CString CString::intern() const
+{
+	if (isnull  ||  isInterned()) {
+		return *this;
+	}
+
+	return intern(mdata, msize);
 }
 
 
@@ -64,6 +64,32 @@ public:
 	template <typename... Args>
 	static CString format(const char* fmt, Args... args);
 
+	/**	\brief Return the canonical interned instance of the given string.
+	 *
+	 * 	Interning uses a global, thread-safe table. All interned strings with the same content share a single read-only
+	 * 	heap buffer (even short ones that would normally be stored inline), so they compare equal by pointer and carry a
+	 * 	precomputed hash. This makes them cheap keys for long-lived maps, and repeated names are stored only once.
+	 *
+	 * 	The table holds weak references only: An entry is removed as soon as the last CString referencing it is
+	 * 	destroyed. Modifying an interned string makes a private copy as usual.
+	 *
+	 * 	@see isInterned()
+	 */
+	static CString intern(const char* str, size_t len);
+	static CString intern(const char* str) { return intern(str, strlen(str)); }
+
+	/**	\brief Return the number of strings that are currently interned.
+	 */
+	static size_t getInternedCount();
+
+	/**	\brief Return the canonical interned instance of this string.
+	 *
+	 * 	Null strings stay null. If this string is interned already, it is returned as it is.
+	 *
+	 * 	@see intern(const char*, size_t)
+	 */
+	CString intern() const;
+
 public:
 	// NOTE: Constructor inheritance is not implemented in VS 2013...
 
@@ -79,18 +105,18 @@ public:
 	CString(const QString& str) : CString(str.toUtf8().constData()) {}
 
 	operator QString() const { return QString::fromUtf8(get(), (int) length()); }
-#endif
-
+#endif
+
   operator std::string() const { return std::string(get(), length()); }
 
-	CString& lower() { ensureUniqueness(); strtolower(d.get(), d.get()); return *this; }
-	CString& upper() { ensureUniqueness(); strtoupper(d.get(), d.get()); return *this; }
+	CString& lower() { ensureUniqueness(); strtolower(mdata, mdata); return *this; }
+	CString& upper() { ensureUniqueness(); strtoupper(mdata, mdata); return *this; }
 
 	CString& ltrim(char c) { char b[2]; b[0] = c; b[1] = '\0'; return ltrim(b); }
 	CString& ltrim(const char* chars);
 	CString& ltrim() { return ltrim(" \t\r\n"); }
-	CString& rtrim(char c) { ensureUniqueness(); msize = ::rtrim(d.get(), c) - d.get(); return *this; }
-	CString& rtrim(const char* chars) { ensureUniqueness(); msize = ::rtrim(d.get(), chars) - d.get(); return *this; }
+	CString& rtrim(char c) { ensureUniqueness(); msize = ::rtrim(mdata, c) - mdata; return *this; }
+	CString& rtrim(const char* chars) { ensureUniqueness(); msize = ::rtrim(mdata, chars) - mdata; return *this; }
 	CString& rtrim() { return rtrim(" \t\r\n"); }
 	CString& trim(char c) { rtrim(c); ltrim(c); return *this; }
 	CString& trim(const char* chars) { rtrim(chars); ltrim(chars); return *this; }
@@ -109,6 +135,13 @@ protected:
 };
 
 
+/**	\brief A read-only view of a part of a CString.
+ *
+ * 	@see AbstractSharedBufferView
+ */
+typedef AbstractSharedBufferView<CString> CStringView;
+
+
 
 namespace std
 {
@@ -120,11 +153,8 @@ namespace std
 
 		result_type operator()(const argument_type& s) const
 		{
-			// TODO: This is slow because it copies the string. We would need to implement our
-			// own hash function...
-			return strHash(std::string(s.get(), s.length()));
+			return s.getHash();
 		}
-		std::hash<std::string> strHash;
 	};
 }
 
@@ -138,14 +168,27 @@ namespace std
 template <typename... Args>
 CString CString::format(const char* fmt, Args... args)
 {
-	int len = snprintf(nullptr, 0, fmt, args...);
-	char* buf = new char[len+1];
-	snprintf(buf, len+1, fmt, args...);
-	return CString::from(buf, len, len+1);
+	// Most formatted strings are short, so try a stack buffer first instead of always measuring with a separate call.
+	char buf[256];
+	int len = snprintf(buf, sizeof(buf), fmt, args...);
+
+	if (len < (int) sizeof(buf)) {
+		return len < 0 ? CString() : CString(buf, (size_t) len);
+	}
+
+	CString str((size_t) len);
+	snprintf(str.mget(), len+1, fmt, args...);
+	str.resize(len);
+	return str;
 }
 
 
 
 std::ostream& operator<<(std::ostream& stream, const CString& cstr);
 
+inline std::ostream& operator<<(std::ostream& stream, const CStringView& view)
+{
+	return stream.write(view.get(), view.length());
+}
+
 #endif /* NXCOMMON_CSTRING_H_ */
@@ -0,0 +1,252 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "CStringBuilder.h"
+#include "stream/IOException.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+
+#ifdef _POSIX_VERSION
+#include <sys/uio.h>
+#endif
+
+
+
+
+char* CStringBuilder::reserveTail(size_t minSize)
+{
+	if (tailWritable) {
+		CString& tail = chunks.back();
+
+		if (tail.getCapacity() - tail.length() >= minSize) {
+			return tail.mget() + tail.length();
+		}
+	}
+
+	size_t chunkSize = MinChunkSize;
+
+	if (!chunks.empty()) {
+		chunkSize = std::min((size_t) MaxChunkSize, std::max(chunks.back().getCapacity() * 2, (size_t) MinChunkSize));
+	}
+
+	chunks.push_back(CString(std::max(chunkSize, minSize)));
+	tailWritable = true;
+
+	// The fresh chunk is empty but not null, so mget() won't reallocate.
+	return chunks.back().mget();
+}
+
+
+void CStringBuilder::commitTail(size_t size)
+{
+	CString& tail = chunks.back();
+	tail.resize(tail.length() + size);
+	len += size;
+}
+
+
+CStringBuilder& CStringBuilder::append(const char* str, size_t strLen)
+{
+	while (strLen != 0) {
+		char* dest = reserveTail(1);
+		CString& tail = chunks.back();
+		size_t n = std::min(strLen, tail.getCapacity() - tail.length());
+
+		memcpy(dest, str, n);
+		commitTail(n);
+
+		str += n;
+		strLen -= n;
+	}
+
+	return *this;
+}
+
+
+CStringBuilder& CStringBuilder::append(const CString& str)
+{
+	if (str.length() < ShareThreshold) {
+		return append(str.get(), str.length());
+	}
+
+	// Share the string's buffer instead of copying it. It must not be written to, so the next append starts a new chunk.
+	chunks.push_back(str);
+	tailWritable = false;
+	len += str.length();
+
+	return *this;
+}
+
+
+CStringBuilder& CStringBuilder::append(long long val, unsigned int base)
+{
+	if (val < 0) {
+		append('-');
+		return append(0ULL - (unsigned long long) val, base);
+	}
+
+	return append((unsigned long long) val, base);
+}
+
+
+CStringBuilder& CStringBuilder::append(unsigned long long val, unsigned int base)
+{
+	// Numbers are converted right into the current chunk, which has to fit the worst case (base 2) plus terminator
+	char* dest = reserveTail(sizeof(val)*8 + 1);
+	commitTail(ULongLongToString(dest, val, base));
+	return *this;
+}
+
+
+CStringBuilder& CStringBuilder::append(double val)
+{
+	char* dest = reserveTail(32);
+	commitTail(DoubleToString(dest, val));
+	return *this;
+}
+
+
+CStringBuilder& CStringBuilder::appendIndented(const CString& str, const CString& indent, bool indentStart,
+		const CString& newline)
+{
+	const char* s = str.get();
+	const char* end = s + str.length();
+
+	if (indentStart) {
+		append(indent.get(), indent.length());
+	}
+
+	while (s != end) {
+		const char* nl = newline.isEmpty() ? NULL : strstr(s, newline.get());
+
+		if (!nl) {
+			append(s, end-s);
+			break;
+		}
+
+		nl += newline.length();
+		append(s, nl-s);
+		append(indent.get(), indent.length());
+		s = nl;
+	}
+
+	return *this;
+}
+
+
+void CStringBuilder::clear()
+{
+	chunks.clear();
+	len = 0;
+	tailWritable = false;
+}
+
+
+CString CStringBuilder::toCString()
+{
+	if (chunks.empty()) {
+		return CString("");
+	}
+
+	if (chunks.size() == 1) {
+		// The caller gets a shared copy, so stop appending in place
+		tailWritable = false;
+		return chunks[0];
+	}
+
+	CString flat(len);
+	char* dest = flat.mget();
+
+	for (const CString& chunk : chunks) {
+		memcpy(dest, chunk.get(), chunk.length());
+		dest += chunk.length();
+	}
+
+	flat.resize(len);
+
+	chunks.clear();
+	chunks.push_back(flat);
+	tailWritable = false;
+
+	return flat;
+}
+
+
+void CStringBuilder::writeTo(std::ostream& stream) const
+{
+	for (const CString& chunk : chunks) {
+		stream.write(chunk.get(), chunk.length());
+	}
+}
+
+
+#ifdef _POSIX_VERSION
+
+void CStringBuilder::writeTo(int fd) const
+{
+#ifdef IOV_MAX
+	const size_t maxIov = IOV_MAX;
+#else
+	const size_t maxIov = 16;
+#endif
+
+	size_t chunkIdx = 0;
+	size_t chunkOffs = 0;
+
+	while (chunkIdx < chunks.size()) {
+		struct iovec iov[64];
+		size_t numIov = 0;
+
+		for (size_t i = chunkIdx ; i < chunks.size()  &&  numIov < std::min(maxIov, sizeof(iov)/sizeof(iov[0])) ; i++) {
+			size_t offs = (i == chunkIdx) ? chunkOffs : 0;
+			iov[numIov].iov_base = (void*) (chunks[i].get() + offs);
+			iov[numIov].iov_len = chunks[i].length() - offs;
+			numIov++;
+		}
+
+		ssize_t written = writev(fd, iov, (int) numIov);
+
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			char errmsg[256];
+			snprintf(errmsg, sizeof(errmsg), "Error writing string chunks with writev(): %s", strerror(errno));
+			throw IOException(errmsg, __FILE__, __LINE__);
+		}
+
+		// Skip what has been written, which may end in the middle of a chunk
+		size_t remaining = (size_t) written;
+
+		while (chunkIdx < chunks.size()  &&  remaining >= chunks[chunkIdx].length() - chunkOffs) {
+			remaining -= chunks[chunkIdx].length() - chunkOffs;
+			chunkIdx++;
+			chunkOffs = 0;
+		}
+
+		chunkOffs += remaining;
+	}
+}
+
+#endif
@@ -0,0 +1,205 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_CSTRINGBUILDER_H_
+#define NXCOMMON_CSTRINGBUILDER_H_
+
+#include <nxcommon/config.h>
+#include "CString.h"
+#include <cstdio>
+#include <ostream>
+#include <vector>
+
+
+
+/**	\brief Builds large strings incrementally from a chain of chunks instead of one contiguous buffer.
+ *
+ * 	Appending to a CString grows a single buffer, copying everything appended so far whenever it runs out of capacity.
+ * 	CStringBuilder instead appends into a list of chunks. Once a chunk is full, a new one is started, so no data is ever
+ * 	moved. Large CStrings are not even copied: the builder shares their buffer and inserts it as a chunk of its own.
+ *
+ * 	The result can be written out chunk by chunk with writeTo(), which uses scatter I/O (writev()) for file descriptors,
+ * 	or it can be flattened into one CString with toCString(). Flattening happens only on demand, and the flat string is
+ * 	kept, so calling toCString() again without appending is cheap.
+ *
+ * 	Like CString, a CStringBuilder object is not thread-safe.
+ */
+class CStringBuilder
+{
+public:
+	enum
+	{
+		/**	\brief The capacity of the first chunk. Each following chunk is twice as large, up to MaxChunkSize.
+		 */
+		MinChunkSize = 256,
+
+		MaxChunkSize = 64*1024,
+
+		/**	\brief CStrings with at least this many characters are shared as separate chunks instead of being copied.
+		 */
+		ShareThreshold = 1024
+	};
+
+public:
+	CStringBuilder() : len(0), tailWritable(false) {}
+
+	CStringBuilder& append(const char* str, size_t strLen);
+	CStringBuilder& append(const char* str) { return append(str, strlen(str)); }
+	CStringBuilder& append(const CString& str);
+	CStringBuilder& append(const CStringView& view) { return append(view.get(), view.length()); }
+	CStringBuilder& append(char c) { return append(&c, 1); }
+
+	CStringBuilder& append(long long val, unsigned int base = 10);
+	CStringBuilder& append(unsigned long long val, unsigned int base = 10);
+	CStringBuilder& append(long val, unsigned int base = 10) { return append((long long) val, base); }
+	CStringBuilder& append(unsigned long val, unsigned int base = 10) { return append((unsigned long long) val, base); }
+	CStringBuilder& append(int val, unsigned int base = 10) { return append((long long) val, base); }
+	CStringBuilder& append(unsigned int val, unsigned int base = 10) { return append((unsigned long long) val, base); }
+	CStringBuilder& append(double val);
+	CStringBuilder& append(float val) { return append((double) val); }
+
+	/**	\brief Append a string formatted like snprintf() would, writing directly into the current chunk if it fits.
+	 */
+	template <typename... Args>
+	CStringBuilder& appendFormat(const char* fmt, Args... args);
+
+	/**	\brief Append the given strings, separated by separator.
+	 */
+	template <typename InputIterator>
+	CStringBuilder& appendJoined(const CString& separator, InputIterator begin, InputIterator end);
+
+	/**	\brief Append str, inserting indent after each newline (and at the start if indentStart is true).
+	 *
+	 * 	This is the CStringBuilder equivalent of CString::indented().
+	 */
+	CStringBuilder& appendIndented(const CString& str, const CString& indent, bool indentStart = false,
+			const CString& newline = CString::readAlias("\n"));
+
+	template <typename T>
+	CStringBuilder& operator<<(const T& val) { return append(val); }
+
+	/**	\brief Return the total number of characters appended so far.
+	 */
+	size_t length() const { return len; }
+
+	bool isEmpty() const { return len == 0; }
+
+	/**	\brief Remove all content.
+	 */
+	void clear();
+
+	/**	\brief Return the number of chunks the content is currently stored in.
+	 */
+	size_t getChunkCount() const { return chunks.size(); }
+
+	/**	\brief Return a view of the i'th chunk, for use with custom scatter output.
+	 */
+	CStringView getChunk(size_t i) const { return CStringView(chunks[i]); }
+
+	/**	\brief Return the content as a single CString.
+	 *
+	 * 	If the content is spread across multiple chunks, it is copied into one string, which then replaces the chunks.
+	 */
+	CString toCString();
+
+	/**	\brief Write the content to a stream, one chunk at a time and without flattening it.
+	 */
+	void writeTo(std::ostream& stream) const;
+
+#ifdef _POSIX_VERSION
+	/**	\brief Write the content to a file descriptor with writev(), without flattening it.
+	 *
+	 * 	Partial writes and EINTR are handled. Throws an IOException on errors.
+	 */
+	void writeTo(int fd) const;
+#endif
+
+private:
+	char* reserveTail(size_t minSize);
+	void commitTail(size_t size);
+
+private:
+	std::vector<CString> chunks;
+	size_t len;
+
+	// Whether the last chunk was created by the builder, so that data may be appended to it in place
+	bool tailWritable;
+};
+
+
+
+
+template <typename... Args>
+CStringBuilder& CStringBuilder::appendFormat(const char* fmt, Args... args)
+{
+	size_t avail = 0;
+	char* dest = NULL;
+
+	if (tailWritable) {
+		CString& tail = chunks.back();
+		avail = tail.getCapacity() - tail.length();
+		dest = tail.mget() + tail.length();
+	}
+
+	int fmtLen = snprintf(dest, dest ? avail+1 : 0, fmt, args...);
+
+	if (fmtLen < 0) {
+		return *this;
+	}
+
+	if (!dest  ||  (size_t) fmtLen > avail) {
+		if (tailWritable) {
+			// The truncated output has to be removed again
+			CString& tail = chunks.back();
+			tail.resize(tail.length());
+		}
+
+		dest = reserveTail(fmtLen);
+		snprintf(dest, fmtLen+1, fmt, args...);
+	}
+
+	commitTail(fmtLen);
+	return *this;
+}
+
+
+template <typename InputIterator>
+CStringBuilder& CStringBuilder::appendJoined(const CString& separator, InputIterator begin, InputIterator end)
+{
+	for (InputIterator it = begin ; it != end ; it++) {
+		if (it != begin) {
+			append(separator);
+		}
+		append(*it);
+	}
+
+	return *this;
+}
+
+
+inline std::ostream& operator<<(std::ostream& stream, const CStringBuilder& builder)
+{
+	builder.writeTo(stream);
+	return stream;
+}
+
+#endif /* NXCOMMON_CSTRINGBUILDER_H_ */
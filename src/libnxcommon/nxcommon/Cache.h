@@ -25,9 +25,15 @@
 
 #include <nxcommon/config.h>
 #include "cxx11hash.h"
+#include "CacheEvictionPolicy.h"
+#include "CacheStats.h"
+#include "CacheTimingWheel.h"
 #include "exception/InvalidStateException.h"
 #include <utility>
 #include <unordered_map>
+#include <functional>
+#include <memory>
+#include <chrono>
 #include <cstdio>
 
 using std::unordered_map;
@@ -61,27 +67,42 @@ using std::equal_to;
  * 	is possible for the occupied size to become greater than the capacity, because locked entries are never
  * 	removed from the cache. In such situations, the cache is said to be <i>overfilled</i>. If a locked entry
  * 	is unlocked in an overfilled cache, it becomes deleted instantly.
+ *
+ * 	The order in which entries are removed to make room is determined by the EvictionPolicy template
+ * 	parameter. The default is strict LRU (LRUEvictionPolicy). Scan-resistant alternatives are
+ * 	TwoQueueEvictionPolicy, ARCEvictionPolicy and TinyLFUEvictionPolicy. GDSFEvictionPolicy evicts entries with
+ * 	a low value per cache size first. See CacheEvictionPolicy.h for details and for the interface of custom
+ * 	policies.
+ *
+ * 	Entries can optionally be given a time-to-live when they are inserted. Expired entries are treated as
+ * 	if they were not cached anymore, and are reclaimed lazily: item() removes an expired entry when it is
+ * 	accessed, and insert() and expire() remove all entries that expired since the last call, using a
+ * 	hierarchical timing wheel (see CacheTimingWheel) instead of scanning the cache. Locked entries never
+ * 	expire while they are locked. As long as no entry is inserted with a time-to-live, the cache does not
+ * 	even look at the clock.
  */
 template<class K, class V, class Compare = less<K>,
 		class MapHash = CXX11Hash<K>,
-		class KeyEqual = equal_to<K> >
+		class KeyEqual = equal_to<K>,
+		template<class, class, class> class EvictionPolicy = LRUEvictionPolicy>
 class Cache {
 public:
 	typedef unsigned int cachesize_t;
+	typedef std::function<void (const K&, V*)> EvictionHandler;
+	typedef std::function<CString (const K&)> KeyClassifier;
+	typedef std::chrono::steady_clock Clock;
+	typedef std::function<Clock::time_point ()> TimeSource;
 
 private:
-	struct Entry
+	struct Entry : public CacheNode<K>, public CacheTimerNode
 	{
-		Entry(V* vPtr, cachesize_t cost, bool locked) : vPtr(vPtr), cost(cost), prev(NULL), next(NULL),
-				locked(locked) {}
-		const K* kPtr;
+		Entry(V* vPtr, cachesize_t cost, bool locked) : CacheNode<K>(cost), vPtr(vPtr), locked(locked) {}
 		V* vPtr;
-		cachesize_t cost;
-		Entry* prev;
-		Entry* next;
 		bool locked;
 	};
 
+	typedef CacheNode<K> Node;
+	typedef EvictionPolicy<K, MapHash, KeyEqual> Policy;
 	typedef unordered_map<K, Entry, MapHash, KeyEqual> EntryMap;
 
 public:
@@ -89,7 +110,9 @@ public:
 	 *
 	 * 	@param capacity The capacity (maximum size) of the cache.
 	 */
-	Cache(cachesize_t capacity = 0) : first(NULL), last(NULL), capacity(capacity), occupied(0) {}
+	Cache(cachesize_t capacity = 0)
+			: capacity(capacity), occupied(0), stats(NULL), expiryResolution(std::chrono::milliseconds(1))
+			{ policy.setCapacity(capacity); }
 
 	/**	\brief Deletes the cache and all it's content.
 	 *
@@ -109,6 +132,9 @@ public:
 	 * 	this same scenario, the entry was inserted as locked, it will be forcefully inserted, causing the
 	 * 	cache to be overfilled.
 	 *
+	 * 	If an entry with the same key is already cached, it is replaced. If that entry is locked, the new
+	 * 	value is deleted instead and false is returned.
+	 *
 	 * 	Ownership of the value pointer is taken by the cache, meaning it can be removed any time a
 	 * 	non-read-only method is called on the cache, unless the entry is stored in locked mode.
 	 *
@@ -118,7 +144,23 @@ public:
 	 * 	@param locked Whether the entry should be stored in locked state.
 	 * 	@return true when the entry was successfully inserted, false otherwise.
 	 */
-	bool insert(const K& key, V* value, cachesize_t size, bool locked = false);
+	bool insert(const K& key, V* value, cachesize_t size, bool locked = false)
+			{ expire(); return insertEntry(key, value, size, locked) != NULL; }
+
+	/**	\brief Inserts a new entry into the cache, which expires after the given time.
+	 *
+	 * 	This works like insert(const K&, V*, cachesize_t, bool), but the entry is treated as not cached
+	 * 	anymore once ttl has passed. The entry never expires early, but may expire up to one expiry resolution
+	 * 	late.
+	 *
+	 * 	@param key The entry's key.
+	 * 	@param A pointer to the entry's value. Ownership of it is taken.
+	 * 	@param size The size of the new entry.
+	 * 	@param ttl The time-to-live of the entry.
+	 * 	@param locked Whether the entry should be stored in locked state.
+	 * 	@return true when the entry was successfully inserted, false otherwise.
+	 */
+	bool insert(const K& key, V* value, cachesize_t size, Clock::duration ttl, bool locked = false);
 
 	/**	\brief Removes an entry from the cache.
 	 *
@@ -140,11 +182,25 @@ public:
 	 */
 	V* item(const K& key) { return access(key); }
 
+	/**	\brief Returns the value of a cache entry without counting it as an access.
+	 *
+	 * 	Unlike item(), this neither updates the last-used status nor the statistics.
+	 *
+	 * 	@param key The entry's key.
+	 * 	@return The entry's value if it was found, or NULL otherwise.
+	 */
+	V* peek(const K& key) const
+	{
+		typename EntryMap::const_iterator it = entries.find(key);
+		return it != entries.end()  &&  !isStale(it->second) ? it->second.vPtr : NULL;
+	}
+
 	/**	\brief Removes entries from the cache until it has the specified size.
 	 *
-	 *	Entries are removed by calling remove() for as many entries as needed, starting with the least
-	 *	recently used one. Freeing the cache stops when either enough entries were removed, or when only
-	 *	locked entries are left inside the cache.
+	 *	Entries are removed by calling remove() for as many entries as needed, in the order given by the
+	 *	eviction policy (for the default LRU policy, starting with the least recently used one). Freeing the
+	 *	cache stops when either enough entries were removed, or when only locked entries are left inside the
+	 *	cache.
 	 *
 	 *	Note that because of the latter case, this method does <b>not</b> guarantee that the occupied size is
 	 *	lower or equal to the one requested afterwards.
@@ -162,6 +218,19 @@ public:
 	 */
 	V* operator[](const K& key) { return item(key); }
 
+	/**	\brief Determines whether an entry with the given key is currently cached.
+	 *
+	 * 	Unlike item(), this does not update the last-used status of the entry.
+	 *
+	 * 	@param key The entry's key.
+	 * 	@return true if the entry is cached, false otherwise.
+	 */
+	bool contains(const K& key) const
+	{
+		typename EntryMap::const_iterator it = entries.find(key);
+		return it != entries.end()  &&  !isStale(it->second);
+	}
+
 	/**	\brief Returns the current capacity of the cache.
 	 *
 	 * 	@return The capacity.
@@ -170,7 +239,7 @@ public:
 
 	/**	\brief Returns the currently occupied size of the cache.
 	 *
-	 * 	This is the sum of the sizes of all cache entries.
+	 * 	This is the sum of the sizes of all cache entries, including expired ones which were not reclaimed yet.
 	 *
 	 * 	@return The occupied size.
 	 */
@@ -197,7 +266,15 @@ public:
 	 *
 	 * 	@param capacity The new capacity.
 	 */
-	void resize(cachesize_t capacity) { free(capacity); this->capacity = capacity; }
+	void resize(cachesize_t capacity)
+	{
+		free(capacity);
+		this->capacity = capacity;
+		policy.setCapacity(capacity);
+		if (stats) {
+			stats->setCapacity(capacity);
+		}
+	}
 
 	/**	\brief Sets the locked status of an entry.
 	 *
@@ -208,7 +285,8 @@ public:
 	 * 	@param key The entry's key.
 	 * 	@param locked The new locked status.
 	 * 	@return A pointer to the locked or unlocked value. If an entry was unlocked in an overfilled cache,
-	 * 		it will be removed by this method. In this case, NULL is returned.
+	 * 		or if it expired while it was locked, it will be removed by this method. In this case, NULL is
+	 * 		returned.
 	 */
 	V* lock(const K& key, bool locked = true);
 
@@ -220,143 +298,319 @@ public:
 	 */
 	V* unlock(const K& key) { return lock(key, false); }
 
+	/**	\brief Returns the eviction policy object of this cache.
+	 */
+	Policy& getEvictionPolicy() { return policy; }
+
+	/**	\brief Sets a function to be called when an entry is evicted.
+	 *
+	 * 	The handler is called for every entry removed by free() (including the implicit calls by insert(),
+	 * 	resize() and clear()), right before its value is deleted. It is not called for explicit calls to
+	 * 	remove(). The handler must not modify the cache.
+	 *
+	 * 	@param handler The handler, or an empty function to disable it.
+	 */
+	void setEvictionHandler(const EvictionHandler& handler) { evictionHandler = handler; }
+
+	/**	\brief Starts or stops collecting statistics.
+	 *
+	 * 	item() is counted as a hit or miss, and inserts, evictions and overfills are counted. The occupied size
+	 * 	is only tracked for entries inserted while statistics are enabled, so this should be called while the
+	 * 	cache is empty.
+	 *
+	 * 	@param stats The statistics object, or NULL to disable statistics. Ownership is not taken.
+	 * 	@param keyClassifier If set, the occupied size is additionally broken down by the class that this
+	 * 		function returns for each key.
+	 */
+	void setStats(CacheStats* stats, const KeyClassifier& keyClassifier = KeyClassifier())
+	{
+		this->stats = stats;
+		this->keyClassifier = keyClassifier;
+		if (stats) {
+			stats->setCapacity(capacity);
+		}
+	}
+
+	CacheStats* getStats() { return stats; }
+
+	/**	\brief Removes all entries whose time-to-live has passed.
+	 *
+	 * 	This is done implicitly by insert(), so it only has to be called to release memory early. The cost is
+	 * 	proportional to the number of expired entries, not to the size of the cache.
+	 *
+	 * 	@return The number of removed entries.
+	 */
+	size_t expire()
+	{
+		if (!wheel  ||  wheel->getTimerCount() == 0) {
+			return 0;
+		}
+		return expire(getCurrentTick());
+	}
+
+	/**	\brief Sets the function used to read the current time for expiry.
+	 *
+	 * 	By default, Clock::now() is used.
+	 */
+	void setTimeSource(const TimeSource& source) { timeSource = source; }
+
+	/**	\brief Sets the granularity of expiry times.
+	 *
+	 * 	The default is one millisecond. Must be called before the first entry is inserted with a time-to-live.
+	 *
+	 * 	@throws InvalidStateException if entries were already inserted with a time-to-live.
+	 */
+	void setExpiryResolution(Clock::duration resolution)
+	{
+		if (wheel) {
+			throw InvalidStateException("Expiry resolution can't be changed after entries with a time-to-live "
+					"were inserted!", __FILE__, __LINE__);
+		}
+		expiryResolution = resolution;
+	}
+
 private:
 	/**	\brief Internal name of method item().
 	 *
 	 * 	@see item()
 	 */
 	V* access(const K& key);
-	bool remove(Entry& entry);
+	Entry* insertEntry(const K& key, V* value, cachesize_t size, bool locked);
+	bool remove(Entry& entry, bool evicted = false);
 
-private:
-	EntryMap entries;
+	uint64_t getCurrentTick() const
+	{
+		Clock::time_point now = timeSource ? timeSource() : Clock::now();
+		return (uint64_t) (now.time_since_epoch() / expiryResolution);
+	}
 
-public:
-	Entry* first;
+	bool isExpired(const Entry& entry) const { return entry.hasDeadline()  &&  entry.deadline <= getCurrentTick(); }
+
+	/**	\brief Returns true if the entry expired and should be treated as not cached.
+	 */
+	bool isStale(const Entry& entry) const { return !entry.locked  &&  isExpired(entry); }
+
+	size_t expire(uint64_t tick);
+	bool removeExpired(Entry& entry);
 
 private:
-	Entry* last;
+	EntryMap entries;
+	Policy policy;
 	cachesize_t capacity;
 	cachesize_t occupied;
+	EvictionHandler evictionHandler;
+	CacheStats* stats;
+	KeyClassifier keyClassifier;
+	std::unique_ptr<CacheTimingWheel> wheel;
+	TimeSource timeSource;
+	Clock::duration expiryResolution;
 };
 
 
-template<class K, class V, class Compare, class MapHash, class KeyEqual>
-V* Cache<K, V, Compare, MapHash, KeyEqual>::access(const K& key)
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+V* Cache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::access(const K& key)
 {
 	typename EntryMap::iterator it = entries.find(key);
 
 	if (it == entries.end()) {
+		if (stats) {
+			stats->count(CacheStats::CounterMisses);
+		}
 		return NULL;
 	}
 
 	Entry& entry = it->second;
-	if (&entry != first) {
-		if (entry.prev) {
-			entry.prev->next = entry.next;
-		}
-		if (entry.next) {
-			entry.next->prev = entry.prev;
-		}
-		if (&entry == last) {
-			last = entry.prev;
+
+	if (isStale(entry)) {
+		removeExpired(entry);
+		if (stats) {
+			stats->count(CacheStats::CounterMisses);
 		}
-		entry.prev = NULL;
-		entry.next = first;
-		first->prev = &entry;
-		first = &entry;
+		return NULL;
 	}
 
+	if (stats) {
+		stats->count(CacheStats::CounterHits);
+	}
+
+	policy.accessed(&entry);
+
 	return entry.vPtr;
 }
 
 
-template<class K, class V, class Compare, class MapHash, class KeyEqual>
-bool Cache<K, V, Compare, MapHash, KeyEqual>::remove(Entry& entry)
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+bool Cache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::remove(Entry& entry, bool evicted)
 {
 	if (entry.locked) {
 		return false;
 	}
 
-	if (entry.prev) {
-		entry.prev->next = entry.next;
+	if (entry.isScheduled()) {
+		wheel->unschedule(&entry);
 	}
-	if (entry.next) {
-		entry.next->prev = entry.prev;
-	}
-	if (&entry == first) {
-		first = entry.next;
+	policy.removed(&entry, evicted);
+	occupied -= entry.cost;
+	if (stats) {
+		if (evicted) {
+			stats->count(CacheStats::CounterEvictions);
+		}
+		stats->addOccupied(-(int64_t) entry.cost);
+		if (keyClassifier) {
+			stats->addOccupied(keyClassifier(*entry.kPtr), -(int64_t) entry.cost);
+		}
 	}
-	if (&entry == last) {
-		last = entry.prev;
+	if (evicted  &&  evictionHandler) {
+		evictionHandler(*entry.kPtr, entry.vPtr);
 	}
-	occupied -= entry.cost;
 	delete entry.vPtr;
 	entries.erase(entries.find(*entry.kPtr));
 	return true;
 }
 
 
-template<class K, class V, class Compare, class MapHash, class KeyEqual>
-bool Cache<K, V, Compare, MapHash, KeyEqual>::insert(const K& key, V* value, cachesize_t size, bool locked)
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+typename Cache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::Entry*
+Cache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::insertEntry(const K& key, V* value, cachesize_t size, bool locked)
 {
+	typename EntryMap::iterator existing = entries.find(key);
+	if (existing != entries.end()  &&  !remove(existing->second)) {
+		// Existing entry is locked
+		delete value;
+		return NULL;
+	}
 	if (size > capacity  &&  !locked) {
 		delete value;
-		return false;
+		return NULL;
 	}
 	bool enoughLeft = free(size > capacity ? 0 : capacity-size);
 	if (!enoughLeft  &&  !locked) {
 		delete value;
-		return false;
+		return NULL;
 	}
 	typename EntryMap::iterator it = entries
 			.insert(pair<const K, Entry>(key, Entry(value, size, locked))).first;
 	Entry& entry = it->second;
-	if (first) {
-		first->prev = &entry;
-		entry.next = first;
-	}
 	entry.kPtr = &it->first;
-	first = &entry;
-	if (!last) {
-		last = &entry;
-	}
+	policy.inserted(&entry);
 	occupied += size;
+	if (stats) {
+		stats->count(CacheStats::CounterInserts);
+		if (occupied > capacity) {
+			stats->count(CacheStats::CounterOverfills);
+		}
+		stats->addOccupied(size);
+		if (keyClassifier) {
+			stats->addOccupied(keyClassifier(key), size);
+		}
+	}
+	return &entry;
+}
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+bool Cache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::insert(const K& key, V* value, cachesize_t size,
+		Clock::duration ttl, bool locked)
+{
+	if (!wheel) {
+		wheel.reset(new CacheTimingWheel);
+	}
+
+	Clock::time_point now = timeSource ? timeSource() : Clock::now();
+	uint64_t nowTick = (uint64_t) (now.time_since_epoch() / expiryResolution);
+
+	// Always advance, even if there are no timers, so that the wheel doesn't have to catch up from a
+	// long-gone tick when the first timer is scheduled.
+	expire(nowTick);
+
+	Entry* entry = insertEntry(key, value, size, locked);
+
+	if (!entry) {
+		return false;
+	}
+
+	// Round up, so that entries never expire early.
+	Clock::duration expiry = now.time_since_epoch() + ttl;
+	uint64_t deadline = (uint64_t) ((expiry + expiryResolution - Clock::duration(1)) / expiryResolution);
+	wheel->schedule(entry, deadline);
+
 	return true;
 }
 
 
-template<class K, class V, class Compare, class MapHash, class KeyEqual>
-bool Cache<K, V, Compare, MapHash, KeyEqual>::free(cachesize_t size)
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+size_t Cache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::expire(uint64_t tick)
 {
-	Entry* entry = last;
-	while (entry  &&  occupied > size) {
-		Entry* cur = entry;
-		entry = entry->prev;
-		remove(*cur);
+	size_t numExpired = 0;
+
+	wheel->advance(tick, [this, &numExpired](CacheTimerNode* node) {
+		// Locked entries are only unscheduled. They are removed when they are unlocked.
+		if (removeExpired(*static_cast<Entry*>(node))) {
+			numExpired++;
+		}
+	});
+
+	return numExpired;
+}
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+bool Cache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::removeExpired(Entry& entry)
+{
+	if (!remove(entry)) {
+		return false;
+	}
+	if (stats) {
+		stats->count(CacheStats::CounterExpirations);
 	}
+	return true;
+}
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+bool Cache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::free(cachesize_t size)
+{
+	policy.evict (
+			[this](Node* node) { return remove(*static_cast<Entry*>(node), true); },
+			[this, size]() { return occupied <= size; }
+			);
 
 	return occupied <= size;
 }
 
 
-template<class K, class V, class Compare, class MapHash, class KeyEqual>
-bool Cache<K, V, Compare, MapHash, KeyEqual>::clear()
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+bool Cache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::clear()
 {
 	return free(0);
 }
 
 
-template<class K, class V, class Compare, class MapHash, class KeyEqual>
-bool Cache<K, V, Compare, MapHash, KeyEqual>::remove(const K& key)
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+bool Cache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::remove(const K& key)
 {
 	typename EntryMap::iterator it = entries.find(key);
+
+	if (it == entries.end()) {
+		return false;
+	}
+
 	return remove(it->second);
 }
 
 
-template<class K, class V, class Compare, class MapHash, class KeyEqual>
-V* Cache<K, V, Compare, MapHash, KeyEqual>::lock(const K& key, bool locked)
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+V* Cache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::lock(const K& key, bool locked)
 {
 	typename EntryMap::iterator it = entries.find(key);
 
@@ -364,9 +618,16 @@ V* Cache<K, V, Compare, MapHash, KeyEqual>::lock(const K& key, bool locked)
 		return NULL;
 	}
 
+	Entry& entry = it->second;
+
+	if ((!locked  ||  !entry.locked)  &&  isExpired(entry)) {
+		entry.locked = false;
+		removeExpired(entry);
+		return NULL;
+	}
+
 	bool wasOverfilled = occupied > capacity;
 
-	Entry& entry = it->second;
 	entry.locked = locked;
 	free(capacity);
 
@@ -0,0 +1,855 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_CACHEEVICTIONPOLICY_H_
+#define NXCOMMON_CACHEEVICTIONPOLICY_H_
+
+#include <nxcommon/config.h>
+#include "util.h"
+#include <list>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+
+
+
+
+typedef unsigned int cachesize_t;
+
+
+
+/*
+ * 	This file contains the eviction policies that can be plugged into Cache (and thus into ConcurrentCache and
+ * 	ResourceCache) through its EvictionPolicy template parameter.
+ *
+ * 	An eviction policy is a class template taking <K, MapHash, KeyEqual> which keeps the cache entries (which
+ * 	are CacheNode objects) in one or more intrusive lists and decides in which order they are evicted. It has
+ * 	the following interface:
+ *
+ * 		void setCapacity(cachesize_t capacity)
+ * 			Called when the capacity of the cache changes. Policies may use it to size their internal lists.
+ * 		void inserted(CacheNode<K>* node)
+ * 			Called after a new entry was inserted into the cache.
+ * 		void accessed(CacheNode<K>* node)
+ * 			Called when an entry was accessed (a cache hit).
+ * 		void removed(CacheNode<K>* node, bool evicted)
+ * 			Called before an entry is removed from the cache. evicted is true if the entry was removed to make
+ * 			room for other entries, and false if it was removed explicitly.
+ * 		template <class RemoveFunc, class DoneFunc> void evict(RemoveFunc tryRemove, DoneFunc done)
+ * 			Called when the cache has to make room. The policy calls tryRemove(node) for candidate entries in
+ * 			the order in which they should be evicted, until done() returns true or no candidates are left.
+ * 			tryRemove() returns false if the entry could not be removed because it is locked. Otherwise, it
+ * 			calls removed() for the node before returning true, so the node must not be touched afterwards.
+ */
+
+
+
+/**	\brief The part of a cache entry that is managed by the eviction policy.
+ */
+template <class K>
+struct CacheNode
+{
+	CacheNode(cachesize_t cost) : prev(NULL), next(NULL), kPtr(NULL), cost(cost), index(0), list(0) {}
+
+	CacheNode* prev;
+	CacheNode* next;
+	const K* kPtr;
+	cachesize_t cost;
+
+	/**	\brief Policy-specific index of the node, e.g. its position in a heap.
+	 */
+	uint32_t index;
+
+	/**	\brief Policy-specific identifier of the list the node is currently in.
+	 */
+	uint8_t list;
+};
+
+
+/**	\brief An intrusive doubly-linked list of CacheNode objects, most recently added first.
+ *
+ * 	The size of the list is the sum of the costs of its nodes.
+ */
+template <class K>
+class CacheNodeList
+{
+public:
+	typedef CacheNode<K> Node;
+
+public:
+	CacheNodeList() : head(NULL), tail(NULL), size(0) {}
+
+	Node* getHead() const { return head; }
+	Node* getTail() const { return tail; }
+	cachesize_t getSize() const { return size; }
+	bool isEmpty() const { return head == NULL; }
+
+	void pushFront(Node* node)
+	{
+		node->prev = NULL;
+		node->next = head;
+		if (head) {
+			head->prev = node;
+		} else {
+			tail = node;
+		}
+		head = node;
+		size += node->cost;
+	}
+
+	void unlink(Node* node)
+	{
+		if (node->prev) {
+			node->prev->next = node->next;
+		} else {
+			head = node->next;
+		}
+		if (node->next) {
+			node->next->prev = node->prev;
+		} else {
+			tail = node->prev;
+		}
+		node->prev = NULL;
+		node->next = NULL;
+		size -= node->cost;
+	}
+
+	void moveToFront(Node* node)
+	{
+		if (node != head) {
+			unlink(node);
+			pushFront(node);
+		}
+	}
+
+private:
+	Node* head;
+	Node* tail;
+	cachesize_t size;
+};
+
+
+/**	\brief Remembers the keys and sizes of entries that were recently evicted, in FIFO order.
+ *
+ * 	Ghost lists are used by scan-resistant policies to recognize entries that come back shortly after they
+ * 	were evicted. The size of the list is the sum of the sizes of the remembered entries.
+ */
+template <class K, class MapHash, class KeyEqual>
+class CacheGhostList
+{
+private:
+	typedef std::list<std::pair<K, cachesize_t> > KeyList;
+	typedef std::unordered_map<K, typename KeyList::iterator, MapHash, KeyEqual> KeyIndex;
+
+public:
+	CacheGhostList() : size(0) {}
+
+	cachesize_t getSize() const { return size; }
+
+	bool contains(const K& key) const { return index.find(key) != index.end(); }
+
+	void push(const K& key, cachesize_t cost)
+	{
+		remove(key);
+		keys.push_front(std::pair<K, cachesize_t>(key, cost));
+		index.insert(std::pair<const K, typename KeyList::iterator>(key, keys.begin()));
+		size += cost;
+	}
+
+	bool remove(const K& key, cachesize_t* cost = NULL)
+	{
+		typename KeyIndex::iterator it = index.find(key);
+
+		if (it == index.end()) {
+			return false;
+		}
+
+		if (cost) {
+			*cost = it->second->second;
+		}
+
+		size -= it->second->second;
+		keys.erase(it->second);
+		index.erase(it);
+		return true;
+	}
+
+	void trim(cachesize_t maxSize)
+	{
+		while (size > maxSize  &&  !keys.empty()) {
+			size -= keys.back().second;
+			index.erase(keys.back().first);
+			keys.pop_back();
+		}
+	}
+
+private:
+	KeyList keys;
+	KeyIndex index;
+	cachesize_t size;
+};
+
+
+/**	\brief A count-min sketch estimating the access frequency of keys, with periodic aging.
+ *
+ * 	Counters saturate at 15. After a number of increments proportional to the sketch width, all counters are
+ * 	halved, so that the frequencies reflect recent history.
+ */
+class CacheFrequencySketch
+{
+public:
+	CacheFrequencySketch() { resize(64); }
+
+	/**	\brief Grows the sketch if it is too small to track the given number of keys with good accuracy.
+	 *
+	 * 	Growing resets all counters.
+	 */
+	void ensureCapacity(size_t numKeys)
+	{
+		if (numKeys > width) {
+			resize(GetNextPowerOfTwo(numKeys));
+		}
+	}
+
+	void increment(uint64_t hash)
+	{
+		for (unsigned int row = 0 ; row < Depth ; row++) {
+			uint8_t& counter = table[row*width + index(hash, row)];
+			if (counter < 15) {
+				counter++;
+			}
+		}
+
+		if (++additions >= sampleSize) {
+			age();
+		}
+	}
+
+	unsigned int frequency(uint64_t hash) const
+	{
+		unsigned int freq = 15;
+		for (unsigned int row = 0 ; row < Depth ; row++) {
+			freq = std::min(freq, (unsigned int) table[row*width + index(hash, row)]);
+		}
+		return freq;
+	}
+
+private:
+	static const unsigned int Depth = 4;
+
+private:
+	size_t index(uint64_t hash, unsigned int row) const
+	{
+		static const uint64_t seeds[Depth] = {
+				0xC3A5C85C97CB3127ULL, 0xB492B66FBE98F273ULL, 0x9AE16A3B2F90404FULL, 0xCBF29CE484222325ULL
+		};
+		uint64_t h = (hash + seeds[row]) * 0x9E3779B97F4A7C15ULL;
+		return (size_t) ((h ^ (h >> 32)) & (width-1));
+	}
+
+	void resize(size_t newWidth)
+	{
+		width = newWidth;
+		table.assign(Depth*width, 0);
+		additions = 0;
+		sampleSize = 10*width;
+	}
+
+	void age()
+	{
+		for (uint8_t& counter : table) {
+			counter >>= 1;
+		}
+		additions /= 2;
+	}
+
+private:
+	std::vector<uint8_t> table;
+	size_t width;
+	size_t additions;
+	size_t sampleSize;
+};
+
+
+
+
+/**	\brief Plain least-recently-used eviction.
+ *
+ * 	This is the default policy of Cache.
+ */
+template <class K, class MapHash, class KeyEqual>
+class LRUEvictionPolicy
+{
+public:
+	typedef CacheNode<K> Node;
+
+public:
+	void setCapacity(cachesize_t) {}
+
+	void inserted(Node* node) { lru.pushFront(node); }
+	void accessed(Node* node) { lru.moveToFront(node); }
+	void removed(Node* node, bool) { lru.unlink(node); }
+
+	template <class RemoveFunc, class DoneFunc>
+	void evict(RemoveFunc tryRemove, DoneFunc done)
+	{
+		Node* node = lru.getTail();
+		while (node  &&  !done()) {
+			Node* cur = node;
+			node = node->prev;
+			tryRemove(cur);
+		}
+	}
+
+private:
+	CacheNodeList<K> lru;
+};
+
+
+/**	\brief The full 2Q eviction policy (Johnson & Shasha).
+ *
+ * 	New entries are put into a FIFO queue (A1in) which takes about a quarter of the capacity. Entries evicted
+ * 	from A1in are remembered in a ghost list (A1out). Only entries that are inserted again while they are in
+ * 	A1out are considered hot and put into the main LRU list (Am). A single sequential scan therefore only
+ * 	flushes A1in, but not the hot working set in Am.
+ */
+template <class K, class MapHash, class KeyEqual>
+class TwoQueueEvictionPolicy
+{
+public:
+	typedef CacheNode<K> Node;
+
+private:
+	enum ListId
+	{
+		ListIn = 1,
+		ListMain = 2
+	};
+
+public:
+	TwoQueueEvictionPolicy() : inMax(0), outMax(0) {}
+
+	void setCapacity(cachesize_t capacity)
+	{
+		inMax = capacity / 4;
+		outMax = capacity / 2;
+		ghostOut.trim(outMax);
+	}
+
+	void inserted(Node* node)
+	{
+		if (ghostOut.remove(*node->kPtr)) {
+			node->list = ListMain;
+			main.pushFront(node);
+		} else {
+			node->list = ListIn;
+			in.pushFront(node);
+		}
+	}
+
+	void accessed(Node* node)
+	{
+		// A1in is a FIFO, so hits there don't change the order.
+		if (node->list == ListMain) {
+			main.moveToFront(node);
+		}
+	}
+
+	void removed(Node* node, bool evicted)
+	{
+		if (node->list == ListIn) {
+			in.unlink(node);
+
+			if (evicted) {
+				ghostOut.push(*node->kPtr, node->cost);
+				ghostOut.trim(outMax);
+			}
+		} else {
+			main.unlink(node);
+		}
+	}
+
+	template <class RemoveFunc, class DoneFunc>
+	void evict(RemoveFunc tryRemove, DoneFunc done)
+	{
+		bool inFirst = in.getSize() > inMax;
+
+		Node* lists[] = { inFirst ? in.getTail() : main.getTail(), inFirst ? main.getTail() : in.getTail() };
+
+		for (Node* node : lists) {
+			while (node  &&  !done()) {
+				Node* cur = node;
+				node = node->prev;
+				tryRemove(cur);
+			}
+		}
+	}
+
+private:
+	CacheNodeList<K> in;
+	CacheNodeList<K> main;
+	CacheGhostList<K, MapHash, KeyEqual> ghostOut;
+	cachesize_t inMax;
+	cachesize_t outMax;
+};
+
+
+/**	\brief The Adaptive Replacement Cache policy (Megiddo & Modha), adapted to weighted entries.
+ *
+ * 	Entries seen once are kept in T1, entries seen at least twice in T2. Evicted entries are remembered in the
+ * 	ghost lists B1 and B2. A hit in a ghost list shifts the target size p of T1 towards recency (B1) or
+ * 	frequency (B2), so the policy adapts itself to the workload. All sizes are measured in entry costs
+ * 	instead of entry counts.
+ */
+template <class K, class MapHash, class KeyEqual>
+class ARCEvictionPolicy
+{
+public:
+	typedef CacheNode<K> Node;
+
+private:
+	enum ListId
+	{
+		ListT1 = 1,
+		ListT2 = 2
+	};
+
+public:
+	ARCEvictionPolicy() : capacity(0), p(0) {}
+
+	void setCapacity(cachesize_t capacity)
+	{
+		this->capacity = capacity;
+		p = std::min(p, capacity);
+		trimGhosts();
+	}
+
+	void inserted(Node* node)
+	{
+		const K& key = *node->kPtr;
+		cachesize_t b1Size = b1.getSize();
+		cachesize_t b2Size = b2.getSize();
+
+		if (b1.remove(key)) {
+			uint64_t delta = (uint64_t) node->cost * std::max(b2Size / std::max(b1Size, 1u), 1u);
+			p = (cachesize_t) std::min((uint64_t) capacity, p + delta);
+			node->list = ListT2;
+			t2.pushFront(node);
+		} else if (b2.remove(key)) {
+			uint64_t delta = (uint64_t) node->cost * std::max(b1Size / std::max(b2Size, 1u), 1u);
+			p = (cachesize_t) (p - std::min((uint64_t) p, delta));
+			node->list = ListT2;
+			t2.pushFront(node);
+		} else {
+			node->list = ListT1;
+			t1.pushFront(node);
+		}
+
+		trimGhosts();
+	}
+
+	void accessed(Node* node)
+	{
+		if (node->list == ListT1) {
+			t1.unlink(node);
+			node->list = ListT2;
+			t2.pushFront(node);
+		} else {
+			t2.moveToFront(node);
+		}
+	}
+
+	void removed(Node* node, bool evicted)
+	{
+		if (node->list == ListT1) {
+			t1.unlink(node);
+			if (evicted) {
+				b1.push(*node->kPtr, node->cost);
+			}
+		} else {
+			t2.unlink(node);
+			if (evicted) {
+				b2.push(*node->kPtr, node->cost);
+			}
+		}
+
+		trimGhosts();
+	}
+
+	template <class RemoveFunc, class DoneFunc>
+	void evict(RemoveFunc tryRemove, DoneFunc done)
+	{
+		bool t1First = t1.getSize() > p  ||  t2.isEmpty();
+
+		Node* lists[] = { t1First ? t1.getTail() : t2.getTail(), t1First ? t2.getTail() : t1.getTail() };
+
+		for (Node* node : lists) {
+			while (node  &&  !done()) {
+				Node* cur = node;
+				node = node->prev;
+				tryRemove(cur);
+			}
+		}
+	}
+
+private:
+	void trimGhosts()
+	{
+		// Keep |T1|+|B1| <= c and |T2|+|B2| <= c
+		b1.trim(capacity > t1.getSize() ? capacity - t1.getSize() : 0);
+		b2.trim(capacity > t2.getSize() ? capacity - t2.getSize() : 0);
+	}
+
+private:
+	CacheNodeList<K> t1;
+	CacheNodeList<K> t2;
+	CacheGhostList<K, MapHash, KeyEqual> b1;
+	CacheGhostList<K, MapHash, KeyEqual> b2;
+	cachesize_t capacity;
+	cachesize_t p;
+};
+
+
+/**	\brief The W-TinyLFU eviction policy (Einziger, Friedman & Manes).
+ *
+ * 	New entries are put into a small LRU admission window (1% of the capacity). When the window overflows, its
+ * 	least recently used entry competes against the least recently used entry of the main space's probation
+ * 	segment: The one with the lower estimated access frequency (as tracked by a count-min sketch, which also
+ * 	remembers keys that are not cached) is evicted. Entries hit in the probation segment are promoted to the
+ * 	protected segment (80% of the main space). Entries that are only seen once, like those of a sequential
+ * 	scan, thus rarely make it into the main space.
+ */
+template <class K, class MapHash, class KeyEqual>
+class TinyLFUEvictionPolicy
+{
+public:
+	typedef CacheNode<K> Node;
+
+private:
+	enum ListId
+	{
+		ListWindow = 1,
+		ListProbation = 2,
+		ListProtected = 3
+	};
+
+public:
+	TinyLFUEvictionPolicy() : windowMax(0), mainMax(0), protectedMax(0), numEntries(0) {}
+
+	void setCapacity(cachesize_t capacity)
+	{
+		windowMax = std::max(capacity / 100, 1u);
+		mainMax = capacity > windowMax ? capacity - windowMax : 0;
+		protectedMax = (cachesize_t) (((uint64_t) mainMax * 4) / 5);
+	}
+
+	void inserted(Node* node)
+	{
+		sketch.increment(hashOf(node));
+		sketch.ensureCapacity(++numEntries);
+
+		node->list = ListWindow;
+		window.pushFront(node);
+
+		// As long as the main space is not full, window overflow is admitted without competition.
+		while (window.getSize() > windowMax) {
+			Node* candidate = window.getTail();
+
+			if ((uint64_t) probation.getSize() + protectedList.getSize() + candidate->cost > mainMax) {
+				break;
+			}
+
+			window.unlink(candidate);
+			candidate->list = ListProbation;
+			probation.pushFront(candidate);
+		}
+	}
+
+	void accessed(Node* node)
+	{
+		sketch.increment(hashOf(node));
+
+		if (node->list == ListWindow) {
+			window.moveToFront(node);
+		} else if (node->list == ListProbation) {
+			probation.unlink(node);
+			node->list = ListProtected;
+			protectedList.pushFront(node);
+
+			while (protectedList.getSize() > protectedMax) {
+				Node* demoted = protectedList.getTail();
+				protectedList.unlink(demoted);
+				demoted->list = ListProbation;
+				probation.pushFront(demoted);
+			}
+		} else {
+			protectedList.moveToFront(node);
+		}
+	}
+
+	void removed(Node* node, bool)
+	{
+		listOf(node).unlink(node);
+		numEntries--;
+	}
+
+	template <class RemoveFunc, class DoneFunc>
+	void evict(RemoveFunc tryRemove, DoneFunc done)
+	{
+		Node* w = window.getTail();
+		Node* p = probation.getTail();
+		Node* r = protectedList.getTail();
+
+		while (!done()) {
+			// Eviction happens right before a new entry is put into the window, so a full window is treated
+			// like an overflowing one.
+			Node* candidate = window.getSize() >= windowMax ? w : NULL;
+
+			if (candidate  &&  p) {
+				if (frequency(candidate) > frequency(p)) {
+					// The window candidate wins: Evict the probation victim and admit the candidate into the
+					// main space.
+					Node* victim = p;
+					p = p->prev;
+
+					if (tryRemove(victim)) {
+						w = candidate->prev;
+						window.unlink(candidate);
+						candidate->list = ListProbation;
+						probation.pushFront(candidate);
+					}
+				} else {
+					w = candidate->prev;
+					tryRemove(candidate);
+				}
+			} else if (candidate) {
+				w = candidate->prev;
+				tryRemove(candidate);
+			} else if (p) {
+				Node* victim = p;
+				p = p->prev;
+				tryRemove(victim);
+			} else if (r) {
+				Node* victim = r;
+				r = r->prev;
+				tryRemove(victim);
+			} else if (w) {
+				Node* victim = w;
+				w = w->prev;
+				tryRemove(victim);
+			} else {
+				break;
+			}
+		}
+	}
+
+private:
+	uint64_t hashOf(Node* node) const { return (uint64_t) hash(*node->kPtr); }
+	unsigned int frequency(Node* node) const { return sketch.frequency(hashOf(node)); }
+
+	CacheNodeList<K>& listOf(Node* node)
+	{
+		return node->list == ListWindow ? window : (node->list == ListProbation ? probation : protectedList);
+	}
+
+private:
+	CacheNodeList<K> window;
+	CacheNodeList<K> probation;
+	CacheNodeList<K> protectedList;
+	CacheFrequencySketch sketch;
+	MapHash hash;
+	cachesize_t windowMax;
+	cachesize_t mainMax;
+	cachesize_t protectedMax;
+	size_t numEntries;
+};
+
+
+
+/**	\brief The GreedyDual-Size-Frequency eviction policy (Cherkasova), which evicts by value per byte.
+ *
+ * 	Every entry has a priority of L + frequency * value / cost, where frequency is the number of accesses
+ * 	since it was inserted, value is the cost of reloading it (1 unless a value function is set) and cost is
+ * 	its cache size. The entry with the lowest priority is evicted first. L is the priority of the last evicted
+ * 	entry, so that entries which are not accessed anymore age relative to newly inserted ones.
+ *
+ * 	Unlike the other policies, this one prefers keeping many small entries over a few large ones of the same
+ * 	popularity. It is useful when entry sizes vary a lot and the cache size is measured in bytes.
+ */
+template <class K, class MapHash, class KeyEqual>
+class GDSFEvictionPolicy
+{
+public:
+	typedef CacheNode<K> Node;
+	typedef std::function<double (const K&)> ValueFunction;
+
+private:
+	struct HeapEntry
+	{
+		double priority;
+		Node* node;
+		uint32_t frequency;
+	};
+
+public:
+	GDSFEvictionPolicy() : inflation(0.0) {}
+
+	/**	\brief Sets a function returning the value (e.g. the cost of reloading) of an entry.
+	 *
+	 * 	It is called once for every insert and access, and must return a positive value. This should be
+	 * 	called while the cache is empty.
+	 */
+	void setValueFunction(const ValueFunction& func) { valueFunc = func; }
+
+	void setCapacity(cachesize_t) {}
+
+	void inserted(Node* node)
+	{
+		HeapEntry entry;
+		entry.node = node;
+		entry.frequency = 1;
+		entry.priority = priority(node, 1);
+
+		node->index = (uint32_t) heap.size();
+		heap.push_back(entry);
+		siftUp(node->index);
+	}
+
+	void accessed(Node* node)
+	{
+		HeapEntry& entry = heap[node->index];
+		if (entry.frequency != UINT32_MAX) {
+			entry.frequency++;
+		}
+
+		// Both the frequency and L only ever grow, so the priority can't decrease.
+		entry.priority = priority(node, entry.frequency);
+		siftDown(node->index);
+	}
+
+	void removed(Node* node, bool evicted)
+	{
+		if (evicted) {
+			inflation = std::max(inflation, heap[node->index].priority);
+		}
+		erase(node->index);
+	}
+
+	template <class RemoveFunc, class DoneFunc>
+	void evict(RemoveFunc tryRemove, DoneFunc done)
+	{
+		// Locked entries are taken out of the heap while looking for victims, and put back afterwards.
+		while (!heap.empty()  &&  !done()) {
+			HeapEntry top = heap[0];
+
+			if (!tryRemove(top.node)) {
+				erase(0);
+				skipped.push_back(top);
+			}
+		}
+
+		for (const HeapEntry& entry : skipped) {
+			entry.node->index = (uint32_t) heap.size();
+			heap.push_back(entry);
+			siftUp(entry.node->index);
+		}
+		skipped.clear();
+	}
+
+	/**	\brief Returns the current value of L.
+	 */
+	double getInflation() const { return inflation; }
+
+private:
+	double priority(Node* node, uint32_t frequency) const
+	{
+		double value = valueFunc ? valueFunc(*node->kPtr) : 1.0;
+		return inflation + frequency * value / std::max(node->cost, 1u);
+	}
+
+	void place(size_t idx, const HeapEntry& entry)
+	{
+		heap[idx] = entry;
+		entry.node->index = (uint32_t) idx;
+	}
+
+	void siftUp(size_t idx)
+	{
+		HeapEntry entry = heap[idx];
+
+		while (idx > 0) {
+			size_t parent = (idx-1) / 2;
+			if (heap[parent].priority <= entry.priority) {
+				break;
+			}
+			place(idx, heap[parent]);
+			idx = parent;
+		}
+
+		place(idx, entry);
+	}
+
+	void siftDown(size_t idx)
+	{
+		HeapEntry entry = heap[idx];
+		size_t size = heap.size();
+
+		while (2*idx + 1 < size) {
+			size_t child = 2*idx + 1;
+			if (child+1 < size  &&  heap[child+1].priority < heap[child].priority) {
+				child++;
+			}
+			if (entry.priority <= heap[child].priority) {
+				break;
+			}
+			place(idx, heap[child]);
+			idx = child;
+		}
+
+		place(idx, entry);
+	}
+
+	void erase(size_t idx)
+	{
+		size_t last = heap.size()-1;
+
+		if (idx != last) {
+			place(idx, heap[last]);
+			heap.pop_back();
+			siftDown(idx);
+			siftUp(idx);
+		} else {
+			heap.pop_back();
+		}
+	}
+
+private:
+	std::vector<HeapEntry> heap;
+	std::vector<HeapEntry> skipped;
+	ValueFunction valueFunc;
+	double inflation;
+};
+
+#endif /* NXCOMMON_CACHEEVICTIONPOLICY_H_ */
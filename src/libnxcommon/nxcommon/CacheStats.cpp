@@ -0,0 +1,276 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "CacheStatsJSON.h"
+#include <rapidjson/stringbuffer.h>
+#include <cstring>
+#include <cmath>
+#include <limits>
+
+
+
+static std::atomic<uint64_t> nextCacheStatsId(1);
+
+
+
+
+unsigned int LatencyHistogram::getBucketIndex(uint64_t value)
+{
+	if (value < SubBucketCount) {
+		return (unsigned int) value;
+	}
+
+#ifdef __GNUC__
+	unsigned int exp = 63 - __builtin_clzll(value);
+#else
+	unsigned int exp = 0;
+	for (uint64_t v = value >> 1 ; v != 0 ; v >>= 1) {
+		exp++;
+	}
+#endif
+
+	unsigned int sub = (unsigned int) (value >> (exp - SubBucketBits)) & (SubBucketCount-1);
+	return (exp - SubBucketBits + 1) * SubBucketCount + sub;
+}
+
+
+uint64_t LatencyHistogram::getBucketLowerBound(unsigned int idx)
+{
+	if (idx < SubBucketCount) {
+		return idx;
+	}
+
+	unsigned int exp = idx / SubBucketCount + SubBucketBits - 1;
+	uint64_t sub = idx % SubBucketCount;
+	return (SubBucketCount + sub) << (exp - SubBucketBits);
+}
+
+
+uint64_t LatencyHistogram::getBucketUpperBound(unsigned int idx)
+{
+	if (idx < SubBucketCount) {
+		return idx;
+	}
+
+	unsigned int exp = idx / SubBucketCount + SubBucketBits - 1;
+	return getBucketLowerBound(idx) + ((uint64_t) 1 << (exp - SubBucketBits)) - 1;
+}
+
+
+void LatencyHistogram::clear()
+{
+	memset(buckets, 0, sizeof(buckets));
+	count = 0;
+	sum = 0;
+	min = std::numeric_limits<uint64_t>::max();
+	max = 0;
+}
+
+
+void LatencyHistogram::addToBucket(unsigned int idx, uint64_t n, uint64_t valueMin, uint64_t valueMax)
+{
+	buckets[idx] += n;
+	count += n;
+	sum += valueMin == valueMax ? n*valueMin : 0;
+	min = std::min(min, valueMin);
+	max = std::max(max, valueMax);
+}
+
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+	for (unsigned int i = 0 ; i < BucketCount ; i++) {
+		buckets[i] += other.buckets[i];
+	}
+
+	count += other.count;
+	sum += other.sum;
+	min = std::min(min, other.min);
+	max = std::max(max, other.max);
+}
+
+
+uint64_t LatencyHistogram::getPercentile(double percentile) const
+{
+	if (count == 0) {
+		return 0;
+	}
+
+	uint64_t rank = (uint64_t) std::ceil(percentile / 100.0 * count);
+	rank = std::max(rank, (uint64_t) 1);
+
+	uint64_t seen = 0;
+
+	for (unsigned int i = 0 ; i < BucketCount ; i++) {
+		seen += buckets[i];
+
+		if (seen >= rank) {
+			return std::min(getBucketUpperBound(i), max);
+		}
+	}
+
+	return max;
+}
+
+
+
+
+double CacheStats::Snapshot::getHitRatio() const
+{
+	uint64_t lookups = getHits() + getMisses();
+	return lookups != 0 ? (double) getHits() / lookups : 0.0;
+}
+
+
+CString CacheStats::Snapshot::toJSON() const
+{
+	rapidjson::StringBuffer buf;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buf);
+	writeJSON(writer);
+	return CString(buf.GetString(), buf.GetSize());
+}
+
+
+
+
+CacheStats::ThreadCounters::ThreadCounters()
+		: occupied(0), loadSum(0), loadMin(std::numeric_limits<uint64_t>::max()), loadMax(0)
+{
+	for (unsigned int i = 0 ; i < CounterCount ; i++) {
+		counters[i].store(0, std::memory_order_relaxed);
+	}
+	for (unsigned int i = 0 ; i < LatencyHistogram::BucketCount ; i++) {
+		loadBuckets[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+
+CacheStats::CacheStats()
+		: id(nextCacheStatsId.fetch_add(1)), capacity(0)
+{
+}
+
+
+CacheStats::~CacheStats()
+{
+}
+
+
+CacheStats::ThreadCounters* CacheStats::registerThread()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	std::unique_ptr<ThreadCounters>& counters = threadCounters[std::this_thread::get_id()];
+
+	if (!counters) {
+		counters.reset(new ThreadCounters);
+	}
+
+	return counters.get();
+}
+
+
+void CacheStats::addOccupied(const CString& keyClass, int64_t delta)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	occupiedPerClass[keyClass] += delta;
+}
+
+
+void CacheStats::recordLoad(uint64_t nanoseconds, bool success)
+{
+	ThreadCounters& tc = getThreadCounters();
+
+	std::atomic<uint64_t>& c = tc.counters[success ? CounterLoads : CounterFailedLoads];
+	c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	std::atomic<uint64_t>& bucket = tc.loadBuckets[LatencyHistogram::getBucketIndex(nanoseconds)];
+	bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	tc.loadSum.store(tc.loadSum.load(std::memory_order_relaxed) + nanoseconds, std::memory_order_relaxed);
+
+	if (nanoseconds < tc.loadMin.load(std::memory_order_relaxed)) {
+		tc.loadMin.store(nanoseconds, std::memory_order_relaxed);
+	}
+	if (nanoseconds > tc.loadMax.load(std::memory_order_relaxed)) {
+		tc.loadMax.store(nanoseconds, std::memory_order_relaxed);
+	}
+}
+
+
+CacheStats::Snapshot CacheStats::getSnapshot() const
+{
+	Snapshot snap;
+
+	memset(snap.counters, 0, sizeof(snap.counters));
+	snap.occupied = 0;
+	snap.capacity = capacity.load(std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	for (auto it = threadCounters.begin() ; it != threadCounters.end() ; it++) {
+		const ThreadCounters& tc = *it->second;
+
+		for (unsigned int i = 0 ; i < CounterCount ; i++) {
+			snap.counters[i] += tc.counters[i].load(std::memory_order_relaxed);
+		}
+
+		snap.occupied += tc.occupied.load(std::memory_order_relaxed);
+
+		LatencyHistogram& hist = snap.loadLatency;
+
+		for (unsigned int i = 0 ; i < LatencyHistogram::BucketCount ; i++) {
+			uint64_t n = tc.loadBuckets[i].load(std::memory_order_relaxed);
+			hist.buckets[i] += n;
+			hist.count += n;
+		}
+
+		hist.sum += tc.loadSum.load(std::memory_order_relaxed);
+		hist.min = std::min(hist.min, tc.loadMin.load(std::memory_order_relaxed));
+		hist.max = std::max(hist.max, tc.loadMax.load(std::memory_order_relaxed));
+	}
+
+	snap.occupiedPerClass = occupiedPerClass;
+
+	return snap;
+}
+
+
+void CacheStats::reset()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	for (auto it = threadCounters.begin() ; it != threadCounters.end() ; it++) {
+		ThreadCounters& tc = *it->second;
+
+		for (unsigned int i = 0 ; i < CounterCount ; i++) {
+			tc.counters[i].store(0, std::memory_order_relaxed);
+		}
+		for (unsigned int i = 0 ; i < LatencyHistogram::BucketCount ; i++) {
+			tc.loadBuckets[i].store(0, std::memory_order_relaxed);
+		}
+
+		tc.loadSum.store(0, std::memory_order_relaxed);
+		tc.loadMin.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+		tc.loadMax.store(0, std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,275 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_CACHESTATS_H_
+#define NXCOMMON_CACHESTATS_H_
+
+#include <nxcommon/config.h>
+#include "CString.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+using std::map;
+using std::vector;
+
+
+
+
+/**	\brief A histogram of latencies with logarithmic buckets, similar to HdrHistogram.
+ *
+ * 	Each power of two is divided into 8 linear sub-buckets, so every recorded value is known with a relative
+ * 	error of at most 12.5%, over the whole range of uint64_t. Values below 8 are recorded exactly. The
+ * 	histogram has a fixed size and recording a value is just an increment.
+ */
+class LatencyHistogram
+{
+public:
+	enum
+	{
+		SubBucketBits = 3,
+		SubBucketCount = 1 << SubBucketBits,
+		BucketCount = (64 - SubBucketBits + 1) * SubBucketCount
+	};
+
+public:
+	/**	\brief Returns the index of the bucket that the value is counted in.
+	 */
+	static unsigned int getBucketIndex(uint64_t value);
+
+	/**	\brief Returns the smallest value counted in a bucket.
+	 */
+	static uint64_t getBucketLowerBound(unsigned int idx);
+
+	/**	\brief Returns the largest value counted in a bucket.
+	 */
+	static uint64_t getBucketUpperBound(unsigned int idx);
+
+public:
+	LatencyHistogram() { clear(); }
+
+	void record(uint64_t value) { addToBucket(getBucketIndex(value), 1, value, value); }
+
+	/**	\brief Adds all values of another histogram to this one.
+	 */
+	void merge(const LatencyHistogram& other);
+
+	void clear();
+
+	uint64_t getCount() const { return count; }
+	uint64_t getMin() const { return count != 0 ? min : 0; }
+	uint64_t getMax() const { return max; }
+	uint64_t getSum() const { return sum; }
+	double getMean() const { return count != 0 ? (double) sum / count : 0.0; }
+
+	/**	\brief Returns the value below which the given percentage of recorded values lies.
+	 *
+	 * 	The result is the upper bound of the bucket that contains the percentile, clamped to the maximum.
+	 *
+	 * 	@param percentile The percentile in [0, 100].
+	 */
+	uint64_t getPercentile(double percentile) const;
+
+	uint64_t getBucketCount(unsigned int idx) const { return buckets[idx]; }
+
+private:
+	void addToBucket(unsigned int idx, uint64_t n, uint64_t valueMin, uint64_t valueMax);
+
+private:
+	uint64_t buckets[BucketCount];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+
+	friend class CacheStats;
+};
+
+
+
+
+/**	\brief Usage statistics for Cache and ResourceCache.
+ *
+ * 	Statistics are opt-in: A CacheStats object is created by the user and attached to one (or more) caches
+ * 	with their setStats() method. Caches without statistics only pay for a NULL check.
+ *
+ * 	To keep the overhead low when a cache is used from multiple threads, each thread counts into its own,
+ * 	cache-line aligned block of counters, which is only ever written by that thread. The blocks are merged
+ * 	when a Snapshot is taken with getSnapshot(), so reading the statistics is comparatively expensive.
+ *
+ * 	The occupied size can additionally be broken down by key class, if a key classifier is passed to the
+ * 	cache's setStats(). Because this needs a map lookup under a lock, it is more expensive than the other
+ * 	counters.
+ */
+class CacheStats
+{
+public:
+	enum Counter
+	{
+		CounterHits,			//!< Lookups that found the entry.
+		CounterMisses,			//!< Lookups that did not find the entry.
+		CounterInserts,			//!< Entries inserted into the cache.
+		CounterEvictions,		//!< Entries removed to make room (not by explicit remove()).
+		CounterOverfills,		//!< Locked inserts that made the cache overfilled.
+		CounterLoads,			//!< Successful calls to the EntryLoader.
+		CounterFailedLoads,		//!< Calls to the EntryLoader that returned NULL or threw.
+		CounterExpirations,		//!< Entries removed because their time-to-live has passed.
+
+		CounterCount
+	};
+
+	/**	\brief A consistent copy of all statistics at one point in time.
+	 */
+	struct Snapshot
+	{
+		uint64_t counters[CounterCount];
+		int64_t occupied;
+		uint64_t capacity;
+		map<CString, int64_t> occupiedPerClass;
+		LatencyHistogram loadLatency;
+
+		uint64_t getHits() const { return counters[CounterHits]; }
+		uint64_t getMisses() const { return counters[CounterMisses]; }
+		uint64_t getInserts() const { return counters[CounterInserts]; }
+		uint64_t getEvictions() const { return counters[CounterEvictions]; }
+		uint64_t getOverfills() const { return counters[CounterOverfills]; }
+		uint64_t getLoads() const { return counters[CounterLoads]; }
+		uint64_t getFailedLoads() const { return counters[CounterFailedLoads]; }
+		uint64_t getExpirations() const { return counters[CounterExpirations]; }
+
+		/**	\brief Returns hits / (hits + misses), or 0 if there were no lookups.
+		 */
+		double getHitRatio() const;
+
+		/**	\brief Writes the snapshot as a JSON object.
+		 *
+		 * 	Defined in CacheStatsJSON.h, so that only code which actually writes JSON has to pull in rapidjson.
+		 *
+		 * 	@param writer A rapidjson Writer or PrettyWriter.
+		 */
+		template <class Writer>
+		void writeJSON(Writer& writer) const;
+
+		/**	\brief Returns the snapshot as a JSON object string.
+		 */
+		CString toJSON() const;
+	};
+
+private:
+	/**	\brief Number of CacheStats objects whose counters each thread can look up without locking.
+	 */
+	static constexpr unsigned int ThreadCountersCacheSize = 8;
+
+	struct alignas(64) ThreadCounters
+	{
+		ThreadCounters();
+
+		std::atomic<uint64_t> counters[CounterCount];
+		std::atomic<int64_t> occupied;
+		std::atomic<uint64_t> loadBuckets[LatencyHistogram::BucketCount];
+		std::atomic<uint64_t> loadSum;
+		std::atomic<uint64_t> loadMin;
+		std::atomic<uint64_t> loadMax;
+	};
+
+public:
+	CacheStats();
+	~CacheStats();
+
+	CacheStats(const CacheStats&) = delete;
+	CacheStats& operator=(const CacheStats&) = delete;
+
+	void count(Counter counter, uint64_t n = 1)
+	{
+		std::atomic<uint64_t>& c = getThreadCounters().counters[counter];
+		c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	/**	\brief Adds to the occupied size.
+	 *
+	 * 	@param delta The size change, negative for removed entries.
+	 */
+	void addOccupied(int64_t delta)
+	{
+		std::atomic<int64_t>& c = getThreadCounters().occupied;
+		c.store(c.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+	}
+
+	/**	\brief Adds to the occupied size of a key class.
+	 */
+	void addOccupied(const CString& keyClass, int64_t delta);
+
+	/**	\brief Records the duration of a call to the EntryLoader.
+	 *
+	 * 	@param nanoseconds The duration.
+	 * 	@param success Whether an entry was loaded.
+	 */
+	void recordLoad(uint64_t nanoseconds, bool success);
+
+	void setCapacity(uint64_t capacity) { this->capacity.store(capacity, std::memory_order_relaxed); }
+
+	/**	\brief Merges the counters of all threads.
+	 */
+	Snapshot getSnapshot() const;
+
+	/**	\brief Sets all counters except the occupied sizes and the capacity to zero.
+	 *
+	 * 	Increments done concurrently by other threads may be lost or survive the reset.
+	 */
+	void reset();
+
+private:
+	ThreadCounters& getThreadCounters()
+	{
+		// Direct-mapped by id, so that a thread alternating between a few caches doesn't have to go through
+		// registerThread() on every count. Consecutive ids use different slots.
+		struct CachedCounters { uint64_t statsId; ThreadCounters* counters; };
+		static thread_local CachedCounters cached[ThreadCountersCacheSize] = {};
+
+		CachedCounters& slot = cached[id % ThreadCountersCacheSize];
+
+		if (slot.statsId != id) {
+			slot.counters = registerThread();
+			slot.statsId = id;
+		}
+
+		return *slot.counters;
+	}
+
+	ThreadCounters* registerThread();
+
+private:
+	/**	\brief Unique among all CacheStats ever created, so that a thread_local cache can't mix them up.
+	 */
+	uint64_t id;
+
+	mutable std::mutex mtx;
+	map<std::thread::id, std::unique_ptr<ThreadCounters> > threadCounters;
+	map<CString, int64_t> occupiedPerClass;
+	std::atomic<uint64_t> capacity;
+};
+
+#endif /* NXCOMMON_CACHESTATS_H_ */
@@ -0,0 +1,87 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_CACHESTATSJSON_H_
+#define NXCOMMON_CACHESTATSJSON_H_
+
+#include <nxcommon/config.h>
+#include "CacheStats.h"
+#include <rapidjson/writer.h>
+
+
+
+template <class Writer>
+void CacheStats::Snapshot::writeJSON(Writer& writer) const
+{
+	writer.StartObject();
+
+	writer.Key("hits");				writer.Uint64(getHits());
+	writer.Key("misses");			writer.Uint64(getMisses());
+	writer.Key("hitRatio");			writer.Double(getHitRatio());
+	writer.Key("inserts");			writer.Uint64(getInserts());
+	writer.Key("evictions");		writer.Uint64(getEvictions());
+	writer.Key("overfills");		writer.Uint64(getOverfills());
+	writer.Key("loads");			writer.Uint64(getLoads());
+	writer.Key("failedLoads");		writer.Uint64(getFailedLoads());
+	writer.Key("expirations");		writer.Uint64(getExpirations());
+	writer.Key("occupied");			writer.Int64(occupied);
+	writer.Key("capacity");			writer.Uint64(capacity);
+
+	writer.Key("occupiedPerClass");
+	writer.StartObject();
+	for (auto it = occupiedPerClass.begin() ; it != occupiedPerClass.end() ; it++) {
+		writer.Key(it->first.get(), (rapidjson::SizeType) it->first.length());
+		writer.Int64(it->second);
+	}
+	writer.EndObject();
+
+	writer.Key("loadLatencyNs");
+	writer.StartObject();
+	writer.Key("count");			writer.Uint64(loadLatency.getCount());
+	writer.Key("min");				writer.Uint64(loadLatency.getMin());
+	writer.Key("mean");				writer.Double(loadLatency.getMean());
+	writer.Key("p50");				writer.Uint64(loadLatency.getPercentile(50.0));
+	writer.Key("p90");				writer.Uint64(loadLatency.getPercentile(90.0));
+	writer.Key("p99");				writer.Uint64(loadLatency.getPercentile(99.0));
+	writer.Key("p999");				writer.Uint64(loadLatency.getPercentile(99.9));
+	writer.Key("max");				writer.Uint64(loadLatency.getMax());
+
+	// Only non-empty buckets, as [lowerBound, upperBound, count]
+	writer.Key("buckets");
+	writer.StartArray();
+	for (unsigned int i = 0 ; i < LatencyHistogram::BucketCount ; i++) {
+		if (loadLatency.getBucketCount(i) != 0) {
+			writer.StartArray();
+			writer.Uint64(LatencyHistogram::getBucketLowerBound(i));
+			writer.Uint64(LatencyHistogram::getBucketUpperBound(i));
+			writer.Uint64(loadLatency.getBucketCount(i));
+			writer.EndArray();
+		}
+	}
+	writer.EndArray();
+
+	writer.EndObject();
+
+	writer.EndObject();
+}
+
+#endif /* NXCOMMON_CACHESTATSJSON_H_ */
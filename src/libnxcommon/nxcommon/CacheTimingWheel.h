@@ -0,0 +1,261 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_CACHETIMINGWHEEL_H_
+#define NXCOMMON_CACHETIMINGWHEEL_H_
+
+#include <nxcommon/config.h>
+#include "nxcommon_stdint.h"
+#include <cstddef>
+
+
+
+
+/**	\brief A timer that can be scheduled in a CacheTimingWheel.
+ *
+ * 	The wheel links the timers intrusively, so scheduling and unscheduling never allocate.
+ */
+struct CacheTimerNode
+{
+	static const uint64_t NoDeadline = UINT64_MAX;
+
+	CacheTimerNode() : prev(NULL), next(NULL), deadline(NoDeadline), level(0) {}
+
+	bool hasDeadline() const { return deadline != NoDeadline; }
+	bool isScheduled() const { return next != NULL; }
+
+	CacheTimerNode* prev;
+	CacheTimerNode* next;
+
+	/**	\brief The tick at which the timer expires, or NoDeadline.
+	 */
+	uint64_t deadline;
+
+	uint8_t level;
+};
+
+
+/**	\brief A hierarchical timing wheel (Varghese & Lauck) for the expiry of cache entries.
+ *
+ * 	Time is measured in abstract ticks. The wheel has LevelCount levels of SlotCount slots each, where a slot
+ * 	of level L spans SlotCount^L ticks. A timer is put into the slot of the lowest level that can represent
+ * 	its distance to the current tick. Whenever the current tick crosses a slot boundary of a higher level, the
+ * 	timers of that slot are cascaded down into the lower levels. Scheduling, unscheduling and expiring a timer
+ * 	are therefore O(1), and advance() skips runs of empty slots instead of stepping through every tick.
+ *
+ * 	Timers further away than the span of the whole wheel are kept in the top level and re-cascaded until they
+ * 	are close enough.
+ */
+class CacheTimingWheel
+{
+public:
+	typedef CacheTimerNode Node;
+
+	static const unsigned int LevelBits = 6;
+	static const unsigned int SlotCount = 1 << LevelBits;
+	static const unsigned int LevelCount = 4;
+
+public:
+	CacheTimingWheel() : current(0), numTimers(0)
+	{
+		for (unsigned int l = 0 ; l < LevelCount ; l++) {
+			levelCounts[l] = 0;
+			for (unsigned int s = 0 ; s < SlotCount ; s++) {
+				slots[l][s].prev = &slots[l][s];
+				slots[l][s].next = &slots[l][s];
+			}
+		}
+	}
+
+	CacheTimingWheel(const CacheTimingWheel&) = delete;
+	CacheTimingWheel& operator=(const CacheTimingWheel&) = delete;
+
+	/**	\brief Returns the next tick to be processed by advance().
+	 */
+	uint64_t getCurrentTick() const { return current; }
+
+	size_t getTimerCount() const { return numTimers; }
+
+	/**	\brief Schedules a timer, or reschedules it if it already is.
+	 *
+	 * 	A deadline that is already in the past expires with the next call to advance().
+	 */
+	void schedule(Node* node, uint64_t deadline)
+	{
+		unschedule(node);
+		node->deadline = deadline;
+		link(node);
+		numTimers++;
+	}
+
+	/**	\brief Removes a timer from the wheel, if it is scheduled. Its deadline is kept.
+	 */
+	void unschedule(Node* node)
+	{
+		if (node->isScheduled()) {
+			unlink(node);
+			numTimers--;
+		}
+	}
+
+	/**	\brief Advances the wheel up to and including the given tick.
+	 *
+	 * 	expire(Node*) is called for every timer whose deadline is <= tick. The timer is unscheduled before the
+	 * 	call, and expire() may schedule or unschedule any timer, including the expired one.
+	 */
+	template <class ExpireFunc>
+	void advance(uint64_t tick, ExpireFunc expire);
+
+private:
+	void link(Node* node)
+	{
+		uint64_t deadline = node->deadline < current ? current : node->deadline;
+		uint64_t delta = deadline - current;
+
+		unsigned int level = 0;
+		while (level < LevelCount-1  &&  delta >= (1ULL << (LevelBits * (level+1)))) {
+			level++;
+		}
+
+		if (level == LevelCount-1) {
+			uint64_t maxDeadline = current + (1ULL << (LevelBits * LevelCount)) - 1;
+			if (deadline > maxDeadline) {
+				deadline = maxDeadline;
+			}
+		}
+
+		Node& head = slots[level][(deadline >> (LevelBits*level)) & (SlotCount-1)];
+		node->level = (uint8_t) level;
+		node->prev = &head;
+		node->next = head.next;
+		head.next->prev = node;
+		head.next = node;
+		levelCounts[level]++;
+	}
+
+	void unlink(Node* node)
+	{
+		node->prev->next = node->next;
+		node->next->prev = node->prev;
+		node->prev = NULL;
+		node->next = NULL;
+		levelCounts[node->level]--;
+	}
+
+	/**	\brief Moves all timers of a slot into a local list headed by out.
+	 *
+	 * 	The timers still count for their level until they are unlinked from the local list.
+	 */
+	void takeSlot(Node& slot, Node& out)
+	{
+		if (slot.next == &slot) {
+			out.prev = &out;
+			out.next = &out;
+		} else {
+			out.next = slot.next;
+			out.prev = slot.prev;
+			out.next->prev = &out;
+			out.prev->next = &out;
+			slot.prev = &slot;
+			slot.next = &slot;
+		}
+	}
+
+	void cascade()
+	{
+		// Higher levels first, so that timers cascaded from them into a lower level's current slot are cascaded
+		// further down right away.
+		for (unsigned int level = LevelCount-1 ; level > 0 ; level--) {
+			if ((current & ((1ULL << (LevelBits*level)) - 1)) != 0) {
+				continue;
+			}
+
+			Node list;
+			takeSlot(slots[level][(current >> (LevelBits*level)) & (SlotCount-1)], list);
+
+			while (list.next != &list) {
+				Node* node = list.next;
+				unlink(node);
+				link(node);
+			}
+		}
+	}
+
+private:
+	Node slots[LevelCount][SlotCount];
+	unsigned int levelCounts[LevelCount];
+	uint64_t current;
+	size_t numTimers;
+};
+
+
+
+
+template <class ExpireFunc>
+void CacheTimingWheel::advance(uint64_t tick, ExpireFunc expire)
+{
+	// Invariant: All ticks before current are processed, but the cascade for current itself is not done yet.
+	while (current <= tick) {
+		if (numTimers == 0) {
+			current = tick+1;
+			break;
+		}
+
+		if ((current & (SlotCount-1)) == 0) {
+			cascade();
+		}
+
+		unsigned int lowest = 0;
+		while (levelCounts[lowest] == 0) {
+			lowest++;
+		}
+
+		if (lowest != 0) {
+			// Nothing can expire before the next cascade of the lowest non-empty level.
+			uint64_t step = 1ULL << (LevelBits*lowest);
+			uint64_t next = (current | (step-1)) + 1;
+
+			if (next > tick) {
+				current = tick+1;
+				break;
+			}
+
+			current = next;
+			continue;
+		}
+
+		Node list;
+		takeSlot(slots[0][current & (SlotCount-1)], list);
+
+		// Timers scheduled by expire() for a past deadline go into the next tick's slot.
+		current++;
+
+		while (list.next != &list) {
+			Node* node = list.next;
+			unlink(node);
+			numTimers--;
+			expire(node);
+		}
+	}
+}
+
+#endif /* NXCOMMON_CACHETIMINGWHEEL_H_ */
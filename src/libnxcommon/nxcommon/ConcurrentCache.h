@@ -0,0 +1,466 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_CONCURRENTCACHE_H_
+#define NXCOMMON_CONCURRENTCACHE_H_
+
+#include <nxcommon/config.h>
+#include "Cache.h"
+#include "util.h"
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <limits>
+#include <algorithm>
+
+using std::unique_ptr;
+
+
+
+
+
+/**	\brief A thread-safe variant of Cache which splits its entries across independently locked shards.
+ *
+ * 	This class has the same interface and semantics as Cache (insert, remove, lock/unlock, overfilling), but
+ * 	it may be accessed by any number of threads in parallel. Keys are distributed across a fixed number of
+ * 	<i>shards</i> by their hash. Each shard has its own mutex and its own LRU list, so threads accessing keys
+ * 	in different shards never contend with each other.
+ *
+ * 	The capacity is a global budget shared by all shards: The occupied size is the sum of the sizes of all
+ * 	entries in all shards, and inserting an entry that does not fit makes room by removing entries from the
+ * 	shards. Each time room is needed, the whole excess is taken from a single shard (in that shard's LRU
+ * 	order), starting at a shard index that rotates with every call. Only if that shard can't free enough
+ * 	are the following shards visited. There is no global LRU list, so the evicted entries are only the
+ * 	least recently used ones <i>of their shard</i>, not of the whole cache. Over many evictions, the
+ * 	rotation spreads them evenly across all shards, but individual evictions may remove entries that are
+ * 	much more recent than others in the cache. Other eviction policies can be selected through the EvictionPolicy template parameter, just like for Cache.
+ * 	Each shard then runs its own instance of the policy.
+ *
+ * 	Because other threads might remove entries at any time, a value pointer returned by item() is only
+ * 	guaranteed to be valid as long as no other thread writes to the cache. To safely access values while
+ * 	other threads are using the cache, either lock the entry, or use visit(), which calls a function on the
+ * 	value while its shard is locked.
+ *
+ * 	Two concurrent insertions of the same key are resolved in favor of the first one. The value of the
+ * 	second one is deleted instantly and insert() returns false.
+ */
+template<class K, class V, class Compare = less<K>,
+		class MapHash = CXX11Hash<K>,
+		class KeyEqual = equal_to<K>,
+		template<class, class, class> class EvictionPolicy = LRUEvictionPolicy>
+class ConcurrentCache {
+public:
+	typedef unsigned int cachesize_t;
+
+private:
+	typedef Cache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy> ShardCache;
+
+	/**	\brief A single shard.
+	 *
+	 * 	The shard's Cache has an unlimited capacity, so it never removes entries by itself. All capacity
+	 * 	management is done by ConcurrentCache. The shard's eviction policy is sized for the shard's share of
+	 * 	the global capacity. Shards are aligned to cache lines to avoid false sharing between
+	 * 	the mutexes of neighboring shards.
+	 */
+	struct alignas(64) Shard
+	{
+		Shard() : cache(std::numeric_limits<cachesize_t>::max()) {}
+		std::mutex mtx;
+		ShardCache cache;
+	};
+
+public:
+	/**	\brief Creates a new, empty cache.
+	 *
+	 * 	@param capacity The capacity (maximum size) of the cache.
+	 * 	@param numShards The number of shards. It is rounded up to the next power of two. If 0, a default
+	 * 		based on the number of hardware threads is used.
+	 */
+	ConcurrentCache(cachesize_t capacity = 0, unsigned int numShards = 0);
+
+	/**	\brief Inserts a new entry into the cache.
+	 *
+	 * 	@see Cache::insert()
+	 */
+	bool insert(const K& key, V* value, cachesize_t size, bool locked = false);
+
+	/**	\brief Removes an entry from the cache.
+	 *
+	 * 	@see Cache::remove()
+	 */
+	bool remove(const K& key);
+
+	/**	\brief Returns the value of a cache entry.
+	 *
+	 * 	This also updates the last-used status of the accessed entry inside its shard. Note that unless the
+	 * 	entry is locked, the returned pointer may become invalid as soon as another thread writes to the cache.
+	 *
+	 * 	@param key The entry's key.
+	 * 	@return The entry's value if it was found, or NULL otherwise.
+	 * 	@see visit()
+	 */
+	V* item(const K& key);
+
+	/**	\brief Calls a function on the value of a cache entry while its shard is locked.
+	 *
+	 * 	This is the safe way of accessing unlocked entries while other threads use the cache. Like item(), it
+	 * 	updates the last-used status of the entry. The function must not call any methods of this cache.
+	 *
+	 * 	@param key The entry's key.
+	 * 	@param func A function taking a V& argument.
+	 * 	@return true if the entry was found and func was called, false otherwise.
+	 */
+	template <typename Func>
+	bool visit(const K& key, Func func);
+
+	/**	\brief Determines whether an entry with the given key is currently cached.
+	 *
+	 * 	@see Cache::contains()
+	 */
+	bool contains(const K& key) const;
+
+	/**	\brief Removes entries from the cache until it has the specified size.
+	 *
+	 * 	@see Cache::free()
+	 */
+	bool free(cachesize_t size) { return freeShards(size); }
+
+	/**	\brief Returns the value of a cache entry.
+	 *
+	 * 	This is a synonym for item().
+	 *
+	 * 	@see item()
+	 */
+	V* operator[](const K& key) { return item(key); }
+
+	/**	\brief Returns the current capacity of the cache.
+	 *
+	 * 	@return The capacity.
+	 */
+	cachesize_t getCapacity() const { return capacity.load(std::memory_order_relaxed); }
+
+	/**	\brief Returns the currently occupied size of the cache.
+	 *
+	 * 	This is the sum of the sizes of all cache entries in all shards.
+	 *
+	 * 	@return The occupied size.
+	 */
+	cachesize_t getOccupiedSize() const { return occupied.load(std::memory_order_relaxed); }
+
+	/**	\brief Determines whether the cache is overfilled.
+	 *
+	 * 	@return true if occupied size > capacity, false otherwise.
+	 */
+	bool isOverfilled() const { return getOccupiedSize() > getCapacity(); }
+
+	/**	\brief Removes all cache entries.
+	 *
+	 * 	This is a synonym for free(0).
+	 *
+	 * 	@see free()
+	 */
+	bool clear() { return free(0); }
+
+	/**	\brief Sets the new capacity of the cache.
+	 *
+	 * 	@see Cache::resize()
+	 */
+	void resize(cachesize_t capacity);
+
+	/**	\brief Sets the locked status of an entry.
+	 *
+	 * 	@see Cache::lock()
+	 */
+	V* lock(const K& key, bool locked = true);
+
+	/**	\brief Unlocks an entry in the cache.
+	 *
+	 * 	This is a synonym for lock(const K&, false).
+	 *
+	 * 	@see lock()
+	 */
+	V* unlock(const K& key) { return lock(key, false); }
+
+	/**	\brief Returns the number of shards.
+	 *
+	 * 	@return The number of shards.
+	 */
+	unsigned int getShardCount() const { return numShards; }
+
+private:
+	Shard& getShard(const K& key) const;
+
+	/**	\brief Removes least recently used entries from the shards until the occupied size is at most size.
+	 *
+	 * 	The whole excess is taken from the first shard, which is chosen by a cursor that advances on every
+	 * 	call. The next shards are only visited if that shard runs out of evictable entries. This spreads
+	 * 	evictions evenly across the shards over time, but a single call does not remove the globally least
+	 * 	recently used entries.
+	 */
+	bool freeShards(cachesize_t size);
+
+	/**	\brief Removes an entry from a shard whose mutex is already locked by the caller.
+	 */
+	bool removeLocked(Shard& shard, const K& key);
+
+	/**	\brief Sizes the eviction policies of all shards for their share of the given capacity.
+	 */
+	void updateShardPolicies(cachesize_t capacity);
+
+private:
+	unique_ptr<Shard[]> shards;
+	unsigned int numShards;
+	MapHash hash;
+	std::atomic<cachesize_t> capacity;
+	std::atomic<cachesize_t> occupied;
+	std::atomic<unsigned int> evictCursor;
+};
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+ConcurrentCache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::ConcurrentCache(cachesize_t capacity, unsigned int numShards)
+		: capacity(capacity), occupied(0), evictCursor(0)
+{
+	if (numShards == 0) {
+		numShards = std::max(std::thread::hardware_concurrency(), 1u) * 4;
+	}
+
+	this->numShards = GetNextPowerOfTwo(numShards);
+	shards = unique_ptr<Shard[]>(new Shard[this->numShards]);
+
+	updateShardPolicies(capacity);
+}
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+void ConcurrentCache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::updateShardPolicies(cachesize_t capacity)
+{
+	cachesize_t shardCapacity = std::max(capacity / numShards, 1u);
+
+	for (unsigned int i = 0 ; i < numShards ; i++) {
+		std::lock_guard<std::mutex> lock(shards[i].mtx);
+		shards[i].cache.getEvictionPolicy().setCapacity(shardCapacity);
+	}
+}
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+void ConcurrentCache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::resize(cachesize_t capacity)
+{
+	this->capacity.store(capacity, std::memory_order_relaxed);
+	updateShardPolicies(capacity);
+	free(capacity);
+}
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+typename ConcurrentCache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::Shard&
+ConcurrentCache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::getShard(const K& key) const
+{
+	// Many std::hash implementations are the identity for integers, so the low bits have to be mixed with the
+	// high bits before masking.
+	uint64_t h = (uint64_t) hash(key);
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+
+	return shards[(size_t) (h & (numShards-1))];
+}
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+bool ConcurrentCache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::insert(const K& key, V* value, cachesize_t size, bool locked)
+{
+	cachesize_t cap = getCapacity();
+
+	if (size > cap  &&  !locked) {
+		delete value;
+		return false;
+	}
+
+	Shard& shard = getShard(key);
+
+	{
+		// Like Cache, we replace an existing entry unless it is locked. It is removed before making room, so
+		// that a rejected insert doesn't evict anything, and so that its size counts as free space.
+		std::lock_guard<std::mutex> lock(shard.mtx);
+
+		if (shard.cache.contains(key)  &&  !removeLocked(shard, key)) {
+			delete value;
+			return false;
+		}
+	}
+
+	// Reserve the space before making room for it. If we only made room and added the size after the
+	// insert, concurrent inserts could all see the same free space and together overfill the cache.
+	occupied.fetch_add(size, std::memory_order_relaxed);
+
+	bool enoughLeft = freeShards(cap);
+	if (!enoughLeft  &&  !locked) {
+		occupied.fetch_sub(size, std::memory_order_relaxed);
+		delete value;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(shard.mtx);
+
+	// Another thread may have inserted the same key in the meantime
+	if (shard.cache.contains(key)  &&  !removeLocked(shard, key)) {
+		occupied.fetch_sub(size, std::memory_order_relaxed);
+		delete value;
+		return false;
+	}
+
+	shard.cache.insert(key, value, size, locked);
+
+	return true;
+}
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+bool ConcurrentCache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::removeLocked(Shard& shard, const K& key)
+{
+	cachesize_t before = shard.cache.getOccupiedSize();
+
+	if (!shard.cache.remove(key)) {
+		return false;
+	}
+
+	occupied.fetch_sub(before - shard.cache.getOccupiedSize(), std::memory_order_relaxed);
+	return true;
+}
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+bool ConcurrentCache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::remove(const K& key)
+{
+	Shard& shard = getShard(key);
+	std::lock_guard<std::mutex> lock(shard.mtx);
+	return removeLocked(shard, key);
+}
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+V* ConcurrentCache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::item(const K& key)
+{
+	Shard& shard = getShard(key);
+	std::lock_guard<std::mutex> lock(shard.mtx);
+	return shard.cache.item(key);
+}
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+template <typename Func>
+bool ConcurrentCache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::visit(const K& key, Func func)
+{
+	Shard& shard = getShard(key);
+	std::lock_guard<std::mutex> lock(shard.mtx);
+
+	V* value = shard.cache.item(key);
+
+	if (!value) {
+		return false;
+	}
+
+	func(*value);
+	return true;
+}
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+bool ConcurrentCache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::contains(const K& key) const
+{
+	Shard& shard = getShard(key);
+	std::lock_guard<std::mutex> lock(shard.mtx);
+	return shard.cache.contains(key);
+}
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+bool ConcurrentCache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::freeShards(cachesize_t size)
+{
+	unsigned int start = evictCursor.fetch_add(1, std::memory_order_relaxed);
+
+	for (unsigned int i = 0 ; i < numShards  &&  getOccupiedSize() > size ; i++) {
+		Shard& shard = shards[(start+i) & (numShards-1)];
+		std::lock_guard<std::mutex> lock(shard.mtx);
+
+		cachesize_t cur = getOccupiedSize();
+		if (cur <= size) {
+			break;
+		}
+
+		cachesize_t excess = cur - size;
+		cachesize_t shardBefore = shard.cache.getOccupiedSize();
+
+		shard.cache.free(excess >= shardBefore ? 0 : shardBefore - excess);
+		occupied.fetch_sub(shardBefore - shard.cache.getOccupiedSize(), std::memory_order_relaxed);
+	}
+
+	return getOccupiedSize() <= size;
+}
+
+
+template<class K, class V, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+V* ConcurrentCache<K, V, Compare, MapHash, KeyEqual, EvictionPolicy>::lock(const K& key, bool locked)
+{
+	Shard& shard = getShard(key);
+
+	{
+		std::lock_guard<std::mutex> lock(shard.mtx);
+
+		bool wasOverfilled = isOverfilled();
+
+		// The shard's capacity is unlimited, so this will never remove anything.
+		V* value = shard.cache.lock(key, locked);
+
+		if (!value) {
+			return NULL;
+		}
+
+		if (locked  ||  !wasOverfilled) {
+			return value;
+		}
+
+		// If an entry is unlocked in an overfilled cache, it is deleted instantly.
+		removeLocked(shard, key);
+	}
+
+	freeShards(getCapacity());
+
+	return NULL;
+}
+
+#endif /* NXCOMMON_CONCURRENTCACHE_H_ */
@@ -0,0 +1,515 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "DiskCache.h"
+#include "CRC32.h"
+#include "stream/IOException.h"
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#ifdef _POSIX_VERSION
+#include <sys/mman.h>
+#endif
+
+using std::vector;
+
+
+
+namespace
+{
+
+const char DiskCacheMagic[4] = { 'N', 'X', 'D', 'C' };
+const uint32_t DiskCacheVersion = 1;
+
+// Marks a record which removes its key
+const uint32_t TombstoneValueSize = 0xFFFFFFFF;
+
+
+struct FileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t reserved;
+};
+
+
+struct RecordHeader
+{
+	uint32_t keySize;
+	uint32_t valueSize;
+	uint32_t checksum;
+	uint32_t reserved;
+};
+
+
+uint32_t RecordChecksum(const RecordHeader& header, const uint8_t* key, const uint8_t* value)
+{
+	CRC32 crc;
+	crc.append((const char*) &header.keySize, sizeof(header.keySize));
+	crc.append((const char*) &header.valueSize, sizeof(header.valueSize));
+	crc.append((const char*) key, header.keySize);
+
+	if (header.valueSize != TombstoneValueSize) {
+		crc.append((const char*) value, header.valueSize);
+	}
+
+	return crc.getChecksum();
+}
+
+
+uint64_t RecordSize(uint64_t keySize, uint64_t valueSize)
+{
+	return sizeof(RecordHeader) + keySize + valueSize;
+}
+
+
+bool SeekFile(FILE* file, uint64_t offset)
+{
+#ifdef _WIN32
+	return _fseeki64(file, (__int64) offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, (off_t) offset, SEEK_SET) == 0;
+#endif
+}
+
+}
+
+
+
+
+DiskCache::DiskCache(const CString& path, uint64_t maxSize)
+		: path(path), maxSize(std::max(maxSize, (uint64_t) sizeof(FileHeader))), file(NULL), fileSize(0),
+		  liveSize(0), mapping(NULL), mappingSize(0)
+{
+	open();
+}
+
+
+DiskCache::~DiskCache()
+{
+	close();
+}
+
+
+void DiskCache::open()
+{
+	file = fopen(path.get(), "r+b");
+
+	if (!file) {
+		file = fopen(path.get(), "w+b");
+
+		if (!file) {
+			throw IOException(CString("Unable to open disk cache file ").append(path), __FILE__, __LINE__);
+		}
+	}
+
+	fseek(file, 0, SEEK_END);
+	fileSize = (uint64_t) ftell(file);
+
+	scan();
+}
+
+
+void DiskCache::close()
+{
+	unmap();
+
+	if (file) {
+		fclose(file);
+		file = NULL;
+	}
+}
+
+
+void DiskCache::scan()
+{
+	index.clear();
+	liveSize = 0;
+
+	remap();
+
+	FileHeader fheader;
+	bool valid = fileSize >= sizeof(FileHeader);
+
+	if (valid) {
+		read(0, &fheader, sizeof(fheader));
+		valid = memcmp(fheader.magic, DiskCacheMagic, sizeof(DiskCacheMagic)) == 0
+				&&  fheader.version == DiskCacheVersion;
+	}
+
+	if (!valid) {
+		// Empty or foreign file: Start over.
+		unmap();
+
+		fclose(file);
+		file = fopen(path.get(), "w+b");
+
+		if (!file) {
+			throw IOException(CString("Unable to create disk cache file ").append(path), __FILE__, __LINE__);
+		}
+
+		memset(&fheader, 0, sizeof(fheader));
+		memcpy(fheader.magic, DiskCacheMagic, sizeof(DiskCacheMagic));
+		fheader.version = DiskCacheVersion;
+
+		if (fwrite(&fheader, sizeof(fheader), 1, file) != 1  ||  fflush(file) != 0) {
+			throw IOException(CString("Error writing disk cache file ").append(path), __FILE__, __LINE__);
+		}
+
+		fileSize = sizeof(fheader);
+		remap();
+		return;
+	}
+
+	uint64_t offset = sizeof(FileHeader);
+	vector<uint8_t> buf;
+
+	while (offset + sizeof(RecordHeader) <= fileSize) {
+		RecordHeader rheader;
+		read(offset, &rheader, sizeof(rheader));
+
+		bool tombstone = rheader.valueSize == TombstoneValueSize;
+		uint64_t recSize = RecordSize(rheader.keySize, tombstone ? 0 : rheader.valueSize);
+
+		if (offset + recSize > fileSize) {
+			break;
+		}
+
+		buf.resize(recSize - sizeof(RecordHeader));
+		read(offset + sizeof(RecordHeader), buf.data(), buf.size());
+
+		if (RecordChecksum(rheader, buf.data(), buf.data() + rheader.keySize) != rheader.checksum) {
+			break;
+		}
+
+		std::string key((const char*) buf.data(), rheader.keySize);
+		Index::iterator it = index.find(key);
+
+		if (it != index.end()) {
+			liveSize -= RecordSize(it->second.keySize, it->second.valueSize);
+			index.erase(it);
+		}
+
+		if (!tombstone) {
+			Record& rec = index[key];
+			rec.offset = offset;
+			rec.keySize = rheader.keySize;
+			rec.valueSize = rheader.valueSize;
+			liveSize += recSize;
+		}
+
+		offset += recSize;
+	}
+
+	if (offset != fileSize) {
+		// Cut off or corrupt tail, probably from an interrupted write. Just overwrite it from now on.
+		fileSize = offset;
+	}
+}
+
+
+void DiskCache::read(uint64_t offset, void* buf, size_t size)
+{
+	if (mapping  &&  offset + size <= mappingSize) {
+		memcpy(buf, mapping + offset, size);
+		return;
+	}
+
+	if (!SeekFile(file, offset)  ||  fread(buf, 1, size, file) != size) {
+		throw IOException(CString("Error reading disk cache file ").append(path), __FILE__, __LINE__);
+	}
+}
+
+
+void DiskCache::unmap()
+{
+#ifdef _POSIX_VERSION
+	if (mapping) {
+		munmap((void*) mapping, (size_t) mappingSize);
+	}
+#endif
+
+	mapping = NULL;
+	mappingSize = 0;
+}
+
+
+void DiskCache::remap()
+{
+	unmap();
+
+#ifdef _POSIX_VERSION
+	if (fileSize != 0) {
+		void* addr = mmap(NULL, (size_t) fileSize, PROT_READ, MAP_SHARED, fileno(file), 0);
+
+		if (addr != MAP_FAILED) {
+			mapping = (const uint8_t*) addr;
+			mappingSize = fileSize;
+		}
+	}
+#endif
+
+	// Without a mapping, read() falls back to stdio.
+}
+
+
+void DiskCache::appendRecord(const std::string& key, const uint8_t* value, uint32_t valueSize, bool tombstone)
+{
+	RecordHeader rheader;
+	rheader.keySize = (uint32_t) key.size();
+	rheader.valueSize = tombstone ? TombstoneValueSize : valueSize;
+	rheader.reserved = 0;
+	rheader.checksum = RecordChecksum(rheader, (const uint8_t*) key.data(), value);
+
+	bool ok = SeekFile(file, fileSize)
+			&&  fwrite(&rheader, sizeof(rheader), 1, file) == 1
+			&&  fwrite(key.data(), 1, key.size(), file) == key.size()
+			&&  (tombstone  ||  fwrite(value, 1, valueSize, file) == valueSize)
+			&&  fflush(file) == 0;
+
+	if (!ok) {
+		throw IOException(CString("Error writing disk cache file ").append(path), __FILE__, __LINE__);
+	}
+
+	fileSize += RecordSize(key.size(), tombstone ? 0 : valueSize);
+}
+
+
+bool DiskCache::put(const ByteArray& key, const ByteArray& value)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	std::string skey((const char*) key.get(), key.length());
+	uint64_t recSize = RecordSize(key.length(), value.length());
+
+	if (value.length() >= TombstoneValueSize  ||  sizeof(FileHeader) + recSize > maxSize) {
+		return false;
+	}
+
+	if (fileSize + recSize > maxSize) {
+		compact(maxSize/4*3 > recSize ? maxSize/4*3 - recSize : 0);
+	}
+
+	uint64_t offset = fileSize;
+	appendRecord(skey, value.get(), (uint32_t) value.length(), false);
+
+	Record& rec = index[skey];
+
+	if (rec.offset != 0) {
+		liveSize -= RecordSize(rec.keySize, rec.valueSize);
+	}
+
+	rec.offset = offset;
+	rec.keySize = (uint32_t) key.length();
+	rec.valueSize = (uint32_t) value.length();
+	liveSize += recSize;
+
+	return true;
+}
+
+
+bool DiskCache::get(const ByteArray& key, ByteArray& value)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	Index::iterator it = index.find(std::string((const char*) key.get(), key.length()));
+
+	if (it == index.end()) {
+		return false;
+	}
+
+	const Record& rec = it->second;
+
+	if (rec.offset + RecordSize(rec.keySize, rec.valueSize) > mappingSize
+			&&  fileSize - mappingSize >= fileSize/4) {
+		// Enough was appended since the last mapping was made that it should be renewed. Smaller tails are
+		// read with stdio to avoid remapping on every put().
+		remap();
+	}
+
+	ByteArray data(rec.valueSize);
+	data.resize(rec.valueSize);
+	read(rec.offset + sizeof(RecordHeader) + rec.keySize, data.mget(), rec.valueSize);
+	value = data;
+
+	return true;
+}
+
+
+bool DiskCache::contains(const ByteArray& key) const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return index.find(std::string((const char*) key.get(), key.length())) != index.end();
+}
+
+
+bool DiskCache::remove(const ByteArray& key)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	std::string skey((const char*) key.get(), key.length());
+	Index::iterator it = index.find(skey);
+
+	if (it == index.end()) {
+		return false;
+	}
+
+	liveSize -= RecordSize(it->second.keySize, it->second.valueSize);
+	index.erase(it);
+
+	uint64_t recSize = RecordSize(skey.size(), 0);
+
+	if (fileSize + recSize > maxSize) {
+		// The compacted file won't contain the old record anymore, so no tombstone needed.
+		compact(maxSize/4*3);
+	} else {
+		appendRecord(skey, NULL, 0, true);
+	}
+
+	return true;
+}
+
+
+void DiskCache::compact()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	compact(maxSize);
+}
+
+
+void DiskCache::compact(uint64_t targetSize)
+{
+	// Keep the newest records, which are the ones most likely to be needed again.
+	vector<Index::iterator> records;
+	records.reserve(index.size());
+
+	for (Index::iterator it = index.begin() ; it != index.end() ; it++) {
+		records.push_back(it);
+	}
+
+	std::sort(records.begin(), records.end(), [](const Index::iterator& a, const Index::iterator& b) {
+		return a->second.offset > b->second.offset;
+	});
+
+	uint64_t keptSize = sizeof(FileHeader);
+	size_t numKept = 0;
+
+	for (; numKept < records.size() ; numKept++) {
+		const Record& rec = records[numKept]->second;
+		uint64_t recSize = RecordSize(rec.keySize, rec.valueSize);
+
+		if (keptSize + recSize > targetSize) {
+			break;
+		}
+
+		keptSize += recSize;
+	}
+
+	// Write them in their original order
+	std::reverse(records.begin(), records.begin() + numKept);
+
+	remap();
+
+	CString tmpPath = CString(path).append(".compact");
+	FILE* tmpFile = fopen(tmpPath.get(), "wb");
+
+	if (!tmpFile) {
+		throw IOException(CString("Unable to create disk cache file ").append(tmpPath), __FILE__, __LINE__);
+	}
+
+	FileHeader fheader;
+	memset(&fheader, 0, sizeof(fheader));
+	memcpy(fheader.magic, DiskCacheMagic, sizeof(DiskCacheMagic));
+	fheader.version = DiskCacheVersion;
+
+	bool ok = fwrite(&fheader, sizeof(fheader), 1, tmpFile) == 1;
+
+	vector<uint8_t> buf;
+	uint64_t offset = sizeof(FileHeader);
+
+	for (size_t i = 0 ; ok  &&  i < numKept ; i++) {
+		Record& rec = records[i]->second;
+		buf.resize(RecordSize(rec.keySize, rec.valueSize));
+		read(rec.offset, buf.data(), buf.size());
+		ok = fwrite(buf.data(), 1, buf.size(), tmpFile) == buf.size();
+		rec.offset = offset;
+		offset += buf.size();
+	}
+
+	ok = fflush(tmpFile) == 0  &&  ok;
+	fclose(tmpFile);
+
+	if (!ok) {
+		::remove(tmpPath.get());
+		close();
+		open();
+		throw IOException(CString("Error writing disk cache file ").append(tmpPath), __FILE__, __LINE__);
+	}
+
+	close();
+
+#ifdef _WIN32
+	// rename() does not replace existing files on Windows
+	::remove(path.get());
+#endif
+
+	if (rename(tmpPath.get(), path.get()) != 0) {
+		open();
+		throw IOException(CString("Error replacing disk cache file ").append(path), __FILE__, __LINE__);
+	}
+
+	for (size_t i = numKept ; i < records.size() ; i++) {
+		index.erase(records[i]);
+	}
+
+	file = fopen(path.get(), "r+b");
+
+	if (!file) {
+		throw IOException(CString("Unable to open disk cache file ").append(path), __FILE__, __LINE__);
+	}
+
+	fileSize = offset;
+	liveSize = offset - sizeof(FileHeader);
+	remap();
+}
+
+
+size_t DiskCache::getEntryCount() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return index.size();
+}
+
+
+uint64_t DiskCache::getFileSize() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return fileSize;
+}
+
+
+uint64_t DiskCache::getLiveSize() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return liveSize;
+}
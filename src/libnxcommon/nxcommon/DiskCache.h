@@ -0,0 +1,189 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_DISKCACHE_H_
+#define NXCOMMON_DISKCACHE_H_
+
+#include <nxcommon/config.h>
+#include "CString.h"
+#include "ByteArray.h"
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <type_traits>
+#include <stdint.h>
+
+using std::unordered_map;
+
+
+
+/**	\brief A persistent key-value store in a single file, used as a second cache tier on local disk.
+ *
+ * 	Records are only ever appended to the file. Overwriting or removing a key appends a new record (or a
+ * 	removal marker) and leaves the old one behind as garbage. An in-memory index maps each key to its
+ * 	newest record, and is rebuilt by scanning the file when it is opened. Records are checksummed, so a
+ * 	file that was cut off in the middle of a write (e.g. by a crash) is simply truncated to the last
+ * 	complete record.
+ *
+ * 	The file is bounded by a maximum size. When appending a record would exceed it, the file is compacted:
+ * 	The newest live records are copied to a new file until it is three quarters full, and everything else
+ * 	is dropped. Because of this, a DiskCache can lose entries at any time and must only be used for data
+ * 	that can be recreated.
+ *
+ * 	Where available, records are read from a memory mapping of the file. The file format uses native byte
+ * 	order and is not meant to be portable between machines.
+ *
+ * 	All methods are thread-safe.
+ */
+class DiskCache
+{
+public:
+	/**	\brief Opens or creates a cache file.
+	 *
+	 * 	If the file exists but is not a valid cache file, it is overwritten.
+	 *
+	 * 	@param path The file path.
+	 * 	@param maxSize The maximum size of the file in bytes.
+	 * 	@throw IOException If the file can't be opened or created.
+	 */
+	DiskCache(const CString& path, uint64_t maxSize);
+
+	~DiskCache();
+
+	DiskCache(const DiskCache&) = delete;
+	DiskCache& operator=(const DiskCache&) = delete;
+
+	/**	\brief Stores a value, replacing any previous value for the same key.
+	 *
+	 * 	@param key The key.
+	 * 	@param value The value.
+	 * 	@return true if the value was stored, false if it is too large for the maximum file size.
+	 * 	@throw IOException If writing fails.
+	 */
+	bool put(const ByteArray& key, const ByteArray& value);
+
+	/**	\brief Looks up a value.
+	 *
+	 * 	@param key The key.
+	 * 	@param value Receives a copy of the value if found.
+	 * 	@return true if the key was found.
+	 */
+	bool get(const ByteArray& key, ByteArray& value);
+
+	/**	\brief Determines whether a value is stored for the given key.
+	 */
+	bool contains(const ByteArray& key) const;
+
+	/**	\brief Removes the value for a key.
+	 *
+	 * 	@param key The key.
+	 * 	@return true if the key was found.
+	 * 	@throw IOException If writing fails.
+	 */
+	bool remove(const ByteArray& key);
+
+	/**	\brief Rewrites the file, dropping all records that are no longer live.
+	 *
+	 * 	@throw IOException If writing fails.
+	 */
+	void compact();
+
+	/**	\brief Returns the number of live records.
+	 */
+	size_t getEntryCount() const;
+
+	/**	\brief Returns the current size of the file in bytes, including garbage.
+	 */
+	uint64_t getFileSize() const;
+
+	/**	\brief Returns the total size of all live records in bytes.
+	 */
+	uint64_t getLiveSize() const;
+
+	uint64_t getMaximumSize() const { return maxSize; }
+
+private:
+	struct Record
+	{
+		uint64_t offset;
+		uint32_t keySize;
+		uint32_t valueSize;
+	};
+
+	typedef unordered_map<std::string, Record> Index;
+
+private:
+	void open();
+	void close();
+	void scan();
+	void appendRecord(const std::string& key, const uint8_t* value, uint32_t valueSize, bool tombstone);
+	void compact(uint64_t targetSize);
+	void read(uint64_t offset, void* buf, size_t size);
+	void unmap();
+	void remap();
+
+private:
+	CString path;
+	uint64_t maxSize;
+	FILE* file;
+	uint64_t fileSize;
+	uint64_t liveSize;
+	Index index;
+
+	const uint8_t* mapping;
+	uint64_t mappingSize;
+
+	mutable std::mutex mtx;
+};
+
+
+
+/**	\brief Converts a key to the byte string used to store it in a DiskCache.
+ *
+ * 	The generic version copies the bytes of trivially copyable types. Specializations exist for CString and
+ * 	ByteArray. Other key types have to provide their own specialization or conversion function.
+ */
+template <class K>
+struct DiskCacheKeySerializer
+{
+	ByteArray operator()(const K& key) const
+	{
+		static_assert(std::is_trivially_copyable<K>::value,
+				"DiskCacheKeySerializer needs to be specialized for this key type");
+		return ByteArray((const uint8_t*) &key, sizeof(K));
+	}
+};
+
+template <>
+struct DiskCacheKeySerializer<CString>
+{
+	ByteArray operator()(const CString& key) const { return ByteArray((const uint8_t*) key.get(), key.length()); }
+};
+
+template <>
+struct DiskCacheKeySerializer<ByteArray>
+{
+	ByteArray operator()(const ByteArray& key) const { return key; }
+};
+
+#endif /* NXCOMMON_DISKCACHE_H_ */
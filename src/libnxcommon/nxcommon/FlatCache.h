@@ -0,0 +1,582 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_FLATCACHE_H_
+#define NXCOMMON_FLATCACHE_H_
+
+#include <nxcommon/config.h>
+#include "cxx11hash.h"
+#include <vector>
+#include <memory>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <cstdio>
+#include <stdint.h>
+
+using std::vector;
+using std::equal_to;
+
+
+
+
+/**	\brief An LRU cache with the same interface as Cache, but a flat, allocation-free memory layout.
+ *
+ * 	Cache stores every entry in a node of an unordered_map, links the LRU list through those nodes and keeps
+ * 	each value in a separate heap allocation. For many small entries, this means lots of allocations and
+ * 	pointer chasing. FlatCache instead keeps all entries in an array of slots, which is allocated in large
+ * 	chunks and never moved, so entry pointers stay valid just like with Cache. The LRU list is linked by
+ * 	32-bit slot indices, and unused slots are recycled through a free list. Lookups go through an
+ * 	open-addressing hash table with linear probing, which stores only a slot index and part of the hash for
+ * 	each bucket, so that most mismatches are rejected without touching the slot.
+ *
+ * 	If InlineValues is true, values are stored by value inside the slots instead of through a pointer. In
+ * 	this case, no allocation at all is done per entry. Values passed to insert() as pointers are moved into
+ * 	the slot and the pointer is deleted; emplace() avoids the temporary allocation. This is meant for small,
+ * 	cheaply movable V.
+ *
+ * 	The semantics of capacity, entry sizes, locking and overfilling are the same as for Cache. The only
+ * 	eviction policy is LRU. Inserting a key which is already cached replaces the old entry, unless it is
+ * 	locked.
+ *
+ * 	FlatCache supports at most 2^32-2 entries.
+ */
+template<class K, class V, class MapHash = CXX11Hash<K>, class KeyEqual = equal_to<K>, bool InlineValues = false>
+class FlatCache {
+public:
+	typedef unsigned int cachesize_t;
+	typedef std::function<void (const K&, V*)> EvictionHandler;
+
+private:
+	typedef uint32_t Index;
+
+	static constexpr Index NoIndex = 0xFFFFFFFF;
+
+	// Slots are allocated in chunks of this many entries.
+	static constexpr unsigned int ChunkBits = 10;
+	static constexpr Index ChunkSize = 1 << ChunkBits;
+
+	typedef typename std::conditional<InlineValues,
+			typename std::aligned_storage<sizeof(V), alignof(V)>::type,
+			V*>::type ValueStorage;
+
+	struct Slot
+	{
+		typename std::aligned_storage<sizeof(K), alignof(K)>::type keyData;
+		ValueStorage valueData;
+		cachesize_t cost;
+
+		/**	\brief LRU neighbours. For unused slots, next is the next free slot.
+		 */
+		Index prev;
+		Index next;
+
+		bool locked;
+
+		K& key() { return *reinterpret_cast<K*>(&keyData); }
+
+		V* value()
+		{
+			if constexpr (InlineValues) {
+				return reinterpret_cast<V*>(&valueData);
+			} else {
+				return valueData;
+			}
+		}
+	};
+
+	struct Bucket
+	{
+		Index slot;
+		uint32_t hash;
+	};
+
+public:
+	/**	\brief Creates a new, empty cache.
+	 *
+	 * 	@param capacity The capacity (maximum size) of the cache.
+	 */
+	FlatCache(cachesize_t capacity = 0);
+
+	/**	\brief Deletes the cache and all its content.
+	 *
+	 * 	Like for Cache, all entries should be unlocked before. Values of locked entries are not deleted
+	 * 	(unless they are stored inline).
+	 */
+	~FlatCache();
+
+	FlatCache(const FlatCache&) = delete;
+	FlatCache& operator=(const FlatCache&) = delete;
+
+	/**	\brief Inserts a new entry into the cache.
+	 *
+	 * 	@param key The entry's key.
+	 * 	@param value A pointer to the entry's value. Ownership of it is taken.
+	 * 	@param size The size of the new entry.
+	 * 	@param locked Whether the entry should be stored in locked state.
+	 * 	@return true when the entry was successfully inserted, false otherwise.
+	 * 	@see Cache::insert()
+	 */
+	bool insert(const K& key, V* value, cachesize_t size, bool locked = false);
+
+	/**	\brief Inserts a new entry, moving the value into the cache.
+	 *
+	 * 	This is the same as insert(), except for how the value is passed. With InlineValues, it does not
+	 * 	allocate.
+	 */
+	bool emplace(const K& key, V&& value, cachesize_t size, bool locked = false);
+
+	/**	\brief Removes an entry from the cache.
+	 *
+	 * 	@param key The entry's key.
+	 * 	@return true if the entry was removed, false if it was not found or is locked.
+	 */
+	bool remove(const K& key);
+
+	/**	\brief Returns the value of a cache entry and marks it as most recently used.
+	 *
+	 * 	@param key The entry's key.
+	 * 	@return The entry's value if it was found, or NULL otherwise.
+	 */
+	V* item(const K& key);
+
+	V* operator[](const K& key) { return item(key); }
+
+	/**	\brief Determines whether an entry is cached, without updating its last-used status.
+	 */
+	bool contains(const K& key) const { return findBucket(key, hashKey(key)) != NoIndex; }
+
+	/**	\brief Removes least recently used, unlocked entries until the occupied size is at most size.
+	 *
+	 * 	@return true if enough space was freed, false otherwise.
+	 * 	@see Cache::free()
+	 */
+	bool free(cachesize_t size);
+
+	bool clear() { return free(0); }
+
+	cachesize_t getCapacity() const { return capacity; }
+	cachesize_t getOccupiedSize() const { return occupied; }
+	bool isOverfilled() const { return occupied > capacity; }
+
+	/**	\brief Returns the number of cached entries.
+	 */
+	size_t getEntryCount() const { return numEntries; }
+
+	void resize(cachesize_t capacity) { free(capacity); this->capacity = capacity; }
+
+	/**	\brief Sets the locked status of an entry.
+	 *
+	 * 	@see Cache::lock()
+	 */
+	V* lock(const K& key, bool locked = true);
+
+	V* unlock(const K& key) { return lock(key, false); }
+
+	/**	\brief Sets a function to be called when an entry is evicted.
+	 *
+	 * 	@see Cache::setEvictionHandler()
+	 */
+	void setEvictionHandler(const EvictionHandler& handler) { evictionHandler = handler; }
+
+private:
+	Slot& slot(Index idx) const { return chunks[idx >> ChunkBits][idx & (ChunkSize-1)]; }
+
+	uint32_t hashKey(const K& key) const;
+	Index findBucket(const K& key, uint32_t hash) const;
+	Index allocateSlot();
+	void growTable();
+	bool prepareInsert(const K& key, cachesize_t size, bool locked);
+	template <class ValueInit> void doInsert(const K& key, cachesize_t size, bool locked, ValueInit init);
+	bool removeBucket(Index bucketIdx, bool evicted = false);
+	void unlink(Index idx);
+	void pushFront(Index idx);
+
+private:
+	vector<std::unique_ptr<Slot[]> > chunks;
+	Index numSlots;
+	Index freeList;
+
+	vector<Bucket> buckets;
+	size_t numEntries;
+
+	Index lruHead;
+	Index lruTail;
+
+	cachesize_t capacity;
+	cachesize_t occupied;
+	EvictionHandler evictionHandler;
+};
+
+
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+FlatCache<K, V, MapHash, KeyEqual, InlineValues>::FlatCache(cachesize_t capacity)
+		: numSlots(0), freeList(NoIndex), buckets(16, Bucket { NoIndex, 0 }), numEntries(0),
+		  lruHead(NoIndex), lruTail(NoIndex), capacity(capacity), occupied(0)
+{
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+FlatCache<K, V, MapHash, KeyEqual, InlineValues>::~FlatCache()
+{
+	if (!clear()) {
+		fprintf(stderr, "Cache entries are still locked upon destruction!\n");
+	}
+
+	for (Index idx = lruHead ; idx != NoIndex ; idx = slot(idx).next) {
+		Slot& s = slot(idx);
+		s.key().~K();
+
+		if constexpr (InlineValues) {
+			s.value()->~V();
+		}
+	}
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+uint32_t FlatCache<K, V, MapHash, KeyEqual, InlineValues>::hashKey(const K& key) const
+{
+	// Many std::hash implementations are the identity for integers, so mix the bits to make linear probing
+	// work with sequential keys.
+	uint64_t h = (uint64_t) MapHash()(key);
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	return (uint32_t) h;
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+typename FlatCache<K, V, MapHash, KeyEqual, InlineValues>::Index
+FlatCache<K, V, MapHash, KeyEqual, InlineValues>::findBucket(const K& key, uint32_t hash) const
+{
+	Index mask = (Index) buckets.size() - 1;
+
+	for (Index i = hash & mask ; ; i = (i+1) & mask) {
+		const Bucket& b = buckets[i];
+
+		if (b.slot == NoIndex) {
+			return NoIndex;
+		}
+		if (b.hash == hash  &&  KeyEqual()(slot(b.slot).key(), key)) {
+			return i;
+		}
+	}
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+typename FlatCache<K, V, MapHash, KeyEqual, InlineValues>::Index
+FlatCache<K, V, MapHash, KeyEqual, InlineValues>::allocateSlot()
+{
+	if (freeList != NoIndex) {
+		Index idx = freeList;
+		freeList = slot(idx).next;
+		return idx;
+	}
+
+	if ((numSlots & (ChunkSize-1)) == 0) {
+		chunks.emplace_back(new Slot[ChunkSize]);
+	}
+
+	return numSlots++;
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+void FlatCache<K, V, MapHash, KeyEqual, InlineValues>::growTable()
+{
+	vector<Bucket> oldBuckets(buckets.size()*2, Bucket { NoIndex, 0 });
+	oldBuckets.swap(buckets);
+
+	Index mask = (Index) buckets.size() - 1;
+
+	for (const Bucket& b : oldBuckets) {
+		if (b.slot != NoIndex) {
+			Index i = b.hash & mask;
+			while (buckets[i].slot != NoIndex) {
+				i = (i+1) & mask;
+			}
+			buckets[i] = b;
+		}
+	}
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+void FlatCache<K, V, MapHash, KeyEqual, InlineValues>::unlink(Index idx)
+{
+	Slot& s = slot(idx);
+
+	if (s.prev != NoIndex) {
+		slot(s.prev).next = s.next;
+	} else {
+		lruHead = s.next;
+	}
+
+	if (s.next != NoIndex) {
+		slot(s.next).prev = s.prev;
+	} else {
+		lruTail = s.prev;
+	}
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+void FlatCache<K, V, MapHash, KeyEqual, InlineValues>::pushFront(Index idx)
+{
+	Slot& s = slot(idx);
+	s.prev = NoIndex;
+	s.next = lruHead;
+
+	if (lruHead != NoIndex) {
+		slot(lruHead).prev = idx;
+	} else {
+		lruTail = idx;
+	}
+
+	lruHead = idx;
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+bool FlatCache<K, V, MapHash, KeyEqual, InlineValues>::removeBucket(Index bucketIdx, bool evicted)
+{
+	Index idx = buckets[bucketIdx].slot;
+	Slot& s = slot(idx);
+
+	if (s.locked) {
+		return false;
+	}
+
+	unlink(idx);
+	occupied -= s.cost;
+	numEntries--;
+
+	if (evicted  &&  evictionHandler) {
+		evictionHandler(s.key(), s.value());
+	}
+
+	if constexpr (InlineValues) {
+		s.value()->~V();
+	} else {
+		delete s.valueData;
+	}
+
+	s.key().~K();
+	s.next = freeList;
+	freeList = idx;
+
+	// Backward-shift deletion, so that no tombstones are needed
+	Index mask = (Index) buckets.size() - 1;
+	Index hole = bucketIdx;
+
+	for (Index i = (hole+1) & mask ; buckets[i].slot != NoIndex ; i = (i+1) & mask) {
+		Index home = buckets[i].hash & mask;
+
+		// Move the bucket into the hole if its home position is not in (hole, i] (cyclically).
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			buckets[hole] = buckets[i];
+			hole = i;
+		}
+	}
+
+	buckets[hole].slot = NoIndex;
+
+	return true;
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+bool FlatCache<K, V, MapHash, KeyEqual, InlineValues>::prepareInsert(const K& key, cachesize_t size, bool locked)
+{
+	Index bucketIdx = findBucket(key, hashKey(key));
+
+	if (bucketIdx != NoIndex  &&  !removeBucket(bucketIdx)) {
+		// Existing entry is locked
+		return false;
+	}
+
+	if (size > capacity  &&  !locked) {
+		return false;
+	}
+
+	bool enoughLeft = free(size > capacity ? 0 : capacity-size);
+
+	return enoughLeft  ||  locked;
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+template <class ValueInit>
+void FlatCache<K, V, MapHash, KeyEqual, InlineValues>::doInsert (
+		const K& key, cachesize_t size, bool locked, ValueInit init
+) {
+	if ((numEntries+1) * 4 > buckets.size() * 3) {
+		growTable();
+	}
+
+	Index idx = allocateSlot();
+	Slot& s = slot(idx);
+
+	new(&s.keyData) K(key);
+	init(s);
+	s.cost = size;
+	s.locked = locked;
+
+	pushFront(idx);
+
+	uint32_t hash = hashKey(key);
+	Index mask = (Index) buckets.size() - 1;
+	Index i = hash & mask;
+	while (buckets[i].slot != NoIndex) {
+		i = (i+1) & mask;
+	}
+	buckets[i].slot = idx;
+	buckets[i].hash = hash;
+
+	numEntries++;
+	occupied += size;
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+bool FlatCache<K, V, MapHash, KeyEqual, InlineValues>::insert(const K& key, V* value, cachesize_t size, bool locked)
+{
+	if (!prepareInsert(key, size, locked)) {
+		delete value;
+		return false;
+	}
+
+	doInsert(key, size, locked, [value](Slot& s) {
+		if constexpr (InlineValues) {
+			new(&s.valueData) V(std::move(*value));
+			delete value;
+		} else {
+			s.valueData = value;
+		}
+	});
+
+	return true;
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+bool FlatCache<K, V, MapHash, KeyEqual, InlineValues>::emplace(const K& key, V&& value, cachesize_t size, bool locked)
+{
+	if (!prepareInsert(key, size, locked)) {
+		return false;
+	}
+
+	doInsert(key, size, locked, [&value](Slot& s) {
+		if constexpr (InlineValues) {
+			new(&s.valueData) V(std::move(value));
+		} else {
+			s.valueData = new V(std::move(value));
+		}
+	});
+
+	return true;
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+bool FlatCache<K, V, MapHash, KeyEqual, InlineValues>::remove(const K& key)
+{
+	Index bucketIdx = findBucket(key, hashKey(key));
+
+	if (bucketIdx == NoIndex) {
+		return false;
+	}
+
+	return removeBucket(bucketIdx);
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+V* FlatCache<K, V, MapHash, KeyEqual, InlineValues>::item(const K& key)
+{
+	Index bucketIdx = findBucket(key, hashKey(key));
+
+	if (bucketIdx == NoIndex) {
+		return NULL;
+	}
+
+	Index idx = buckets[bucketIdx].slot;
+
+	if (idx != lruHead) {
+		unlink(idx);
+		pushFront(idx);
+	}
+
+	return slot(idx).value();
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+bool FlatCache<K, V, MapHash, KeyEqual, InlineValues>::free(cachesize_t size)
+{
+	Index idx = lruTail;
+
+	while (idx != NoIndex  &&  occupied > size) {
+		Slot& s = slot(idx);
+		Index prev = s.prev;
+
+		if (!s.locked) {
+			removeBucket(findBucket(s.key(), hashKey(s.key())), true);
+		}
+
+		idx = prev;
+	}
+
+	return occupied <= size;
+}
+
+
+template<class K, class V, class MapHash, class KeyEqual, bool InlineValues>
+V* FlatCache<K, V, MapHash, KeyEqual, InlineValues>::lock(const K& key, bool locked)
+{
+	Index bucketIdx = findBucket(key, hashKey(key));
+
+	if (bucketIdx == NoIndex) {
+		return NULL;
+	}
+
+	bool wasOverfilled = occupied > capacity;
+
+	Slot& s = slot(buckets[bucketIdx].slot);
+	s.locked = locked;
+	free(capacity);
+
+	if (!locked  &&  wasOverfilled) {
+		// If an entry is unlocked in an overfilled cache, it will be deleted by the above call to free().
+		return NULL;
+	} else {
+		return s.value();
+	}
+}
+
+#endif /* NXCOMMON_FLATCACHE_H_ */
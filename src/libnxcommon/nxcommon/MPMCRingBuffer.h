@@ -0,0 +1,239 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_MPMCRINGBUFFER_H_
+#define NXCOMMON_MPMCRINGBUFFER_H_
+
+#include <nxcommon/config.h>
+#include <atomic>
+#include <algorithm>
+#include <utility>
+#include <type_traits>
+
+
+
+/**	\brief Bounded queue that allows any number of parallel readers and writers.
+ *
+ * 	This is the C++ counterpart of ringbuf_mpmc_t, using the algorithm by Dmitry Vyukov: Every slot carries a
+ * 	sequence number that tells whether it is ready to be written or read in the current round, and readers and
+ * 	writers claim slots by advancing the read or write position with a CAS. Readers only contend with readers and
+ * 	writers only with writers, and the two positions are kept on separate cache lines.
+ *
+ * 	Unlike RingBuffer, elements are copied or moved with their assignment operators, so T doesn't need to be
+ * 	trivially copyable. It must be default-constructible, though.
+ *
+ * 	Batch operations claim all their slots with a single CAS, and the elements of a batch are consecutive in the
+ * 	queue. Note that readers may already see the first elements of a batch before the last ones are written.
+ */
+template <typename T, typename SizeType = size_t>
+class MPMCRingBuffer
+{
+public:
+	typedef SizeType size_type;
+
+public:
+	/**	\brief Create a buffer for at least the given number of elements.
+	 *
+	 * 	The capacity is rounded up to a power of two (and at least 2).
+	 */
+	MPMCRingBuffer(size_type capacity);
+
+	MPMCRingBuffer(const MPMCRingBuffer&) = delete;
+	~MPMCRingBuffer() { delete[] slots; }
+
+	size_type capacity() const { return mcapacity; }
+	size_type getCapacity() const { return capacity(); }
+
+	/**	\brief The number of elements in the buffer. With parallel readers or writers, this is only a snapshot.
+	 */
+	size_type readSize() const;
+	size_type getReadSize() const { return readSize(); }
+
+	bool isEmpty() const { return readSize() == 0; }
+
+	/**	\brief Write up to len elements as one batch, returning the number of elements written.
+	 */
+	size_type write(const T* data, size_type len);
+	bool write(const T& elem) { return write(&elem, 1) == 1; }
+	bool write(T&& elem);
+
+	/**	\brief Read up to len elements as one batch, returning the number of elements read.
+	 */
+	size_type read(T* data, size_type len);
+	bool read(T& elem) { return read(&elem, 1) == 1; }
+
+	MPMCRingBuffer& operator=(const MPMCRingBuffer&) = delete;
+
+private:
+	struct Slot
+	{
+		std::atomic<size_type> seq;
+		T data;
+	};
+
+private:
+	size_type claim(std::atomic<size_type>& pos, size_type seqOffs, size_type len, size_type& claimedPos);
+
+private:
+	Slot* slots;
+	size_type mcapacity;
+	size_type mask;
+
+	alignas(64) std::atomic<size_type> writePos;
+	alignas(64) std::atomic<size_type> readPos;
+	char pad[64 - sizeof(std::atomic<size_type>)];
+};
+
+
+
+
+
+
+template <typename T, typename SizeType>
+MPMCRingBuffer<T, SizeType>::MPMCRingBuffer(size_type capacity)
+		: mcapacity(2), writePos(0), readPos(0)
+{
+	while (mcapacity < capacity) {
+		mcapacity *= 2;
+	}
+	mask = mcapacity-1;
+
+	slots = new Slot[mcapacity];
+
+	// Slot i is ready to be written at position i
+	for (size_type i = 0 ; i < mcapacity ; i++) {
+		slots[i].seq.store(i, std::memory_order_relaxed);
+	}
+}
+
+
+template <typename T, typename SizeType>
+typename MPMCRingBuffer<T, SizeType>::size_type MPMCRingBuffer<T, SizeType>::readSize() const
+{
+	size_type r = readPos.load(std::memory_order_relaxed);
+	size_type w = writePos.load(std::memory_order_relaxed);
+
+	// Both are loaded separately, so w might lag behind
+	return w > r ? std::min((size_type) (w - r), mcapacity) : 0;
+}
+
+
+template <typename T, typename SizeType>
+typename MPMCRingBuffer<T, SizeType>::size_type MPMCRingBuffer<T, SizeType>::claim(
+		std::atomic<size_type>& posVar, size_type seqOffs, size_type len, size_type& claimedPos)
+{
+	// Claims up to len slots at posVar whose sequence number equals their position + seqOffs, i.e. that are free
+	// (seqOffs = 0) or filled (seqOffs = 1) in the current round.
+
+	size_type pos = posVar.load(std::memory_order_relaxed);
+
+	while (true) {
+		size_type numReady = 0;
+
+		while (numReady < len  &&  slots[(pos+numReady) & mask].seq.load(std::memory_order_acquire)
+				== (size_type) (pos+numReady+seqOffs)) {
+			numReady++;
+		}
+
+		if (numReady == 0) {
+			size_type seq = slots[pos & mask].seq.load(std::memory_order_acquire);
+			size_type expected = pos + seqOffs;
+
+			if (seq == expected) {
+				continue;
+			} else if ((typename std::make_signed<size_type>::type) (seq - expected) < 0) {
+				// The slot is still in the previous round: Full (for writers) or empty (for readers)
+				return 0;
+			}
+
+			// Another thread claimed pos in the meantime
+			pos = posVar.load(std::memory_order_relaxed);
+			continue;
+		}
+
+		// The slots between pos and pos+numReady can only change once another thread has advanced posVar past
+		// them, in which case the CAS fails.
+		if (posVar.compare_exchange_weak(pos, pos+numReady, std::memory_order_relaxed)) {
+			claimedPos = pos;
+			return numReady;
+		}
+	}
+}
+
+
+template <typename T, typename SizeType>
+typename MPMCRingBuffer<T, SizeType>::size_type MPMCRingBuffer<T, SizeType>::write(const T* data, size_type len)
+{
+	if (len == 0) {
+		return 0;
+	}
+
+	size_type pos;
+	len = claim(writePos, 0, len, pos);
+
+	for (size_type i = 0 ; i < len ; i++) {
+		Slot& slot = slots[(pos+i) & mask];
+		slot.data = data[i];
+		slot.seq.store(pos+i+1, std::memory_order_release);
+	}
+
+	return len;
+}
+
+
+template <typename T, typename SizeType>
+bool MPMCRingBuffer<T, SizeType>::write(T&& elem)
+{
+	size_type pos;
+	if (claim(writePos, 0, 1, pos) == 0) {
+		return false;
+	}
+
+	Slot& slot = slots[pos & mask];
+	slot.data = std::move(elem);
+	slot.seq.store(pos+1, std::memory_order_release);
+
+	return true;
+}
+
+
+template <typename T, typename SizeType>
+typename MPMCRingBuffer<T, SizeType>::size_type MPMCRingBuffer<T, SizeType>::read(T* data, size_type len)
+{
+	if (len == 0) {
+		return 0;
+	}
+
+	size_type pos;
+	len = claim(readPos, 1, len, pos);
+
+	for (size_type i = 0 ; i < len ; i++) {
+		Slot& slot = slots[(pos+i) & mask];
+		data[i] = std::move(slot.data);
+		slot.seq.store(pos+i+mcapacity, std::memory_order_release);
+	}
+
+	return len;
+}
+
+
+#endif /* NXCOMMON_MPMCRINGBUFFER_H_ */
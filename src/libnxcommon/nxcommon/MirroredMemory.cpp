@@ -0,0 +1,122 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "MirroredMemory.h"
+#include <cstdint>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)  &&  defined(MFD_CLOEXEC)
+#define NXCOMMON_MIRRORED_MEMORY_SUPPORTED
+#endif
+
+
+
+#ifdef NXCOMMON_MIRRORED_MEMORY_SUPPORTED
+
+static size_t Gcd(size_t a, size_t b)
+{
+	while (b != 0) {
+		size_t r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+#endif
+
+
+void* AllocateMirroredMemory(size_t minSize, size_t unitSize, size_t* size)
+{
+#ifdef NXCOMMON_MIRRORED_MEMORY_SUPPORTED
+	if (unitSize == 0) {
+		return NULL;
+	}
+
+	// Both mappings must start on a page boundary, and the wrap point must fall between two units
+	size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+	size_t granularity = pageSize / Gcd(pageSize, unitSize) * unitSize;
+
+	if (minSize > SIZE_MAX/2 - granularity) {
+		return NULL;
+	}
+
+	size_t allocSize = (minSize + granularity-1) / granularity * granularity;
+
+	if (allocSize == 0) {
+		allocSize = granularity;
+	}
+
+	int fd = memfd_create("nxcommon-mirrored", MFD_CLOEXEC);
+
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (ftruncate(fd, (off_t) allocSize) != 0) {
+		close(fd);
+		return NULL;
+	}
+
+	// Reserve the address space for both halves first, so that nothing else can be mapped in between them.
+	void* base = mmap(NULL, 2*allocSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (base == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	uint8_t* first = (uint8_t*) base;
+	uint8_t* second = first + allocSize;
+
+	bool ok = mmap(first, allocSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED
+			&&  mmap(second, allocSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+
+	// The mappings keep the memory alive on their own
+	close(fd);
+
+	if (!ok) {
+		munmap(base, 2*allocSize);
+		return NULL;
+	}
+
+	*size = allocSize;
+	return base;
+#else
+	return NULL;
+#endif
+}
+
+
+void FreeMirroredMemory(void* mem, size_t size)
+{
+#ifdef NXCOMMON_MIRRORED_MEMORY_SUPPORTED
+	if (mem) {
+		munmap(mem, 2*size);
+	}
+#endif
+}
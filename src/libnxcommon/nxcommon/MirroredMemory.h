@@ -0,0 +1,55 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_MIRROREDMEMORY_H_
+#define NXCOMMON_MIRROREDMEMORY_H_
+
+#include <nxcommon/config.h>
+#include <cstddef>
+
+
+
+/**	\brief Allocate a block of memory that is mapped twice, back-to-back, in virtual memory.
+ *
+ * 	The returned block is 2*size bytes of address space, where the second half is a view of the same physical memory
+ * 	as the first half. Any range of up to size bytes that starts in the first half is therefore contiguous, even if it
+ * 	crosses the end of the first half. This is what ring buffers need to hand out their contents in one piece.
+ *
+ * 	The size is rounded up to a multiple of both the page size and unitSize.
+ *
+ * 	This is currently only supported on Linux, where it is implemented with memfd_create() and two MAP_SHARED mappings.
+ *
+ * 	@param minSize The minimum size of a half in bytes.
+ * 	@param unitSize The size will be a multiple of this (e.g. the size of a ring buffer element).
+ * 	@param size Receives the actual size of a half in bytes.
+ * 	@return The start of the block, or NULL if mirrored memory is not supported or the allocation failed.
+ */
+void* AllocateMirroredMemory(size_t minSize, size_t unitSize, size_t* size);
+
+/**	\brief Free a block returned by AllocateMirroredMemory().
+ *
+ * 	@param mem The block.
+ * 	@param size The size of a half, as returned by AllocateMirroredMemory().
+ */
+void FreeMirroredMemory(void* mem, size_t size);
+
+#endif /* NXCOMMON_MIRROREDMEMORY_H_ */
@@ -26,16 +26,27 @@
 #include <nxcommon/config.h>
 #include "Cache.h"
 #include <map>
+#include <vector>
 #include <cstdio>
 #include <algorithm>
 #include "exception/InvalidStateException.h"
 #include "util.h"
+#include "ThreadPool.h"
+#include "DiskCache.h"
+#include "stream/IOException.h"
 #include <memory>
 #include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
 
 using std::find;
 using std::map;
+using std::vector;
 using std::shared_ptr;
+using std::unique_ptr;
+using std::shared_future;
 
 
 
@@ -89,8 +100,32 @@ typedef unsigned int cachesize_t;
  *	lock it through one of its entry pointers. The entry is then locked in much the same way as with the base
  *	Cache class. A locked entry is only unlocked if <b>all</b> pointers referring to it are unlocked
  *	(released). This is done by keeping a lock count in the SharedPointer.
+ *
+ *	Entries can also be loaded asynchronously with Pointer::getEntryAsync(), which runs the EntryLoader on a
+ *	ThreadPool and returns a future. Loads are <i>single-flight</i>: If an entry is requested while it is
+ *	already being loaded (by an asynchronous load or by a synchronous dereference in another thread), no
+ *	second load is started, but the requester waits for the running one. The cache itself is internally
+ *	synchronized, so pointers may be dereferenced from multiple threads. Note however that an unlocked entry
+ *	may then be removed by another thread at any time, so entries used from multiple threads should be
+ *	locked.
+ *
+ *	Entries that are likely to be needed soon can be loaded ahead of time with prefetch(), or automatically
+ *	by an AccessPredictor that is notified of each access. Prefetches run with low priority in the
+ *	background and only ever fill spare capacity, so they never cause other entries to be evicted.
+ *
+ *	Optionally, a DiskCache can be set as a second tier with setDiskCache(). Entries that are evicted are then
+ *	serialized (see Entry::serialize()) into the DiskCache, and when an entry is missing, the DiskCache is
+ *	checked before asking the EntryLoader to load it from scratch. The EntryLoader turns the serialized data
+ *	back into an entry with EntryLoader::deserialize(). Because the DiskCache is persistent, this also helps
+ *	when starting with an empty cache after a restart. Entries are expected not to change after loading, so
+ *	an entry that was read from the DiskCache is not written again when it is evicted.
+ *
+ *	Statistics about hits, misses, evictions and the EntryLoader can be collected with setStats().
+ *
+ *	The EvictionPolicy template parameter is passed to the underlying Cache.
  */
-template<class K, class Compare = less<K>, class MapHash = CXX11Hash<K>, class KeyEqual = equal_to<K> >
+template<class K, class Compare = less<K>, class MapHash = CXX11Hash<K>, class KeyEqual = equal_to<K>,
+		template<class, class, class> class EvictionPolicy = LRUEvictionPolicy>
 class ResourceCache {
 private:
 	class SharedPointer;
@@ -104,7 +139,7 @@ public:
 	public:
 		/**	\brief Creates a new Entry.
 		 */
-		Entry() : sharedPtr(NULL) {}
+		Entry() : sharedPtr(NULL), prefetchedBy(NULL), inDiskCache(false) {}
 
 		/**	\brief Destroys the entry.
 		 */
@@ -116,6 +151,17 @@ public:
 		 */
 		virtual cachesize_t getSize() const = 0;
 
+		/**	\brief Serializes the entry for storage in a DiskCache.
+		 *
+		 * 	This is called when the entry is evicted from a ResourceCache that has a DiskCache. The default
+		 * 	implementation returns false, so the entry is not stored.
+		 *
+		 * 	@param data Receives the serialized entry.
+		 * 	@return true if the entry was serialized, false if it should not be stored.
+		 * 	@see EntryLoader::deserialize()
+		 */
+		virtual bool serialize(ByteArray& /* data */) const { return false; }
+
 	private:
 		/**	\brief Register a SharedPointer for this entry.
 		 *
@@ -134,6 +180,14 @@ public:
 	private:
 		SharedPointer* sharedPtr;
 
+		/**	\brief The cache that prefetched this entry, as long as it wasn't accessed since.
+		 */
+		ResourceCache* prefetchedBy;
+
+		/**	\brief true if the DiskCache already contains this entry.
+		 */
+		bool inDiskCache;
+
 		friend class ResourceCache;
 		friend class SharedPointer;
 	};
@@ -191,6 +245,23 @@ public:
 		 */
 		Entry* getEntry(bool lock = false);
 
+		/**	\brief Dereferences this pointer asynchronously.
+		 *
+		 *	If the entry is cached, the returned future is ready immediately. Otherwise, the entry is loaded
+		 *	on the cache's ThreadPool, and the calling thread can continue in the meantime. If the entry is
+		 *	already being loaded, the future refers to the running load.
+		 *
+		 *	The lock parameter works like for getEntry(). Do not call release() before the future is ready.
+		 *	Because other threads may remove unlocked entries at any time, the entry obtained from the future
+		 *	is only guaranteed to be valid if it was locked.
+		 *
+		 *	@param lock If true, the entry will be locked so that it won't be deleted until release() is
+		 *		called. If false, the locked status is kept unchanged.
+		 *	@return A future for the entry, which is NULL if it could not be loaded. If the EntryLoader throws,
+		 *		the exception is stored in the future.
+		 */
+		shared_future<Entry*> getEntryAsync(bool lock = false);
+
 		/**	\brief Release (unlock) the entry pointed to by this pointer.
 		 *
 		 *	This does not directly unlock the entry, but decreased its lock count by one. Only when the
@@ -217,29 +288,79 @@ public:
 		bool locked;
 
 	private:
-		friend class ResourceCache<K, Compare, MapHash, KeyEqual>;
+		friend class ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>;
 	};
 
 
 	/**	\brief Base class responsible for loading entries into the cache from an external source.
+	 *
+	 * 	load() is called without holding the cache's internal lock, so it may access the cache itself. When
+	 * 	entries are loaded asynchronously, it may be called from several ThreadPool threads at once (but
+	 * 	never concurrently for the same key).
 	 */
 	class EntryLoader {
 	public:
+		virtual ~EntryLoader() {}
+
 		/**	\brief Load the entry with the specified key from an external source.
 		 *
 		 * 	@param key The entry's key.
 		 * 	@return The loaded entry, or NULL if it could not be found or loaded.
 		 */
 		virtual Entry* load(K key) = 0;
+
+		/**	\brief Recreates an entry from data previously produced by Entry::serialize().
+		 *
+		 * 	The default implementation returns NULL, so entries are always loaded with load().
+		 *
+		 * 	@param key The entry's key.
+		 * 	@param data The serialized entry, as read from the DiskCache.
+		 * 	@return The entry, or NULL to fall back to load().
+		 */
+		virtual Entry* deserialize(K /* key */, const ByteArray& /* data */) { return NULL; }
 	};
 
 	class SimpleEntryLoader : public EntryLoader {
 	public:
-		SimpleEntryLoader(std::function<Entry*(K)> loadFunc) : loadFunc(loadFunc) {}
+		SimpleEntryLoader(std::function<Entry*(K)> loadFunc,
+				std::function<Entry*(K, const ByteArray&)> deserializeFunc = std::function<Entry*(K, const ByteArray&)>())
+				: loadFunc(loadFunc), deserializeFunc(deserializeFunc) {}
 		virtual Entry* load(K key) { return loadFunc(key); }
+		virtual Entry* deserialize(K key, const ByteArray& data)
+				{ return deserializeFunc ? deserializeFunc(key, data) : NULL; }
 
 	private:
 		std::function<Entry*(K)> loadFunc;
+		std::function<Entry*(K, const ByteArray&)> deserializeFunc;
+	};
+
+
+	/**	\brief Base class for predicting which entries will be accessed next.
+	 *
+	 * 	The predictor is notified of every access through an entry pointer, and can respond by naming keys
+	 * 	that should be prefetched. It is called without holding the cache's internal lock, possibly from
+	 * 	multiple threads at once.
+	 */
+	class AccessPredictor {
+	public:
+		virtual ~AccessPredictor() {}
+
+		/**	\brief Called when an entry is accessed.
+		 *
+		 * 	@param key The key of the accessed entry.
+		 * 	@param predictedKeys Keys that are likely to be accessed soon should be appended to this. They
+		 * 		will be prefetched.
+		 */
+		virtual void accessed(K key, vector<K>& predictedKeys) = 0;
+	};
+
+	class SimpleAccessPredictor : public AccessPredictor {
+	public:
+		SimpleAccessPredictor(std::function<void (K, vector<K>&)> predictFunc) : predictFunc(predictFunc) {}
+		virtual void accessed(K key, vector<K>& predictedKeys) { predictFunc(key, predictedKeys); }
+
+	private:
+		std::function<void (K, vector<K>&)> predictFunc;
 	};
 
 private:
@@ -258,10 +379,12 @@ private:
 
 		Entry* getEntry(bool lock = false);
 
+		shared_future<Entry*> getEntryAsync(bool lock, const shared_ptr<SharedPointer>& self);
+
 		void release();
 
 	private:
-		SharedPointer(ResourceCache<K, Compare, MapHash, KeyEqual>* cache, K key)
+		SharedPointer(ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>* cache, K key)
 				: cache(cache), key(key), entry(NULL), lockCount(0) {}
 
 		/**	\brief Callback method which is called by Entry::~Entry().
@@ -270,21 +393,67 @@ private:
 		 */
 		void entryDeleted();
 
+		/**	\brief Remembers the entry after it was obtained from the cache.
+		 *
+		 * 	This also counts the first access to a prefetched entry as a prefetch hit. Must be called with the
+		 * 	cache mutex locked.
+		 */
+		Entry* setEntry(Entry* e);
+
 	private:
-		ResourceCache<K, Compare, MapHash, KeyEqual>* cache;
+		ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>* cache;
 		K key;
 		Entry* entry;
 		unsigned int lockCount;
 
 	private:
-		friend class ResourceCache<K, Compare, MapHash, KeyEqual>;
+		friend class ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>;
 		friend class Entry;
 	};
 
 private:
-	typedef Cache<K, Entry, Compare, MapHash, KeyEqual> EntryCache;
+	typedef Cache<K, Entry, Compare, MapHash, KeyEqual, EvictionPolicy> EntryCache;
 	typedef map<K, shared_ptr<SharedPointer>, Compare> SharedPtrMap;
 
+	/**	\brief A load that is currently running, or queued by prefetch().
+	 */
+	struct PendingLoad
+	{
+		shared_future<Entry*> future;
+
+		/**	\brief The promise of a queued prefetch, so that a thread that needs the entry can take the load over.
+		 */
+		shared_ptr<std::promise<Entry*> > promise;
+
+		/**	\brief true if the load was started by prefetch() and nobody has asked for the entry yet.
+		 */
+		bool prefetch;
+
+		/**	\brief false while a prefetch is still queued in the ThreadPool.
+		 *
+		 * 	Waiting for a queued prefetch could deadlock, because it runs with low priority and all pool threads
+		 * 	might be waiting for it. Whoever sets this to true runs the load.
+		 */
+		bool started;
+	};
+
+	typedef map<K, PendingLoad, Compare> PendingLoadMap;
+
+	/**	\brief Writes the entries evicted during its lifetime to the DiskCache when it is destroyed.
+	 *
+	 * 	Declare it before the lock on mtx, so that it is destroyed after the lock was released and the disk
+	 * 	writes don't block other threads.
+	 */
+	class EvictedEntryWriter
+	{
+	public:
+		EvictedEntryWriter(ResourceCache* cache) : cache(cache) {}
+		~EvictedEntryWriter() { cache->writeEvictedEntries(); }
+
+	private:
+		ResourceCache* cache;
+	};
+
 public:
 	/**	\brief Create a new ResourceCache.
 	 *
@@ -318,13 +487,13 @@ public:
 	 *
 	 *	@return The capacity.
 	 */
-	cachesize_t getCapacity() const { return cache.getCapacity(); }
+	cachesize_t getCapacity() const { std::lock_guard<std::mutex> lock(mtx); return cache.getCapacity(); }
 
 	/**	\brief Return the currently occupied size.
 	 *
 	 * 	@return The occupied size.
 	 */
-	cachesize_t getOccupiedSize() const { return cache.getOccupiedSize(); }
+	cachesize_t getOccupiedSize() const { std::lock_guard<std::mutex> lock(mtx); return cache.getOccupiedSize(); }
 
 	/**	\brief Set a new cache capacity.
 	 *
@@ -332,7 +501,8 @@ public:
 	 *
 	 * 	@param capacity The new capacity.
 	 */
-	void resize(cachesize_t capacity) { cache.resize(capacity); }
+	void resize(cachesize_t capacity)
+		{ EvictedEntryWriter writer(this); std::lock_guard<std::mutex> lock(mtx); cache.resize(capacity); }
 
 	/**	\brief Determine whether the cache is overfilled.
 	 *
@@ -340,7 +510,8 @@ public:
 	 *
 	 * 	@return true if occupied size > capacity.
 	 */
-	bool isOverfilled() const { return getOccupiedSize() > getCapacity(); }
+	bool isOverfilled() const
+		{ std::lock_guard<std::mutex> lock(mtx); return cache.getOccupiedSize() > cache.getCapacity(); }
 
 	/**	\brief Attempt to remove all entries from the cache.
 	 *
@@ -358,18 +529,140 @@ public:
 	 */
 	EntryLoader* getEntryLoader() { return loader; }
 
+	/**	\brief Sets the ThreadPool on which asynchronous loads are run.
+	 *
+	 * 	Ownership of the pool is not taken, and it must stay alive until this cache is destroyed. A single pool
+	 * 	may be shared by multiple caches. If no pool is set, a private pool with one thread per hardware
+	 * 	thread is created on the first asynchronous load.
+	 *
+	 * 	@param pool The pool.
+	 */
+	void setThreadPool(ThreadPool* pool) { std::lock_guard<std::mutex> lock(mtx); this->pool = pool; }
+
+	/**	\brief Loads an entry in the background if it is not yet cached.
+	 *
+	 * 	The load is run with low priority on the ThreadPool. The entry is only inserted if it fits into the
+	 * 	spare capacity of the cache at the time the load completes, otherwise it is dropped again. This way,
+	 * 	prefetching never evicts other (e.g. locked or recently used) entries. If an entry pointer is
+	 * 	dereferenced while its entry is being prefetched, it waits for the prefetch instead of loading the
+	 * 	entry a second time.
+	 *
+	 * 	@param key The entry's key.
+	 */
+	void prefetch(K key) { prefetch(&key, &key+1); }
+
+	/**	\brief Prefetches multiple entries.
+	 *
+	 * 	@param begin Iterator to the first key.
+	 * 	@param end Iterator past the last key.
+	 * 	@see prefetch(K)
+	 */
+	template <class InputIterator>
+	void prefetch(InputIterator begin, InputIterator end);
+
+	/**	\brief Sets the AccessPredictor which is notified of each access.
+	 *
+	 * 	Ownership of the predictor is taken, and the previous one is deleted. This must not be called while
+	 * 	other threads access the cache.
+	 *
+	 * 	@param predictor The new predictor, or NULL to disable access prediction.
+	 */
+	void setAccessPredictor(AccessPredictor* predictor);
+
+	/**	\brief Sets a DiskCache as second tier behind this cache.
+	 *
+	 * 	Ownership of the DiskCache is not taken, and it must stay alive until this cache is destroyed or the
+	 * 	DiskCache is unset. Entries still cached when this cache is destroyed are written to the DiskCache,
+	 * 	too. This must not be called while other threads access the cache.
+	 *
+	 * 	@param diskCache The DiskCache, or NULL to disable the second tier.
+	 * 	@param keySerializer Converts keys to the byte strings used as DiskCache keys.
+	 */
+	void setDiskCache(DiskCache* diskCache,
+			std::function<ByteArray (const K&)> keySerializer = DiskCacheKeySerializer<K>());
+
+	/**	\brief Starts or stops collecting statistics.
+	 *
+	 * 	Every dereference of an entry pointer counts as one hit or miss. Additionally, the calls to the
+	 * 	EntryLoader are counted and timed. See Cache::setStats() for details.
+	 *
+	 * 	@param stats The statistics object, or NULL to disable statistics. Ownership is not taken.
+	 * 	@param keyClassifier If set, the occupied size is additionally broken down by the class that this
+	 * 		function returns for each key.
+	 */
+	void setStats(CacheStats* stats,
+			const typename EntryCache::KeyClassifier& keyClassifier = typename EntryCache::KeyClassifier())
+			{ std::lock_guard<std::mutex> lock(mtx); cache.setStats(stats, keyClassifier); }
+
+	/**	\brief Returns the number of prefetched entries that were accessed through an entry pointer.
+	 */
+	unsigned int getPrefetchHitCount() const { std::lock_guard<std::mutex> lock(mtx); return numPrefetchHits; }
+
+	/**	\brief Returns the number of prefetched entries that were never accessed.
+	 *
+	 * 	This includes entries that were dropped because they did not fit into the spare capacity, and
+	 * 	prefetched entries that were removed from the cache before their first access.
+	 */
+	unsigned int getWastedPrefetchCount() const
+			{ std::lock_guard<std::mutex> lock(mtx); return numWastedPrefetches; }
+
 private:
 	/**	\brief Ask the EntryLoader to load the entry with the specified key and store it inside the cache.
 	 *
 	 * 	This method does not check whether the entry is already cached, so do not call it when you aren't
 	 * 	sure it isn't already cached.
 	 *
+	 * 	If another thread is already loading the entry, this waits for that load instead of starting a new
+	 * 	one. The mutex is released while loading or waiting. If the EntryLoader throws, the exception is passed
+	 * 	on to the thread that ran the load as well as to all threads that waited for it.
+	 *
 	 * 	@param key The entry's key.
 	 * 	@param lock The initial lock status.
+	 * 	@param lk The lock on mtx held by the caller.
 	 * 	@return The loaded entry or NULL if it could not be loaded or does not fit into the cache and wasn't
 	 * 		locked.
 	 */
-	Entry* doCache(K key, bool lock = false);
+	Entry* doCache(K key, bool lock, std::unique_lock<std::mutex>& lk);
+
+	/**	\brief Calls the EntryLoader for an entry registered in pendingLoads and caches the result.
+	 *
+	 * 	@param key The entry's key.
+	 * 	@param promise The promise belonging to the PendingLoad. It is fulfilled by this method.
+	 * 	@param lock The initial lock status.
+	 * 	@param lk The lock on mtx held by the caller. It is released while loading.
+	 * 	@return The loaded entry, or NULL if it could not be loaded or was not cached.
+	 */
+	Entry* runLoad(K key, std::promise<Entry*>& promise, bool lock, std::unique_lock<std::mutex>& lk);
+
+	/**	\brief Counts an event in the statistics, if enabled.
+	 */
+	void countStat(CacheStats::Counter counter) { if (cache.getStats()) cache.getStats()->count(counter); }
+
+	/**	\brief Notifies the AccessPredictor of an access and prefetches the predicted keys.
+	 *
+	 * 	Must be called without mtx being locked.
+	 */
+	void predictAccess(K key);
+
+	/**	\brief Eviction handler serializing evicted entries for the DiskCache.
+	 *
+	 * 	It is called with mtx locked, so the entries are only queued in pendingDiskWrites. They are written by
+	 * 	writeEvictedEntries().
+	 */
+	void entryEvicted(const K& key, Entry* entry);
+
+	/**	\brief Writes the entries queued by entryEvicted() to the DiskCache.
+	 *
+	 * 	Must be called without mtx being locked. See EvictedEntryWriter.
+	 */
+	void writeEvictedEntries();
+
+	/**	\brief Submits a task to the ThreadPool, creating the private pool if necessary.
+	 *
+	 * 	Must be called with mtx locked. The destructor waits for all submitted tasks.
+	 */
+	void submitAsyncTask(const std::function<void ()>& task,
+			ThreadPool::Priority priority = ThreadPool::PriorityNormal);
 
 	/**	\brief Find the SharedPointer responsible for the entry with the specified key.
 	 *
@@ -400,16 +693,18 @@ private:
 	 * 		be instantly removed by this method and thus NULL will be returned.
 	 * 	@see getEntry(K key)
 	 */
-	Entry* lock(K key, bool lock = false);
+	Entry* lock(K key, bool lock, std::unique_lock<std::mutex>& lk);
 
 	/**	\brief Returns a cache entry with the specified key.
 	 *
 	 * 	When the entry is not yet cached, doCache() is called to laod it into the cache.
 	 *
 	 * 	@param key The entry's key.
+	 * 	@param lk The lock on mtx held by the caller.
+	 * 	@param countAccess Whether to count the lookup in the statistics.
 	 * 	@return The entry or NULL if it was neither cached nor could be loaded.
 	 */
-	Entry* getEntry(K key);
+	Entry* getEntry(K key, std::unique_lock<std::mutex>& lk, bool countAccess = true);
 
 	/**	\brief Returns a cache entry with the specified key only if it is currently cached.
 	 *
@@ -434,6 +729,21 @@ private:
 	EntryCache cache;
 	EntryLoader* loader;
 	SharedPtrMap sharedPtrs;
+	PendingLoadMap pendingLoads;
+	ThreadPool* pool;
+	unique_ptr<ThreadPool> ownPool;
+	unsigned int numAsyncTasks;
+	std::condition_variable asyncTasksDoneCv;
+	AccessPredictor* predictor;
+	unsigned int numPrefetchHits;
+	unsigned int numWastedPrefetches;
+	DiskCache* diskCache;
+	std::function<ByteArray (const K&)> diskCacheKeySerializer;
+	std::vector<std::pair<ByteArray, ByteArray> > pendingDiskWrites;
+
+	/**	\brief Guards all of the members above and the state of the SharedPointers.
+	 */
+	mutable std::mutex mtx;
 
 private:
 	friend class SharedPointer;
@@ -447,16 +757,25 @@ private:
 
 
 
-template <class K, class Compare, class MapHash, class KeyEqual>
-ResourceCache<K, Compare, MapHash, KeyEqual>::ResourceCache(EntryLoader* loader, cachesize_t capacity)
-		: cache(EntryCache(capacity)), loader(loader)
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::ResourceCache(EntryLoader* loader, cachesize_t capacity)
+		: cache(EntryCache(capacity)), loader(loader), pool(NULL), numAsyncTasks(0), predictor(NULL),
+		  numPrefetchHits(0), numWastedPrefetches(0), diskCache(NULL)
 {
 }
 
 
-template <class K, class Compare, class MapHash, class KeyEqual>
-ResourceCache<K, Compare, MapHash, KeyEqual>::~ResourceCache()
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::~ResourceCache()
 {
+	{
+		// Asynchronous loads still reference this cache, so wait for them first.
+		std::unique_lock<std::mutex> lk(mtx);
+		asyncTasksDoneCv.wait(lk, [this]() { return numAsyncTasks == 0; });
+	}
+
 	if (!clear()) {
 		fprintf(stderr, "At least one cache entry is still locked during the destruction of "
 				"this ResourceCache!\n");
@@ -468,22 +787,26 @@ ResourceCache<K, Compare, MapHash, KeyEqual>::~ResourceCache()
 	}
 
 	delete loader;
+	delete predictor;
 }
 
 
-template <class K, class Compare, class MapHash, class KeyEqual>
-typename ResourceCache<K, Compare, MapHash, KeyEqual>::Pointer ResourceCache<K, Compare, MapHash, KeyEqual>::getEntryPointer(K key)
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+typename ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::Pointer ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::getEntryPointer(K key)
 {
+	std::lock_guard<std::mutex> lock(mtx);
 	return Pointer(getSharedPointer(key));
 }
 
 
-template <class K, class Compare, class MapHash, class KeyEqual>
-shared_ptr<typename ResourceCache<K, Compare, MapHash, KeyEqual>::SharedPointer> ResourceCache<K, Compare, MapHash, KeyEqual>::getSharedPointer(K key)
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+shared_ptr<typename ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::SharedPointer> ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::getSharedPointer(K key)
 {
 	pair<typename SharedPtrMap::iterator, bool> res
-			= sharedPtrs.insert(pair<K, shared_ptr<typename ResourceCache<K, Compare, MapHash, KeyEqual>::SharedPointer> >(key,
-					shared_ptr<typename ResourceCache<K, Compare, MapHash, KeyEqual>::SharedPointer>()));
+			= sharedPtrs.insert(pair<K, shared_ptr<typename ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::SharedPointer> >(key,
+					shared_ptr<typename ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::SharedPointer>()));
 
 	if (res.second) {
 		res.first->second = shared_ptr<SharedPointer>(new SharedPointer(this, key));
@@ -493,41 +816,363 @@ shared_ptr<typename ResourceCache<K, Compare, MapHash, KeyEqual>::SharedPointer>
 }
 
 
-template <class K, class Compare, class MapHash, class KeyEqual>
-void ResourceCache<K, Compare, MapHash, KeyEqual>::removeSharedPointer(K key)
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+void ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::removeSharedPointer(K key)
 {
 	sharedPtrs.erase(key);
 }
 
 
-template <class K, class Compare, class MapHash, class KeyEqual>
-typename ResourceCache<K, Compare, MapHash, KeyEqual>::Entry* ResourceCache<K, Compare, MapHash, KeyEqual>::doCache(K key, bool lock)
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+typename ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::Entry* ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::doCache(K key, bool lock, std::unique_lock<std::mutex>& lk)
 {
-	Entry* entry = loader->load(key);
+	while (true) {
+		typename PendingLoadMap::iterator pit = pendingLoads.find(key);
+
+		if (pit == pendingLoads.end()) {
+			break;
+		}
+
+		// Someone else is already loading the entry, so wait for them instead of loading it twice. If it's
+		// a prefetch, it now has to be cached even if that means evicting something.
+		if (pit->second.prefetch) {
+			pit->second.prefetch = false;
+			numPrefetchHits++;
+		}
+
+		if (!pit->second.started) {
+			// The prefetch is still queued, so load it right here instead of waiting for it.
+			pit->second.started = true;
+			shared_ptr<std::promise<Entry*> > promise = pit->second.promise;
+			return runLoad(key, *promise, lock, lk);
+		}
+
+		shared_future<Entry*> pending = pit->second.future;
+
+		lk.unlock();
+
+		try {
+			// Rethrows if the loader failed, just like for the thread that ran the load.
+			pending.get();
+		} catch (...) {
+			lk.lock();
+			throw;
+		}
 
-	if (!entry  ||  !cache.insert(key, entry, entry->getSize(), lock)) {
-		return NULL;
+		lk.lock();
+
+		Entry* entry = lock ? cache.lock(key, true) : cache.peek(key);
+
+		if (entry) {
+			return entry;
+		}
+
+		if (!lock) {
+			// The entry could not be loaded or did not fit into the cache, and retrying would not help.
+			return NULL;
+		}
+
+		// A locked entry may still fit into the cache when an unlocked one didn't, so we have to load it
+		// ourselves (unless yet another thread has already started doing so).
 	}
 
+	std::promise<Entry*> promise;
+	PendingLoad& pending = pendingLoads[key];
+	pending.future = promise.get_future().share();
+	pending.prefetch = false;
+	pending.started = true;
+
+	return runLoad(key, promise, lock, lk);
+}
+
+
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+typename ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::Entry* ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::runLoad (
+		K key, std::promise<Entry*>& promise, bool lock, std::unique_lock<std::mutex>& lk
+) {
+	Entry* entry = NULL;
+
+	DiskCache* diskCache = this->diskCache;
+	std::function<ByteArray (const K&)> keySerializer = diskCacheKeySerializer;
+
+	lk.unlock();
+
+	try {
+		if (diskCache) {
+			ByteArray data;
+
+			if (diskCache->get(keySerializer(key), data)) {
+				entry = loader->deserialize(key, data);
+
+				if (entry) {
+					entry->inDiskCache = true;
+				}
+			}
+		}
+
+		if (!entry) {
+			CacheStats* stats = cache.getStats();
+			std::chrono::steady_clock::time_point start;
+
+			if (stats) {
+				start = std::chrono::steady_clock::now();
+			}
+
+			try {
+				entry = loader->load(key);
+			} catch (...) {
+				if (stats) {
+					stats->recordLoad(std::chrono::duration_cast<std::chrono::nanoseconds> (
+							std::chrono::steady_clock::now() - start).count(), false);
+				}
+				throw;
+			}
+
+			if (stats) {
+				stats->recordLoad(std::chrono::duration_cast<std::chrono::nanoseconds> (
+						std::chrono::steady_clock::now() - start).count(), entry != NULL);
+			}
+		}
+	} catch (...) {
+		lk.lock();
+		pendingLoads.erase(key);
+		promise.set_exception(std::current_exception());
+		throw;
+	}
+
+	lk.lock();
+
+	typename PendingLoadMap::iterator pit = pendingLoads.find(key);
+	bool prefetch = pit->second.prefetch;
+	pendingLoads.erase(pit);
+
+	if (entry) {
+		if (prefetch) {
+			cachesize_t occupied = cache.getOccupiedSize();
+			cachesize_t capacity = cache.getCapacity();
+
+			if (occupied > capacity  ||  entry->getSize() > capacity - occupied) {
+				// Would have to evict something
+				delete entry;
+				entry = NULL;
+				numWastedPrefetches++;
+			} else {
+				entry->prefetchedBy = this;
+				cache.insert(key, entry, entry->getSize(), false);
+			}
+		} else if (!cache.insert(key, entry, entry->getSize(), lock)) {
+			entry = NULL;
+		}
+	}
+
+	promise.set_value(entry);
+
 	return entry;
 }
 
 
-template <class K, class Compare, class MapHash, class KeyEqual>
-typename ResourceCache<K, Compare, MapHash, KeyEqual>::Entry* ResourceCache<K, Compare, MapHash, KeyEqual>::getEntryIfCached(K key)
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+template <class InputIterator>
+void ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::prefetch(InputIterator begin, InputIterator end)
 {
-	Entry* entry = cache.getEntry(key);
-	return entry;
+	std::lock_guard<std::mutex> lock(mtx);
+
+	for (InputIterator it = begin ; it != end ; it++) {
+		K key = *it;
+
+		if (cache.getOccupiedSize() >= cache.getCapacity()) {
+			// No spare capacity left to fill
+			break;
+		}
+
+		if (cache.contains(key)  ||  pendingLoads.find(key) != pendingLoads.end()) {
+			continue;
+		}
+
+		shared_ptr<std::promise<Entry*> > promise(new std::promise<Entry*>);
+
+		// Register the load right away, so that dereferencing the entry in the meantime waits for it.
+		PendingLoad& pending = pendingLoads[key];
+		pending.future = promise->get_future().share();
+		pending.promise = promise;
+		pending.prefetch = true;
+		pending.started = false;
+
+		submitAsyncTask([this, key, promise]() {
+			EvictedEntryWriter writer(this);
+			std::unique_lock<std::mutex> lk(mtx);
+
+			typename PendingLoadMap::iterator pit = pendingLoads.find(key);
+
+			if (pit == pendingLoads.end()  ||  pit->second.promise != promise  ||  pit->second.started) {
+				// Another thread took the load over
+				return;
+			}
+
+			pit->second.started = true;
+
+			try {
+				runLoad(key, *promise, false, lk);
+			} catch (...) {
+				// The exception is stored in the promise, so whoever asks for the entry gets it. Nobody would
+				// see it here anyway.
+			}
+		}, ThreadPool::PriorityLow);
+	}
+}
+
+
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+void ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::setAccessPredictor(AccessPredictor* predictor)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	delete this->predictor;
+	this->predictor = predictor;
+}
+
+
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+void ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::setDiskCache(DiskCache* diskCache, std::function<ByteArray (const K&)> keySerializer)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	this->diskCache = diskCache;
+	diskCacheKeySerializer = keySerializer;
+
+	if (diskCache) {
+		cache.setEvictionHandler([this](const K& key, Entry* entry) { entryEvicted(key, entry); });
+	} else {
+		cache.setEvictionHandler(typename EntryCache::EvictionHandler());
+	}
 }
 
 
-template <class K, class Compare, class MapHash, class KeyEqual>
-typename ResourceCache<K, Compare, MapHash, KeyEqual>::Entry* ResourceCache<K, Compare, MapHash, KeyEqual>::getEntry(K key)
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+void ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::entryEvicted(const K& key, Entry* entry)
 {
+	if (entry->inDiskCache) {
+		return;
+	}
+
+	ByteArray data;
+
+	if (entry->serialize(data)) {
+		pendingDiskWrites.push_back(std::pair<ByteArray, ByteArray>(diskCacheKeySerializer(key), data));
+	}
+}
+
+
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+void ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::writeEvictedEntries()
+{
+	std::vector<std::pair<ByteArray, ByteArray> > writes;
+	DiskCache* diskCache;
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+
+		if (pendingDiskWrites.empty()) {
+			return;
+		}
+
+		writes.swap(pendingDiskWrites);
+		diskCache = this->diskCache;
+	}
+
+	if (!diskCache) {
+		return;
+	}
+
+	for (const std::pair<ByteArray, ByteArray>& write : writes) {
+		try {
+			diskCache->put(write.first, write.second);
+		} catch (IOException&) {
+			// The DiskCache is only an optimization, so the entry is just lost.
+		}
+	}
+}
+
+
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+void ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::predictAccess(K key)
+{
+	AccessPredictor* predictor;
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		predictor = this->predictor;
+	}
+
+	if (!predictor) {
+		return;
+	}
+
+	vector<K> predictedKeys;
+	predictor->accessed(key, predictedKeys);
+
+	if (!predictedKeys.empty()) {
+		prefetch(predictedKeys.begin(), predictedKeys.end());
+	}
+}
+
+
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+void ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::submitAsyncTask(const std::function<void ()>& task, ThreadPool::Priority priority)
+{
+	if (!pool) {
+		ownPool.reset(new ThreadPool);
+		pool = ownPool.get();
+	}
+
+	numAsyncTasks++;
+
+	shared_ptr<std::function<void ()> > taskPtr(new std::function<void ()>(task));
+
+	pool->submit([this, taskPtr]() {
+		try {
+			(*taskPtr)();
+		} catch (...) {
+			// The ThreadPool would swallow it anyway, and the task must still be counted as done below.
+		}
+
+		// Destroy the task's captures before the destructor may proceed.
+		*taskPtr = std::function<void ()>();
+
+		std::lock_guard<std::mutex> lock(mtx);
+		numAsyncTasks--;
+		asyncTasksDoneCv.notify_all();
+	}, priority);
+}
+
+
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+typename ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::Entry* ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::getEntryIfCached(K key)
+{
+	std::lock_guard<std::mutex> lock(mtx);
 	Entry* entry = cache.item(key);
+	return entry;
+}
+
+
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+typename ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::Entry* ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::getEntry(K key, std::unique_lock<std::mutex>& lk, bool countAccess)
+{
+	Entry* entry = countAccess ? cache.item(key) : cache.peek(key);
 
 	if (!entry) {
-		Entry* entry = doCache(key);
+		Entry* entry = doCache(key, false, lk);
 		return entry;
 	}
 
@@ -535,11 +1180,16 @@ typename ResourceCache<K, Compare, MapHash, KeyEqual>::Entry* ResourceCache<K, C
 }
 
 
-template <class K, class Compare, class MapHash, class KeyEqual>
-typename ResourceCache<K, Compare, MapHash, KeyEqual>::Entry* ResourceCache<K, Compare, MapHash, KeyEqual>::lock(K key, bool lock)
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+typename ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::Entry* ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::lock(K key, bool lock, std::unique_lock<std::mutex>& lk)
 {
 	Entry* entry = cache.lock(key, lock);
 
+	if (lock) {
+		countStat(entry ? CacheStats::CounterHits : CacheStats::CounterMisses);
+	}
+
 	if (!entry) {
 		// This can mean two things: Either the entry was not found in the internal cache, or it was unlocked
 		// successfully in an overfilled cache, which means it is instantly deleted by cache.lock().
@@ -547,7 +1197,7 @@ typename ResourceCache<K, Compare, MapHash, KeyEqual>::Entry* ResourceCache<K, C
 		if (lock) {
 			// We must cache the entry now
 
-			Entry* entry = doCache(key, true);
+			Entry* entry = doCache(key, true, lk);
 			return entry;
 		} else {
 			// Unlocked is the default state of an entry, so we won't have to cache it right now.
@@ -558,16 +1208,21 @@ typename ResourceCache<K, Compare, MapHash, KeyEqual>::Entry* ResourceCache<K, C
 }
 
 
-template <class K, class Compare, class MapHash, class KeyEqual>
-bool ResourceCache<K, Compare, MapHash, KeyEqual>::uncacheEntry(K key)
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+bool ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::uncacheEntry(K key)
 {
+	std::lock_guard<std::mutex> lock(mtx);
 	return cache.remove(key);
 }
 
 
-template <class K, class Compare, class MapHash, class KeyEqual>
-bool ResourceCache<K, Compare, MapHash, KeyEqual>::clear()
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+bool ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::clear()
 {
+	EvictedEntryWriter writer(this);
+	std::lock_guard<std::mutex> lock(mtx);
 	return cache.clear();
 }
 
@@ -576,25 +1231,50 @@ bool ResourceCache<K, Compare, MapHash, KeyEqual>::clear()
 
 
 
-template<class K, class Compare, class MapHash, class KeyEqual>
-typename ResourceCache<K, Compare, MapHash, KeyEqual>::Entry* ResourceCache<K, Compare, MapHash, KeyEqual>::Pointer::getEntry(bool lock)
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+typename ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::Entry* ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::Pointer::getEntry(bool lock)
 {
-	if (lock) {
-		if (!locked) {
-			locked = true;
-			return sharedPtr->getEntry(true);
-		}
+	Entry* entry;
+
+	if (lock  &&  !locked) {
+		locked = true;
+		entry = sharedPtr->getEntry(true);
+	} else {
+		entry = sharedPtr->getEntry();
 	}
 
-	return sharedPtr->getEntry();
+	sharedPtr->cache->predictAccess(sharedPtr->key);
+
+	return entry;
 }
 
 
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+shared_future<typename ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::Entry*> ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::Pointer::getEntryAsync(bool lock)
+{
+	shared_future<Entry*> future;
 
+	if (lock  &&  !locked) {
+		locked = true;
+		future = sharedPtr->getEntryAsync(true, sharedPtr);
+	} else {
+		future = sharedPtr->getEntryAsync(false, sharedPtr);
+	}
+
+	sharedPtr->cache->predictAccess(sharedPtr->key);
+
+	return future;
+}
 
 
-template<class K, class Compare, class MapHash, class KeyEqual>
-ResourceCache<K, Compare, MapHash, KeyEqual>::SharedPointer::~SharedPointer()
+
+
+
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::SharedPointer::~SharedPointer()
 {
 	if (cache) {
 		// ~ResourceCache() sets the 'cache' member of SharedPointer to NULL. This way, it is valid to have cache pointers
@@ -607,63 +1287,164 @@ ResourceCache<K, Compare, MapHash, KeyEqual>::SharedPointer::~SharedPointer()
 }
 
 
-template<class K, class Compare, class MapHash, class KeyEqual>
-typename ResourceCache<K, Compare, MapHash, KeyEqual>::Entry* ResourceCache<K, Compare, MapHash, KeyEqual>::SharedPointer::getEntry(bool lock)
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+typename ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::Entry* ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::SharedPointer::getEntry(bool lock)
 {
+	EvictedEntryWriter writer(cache);
+	std::unique_lock<std::mutex> lk(cache->mtx);
+
 	if (lock) {
 		lockCount++;
 
 		if (lockCount == 1) {
 			// Entry was unlocked before, so it must be really locked now.
-			Entry* oldEntry = entry;
-			entry = cache->lock(key, true);
-
-			if (!oldEntry  &&  entry)
-				entry->registerPointer(this);
-
-			return entry;
+			return setEntry(cache->lock(key, true, lk));
 		}
 	}
 
 	if (entry) {
+		cache->countStat(CacheStats::CounterHits);
 		return entry;
 	}
 
-	entry = cache->getEntry(key);
+	return setEntry(cache->getEntry(key, lk));
+}
+
+
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+shared_future<typename ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::Entry*> ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::SharedPointer::getEntryAsync (
+		bool lock, const shared_ptr<SharedPointer>& self
+) {
+	EvictedEntryWriter writer(cache);
+	std::unique_lock<std::mutex> lk(cache->mtx);
+
+	bool needsLock = false;
+
+	if (lock) {
+		lockCount++;
+		needsLock = (lockCount == 1);
+	}
+
+	if (needsLock) {
+		// Cheap enough to do synchronously if the entry is cached already.
+		Entry* cached = cache->cache.lock(key, true);
 
-	if (entry) {
-		entry->registerPointer(this);
+		if (cached) {
+			cache->countStat(CacheStats::CounterHits);
+			std::promise<Entry*> ready;
+			ready.set_value(setEntry(cached));
+			return ready.get_future().share();
+		}
+	} else {
+		if (entry) {
+			cache->countStat(CacheStats::CounterHits);
+		}
+
+		Entry* cached = entry ? entry : setEntry(cache->cache.item(key));
+
+		if (cached) {
+			std::promise<Entry*> ready;
+			ready.set_value(cached);
+			return ready.get_future().share();
+		}
+
+		typename PendingLoadMap::iterator pit = cache->pendingLoads.find(key);
+
+		if (pit != cache->pendingLoads.end()  &&  pit->second.started) {
+			// Single-flight: Piggyback on the running load. A queued prefetch is taken over by the task below
+			// instead, which doesn't have to wait for the low-priority queue.
+			if (pit->second.prefetch) {
+				pit->second.prefetch = false;
+				cache->numPrefetchHits++;
+			}
+			return pit->second.future;
+		}
 	}
 
-	return entry;
+	shared_ptr<std::promise<Entry*> > promise(new std::promise<Entry*>);
+	shared_future<Entry*> future = promise->get_future().share();
+
+	shared_ptr<SharedPointer> sharedSelf = self;
+
+	cache->submitAsyncTask([sharedSelf, promise, needsLock]() {
+		SharedPointer* sp = sharedSelf.get();
+		EvictedEntryWriter writer(sp->cache);
+		std::unique_lock<std::mutex> lk(sp->cache->mtx);
+
+		try {
+			Entry* e;
+
+			if (needsLock) {
+				e = sp->cache->lock(sp->key, true, lk);
+			} else {
+				// The miss was already counted by getEntryAsync().
+				e = sp->cache->getEntry(sp->key, lk, false);
+			}
+
+			promise->set_value(sp->setEntry(e));
+		} catch (...) {
+			promise->set_exception(std::current_exception());
+		}
+	});
+
+	return future;
 }
 
 
-template<class K, class Compare, class MapHash, class KeyEqual>
-void ResourceCache<K, Compare, MapHash, KeyEqual>::SharedPointer::release()
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+typename ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::Entry* ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::SharedPointer::setEntry(Entry* e)
 {
+	if (e) {
+		entry = e;
+		e->registerPointer(this);
+
+		if (e->prefetchedBy) {
+			e->prefetchedBy = NULL;
+			cache->numPrefetchHits++;
+		}
+	}
+
+	return e;
+}
+
+
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+void ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::SharedPointer::release()
+{
+	EvictedEntryWriter writer(cache);
+	std::unique_lock<std::mutex> lk(cache->mtx);
+
 	lockCount--;
 
 	if (lockCount == 0) {
 		// Entry was locked before, so it must be really unlocked now.
-		Entry* oldEntry = entry;
-		cache->lock(key, false);
+		cache->lock(key, false, lk);
 	}
 }
 
 
-template<class K, class Compare, class MapHash, class KeyEqual>
-void ResourceCache<K, Compare, MapHash, KeyEqual>::SharedPointer::entryDeleted()
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+void ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::SharedPointer::entryDeleted()
 {
 	entry = NULL;
 }
 
 
-template<class K, class Compare, class MapHash, class KeyEqual>
-ResourceCache<K, Compare, MapHash, KeyEqual>::Entry::~Entry()
+template <class K, class Compare, class MapHash, class KeyEqual,
+		template<class, class, class> class EvictionPolicy>
+ResourceCache<K, Compare, MapHash, KeyEqual, EvictionPolicy>::Entry::~Entry()
 {
 	if (sharedPtr)
 		sharedPtr->entryDeleted();
+
+	// Entries are only deleted by the cache, so its mutex is locked here.
+	if (prefetchedBy)
+		prefetchedBy->numWastedPrefetches++;
 }
 
 #endif /* RESOURCECACHE_H_ */
@@ -3,11 +3,15 @@
 
 #include <nxcommon/config.h>
 #include "util.h"
+#include "MirroredMemory.h"
+#include "ringbuf.h"
 #include <cstring>
 #include <algorithm>
 #include <memory>
 #include <functional>
 #include <atomic>
+#include <limits>
+#include <type_traits>
 
 using std::unique_ptr;
 
@@ -26,6 +30,17 @@ using std::unique_ptr;
  *
  * This class allows one reader in parallel with one writer at maximum. Behavior is UNDEFINED if
  * there are multiple parallel readers, multiple parallel writers, or both.
+ *
+ * Apart from the copying write() and read(), the buffer contents can be accessed in place: reserveWrite()
+ * returns a span of free elements that the writer fills and then publishes with commitWrite(), and
+ * peekRead() returns a span of readable elements that the reader releases with commitRead(). Normally
+ * these spans end at the end of the backing buffer, so two steps may be needed around the wrap point.
+ * A buffer created with createMirrored() maps its memory twice back-to-back, so that its spans are always
+ * as large as writeSize() or readSize(), and can be handed directly to e.g. ::read(), ::write() or parsers.
+ *
+ * Instead of polling isEmpty() or isFull(), the reader can block in readWait() and the writer in writeWait().
+ * Sleeping threads are only woken when the buffer goes from empty to non-empty or from full to non-full (see
+ * ringbuf_event_t), so write() and read() stay lock-free while nobody is waiting.
  */
 template <typename T, typename SizeType = size_t>
 class RingBuffer
@@ -33,6 +48,41 @@ class RingBuffer
 public:
 	typedef SizeType size_type;
 
+	/**
+	 * A contiguous range of elements inside the buffer, as returned by reserveWrite() and peekRead().
+	 */
+	class Span
+	{
+	public:
+		Span() : mdata(NULL), msize(0) {}
+		Span(T* data, size_type size) : mdata(data), msize(size) {}
+
+		T* data() const { return mdata; }
+		size_type size() const { return msize; }
+		bool isEmpty() const { return msize == 0; }
+
+		T* begin() const { return mdata; }
+		T* end() const { return mdata + msize; }
+		T& operator[](size_type idx) const { return mdata[idx]; }
+
+	private:
+		T* mdata;
+		size_type msize;
+	};
+
+public:
+	/**
+	 * Create a buffer of at least the given capacity whose memory is mapped twice back-to-back (see
+	 * AllocateMirroredMemory()). The capacity is rounded up so that the buffer fills whole pages.
+	 *
+	 * If mirrored memory is not available, this returns a normal buffer of exactly minCapacity elements.
+	 * Use isMirrored() to find out which one you got.
+	 *
+	 * Only trivially copyable element types are allowed: The elements live in raw, doubly mapped
+	 * memory and are never constructed or destroyed.
+	 */
+	static RingBuffer createMirrored(size_type minCapacity);
+
 public:
 	// TODO: More constructors. Like, really...
 	// TODO: Consider allowing copy-construction (but which semantics? deep copy?)
@@ -68,6 +118,8 @@ public:
 
 	bool isNull() const;
 
+	bool isMirrored() const { return mirrored; }
+
 	bool isEmpty() const;
 	bool isFull() const;
 
@@ -85,12 +137,50 @@ public:
 
 	size_type advanceWrite(size_type len);
 
+	/**
+	 * Return a span of at most len free elements starting at the current write position. The elements
+	 * can be written in place and are published to the reader by commitWrite(). The span may be shorter
+	 * than writeSize() if the buffer is not mirrored and the free space wraps around.
+	 */
+	Span reserveWrite(size_type len = std::numeric_limits<size_type>::max());
+
+	/**
+	 * Publish the first len elements of a span returned by reserveWrite(). Same as advanceWrite().
+	 */
+	size_type commitWrite(size_type len) { return advanceWrite(len); }
+
 	size_type read(T* data, size_type len);
 	T read() { T d; read(&d, 1); return d; }
 
 	size_type advanceRead(size_type len);
 	size_type skip(size_type len) { return advanceRead(len); }
 
+	/**
+	 * Return a span of at most len readable elements starting at the current read position, without
+	 * copying them. They stay valid until they are released by commitRead(). The span may be shorter
+	 * than readSize() if the buffer is not mirrored and the contents wrap around.
+	 */
+	Span peekRead(size_type len = std::numeric_limits<size_type>::max());
+
+	/**
+	 * Release the first len elements of a span returned by peekRead(). Same as advanceRead().
+	 */
+	size_type commitRead(size_type len) { return advanceRead(len); }
+
+#ifdef _NX_HAVE_ATOMICS
+	/**
+	 * Block until there is at least one element to read, or the timeout (in microseconds) expires. A negative
+	 * timeout waits forever. Returns true if there is something to read.
+	 */
+	bool readWait(int64_t timeoutUs = -1) { return ringbuf_event_wait(&readEvent, &canRead, this, timeoutUs); }
+
+	/**
+	 * Block until there is space for at least one element, or the timeout (in microseconds) expires. A negative
+	 * timeout waits forever. Returns true if there is space to write.
+	 */
+	bool writeWait(int64_t timeoutUs = -1) { return ringbuf_event_wait(&writeEvent, &canWrite, this, timeoutUs); }
+#endif
+
 	size_type peek(T* data, size_type len);
 	T& peek();
 
@@ -104,12 +194,27 @@ public:
 
 	RingBuffer& operator=(const RingBuffer&) = delete;
 
+private:
+	void initEvents();
+	void commitWrittenCount(size_type len);
+	void commitReadCount(size_type len);
+
+#ifdef _NX_HAVE_ATOMICS
+	static bool canRead(void* rbuf) { return !((RingBuffer*) rbuf)->isEmpty(); }
+	static bool canWrite(void* rbuf) { return !((RingBuffer*) rbuf)->isFull(); }
+#endif
+
 private:
 	unique_ptr<T[], std::function<void (T*)>> buf;
 	size_type mcapacity;
 	size_type readOffs;
 	size_type writeOffs;
 	std::atomic<size_type> mcount; // Used as a general memory ordering atomic using release/acquire
+	bool mirrored;
+#ifdef _NX_HAVE_ATOMICS
+	ringbuf_event_t readEvent;
+	ringbuf_event_t writeEvent;
+#endif
 };
 
 
@@ -117,9 +222,34 @@ private:
 
 
 
+template <typename T, typename SizeType>
+RingBuffer<T, SizeType> RingBuffer<T, SizeType>::createMirrored(size_type minCapacity)
+{
+	static_assert(std::is_trivially_copyable<T>::value,
+			"Mirrored RingBuffer requires a trivially copyable element type");
+
+	size_t size;
+	T* mem = (T*) AllocateMirroredMemory((size_t) minCapacity * sizeof(T), sizeof(T), &size);
+
+	if (mem  &&  size / sizeof(T) > (size_t) std::numeric_limits<size_type>::max()) {
+		// Rounding up to whole pages overflowed size_type
+		FreeMirroredMemory(mem, size);
+		mem = NULL;
+	}
+
+	if (!mem) {
+		return RingBuffer(minCapacity);
+	}
+
+	RingBuffer rbuf(mem, (size_type) (size / sizeof(T)), [size](T* p) { FreeMirroredMemory(p, size); });
+	rbuf.mirrored = true;
+	return rbuf;
+}
+
+
 template <typename T, typename SizeType>
 RingBuffer<T, SizeType>::RingBuffer()
-		: buf(), mcapacity(0), readOffs(1), mcount(0)
+		: buf(), mcapacity(0), readOffs(1), mcount(0), mirrored(false)
 {
 	// NOTE: Other members need not be initialized. mcapacity and mcount are enough to make both
 	// readSize() and writeSize() return 0, effectively making all modifying members of this
@@ -127,42 +257,95 @@ RingBuffer<T, SizeType>::RingBuffer()
 	// implementing isNull(): To distinguish an actual null RingBuffer from e.g. a "normal" one
 	// with capacity 0 or a null backend buffer. No idea if that's useful, but that's how it is.
 	// buf should be set to null, because we might return a pointer to it at some point in time.
+	initEvents();
 }
 
 
 template <typename T, typename SizeType>
 RingBuffer<T, SizeType>::RingBuffer(RingBuffer&& other)
-		: buf(other.buf), mcapacity(other.mcapacity), readOffs(other.readOffs), writeOffs(other.writeOffs),
-		  mcount(other.mcount.load(std::memory_order_acquire))
+		: buf(std::move(other.buf)), mcapacity(other.mcapacity), readOffs(other.readOffs), writeOffs(other.writeOffs),
+		  mcount(other.mcount.load(std::memory_order_acquire)), mirrored(other.mirrored)
 {
 	// Set same values as default constructor would set
 	//other.buf = nullptr; // Done automatically by move-constructor of unique_ptr<T[]>
 	other.mcapacity = 0;
 	other.readOffs = 1;
 	other.mcount = 0;
+	other.mirrored = false;
+
+	initEvents();
 }
 
 
 template <typename T, typename SizeType>
 RingBuffer<T, SizeType>::RingBuffer(T* buf, size_type capacity)
-		: buf(buf, NopDeleter<T>()), mcapacity(capacity), readOffs(0), writeOffs(0), mcount(0)
+		: buf(buf, NopDeleter<T>()), mcapacity(capacity), readOffs(0), writeOffs(0), mcount(0), mirrored(false)
 {
+	initEvents();
 }
 
 
 template <typename T, typename SizeType>
 template <typename Deleter>
 RingBuffer<T, SizeType>::RingBuffer(T* buf, size_type capacity, Deleter del)
-		: buf(buf, del), mcapacity(capacity), readOffs(0), writeOffs(0), mcount(0)
+		: buf(buf, del), mcapacity(capacity), readOffs(0), writeOffs(0), mcount(0), mirrored(false)
 {
-
+	initEvents();
 }
 
 
 template <typename T, typename SizeType>
 RingBuffer<T, SizeType>::RingBuffer(size_type capacity)
-		: buf(new T[capacity], std::default_delete<T[]>()), mcapacity(capacity), readOffs(0), writeOffs(0), mcount(0)
+		: buf(new T[capacity], std::default_delete<T[]>()), mcapacity(capacity), readOffs(0), writeOffs(0), mcount(0),
+		  mirrored(false)
 {
+	initEvents();
+}
+
+
+template <typename T, typename SizeType>
+void RingBuffer<T, SizeType>::initEvents()
+{
+#ifdef _NX_HAVE_ATOMICS
+	ringbuf_event_init(&readEvent);
+	ringbuf_event_init(&writeEvent);
+#endif
+}
+
+
+template <typename T, typename SizeType>
+void RingBuffer<T, SizeType>::commitWrittenCount(size_type len)
+{
+	// Make sure another thread that reads mcount (in parallel read() or sequential write()) will
+	// also see all changes before this call
+	size_type oldCount = mcount.fetch_add(len, std::memory_order_release);
+
+#ifdef _NX_HAVE_ATOMICS
+	// Only the empty -> non-empty transition can end a readWait()
+	if (oldCount == 0  &&  len != 0) {
+		ringbuf_event_notify(&readEvent);
+	}
+#else
+	(void) oldCount;
+#endif
+}
+
+
+template <typename T, typename SizeType>
+void RingBuffer<T, SizeType>::commitReadCount(size_type len)
+{
+	// Make sure another thread that reads mcount (in sequential read() or parallel write()) will
+	// also see all changes before this call
+	size_type oldCount = mcount.fetch_sub(len, std::memory_order_release);
+
+#ifdef _NX_HAVE_ATOMICS
+	// Only the full -> non-full transition can end a writeWait()
+	if (oldCount == mcapacity  &&  len != 0) {
+		ringbuf_event_notify(&writeEvent);
+	}
+#else
+	(void) oldCount;
+#endif
 }
 
 
@@ -228,9 +411,7 @@ typename RingBuffer<T, SizeType>::size_type RingBuffer<T, SizeType>::write(const
 
 	writeOffs = (writeOffs + len) % mcapacity;
 
-	// Make sure another thread that reads mcount (in parallel read() or sequential write()) will
-	// also see all changes above
-	mcount.fetch_add(len, std::memory_order_release);
+	commitWrittenCount(len);
 
 	return len;
 }
@@ -246,12 +427,26 @@ typename RingBuffer<T, SizeType>::size_type RingBuffer<T, SizeType>::advanceWrit
 
 	// A sequential write()/advanceWrite() in another thread must be guaranteed to see writeOffs updated, too.
 	// This is why we need "release" instead of "relaxed".
-	mcount.fetch_add(len, std::memory_order_release);
+	commitWrittenCount(len);
 
 	return len;
 }
 
 
+template <typename T, typename SizeType>
+typename RingBuffer<T, SizeType>::Span RingBuffer<T, SizeType>::reserveWrite(size_type len)
+{
+	// Acquires mcount, making sure the reader is done with the elements we hand out
+	len = std::min(len, writeSize());
+
+	if (!mirrored) {
+		len = std::min(len, (size_type) (mcapacity - writeOffs));
+	}
+
+	return Span(buf.get() + writeOffs, len);
+}
+
+
 template <typename T, typename SizeType>
 typename RingBuffer<T, SizeType>::size_type RingBuffer<T, SizeType>::read(T* data, size_type len)
 {
@@ -259,9 +454,7 @@ typename RingBuffer<T, SizeType>::size_type RingBuffer<T, SizeType>::read(T* dat
 
 	readOffs = (readOffs + len) % mcapacity;
 
-	// Make sure another thread that reads mcount (in sequential read() or parallel write()) will
-	// also see all changes above
-	mcount.fetch_sub(len, std::memory_order_release);
+	commitReadCount(len);
 
 	return len;
 }
@@ -276,12 +469,26 @@ typename RingBuffer<T, SizeType>::size_type RingBuffer<T, SizeType>::advanceRead
 
 	// A sequential read()/advanceRead() in another thread must be guaranteed to see readOffs updated, too.
 	// This is why we need "release" instead of "relaxed".
-	mcount.fetch_sub(len, std::memory_order_release);
+	commitReadCount(len);
 
 	return len;
 }
 
 
+template <typename T, typename SizeType>
+typename RingBuffer<T, SizeType>::Span RingBuffer<T, SizeType>::peekRead(size_type len)
+{
+	// Acquires mcount, making sure all changes of previous write()/read() calls are visible
+	len = std::min(len, readSize());
+
+	if (!mirrored) {
+		len = std::min(len, (size_type) (mcapacity - readOffs));
+	}
+
+	return Span(buf.get() + readOffs, len);
+}
+
+
 template <typename T, typename SizeType>
 typename RingBuffer<T, SizeType>::size_type RingBuffer<T, SizeType>::peek(T* data, size_type len)
 {
@@ -317,6 +524,10 @@ void RingBuffer<T, SizeType>::clear()
 	// one of them right after this method ends. In this case, we will ensure that the other thread sees
 	// all changes above when reading mcount.
 	mcount.store(0, std::memory_order_release);
+
+#ifdef _NX_HAVE_ATOMICS
+	ringbuf_event_notify(&writeEvent);
+#endif
 }
 
 
@@ -328,12 +539,14 @@ RingBuffer<T, SizeType>& RingBuffer<T, SizeType>::operator=(RingBuffer&& other)
 	readOffs = other.readOffs;
 	writeOffs = other.writeOffs;
 	mcount = other.mcount.load(std::memory_order_acquire);
+	mirrored = other.mirrored;
 
 	// Set same values as default constructor would set
 	//other.buf = nullptr; // Done automatically by move-assignment of unique_ptr<T[]>
 	other.mcapacity = 0;
 	other.readOffs = 1;
 	other.mcount = 0;
+	other.mirrored = false;
 
 	return *this;
 }
@@ -0,0 +1,298 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_SPSCRINGBUFFER_H_
+#define NXCOMMON_SPSCRINGBUFFER_H_
+
+#include <nxcommon/config.h>
+#include "util.h"
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <functional>
+#include <atomic>
+
+using std::unique_ptr;
+
+
+
+/**	\brief High-throughput ring buffer for exactly one reader and one writer.
+ *
+ * 	This has the same interface and the same threading rules as RingBuffer, but a different synchronization
+ * 	scheme: RingBuffer synchronizes through a shared element count that both sides modify on every call, so its
+ * 	cache line constantly moves between the reader's and the writer's cores. Here, the writer owns the write
+ * 	position and the reader owns the read position, each on its own cache line. Each side also caches the other
+ * 	side's position and only reloads it when the cached value says that the buffer is full (or empty), so in the
+ * 	steady state, the two sides rarely touch each other's cache lines.
+ *
+ * 	If PowerOfTwo is true, the capacity is rounded up to a power of two, and positions are wrapped by masking.
+ * 	Otherwise, positions run from 0 to 2*capacity-1 and wrap with a compare and subtract, which is nearly as
+ * 	cheap. T must be trivially copyable, like for RingBuffer.
+ *
+ * 	@see ringbuf_spsc_t for the C version.
+ */
+template <typename T, typename SizeType = size_t, bool PowerOfTwo = false>
+class SPSCRingBuffer
+{
+public:
+	typedef SizeType size_type;
+
+public:
+	/**
+	 * Write-aliasing constructor (class does not free memory). If PowerOfTwo is true, capacity must be a power
+	 * of two.
+	 */
+	SPSCRingBuffer(T* buf, size_type capacity);
+
+	/**
+	 * Create a new buffer of given capacity, owned by the new object.
+	 */
+	SPSCRingBuffer(size_type capacity);
+
+	SPSCRingBuffer(const SPSCRingBuffer&) = delete;
+
+	bool isEmpty() const { return readSize() == 0; }
+	bool isFull() const { return readSize() == mcapacity; }
+
+	size_type capacity() const { return mcapacity; }
+	size_type getCapacity() const { return capacity(); }
+
+	size_type readSize() const;
+	size_type getReadSize() const { return readSize(); }
+
+	size_type writeSize() const { return mcapacity - readSize(); }
+	size_type getWriteSize() const { return writeSize(); }
+
+	// Writer side
+
+	size_type write(const T* data, size_type len);
+	bool write(const T& elem) { return write(&elem, 1) == 1; }
+
+	size_type advanceWrite(size_type len);
+
+	// Reader side
+
+	size_type read(T* data, size_type len);
+	T read() { T d; read(&d, 1); return d; }
+
+	size_type advanceRead(size_type len);
+	size_type skip(size_type len) { return advanceRead(len); }
+
+	size_type peek(T* data, size_type len);
+
+	SPSCRingBuffer& operator=(const SPSCRingBuffer&) = delete;
+
+private:
+	static size_type roundCapacity(size_type capacity);
+
+	size_type posDiff(size_type a, size_type b) const
+	{
+		if (PowerOfTwo) {
+			return (size_type) (a - b);
+		}
+		return a >= b ? a - b : a + 2*mcapacity - b;
+	}
+
+	size_type posAdd(size_type pos, size_type num) const
+	{
+		if (PowerOfTwo) {
+			return (size_type) (pos + num);
+		}
+		pos += num;
+		return pos >= 2*mcapacity ? pos - 2*mcapacity : pos;
+	}
+
+	size_type posIndex(size_type pos) const
+	{
+		if (PowerOfTwo) {
+			return pos & (mcapacity-1);
+		}
+		return pos >= mcapacity ? pos - mcapacity : pos;
+	}
+
+	size_type prepareWrite(size_type& len);
+	size_type prepareRead(size_type& len);
+
+private:
+	unique_ptr<T[], std::function<void (T*)>> buf;
+	size_type mcapacity;
+
+	// Owned by the writer
+	alignas(64) std::atomic<size_type> writePos;
+	size_type cachedReadPos;
+
+	// Owned by the reader
+	alignas(64) std::atomic<size_type> readPos;
+	size_type cachedWritePos;
+
+	char pad[64 - sizeof(std::atomic<size_type>) - sizeof(size_type)];
+};
+
+
+
+
+
+
+template <typename T, typename SizeType, bool PowerOfTwo>
+SPSCRingBuffer<T, SizeType, PowerOfTwo>::SPSCRingBuffer(T* buf, size_type capacity)
+		: buf(buf, NopDeleter<T>()), mcapacity(capacity), writePos(0), cachedReadPos(0), readPos(0),
+		  cachedWritePos(0)
+{
+}
+
+
+template <typename T, typename SizeType, bool PowerOfTwo>
+SPSCRingBuffer<T, SizeType, PowerOfTwo>::SPSCRingBuffer(size_type capacity)
+		: buf(new T[roundCapacity(capacity)], std::default_delete<T[]>()), mcapacity(roundCapacity(capacity)),
+		  writePos(0), cachedReadPos(0), readPos(0), cachedWritePos(0)
+{
+}
+
+
+template <typename T, typename SizeType, bool PowerOfTwo>
+typename SPSCRingBuffer<T, SizeType, PowerOfTwo>::size_type
+SPSCRingBuffer<T, SizeType, PowerOfTwo>::roundCapacity(size_type capacity)
+{
+	if (!PowerOfTwo) {
+		return capacity;
+	}
+
+	size_type c = 1;
+	while (c < capacity) {
+		c *= 2;
+	}
+	return c;
+}
+
+
+template <typename T, typename SizeType, bool PowerOfTwo>
+typename SPSCRingBuffer<T, SizeType, PowerOfTwo>::size_type SPSCRingBuffer<T, SizeType, PowerOfTwo>::readSize() const
+{
+	size_type r = readPos.load(std::memory_order_acquire);
+	size_type w = writePos.load(std::memory_order_acquire);
+	return posDiff(w, r);
+}
+
+
+template <typename T, typename SizeType, bool PowerOfTwo>
+typename SPSCRingBuffer<T, SizeType, PowerOfTwo>::size_type
+SPSCRingBuffer<T, SizeType, PowerOfTwo>::prepareWrite(size_type& len)
+{
+	size_type w = writePos.load(std::memory_order_relaxed);
+	size_type numFree = mcapacity - posDiff(w, cachedReadPos);
+
+	if (numFree < len) {
+		// Acquire makes sure that the reader is done with the slots it released
+		cachedReadPos = readPos.load(std::memory_order_acquire);
+		numFree = mcapacity - posDiff(w, cachedReadPos);
+	}
+
+	len = std::min(len, numFree);
+	return w;
+}
+
+
+template <typename T, typename SizeType, bool PowerOfTwo>
+typename SPSCRingBuffer<T, SizeType, PowerOfTwo>::size_type
+SPSCRingBuffer<T, SizeType, PowerOfTwo>::prepareRead(size_type& len)
+{
+	size_type r = readPos.load(std::memory_order_relaxed);
+	size_type numFilled = posDiff(cachedWritePos, r);
+
+	if (numFilled < len) {
+		// Acquire makes sure that the data of the new elements is visible
+		cachedWritePos = writePos.load(std::memory_order_acquire);
+		numFilled = posDiff(cachedWritePos, r);
+	}
+
+	len = std::min(len, numFilled);
+	return r;
+}
+
+
+template <typename T, typename SizeType, bool PowerOfTwo>
+typename SPSCRingBuffer<T, SizeType, PowerOfTwo>::size_type
+SPSCRingBuffer<T, SizeType, PowerOfTwo>::write(const T* data, size_type len)
+{
+	size_type w = prepareWrite(len);
+	size_type offs = posIndex(w);
+
+	size_type len1 = std::min(len, (size_type) (mcapacity - offs));
+	size_type len2 = len - len1;
+
+	memcpy(buf.get() + offs, data, len1 * sizeof(T));
+	memcpy(buf.get(), data+len1, len2 * sizeof(T));
+
+	writePos.store(posAdd(w, len), std::memory_order_release);
+
+	return len;
+}
+
+
+template <typename T, typename SizeType, bool PowerOfTwo>
+typename SPSCRingBuffer<T, SizeType, PowerOfTwo>::size_type
+SPSCRingBuffer<T, SizeType, PowerOfTwo>::advanceWrite(size_type len)
+{
+	size_type w = prepareWrite(len);
+	writePos.store(posAdd(w, len), std::memory_order_release);
+	return len;
+}
+
+
+template <typename T, typename SizeType, bool PowerOfTwo>
+typename SPSCRingBuffer<T, SizeType, PowerOfTwo>::size_type
+SPSCRingBuffer<T, SizeType, PowerOfTwo>::peek(T* data, size_type len)
+{
+	size_type r = prepareRead(len);
+	size_type offs = posIndex(r);
+
+	size_type len1 = std::min(len, (size_type) (mcapacity - offs));
+	size_type len2 = len - len1;
+
+	memcpy(data, buf.get() + offs, len1 * sizeof(T));
+	memcpy(data + len1, buf.get(), len2 * sizeof(T));
+
+	return len;
+}
+
+
+template <typename T, typename SizeType, bool PowerOfTwo>
+typename SPSCRingBuffer<T, SizeType, PowerOfTwo>::size_type
+SPSCRingBuffer<T, SizeType, PowerOfTwo>::read(T* data, size_type len)
+{
+	len = peek(data, len);
+	readPos.store(posAdd(readPos.load(std::memory_order_relaxed), len), std::memory_order_release);
+	return len;
+}
+
+
+template <typename T, typename SizeType, bool PowerOfTwo>
+typename SPSCRingBuffer<T, SizeType, PowerOfTwo>::size_type
+SPSCRingBuffer<T, SizeType, PowerOfTwo>::advanceRead(size_type len)
+{
+	size_type r = prepareRead(len);
+	readPos.store(posAdd(r, len), std::memory_order_release);
+	return len;
+}
+
+
+#endif /* NXCOMMON_SPSCRINGBUFFER_H_ */
@@ -0,0 +1,158 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_SHAREDBUFFERHEADER_H_
+#define NXCOMMON_SHAREDBUFFERHEADER_H_
+
+#include <nxcommon/config.h>
+#include <cstddef>
+#include <new>
+#include <atomic>
+
+
+
+/**	\brief The reference-counted header of the heap storage of an AbstractSharedBuffer.
+ *
+ * 	Every heap buffer has exactly one header, which holds an atomic reference count for all AbstractSharedBuffer objects
+ * 	that share the buffer. Buffers allocated by AbstractSharedBuffer itself are stored in the same allocation, directly
+ * 	behind the header (see create()). Buffers that are owned or aliased externally get a separate header that knows how
+ * 	to free them (see ExternalSharedBufferHeader).
+ *
+ * 	The reference count is manipulated with atomic operations, so different AbstractSharedBuffer objects sharing the same
+ * 	header can be used (and modified) concurrently from different threads. A single AbstractSharedBuffer object is not
+ * 	thread-safe, just like any other standard library object.
+ */
+struct SharedBufferHeader
+{
+	typedef void (*ReleaseFunc)(SharedBufferHeader* header);
+
+	/**	\brief The size of the header including padding, which is the offset of the data in create()'d buffers.
+	 */
+	static const size_t PaddedSize = 32;
+
+	/**	\brief Allocate a header with space for the given number of data bytes directly behind it.
+	 *
+	 * 	If a BufferArena is active in the calling thread, the memory is taken from the arena. The reference count of the
+	 * 	new header is 1.
+	 */
+	static SharedBufferHeader* create(size_t dataSize);
+
+	SharedBufferHeader(ReleaseFunc release, bool readOnly, bool interned = false)
+			: refcount(1), release(release), readOnly(readOnly), interned(interned), arena(false) {}
+
+	/**	\brief Return the data of a buffer that was allocated with create().
+	 */
+	void* getData() { return ((char*) this) + PaddedSize; }
+
+	void ref() { refcount.fetch_add(1, std::memory_order_relaxed); }
+
+	/**	\brief Drop a reference, and release the header and the buffer if it was the last one.
+	 */
+	void unref()
+	{
+		// The release ordering makes sure that all accesses to the buffer through this reference happen before it is
+		// freed, or before another thread sees the buffer as unique and writes to it. The matching acquire is part of
+		// the same operation for the former case (a standalone fence would do, but ThreadSanitizer doesn't understand
+		// fences), and in isUnique() for the latter.
+		if (refcount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			release(this);
+		}
+	}
+
+	/**	\brief Determine whether the caller holds the only reference and may write to the buffer.
+	 *
+	 * 	Read-only buffers are never unique.
+	 */
+	bool isUnique() const { return !readOnly  &&  refcount.load(std::memory_order_acquire) == 1; }
+
+	/**	\brief Determine whether the buffer was allocated by a BufferArena that is not in scope in the calling thread.
+	 *
+	 * 	Copies of such buffers get their own storage instead of sharing this one, so that they don't keep the arena's
+	 * 	memory alive.
+	 */
+	bool isEscapedFromArena() const { return arena  &&  isOutsideArenaScope(); }
+
+	std::atomic<size_t> refcount;
+	ReleaseFunc release;
+	bool readOnly;
+
+	// True for an InternedSharedBufferHeader
+	bool interned;
+
+	// True if the header was allocated from a BufferArena
+	bool arena;
+
+private:
+	static void releaseCreated(SharedBufferHeader* header);
+
+	// Implemented in BufferArena.cpp
+	bool isOutsideArenaScope() const;
+};
+
+
+/**	\brief A SharedBufferHeader for a buffer that isn't allocated behind the header.
+ *
+ * 	The buffer is freed by calling the deleter functor when the last reference is dropped. For aliased buffers, that's
+ * 	a NopDeleter.
+ */
+template <typename UnitT, typename Deleter>
+struct ExternalSharedBufferHeader : public SharedBufferHeader
+{
+	ExternalSharedBufferHeader(UnitT* data, Deleter del, bool readOnly)
+			: SharedBufferHeader(&releaseExternal, readOnly), data(data), del(del) {}
+
+	UnitT* data;
+	Deleter del;
+
+private:
+	static void releaseExternal(SharedBufferHeader* header)
+	{
+		ExternalSharedBufferHeader* ext = static_cast<ExternalSharedBufferHeader*>(header);
+		ext->del(ext->data);
+		delete ext;
+	}
+};
+
+
+/**	\brief The header of a canonical, read-only buffer in the string intern table (see CString::intern()).
+ *
+ * 	The data is stored directly behind the header. The intern table only holds a weak pointer to the header, which it
+ * 	drops when the last reference is released.
+ */
+struct InternedSharedBufferHeader : public SharedBufferHeader
+{
+	InternedSharedBufferHeader(ReleaseFunc release, size_t size, size_t hash)
+			: SharedBufferHeader(release, true, true), size(size), hash(hash), next(NULL) {}
+
+	void* getData() { return this+1; }
+	const void* getData() const { return this+1; }
+
+	// Size of the data in bytes, excluding the terminator
+	size_t size;
+
+	size_t hash;
+
+	// Next entry in the same bucket of the intern table
+	InternedSharedBufferHeader* next;
+};
+
+#endif /* NXCOMMON_SHAREDBUFFERHEADER_H_ */
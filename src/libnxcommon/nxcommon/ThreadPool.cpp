@@ -0,0 +1,114 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "ThreadPool.h"
+#include <algorithm>
+
+
+
+ThreadPool::ThreadPool(unsigned int numThreads)
+		: numRunning(0), stopping(false)
+{
+	if (numThreads == 0) {
+		numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	threads.reserve(numThreads);
+
+	for (unsigned int i = 0 ; i < numThreads ; i++) {
+		threads.emplace_back(&ThreadPool::run, this);
+	}
+}
+
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+
+	taskCv.notify_all();
+
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+
+void ThreadPool::submit(const Task& task, Priority priority)
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+
+		if (priority == PriorityLow) {
+			lowPriorityTasks.push_back(task);
+		} else {
+			tasks.push_back(task);
+		}
+	}
+
+	taskCv.notify_one();
+}
+
+
+void ThreadPool::waitIdle()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	idleCv.wait(lock, [this]() { return tasks.empty()  &&  lowPriorityTasks.empty()  &&  numRunning == 0; });
+}
+
+
+void ThreadPool::run()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+
+	while (true) {
+		taskCv.wait(lock, [this]() { return stopping  ||  !tasks.empty()  ||  !lowPriorityTasks.empty(); });
+
+		deque<Task>& queue = tasks.empty() ? lowPriorityTasks : tasks;
+
+		if (queue.empty()) {
+			// Only reached when stopping and all tasks are done
+			break;
+		}
+
+		Task task = std::move(queue.front());
+		queue.pop_front();
+		numRunning++;
+
+		lock.unlock();
+
+		try {
+			task();
+		} catch (...) {
+		}
+
+		lock.lock();
+
+		numRunning--;
+
+		if (tasks.empty()  &&  lowPriorityTasks.empty()  &&  numRunning == 0) {
+			idleCv.notify_all();
+		}
+	}
+}
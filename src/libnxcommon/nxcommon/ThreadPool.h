@@ -0,0 +1,98 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_THREADPOOL_H_
+#define NXCOMMON_THREADPOOL_H_
+
+#include <nxcommon/config.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+using std::vector;
+using std::deque;
+
+
+
+/**	\brief A fixed-size pool of worker threads executing tasks in FIFO order.
+ *
+ * 	Tasks can be submitted with low priority, in which case they are only run when no normal priority task
+ * 	is waiting. This is useful for speculative work like prefetching.
+ */
+class ThreadPool
+{
+public:
+	typedef std::function<void ()> Task;
+
+	enum Priority
+	{
+		PriorityNormal,
+		PriorityLow
+	};
+
+public:
+	/**	\brief Creates a pool and starts its worker threads.
+	 *
+	 * 	@param numThreads The number of worker threads. If 0, the number of hardware threads is used.
+	 */
+	ThreadPool(unsigned int numThreads = 0);
+
+	/**	\brief Executes all remaining tasks and stops the worker threads.
+	 */
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/**	\brief Enqueues a task to be executed by one of the worker threads.
+	 *
+	 * 	Exceptions thrown by the task are silently dropped. Use std::packaged_task if you need them.
+	 *
+	 * 	@param task The task.
+	 * 	@param priority The priority. Tasks of the same priority are executed in FIFO order.
+	 */
+	void submit(const Task& task, Priority priority = PriorityNormal);
+
+	/**	\brief Blocks until the task queue is empty and no task is running anymore.
+	 */
+	void waitIdle();
+
+	unsigned int getThreadCount() const { return (unsigned int) threads.size(); }
+
+private:
+	void run();
+
+private:
+	vector<std::thread> threads;
+	deque<Task> tasks;
+	deque<Task> lowPriorityTasks;
+	std::mutex mtx;
+	std::condition_variable taskCv;
+	std::condition_variable idleCv;
+	unsigned int numRunning;
+	bool stopping;
+};
+
+#endif /* NXCOMMON_THREADPOOL_H_ */
@@ -21,6 +21,7 @@
  */
 
 #include "UString.h"
+#include "encoding.h"
 
 
 
@@ -39,6 +40,19 @@ UString UString::fromUTF8(const CString& utf8)
 	UErrorCode errcode = U_ZERO_ERROR;
 	size_t utf8Len = utf8.length();
 	UChar* utf16 = new UChar[utf8Len+1];
+
+#ifdef NXCOMMON_LITTLE_ENDIAN
+	// UChar is in host byte order, so TranscodeNative()'s UTF-16LE can be written to it directly. It is a lot
+	// faster than ICU for mostly-ASCII strings. Invalid input is left to ICU, to keep its error behavior.
+	TranscodeResult res = TranscodeNative(utf8.get(), utf8Len, (char*) utf16, utf8Len*sizeof(UChar),
+			UTF8, UTF16);
+	if (res.status == TranscodeOK) {
+		len = (int32_t) (res.destBytes / sizeof(UChar));
+		utf16[len] = 0;
+		return UString::from(utf16, len, utf8Len+1);
+	}
+#endif
+
 	u_strFromUTF8(utf16, utf8Len+1, &len, utf8.get(), utf8Len, &errcode);
 	return UString::from(utf16, len, utf8Len+1);
 }
@@ -67,12 +81,12 @@ UString& UString::lower(const CString& locale)
 	ensureUniqueness();
 	UErrorCode errcode = U_ZERO_ERROR;
 
-	int32_t len = u_strToLower(d.get(), mcapacity, d.get(), msize, locale.get(), &errcode);
+	int32_t len = u_strToLower(mdata, mcapacity, mdata, msize, locale.get(), &errcode);
 
 	if (len > mcapacity) {
 		grow(len);
 		errcode = U_ZERO_ERROR;
-		u_strToLower(d.get(), mcapacity, cpy.d.get(), cpy.msize, locale.get(), &errcode);
+		u_strToLower(mdata, mcapacity, cpy.mdata, cpy.msize, locale.get(), &errcode);
 	}
 
 	msize = len;
@@ -88,12 +102,12 @@ UString& UString::upper(const CString& locale)
 	ensureUniqueness();
 	UErrorCode errcode = U_ZERO_ERROR;
 
-	int32_t len = u_strToUpper(d.get(), mcapacity, d.get(), msize, locale.get(), &errcode);
+	int32_t len = u_strToUpper(mdata, mcapacity, mdata, msize, locale.get(), &errcode);
 
 	if (len > mcapacity) {
 		grow(len);
 		errcode = U_ZERO_ERROR;
-		u_strToUpper(d.get(), mcapacity, cpy.d.get(), cpy.msize, locale.get(), &errcode);
+		u_strToUpper(mdata, mcapacity, cpy.mdata, cpy.msize, locale.get(), &errcode);
 	}
 
 	msize = len;
@@ -112,7 +126,7 @@ UString& UString::ltrim()
 	int32_t len = msize;
 	int32_t i = 0;
 	UChar32 c;
-	UChar* str = d.get();
+	UChar* str = mdata;
 	int32_t begin = 0;
 
 	for (;;) {
@@ -144,7 +158,7 @@ UString& UString::rtrim()
 
 	int32_t i = msize;
 	UChar32 c;
-	UChar* str = d.get();
+	UChar* str = mdata;
 	int32_t len = 0;
 
 	for (;;) {
@@ -174,7 +188,19 @@ size_t UString::toUTF8(char* dest, size_t destSize) const
 {
 	UErrorCode errcode = U_ZERO_ERROR;
 	int32_t destLen;
-	u_strToUTF8(dest, destSize, &destLen, d.get(), msize, &errcode);
+
+#ifdef NXCOMMON_LITTLE_ENDIAN
+	// See fromUTF8(). ICU also handles the cases where dest is too small, because it returns the required size then.
+	TranscodeResult res = TranscodeNative((const char*) mdata, msize*sizeof(UChar), dest, destSize, UTF16, UTF8);
+	if (res.status == TranscodeOK) {
+		if (res.destBytes < destSize) {
+			dest[res.destBytes] = '\0';
+		}
+		return res.destBytes;
+	}
+#endif
+
+	u_strToUTF8(dest, destSize, &destLen, mdata, msize, &errcode);
 	return destLen;
 }
 
@@ -189,7 +215,7 @@ CString UString::toUTF8() const
 
 bool UString::isWhitespaceOnly() const
 {
-	const UChar* str = d.get();
+	const UChar* str = mdata;
 	int32_t len = msize;
 	int32_t i = 0;
 	UChar32 c;
@@ -227,17 +253,15 @@ UString UString::convertFromULongLong(unsigned long long val, unsigned int base)
 
 UString UString::convertFromDouble(double val)
 {
-	// TODO: Maybe there's a nicer option?
-
-	char buf[64];
-	int len = sprintf(buf, "%f", val);
+	char buf[32];
+	size_t len = DoubleToString(buf, val);
 
 	UString str(64);
 	UChar* cstr = str.mget();
 
-	// sprintf only prints ASCII characters, which are at the beginning of the Unicode BMP, and the BMP is encoded
-	// as the code point value in UTF-16, so we basically just have to 'widen' the output of sprintf here.
-	for (int i = 0 ; i < len ; i++) {
+	// DoubleToString only prints ASCII characters, which are at the beginning of the Unicode BMP, and the BMP is
+	// encoded as the code point value in UTF-16, so we basically just have to 'widen' its output here.
+	for (size_t i = 0 ; i < len ; i++) {
 		cstr[i] = (UChar) buf[i];
 	}
 
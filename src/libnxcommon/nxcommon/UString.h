@@ -94,6 +94,9 @@ protected:
 };
 
 
+typedef AbstractSharedBufferView<UString> UStringView;
+
+
 
 
 std::ostream& operator<<(std::ostream& stream, const UString& cstr);
@@ -0,0 +1,256 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "WildcardPattern.h"
+#include "strutil.h"
+
+
+
+
+WildcardPattern::WildcardPattern(const char* pattern, bool caseSensitive)
+		: minLength(0), hasStar(false), matchesNothing(false), caseSensitive(caseSensitive)
+{
+	Segment seg = { 0, 0, true };
+
+	for (const char* p = pattern ; *p != '\0' ; p++) {
+		if (*p == '*') {
+			// Consecutive stars are the same as a single one, so the middle segments are never empty.
+			if (!hasStar  ||  seg.length != 0) {
+				segments.push_back(seg);
+			}
+
+			hasStar = true;
+			seg.offset = chars.length();
+			seg.length = 0;
+			seg.literal = true;
+			continue;
+		}
+
+		char c = *p;
+		bool any = false;
+
+		if (c == '?') {
+			any = true;
+			seg.literal = false;
+		} else if (c == '\\') {
+			c = *++p;
+
+			if (c == '\0') {
+				// A trailing backslash escapes the terminator, which no string can match.
+				matchesNothing = true;
+				break;
+			}
+		}
+
+		if (!caseSensitive  &&  c >= 'A'  &&  c <= 'Z') {
+			c = c | 0x20;
+		}
+
+		chars += c;
+		anyMask += any ? '\1' : '\0';
+		seg.length++;
+		minLength++;
+	}
+
+	segments.push_back(seg);
+}
+
+
+bool WildcardPattern::matchSegment(const Segment& seg, const char* text) const
+{
+	const char* sc = chars.data() + seg.offset;
+
+	if (seg.literal) {
+		return memcmp(text, sc, seg.length) == 0;
+	}
+
+	const char* sany = anyMask.data() + seg.offset;
+
+	for (size_t i = 0 ; i < seg.length ; i++) {
+		if (text[i] != sc[i]  &&  !sany[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+const char* WildcardPattern::findSegment(const Segment& seg, const char* beg, const char* end) const
+{
+	if ((size_t) (end-beg) < seg.length) {
+		return NULL;
+	}
+
+	if (seg.literal) {
+		const char* res = FindSubstring(beg, end, chars.data() + seg.offset, seg.length);
+		return res == end ? NULL : res;
+	}
+
+	// Use the first literal character of the segment to skip ahead quickly
+	const char* sany = anyMask.data() + seg.offset;
+	size_t anchor = 0;
+
+	while (anchor < seg.length  &&  sany[anchor]) {
+		anchor++;
+	}
+
+	const char* last = end - seg.length;
+
+	for (const char* s = beg ; s <= last ; s++) {
+		if (anchor < seg.length) {
+			const char* a = FindChar(s + anchor, last + anchor + 1, chars[seg.offset + anchor]);
+
+			if (a == last + anchor + 1) {
+				return NULL;
+			}
+
+			s = a - anchor;
+		}
+
+		if (matchSegment(seg, s)) {
+			return s;
+		}
+	}
+
+	return NULL;
+}
+
+
+bool WildcardPattern::matchCaseSensitive(const char* text, size_t len) const
+{
+	if (len < minLength) {
+		return false;
+	}
+
+	if (!hasStar) {
+		return len == minLength  &&  matchSegment(segments[0], text);
+	}
+
+	// Check the anchored segments at both ends first, which rejects most strings quickly.
+	const Segment& prefix = segments.front();
+	const Segment& suffix = segments.back();
+
+	if (!matchSegment(prefix, text)  ||  !matchSegment(suffix, text + len - suffix.length)) {
+		return false;
+	}
+
+	const char* pos = text + prefix.length;
+	const char* end = text + len - suffix.length;
+
+	for (size_t i = 1 ; i < segments.size()-1 ; i++) {
+		const Segment& seg = segments[i];
+		const char* found = findSegment(seg, pos, end);
+
+		if (!found) {
+			return false;
+		}
+
+		pos = found + seg.length;
+	}
+
+	return true;
+}
+
+
+bool WildcardPattern::match(const char* text, size_t len) const
+{
+	if (matchesNothing) {
+		return false;
+	}
+
+	if (caseSensitive) {
+		return matchCaseSensitive(text, len);
+	}
+
+	char buf[256];
+	char* ltext = len <= sizeof(buf) ? buf : new char[len];
+
+	size_t llen = AsciiToLower(ltext, text, len);
+
+	// AsciiToLower() stops at null characters, which WildcardMatch() treats as the end of the string as well.
+	bool res = matchCaseSensitive(ltext, llen);
+
+	if (ltext != buf) {
+		delete[] ltext;
+	}
+
+	return res;
+}
+
+
+size_t WildcardPattern::matchAll(const CString* names, size_t numNames, bool* results) const
+{
+	size_t numMatches = 0;
+
+	for (size_t i = 0 ; i < numNames ; i++) {
+		results[i] = match(names[i].get(), names[i].length());
+
+		if (results[i]) {
+			numMatches++;
+		}
+	}
+
+	return numMatches;
+}
+
+
+std::vector<size_t> WildcardPattern::matchAll(const std::vector<CString>& names) const
+{
+	std::vector<size_t> indices;
+
+	for (size_t i = 0 ; i < names.size() ; i++) {
+		if (match(names[i].get(), names[i].length())) {
+			indices.push_back(i);
+		}
+	}
+
+	return indices;
+}
+
+
+size_t WildcardPattern::getLiteralLength(const Segment& seg, bool fromEnd) const
+{
+	const char* sany = anyMask.data() + seg.offset;
+	size_t n = 0;
+
+	while (n < seg.length  &&  !sany[fromEnd ? seg.length-1-n : n]) {
+		n++;
+	}
+
+	return n;
+}
+
+
+CString WildcardPattern::getLiteralPrefix() const
+{
+	const Segment& seg = segments.front();
+	return CString(chars.data() + seg.offset, getLiteralLength(seg, false));
+}
+
+
+CString WildcardPattern::getLiteralSuffix() const
+{
+	const Segment& seg = segments.back();
+	size_t n = getLiteralLength(seg, true);
+	return CString(chars.data() + seg.offset + seg.length - n, n);
+}
@@ -0,0 +1,114 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_WILDCARDPATTERN_H_
+#define NXCOMMON_WILDCARDPATTERN_H_
+
+#include <nxcommon/config.h>
+#include "CString.h"
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+
+/**	\brief A wildcard pattern that is compiled once and can then be matched against many strings quickly.
+ *
+ * 	The syntax is the same as for WildcardMatch(): '?' matches any single character, '*' matches any sequence of
+ * 	characters (including the empty one) and '\' makes the following character match literally. A pattern ending in a
+ * 	single '\' never matches.
+ *
+ * 	The pattern is split into the literal segments between the stars. The segment before the first star has to match at
+ * 	the start of the string and the one after the last star at its end, which rejects most strings after a few
+ * 	comparisons. The remaining segments are searched from left to right, taking the leftmost occurrence each time. This
+ * 	never needs to backtrack, so matching takes linear time for literal segments, no matter how many stars there are.
+ */
+class WildcardPattern
+{
+public:
+	/**	\brief Compile a pattern.
+	 *
+	 * 	@param pattern The pattern.
+	 * 	@param caseSensitive If false, ASCII letters are matched regardless of their case.
+	 */
+	WildcardPattern(const char* pattern, bool caseSensitive = true);
+	WildcardPattern(const CString& pattern, bool caseSensitive = true) : WildcardPattern(pattern.get(), caseSensitive) {}
+
+	bool match(const char* text, size_t len) const;
+	bool match(const char* text) const { return match(text, strlen(text)); }
+	bool match(const CString& text) const { return match(text.get(), text.length()); }
+	bool match(const CStringView& text) const { return match(text.get(), text.length()); }
+
+	/**	\brief Match a list of strings.
+	 *
+	 * 	@param names The strings to match.
+	 * 	@param numNames The number of strings.
+	 * 	@param results Receives true for each string that matches, false for all others.
+	 * 	@return The number of matching strings.
+	 */
+	size_t matchAll(const CString* names, size_t numNames, bool* results) const;
+
+	/**	\brief Match a list of strings and return the indices of those that match.
+	 */
+	std::vector<size_t> matchAll(const std::vector<CString>& names) const;
+
+	bool isCaseSensitive() const { return caseSensitive; }
+
+	/**	\brief Return the literal text that all matching strings start with.
+	 *
+	 * 	For case-insensitive patterns, this is in lower case.
+	 */
+	CString getLiteralPrefix() const;
+
+	/**	\brief Return the literal text that all matching strings end with.
+	 */
+	CString getLiteralSuffix() const;
+
+private:
+	struct Segment
+	{
+		size_t offset;
+		size_t length;
+
+		// Whether the segment contains no '?'
+		bool literal;
+	};
+
+private:
+	bool matchCaseSensitive(const char* text, size_t len) const;
+	bool matchSegment(const Segment& seg, const char* text) const;
+	const char* findSegment(const Segment& seg, const char* beg, const char* end) const;
+	size_t getLiteralLength(const Segment& seg, bool fromEnd) const;
+
+private:
+	// The characters of all segments, and for each of them a flag telling whether it is a '?'
+	std::string chars;
+	std::string anyMask;
+
+	std::vector<Segment> segments;
+	size_t minLength;
+	bool hasStar;
+	bool matchesNothing;
+	bool caseSensitive;
+};
+
+#endif /* NXCOMMON_WILDCARDPATTERN_H_ */
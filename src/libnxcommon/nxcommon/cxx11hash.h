@@ -40,25 +40,19 @@ class CXX11Hash : public std::hash<K> {};
 template <>
 class CXX11Hash<const char*> {
 public:
-	size_t operator()(const char* s) const { return strHash(std::string(s)); }
-private:
-	CXX11Hash<std::string> strHash;
+	size_t operator()(const char* s) const { return (size_t) Hash(s); }
 };
 
 template <>
 class CXX11Hash<std::shared_ptr<const char> > {
 public:
-	size_t operator()(std::shared_ptr<const char> s) const { return strHash(std::string(s.get())); }
-private:
-	CXX11Hash<std::string> strHash;
+	size_t operator()(const std::shared_ptr<const char>& s) const { return (size_t) Hash(s.get()); }
 };
 
 template <>
 class CXX11Hash<CString> {
 public:
-	size_t operator()(const CString& s) const { return strHash(std::string(s.get())); }
-private:
-	CXX11Hash<std::string> strHash;
+	size_t operator()(const CString& s) const { return s.getHash(); }
 };
 
 template <>
@@ -23,11 +23,14 @@
 #ifndef __ANDROID__
 
 #include "encoding.h"
+#include "strsimd.h"
 #include <iostream>
 #include <errno.h>
 #include <cstdio>
 #include <cstring>
 #include <cassert>
+#include <cstdint>
+#include <algorithm>
 
 #ifdef _HAVE_ICONV
 #include <iconv.h>
@@ -87,102 +90,520 @@ const unsigned char ISO88591ToGXT8Table[] = {
 
 
 
+// **************************************************
+// *												*
+// *			NATIVE TRANSCODING					*
+// *												*
+// **************************************************
 
-// Unfortunately, first parameter needs to be non-const because iconv() takes the inbuf as non-const char**
-int Transcode(char* src, int srcBytes, char* dest, int destBytes, Encoding srcEnc, Encoding destEnc)
+// Each codec converts between its encoding and Unicode code points, one character at a time:
+//
+//		int decode(const unsigned char* src, size_t len, uint32_t& cp)
+//			Returns the number of bytes read, 0 if src ends before the character does, or -1 if it is invalid.
+//		int encode(uint32_t cp, unsigned char* dest, size_t len)
+//			Returns the number of bytes written, 0 if dest is too small, or -1 if cp can't be represented.
+//
+// Form and DirectLimit describe which characters are eligible for the bulk ASCII conversions: For codecs with
+// ByteForm, every code point below DirectLimit is a single byte of the same value. For UTF16Form, it is a single
+// little endian unit of that value.
+
+enum CodecForm
 {
-	if (srcEnc == None) {
-		return ERR_INVALID_PARAMETER;
+	ByteForm,
+	UTF16Form,
+	TableForm
+};
+
+
+struct ASCIICodec
+{
+	static constexpr CodecForm Form = ByteForm;
+	static constexpr unsigned int DirectLimit = 0x80;
+
+	static inline int decode(const unsigned char* src, size_t /* len */, uint32_t& cp)
+	{
+		if (src[0] >= 0x80) {
+			return -1;
+		}
+		cp = src[0];
+		return 1;
 	}
-	if (srcEnc == destEnc  ||  destEnc == None) {
-		// If we have the same encoding in src and dest, we will just copy.
-		int len = srcBytes < destBytes ? srcBytes : destBytes;
-		memcpy(dest, src, len);
 
-		if (srcBytes > destBytes) {
-			return ERR_INSUFFICIENT_BUFFER;
+	static inline int encode(uint32_t cp, unsigned char* dest, size_t len)
+	{
+		if (cp >= 0x80) {
+			return -1;
 		}
+		if (len < 1) {
+			return 0;
+		}
+		dest[0] = (unsigned char) cp;
+		return 1;
+	}
+};
 
-		return len;
+
+struct Latin1Codec
+{
+	static constexpr CodecForm Form = ByteForm;
+	static constexpr unsigned int DirectLimit = 0x100;
+
+	static inline int decode(const unsigned char* src, size_t /* len */, uint32_t& cp)
+	{
+		cp = src[0];
+		return 1;
 	}
 
-	if (srcEnc == GXT8) {
-		// GXT8 -> destEnc conversion is done by converting to ISO-8859-1 first and then to destEnc.
-		unsigned char* tmp = new unsigned char[destBytes];
-		int len = srcBytes < destBytes ? srcBytes : destBytes;
+	static inline int encode(uint32_t cp, unsigned char* dest, size_t len)
+	{
+		if (cp >= 0x100) {
+			return -1;
+		}
+		if (len < 1) {
+			return 0;
+		}
+		dest[0] = (unsigned char) cp;
+		return 1;
+	}
+};
+
+
+struct GXT8Codec
+{
+	static constexpr CodecForm Form = TableForm;
+	static constexpr unsigned int DirectLimit = 0;
+
+	static inline int decode(const unsigned char* src, size_t /* len */, uint32_t& cp)
+	{
+		cp = GXT8ToISO88591Table[src[0]];
+		return 1;
+	}
 
-		for (int i = 0 ; i < len ; i++) {
-			tmp[i] = GXT8ToISO88591Table[((unsigned char*) src)[i]];
+	static inline int encode(uint32_t cp, unsigned char* dest, size_t len)
+	{
+		if (cp >= 0x100) {
+			return -1;
 		}
+		if (len < 1) {
+			return 0;
+		}
+		dest[0] = ISO88591ToGXT8Table[cp];
+		return 1;
+	}
+};
 
-		int endLen = Transcode((char*) tmp, len, dest, destBytes, ISO8859_1, destEnc);
 
-		delete[] tmp;
+// TODO We assume that GXT16 is just GXT8 with an unused second byte. Don't know if that's true.
+struct GXT16Codec
+{
+	static constexpr CodecForm Form = TableForm;
+	static constexpr unsigned int DirectLimit = 0;
 
-		if (srcBytes > destBytes) {
-			return ERR_INSUFFICIENT_BUFFER;
+	static inline int decode(const unsigned char* src, size_t len, uint32_t& cp)
+	{
+		if (len < 2) {
+			return 0;
 		}
+		cp = GXT8ToISO88591Table[src[0]];
+		return 2;
+	}
 
-		return endLen;
-	} else if (srcEnc == GXT16) {
-		// TODO We assume that GXT16 is just GXT8 with an unused second byte. Don't know if that's true.
-		int tmpSize = srcBytes%2 == 0 ? srcBytes/2 : (srcBytes+1)/2;
-		unsigned char* tmp = new unsigned char[tmpSize];
-		int len = srcBytes < destBytes ? srcBytes : destBytes;
+	static inline int encode(uint32_t cp, unsigned char* dest, size_t len)
+	{
+		if (cp >= 0x100) {
+			return -1;
+		}
+		if (len < 2) {
+			return 0;
+		}
+		dest[0] = ISO88591ToGXT8Table[cp];
+		dest[1] = 0;
+		return 2;
+	}
+};
+
+
+struct UTF8Codec
+{
+	static constexpr CodecForm Form = ByteForm;
+	static constexpr unsigned int DirectLimit = 0x80;
 
-		for (int i = 0 ; i < len/2 ; i++) {
-			tmp[i] = GXT8ToISO88591Table[((unsigned char*) src)[i*2]];
+	static inline int decode(const unsigned char* src, size_t len, uint32_t& cp)
+	{
+		unsigned char b0 = src[0];
+
+		if (b0 < 0x80) {
+			cp = b0;
+			return 1;
 		}
 
-		int endLen = Transcode((char*) tmp, tmpSize, dest, destBytes, ISO8859_1, destEnc);
+		// The allowed range of the second byte excludes overlong encodings, surrogates and code points above
+		// U+10FFFF (see table 3-7 of the Unicode standard).
+		int seqLen;
+		uint32_t c;
+		unsigned char lo = 0x80;
+		unsigned char hi = 0xBF;
+
+		if (b0 < 0xC2) {
+			return -1;
+		} else if (b0 < 0xE0) {
+			seqLen = 2;
+			c = b0 & 0x1F;
+		} else if (b0 < 0xF0) {
+			seqLen = 3;
+			c = b0 & 0x0F;
+			if (b0 == 0xE0) {
+				lo = 0xA0;
+			} else if (b0 == 0xED) {
+				hi = 0x9F;
+			}
+		} else if (b0 < 0xF5) {
+			seqLen = 4;
+			c = b0 & 0x07;
+			if (b0 == 0xF0) {
+				lo = 0x90;
+			} else if (b0 == 0xF4) {
+				hi = 0x8F;
+			}
+		} else {
+			return -1;
+		}
 
-		delete[] tmp;
+		// A sequence is only incomplete if the bytes that are there are valid. Otherwise, more input wouldn't help.
+		for (int i = 1 ; i < seqLen ; i++) {
+			if ((size_t) i >= len) {
+				return 0;
+			}
 
-		return endLen;
+			unsigned char b = src[i];
+			if (b < lo  ||  b > hi) {
+				return -1;
+			}
+
+			c = (c << 6) | (b & 0x3F);
+			lo = 0x80;
+			hi = 0xBF;
+		}
+
+		cp = c;
+		return seqLen;
 	}
 
-	if (destEnc == GXT8) {
-		// srcEnc -> GXT8 conversion is done by converting to ISO-8859-1 first and then to GXT8.
-		unsigned char* tmp = new unsigned char[destBytes];
-		unsigned char* udest = (unsigned char*) dest;
-		int len = Transcode(src, srcBytes, (char*) tmp, destBytes, srcEnc, ISO8859_1);
-		bool insufficient = false;
+	static inline int encode(uint32_t cp, unsigned char* dest, size_t len)
+	{
+		if (cp < 0x80) {
+			if (len < 1) {
+				return 0;
+			}
+			dest[0] = (unsigned char) cp;
+			return 1;
+		} else if (cp < 0x800) {
+			if (len < 2) {
+				return 0;
+			}
+			dest[0] = (unsigned char) (0xC0 | (cp >> 6));
+			dest[1] = (unsigned char) (0x80 | (cp & 0x3F));
+			return 2;
+		} else if (cp < 0x10000) {
+			if (len < 3) {
+				return 0;
+			}
+			dest[0] = (unsigned char) (0xE0 | (cp >> 12));
+			dest[1] = (unsigned char) (0x80 | ((cp >> 6) & 0x3F));
+			dest[2] = (unsigned char) (0x80 | (cp & 0x3F));
+			return 3;
+		} else {
+			if (len < 4) {
+				return 0;
+			}
+			dest[0] = (unsigned char) (0xF0 | (cp >> 18));
+			dest[1] = (unsigned char) (0x80 | ((cp >> 12) & 0x3F));
+			dest[2] = (unsigned char) (0x80 | ((cp >> 6) & 0x3F));
+			dest[3] = (unsigned char) (0x80 | (cp & 0x3F));
+			return 4;
+		}
+	}
+};
 
-		if (len == ERR_INSUFFICIENT_BUFFER) {
-			// We will still fill the buffer
-			len = destBytes;
-			insufficient = true;
+
+// Units are composed from single bytes, so this works regardless of host byte order and alignment.
+struct UTF16Codec
+{
+	static constexpr CodecForm Form = UTF16Form;
+	static constexpr unsigned int DirectLimit = 0x10000;
+
+	static inline int decode(const unsigned char* src, size_t len, uint32_t& cp)
+	{
+		if (len < 2) {
+			return 0;
 		}
 
-		for (int i = 0 ; i < len ; i++) {
-			udest[i] = ISO88591ToGXT8Table[tmp[i]];
+		uint32_t u = src[0] | ((uint32_t) src[1] << 8);
+
+		if (u < 0xD800  ||  u > 0xDFFF) {
+			cp = u;
+			return 2;
+		} else if (u >= 0xDC00) {
+			return -1;
 		}
 
-		delete[] tmp;
+		if (len < 4) {
+			return 0;
+		}
 
-		if (insufficient) {
+		uint32_t u2 = src[2] | ((uint32_t) src[3] << 8);
+
+		if (u2 < 0xDC00  ||  u2 > 0xDFFF) {
+			return -1;
+		}
+
+		cp = 0x10000 + ((u - 0xD800) << 10) + (u2 - 0xDC00);
+		return 4;
+	}
+
+	static inline int encode(uint32_t cp, unsigned char* dest, size_t len)
+	{
+		if (cp < 0x10000) {
+			if (len < 2) {
+				return 0;
+			}
+			dest[0] = (unsigned char) cp;
+			dest[1] = (unsigned char) (cp >> 8);
+			return 2;
+		} else {
+			if (len < 4) {
+				return 0;
+			}
+			uint32_t hi = 0xD800 + ((cp - 0x10000) >> 10);
+			uint32_t lo = 0xDC00 + ((cp - 0x10000) & 0x3FF);
+			dest[0] = (unsigned char) hi;
+			dest[1] = (unsigned char) (hi >> 8);
+			dest[2] = (unsigned char) lo;
+			dest[3] = (unsigned char) (lo >> 8);
+			return 4;
+		}
+	}
+};
+
+
+// Returns whether the character at src can be converted by TranscodeDirectRun().
+template <class Src, class Dest>
+static inline bool IsDirectChar(const unsigned char* src, size_t len)
+{
+	if (Src::Form == ByteForm  &&  (Dest::Form == ByteForm  ||  Dest::Form == UTF16Form)) {
+		return src[0] < std::min(Src::DirectLimit, Dest::DirectLimit);
+	} else if (Src::Form == UTF16Form  &&  Dest::Form == ByteForm) {
+		return len >= 2  &&  src[1] == 0  &&  src[0] < Dest::DirectLimit;
+	}
+	return false;
+}
+
+
+// Converts the longest run of characters that are below the DirectLimit of both codecs with the strsimd.h bulk
+// routines. Returns the number of source units converted, which is also the number of destination units written.
+template <class Src, class Dest>
+static inline size_t TranscodeDirectRun(const char* src, size_t srcLen, char* dest, size_t destLen)
+{
+	if (Src::Form == ByteForm  &&  Dest::Form == ByteForm) {
+		size_t num = FindNonASCII(src, std::min(srcLen, destLen));
+		memcpy(dest, src, num);
+		return num;
+	} else if (Src::Form == ByteForm  &&  Dest::Form == UTF16Form) {
+		size_t num = std::min(srcLen, destLen/2);
+		if (Src::DirectLimit <= 0x80) {
+			num = FindNonASCII(src, num);
+		}
+		WidenToUTF16LE(dest, src, num);
+		return num;
+	} else if (Src::Form == UTF16Form  &&  Dest::Form == ByteForm) {
+		return NarrowFromUTF16LE(dest, src, std::min(srcLen/2, destLen), Dest::DirectLimit);
+	}
+	return 0;
+}
+
+
+template <class Src, class Dest>
+static TranscodeResult TranscodeNativeImpl(const char* src, size_t srcBytes, char* dest, size_t destBytes)
+{
+	const unsigned char* usrc = (const unsigned char*) src;
+	unsigned char* udest = (unsigned char*) dest;
+
+	const size_t srcUnit = (Src::Form == UTF16Form) ? 2 : 1;
+	const size_t destUnit = (Dest::Form == UTF16Form) ? 2 : 1;
+
+	size_t srcIdx = 0;
+	size_t destIdx = 0;
+
+	while (srcIdx < srcBytes) {
+		if (IsDirectChar<Src, Dest>(usrc+srcIdx, srcBytes-srcIdx)) {
+			size_t num = TranscodeDirectRun<Src, Dest>(src+srcIdx, srcBytes-srcIdx, dest+destIdx, destBytes-destIdx);
+			srcIdx += num*srcUnit;
+			destIdx += num*destUnit;
+
+			if (srcIdx == srcBytes) {
+				break;
+			}
+		}
+
+		uint32_t cp;
+		int numRead = Src::decode(usrc+srcIdx, srcBytes-srcIdx, cp);
+		if (numRead <= 0) {
+			return { numRead == 0 ? TranscodeIncomplete : TranscodeInvalid, srcIdx, destIdx };
+		}
+
+		int numWritten = Dest::encode(cp, udest+destIdx, destBytes-destIdx);
+		if (numWritten <= 0) {
+			return { numWritten == 0 ? TranscodeDestFull : TranscodeInvalid, srcIdx, destIdx };
+		}
+
+		srcIdx += numRead;
+		destIdx += numWritten;
+	}
+
+	return { TranscodeOK, srcIdx, destIdx };
+}
+
+
+template <class Src>
+static TranscodeResult TranscodeNativeFrom(const char* src, size_t srcBytes, char* dest, size_t destBytes,
+		Encoding destEnc)
+{
+	switch (destEnc) {
+	case ASCII:
+		return TranscodeNativeImpl<Src, ASCIICodec>(src, srcBytes, dest, destBytes);
+	case UTF8:
+		return TranscodeNativeImpl<Src, UTF8Codec>(src, srcBytes, dest, destBytes);
+	case UTF16:
+		return TranscodeNativeImpl<Src, UTF16Codec>(src, srcBytes, dest, destBytes);
+	case GXT8:
+		return TranscodeNativeImpl<Src, GXT8Codec>(src, srcBytes, dest, destBytes);
+	case GXT16:
+		return TranscodeNativeImpl<Src, GXT16Codec>(src, srcBytes, dest, destBytes);
+	case ISO8859_1:
+		return TranscodeNativeImpl<Src, Latin1Codec>(src, srcBytes, dest, destBytes);
+	default:
+		assert(false);
+		return { TranscodeInvalid, 0, 0 };
+	}
+}
+
+
+static bool IsNativeEncoding(Encoding enc)
+{
+	switch (enc) {
+	case ASCII:
+	case UTF8:
+	case UTF16:
+	case GXT8:
+	case GXT16:
+	case ISO8859_1:
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+bool IsNativeTranscodeSupported(Encoding srcEnc, Encoding destEnc)
+{
+	return IsNativeEncoding(srcEnc)  &&  IsNativeEncoding(destEnc);
+}
+
+
+TranscodeResult TranscodeNative(const char* src, size_t srcBytes, char* dest, size_t destBytes,
+		Encoding srcEnc, Encoding destEnc)
+{
+	switch (srcEnc) {
+	case ASCII:
+		return TranscodeNativeFrom<ASCIICodec>(src, srcBytes, dest, destBytes, destEnc);
+	case UTF8:
+		return TranscodeNativeFrom<UTF8Codec>(src, srcBytes, dest, destBytes, destEnc);
+	case UTF16:
+		return TranscodeNativeFrom<UTF16Codec>(src, srcBytes, dest, destBytes, destEnc);
+	case GXT8:
+		return TranscodeNativeFrom<GXT8Codec>(src, srcBytes, dest, destBytes, destEnc);
+	case GXT16:
+		return TranscodeNativeFrom<GXT16Codec>(src, srcBytes, dest, destBytes, destEnc);
+	case ISO8859_1:
+		return TranscodeNativeFrom<Latin1Codec>(src, srcBytes, dest, destBytes, destEnc);
+	default:
+		assert(false);
+		return { TranscodeInvalid, 0, 0 };
+	}
+}
+
+
+
+
+
+// Unfortunately, first parameter needs to be non-const because iconv() takes the inbuf as non-const char**
+int Transcode(char* src, int srcBytes, char* dest, int destBytes, Encoding srcEnc, Encoding destEnc)
+{
+	if (srcEnc == None) {
+		return ERR_INVALID_PARAMETER;
+	}
+	if (srcEnc == destEnc  ||  destEnc == None) {
+		// If we have the same encoding in src and dest, we will just copy.
+		int len = srcBytes < destBytes ? srcBytes : destBytes;
+		memcpy(dest, src, len);
+
+		if (srcBytes > destBytes) {
 			return ERR_INSUFFICIENT_BUFFER;
 		}
 
 		return len;
-	} else if (destEnc == GXT16) {
-		// TODO We assume that GXT16 is just GXT8 with an unused second byte. Don't know if that's true.
-		int tmpSize = destBytes%2 == 0 ? destBytes/2 : (destBytes+1)/2;
-		unsigned char* tmp = new unsigned char[tmpSize];
-		unsigned char* udest = (unsigned char*) dest;
-		int len = Transcode(src, srcBytes, (char*) tmp, tmpSize, srcEnc, ISO8859_1);
+	}
+
+	if (srcBytes < 0  ||  destBytes < 0) {
+		return ERR_INVALID_PARAMETER;
+	}
+
+	if (IsNativeTranscodeSupported(srcEnc, destEnc)) {
+		TranscodeResult res = TranscodeNative(src, srcBytes, dest, destBytes, srcEnc, destEnc);
+
+		switch (res.status) {
+		case TranscodeOK:
+			return (int) res.destBytes;
+		case TranscodeDestFull:
+			return ERR_INSUFFICIENT_BUFFER;
+		default:
+			return ERR_INVALID_SEQUENCE;
+		}
+	}
+
+	if (srcEnc == GXT8  ||  srcEnc == GXT16) {
+		// GXT -> destEnc conversion is done by converting to ISO-8859-1 first and then to destEnc.
+		int tmpSize = srcEnc == GXT16 ? srcBytes/2 : srcBytes;
+		char* tmp = new char[tmpSize];
+
+		TranscodeResult res = TranscodeNative(src, srcBytes, tmp, tmpSize, srcEnc, ISO8859_1);
+
+		int endLen = res.status == TranscodeOK
+				? Transcode(tmp, (int) res.destBytes, dest, destBytes, ISO8859_1, destEnc)
+				: ERR_INVALID_SEQUENCE;
+
+		delete[] tmp;
+
+		return endLen;
+	}
+
+	if (destEnc == GXT8  ||  destEnc == GXT16) {
+		// srcEnc -> GXT conversion is done by converting to ISO-8859-1 first and then to GXT.
+		int tmpSize = destEnc == GXT16 ? destBytes/2 : destBytes;
+		char* tmp = new char[tmpSize];
+		int len = Transcode(src, srcBytes, tmp, tmpSize, srcEnc, ISO8859_1);
 		bool insufficient = false;
 
 		if (len == ERR_INSUFFICIENT_BUFFER) {
 			// We will still fill the buffer
 			len = tmpSize;
 			insufficient = true;
+		} else if (len < 0) {
+			delete[] tmp;
+			return len;
 		}
 
-		for (int i = 0 ; i < len ; i++) {
-			udest[i*2] = ISO88591ToGXT8Table[tmp[i]];
-			udest[i*2+1] = '\0';
-		}
+		TranscodeResult res = TranscodeNative(tmp, len, dest, destBytes, ISO8859_1, destEnc);
 
 		delete[] tmp;
 
@@ -190,7 +611,7 @@ int Transcode(char* src, int srcBytes, char* dest, int destBytes, Encoding srcEn
 			return ERR_INSUFFICIENT_BUFFER;
 		}
 
-		return len;
+		return (int) res.destBytes;
 	}
 
 #ifdef _HAVE_ICONV
@@ -245,12 +666,11 @@ int Transcode(char* src, int srcBytes, char* dest, int destBytes, Encoding srcEn
 
 	iconv_t ic = iconv_open(iconvDestEnc, iconvSrcEnc);
 	size_t len = iconv(ic, &src, &inLeft, &dest, &outLeft);
+	int err = errno;
 	iconv_close(ic);
 
 	if (len == (size_t)-1) {
-		iconv_close(ic);
-
-		switch (errno) {
+		switch (err) {
 		case EILSEQ:
 		case EINVAL:
 			return ERR_INVALID_SEQUENCE;
@@ -362,6 +782,165 @@ int Transcode(char* src, int srcBytes, char* dest, int destBytes, Encoding srcEn
 }
 
 
+// Grows buf so that it can hold at least minCapacity bytes, keeping the first size bytes.
+static void GrowTranscodeBuffer(char*& buf, size_t size, size_t& capacity, size_t minCapacity)
+{
+	if (capacity >= minCapacity) {
+		return;
+	}
+
+	size_t newCapacity = std::max(minCapacity, capacity*2);
+	char* newBuf = new char[newCapacity];
+	if (size != 0) {
+		memcpy(newBuf, buf, size);
+	}
+	delete[] buf;
+
+	buf = newBuf;
+	capacity = newCapacity;
+}
+
+
+// Transcodes src with TranscodeNative(), appending to buf and growing it as needed.
+static TranscodeStatus TranscodeNativeAppend(const char* src, size_t len, size_t& consumed, Encoding srcEnc,
+		Encoding destEnc, char*& buf, size_t& size, size_t& capacity)
+{
+	consumed = 0;
+
+	while (true) {
+		// No pair of native encodings needs more than twice the source size, so this normally runs only once
+		GrowTranscodeBuffer(buf, size, capacity, size + (len-consumed)*2 + 4);
+
+		TranscodeResult res = TranscodeNative(src+consumed, len-consumed, buf+size, capacity-size, srcEnc, destEnc);
+		consumed += res.srcBytes;
+		size += res.destBytes;
+
+		if (res.status != TranscodeDestFull) {
+			return res.status;
+		}
+	}
+}
+
+
+Transcoder::Transcoder(Encoding srcEnc, Encoding destEnc)
+		: srcEnc(srcEnc), destEnc(destEnc), outBuf(NULL), outSize(0), outCapacity(0), pivotBuf(NULL),
+		  pivotCapacity(0), pendingLen(0), failed(false)
+{
+	assert(srcEnc != None  &&  destEnc != None);
+}
+
+
+Transcoder::~Transcoder()
+{
+	delete[] outBuf;
+	delete[] pivotBuf;
+}
+
+
+TranscodeStatus Transcoder::transcodeChunk(const char* src, size_t len, size_t& consumed)
+{
+	if (IsNativeTranscodeSupported(srcEnc, destEnc)) {
+		return TranscodeNativeAppend(src, len, consumed, srcEnc, destEnc, outBuf, outSize, outCapacity);
+	}
+
+	if (srcEnc == WINDOWS1252) {
+		// Every byte is a complete character, so the chunk can be handed to Transcode() as it is. A byte takes
+		// at most 3 bytes in UTF-8 (e.g. the Euro sign).
+		GrowTranscodeBuffer(outBuf, outSize, outCapacity, outSize + len*3 + 4);
+		consumed = len;
+
+		if (len == 0) {
+			return TranscodeOK;
+		}
+
+		int res = Transcode((char*) src, (int) len, outBuf+outSize, (int) (outCapacity-outSize), srcEnc, destEnc);
+		if (res < 0) {
+			return TranscodeInvalid;
+		}
+		outSize += res;
+		return TranscodeOK;
+	}
+
+	// Transcode to UTF-16 first, which only ever produces complete characters, and from there to destEnc
+	size_t pivotSize = 0;
+	TranscodeStatus status = TranscodeNativeAppend(src, len, consumed, srcEnc, UTF16, pivotBuf, pivotSize,
+			pivotCapacity);
+
+	if (pivotSize != 0) {
+		GrowTranscodeBuffer(outBuf, outSize, outCapacity, outSize + pivotSize/2);
+
+		int res = Transcode(pivotBuf, (int) pivotSize, outBuf+outSize, (int) (outCapacity-outSize), UTF16, destEnc);
+		if (res < 0) {
+			return TranscodeInvalid;
+		}
+		outSize += res;
+	}
+
+	return status;
+}
+
+
+int Transcoder::feed(const char* src, size_t len)
+{
+	if (failed) {
+		return ERR_INVALID_SEQUENCE;
+	}
+
+	size_t oldOutSize = outSize;
+
+	// Complete the character that was split at the end of the previous chunk, one byte at a time
+	while (pendingLen != 0  &&  len != 0) {
+		pending[pendingLen++] = *src++;
+		len--;
+
+		size_t consumed;
+		TranscodeStatus status = transcodeChunk(pending, pendingLen, consumed);
+
+		if (status == TranscodeOK) {
+			pendingLen = 0;
+		} else if (status != TranscodeIncomplete  ||  pendingLen == sizeof(pending)) {
+			failed = true;
+			return ERR_INVALID_SEQUENCE;
+		}
+	}
+
+	if (len != 0) {
+		size_t consumed;
+		TranscodeStatus status = transcodeChunk(src, len, consumed);
+
+		if (status == TranscodeIncomplete) {
+			pendingLen = len - consumed;
+			assert(pendingLen < sizeof(pending));
+			memcpy(pending, src+consumed, pendingLen);
+		} else if (status != TranscodeOK) {
+			failed = true;
+			return ERR_INVALID_SEQUENCE;
+		}
+	}
+
+	return (int) (outSize - oldOutSize);
+}
+
+
+int Transcoder::flush()
+{
+	bool truncated = pendingLen != 0;
+
+	pendingLen = 0;
+	failed = false;
+
+	return truncated ? ERR_INVALID_SEQUENCE : 0;
+}
+
+
+void Transcoder::reset()
+{
+	outSize = 0;
+	pendingLen = 0;
+	failed = false;
+}
+
+
 int GetSufficientTranscodeBufferSize(int length, Encoding srcEnc, Encoding destEnc)
 {
 	if (srcEnc == UTF16  ||  srcEnc == GXT16) {
@@ -59,6 +59,30 @@ enum Encoding
 };
 
 
+/**	\brief Outcome of TranscodeNative().
+ */
+enum TranscodeStatus
+{
+	TranscodeOK,			//!< The whole source buffer was transcoded
+	TranscodeIncomplete,	//!< The source ends in the middle of a character (which might continue in more input)
+	TranscodeInvalid,		//!< An invalid sequence or a character that the destination encoding can't represent
+	TranscodeDestFull		//!< The destination buffer is too small for the next character
+};
+
+
+/**	\brief Result of TranscodeNative().
+ *
+ * 	srcBytes and destBytes are the number of bytes read and written. Transcoding always stops at a character
+ * 	boundary, so if status is not TranscodeOK, srcBytes points to the character that couldn't be transcoded.
+ */
+struct TranscodeResult
+{
+	TranscodeStatus status;
+	size_t srcBytes;
+	size_t destBytes;
+};
+
+
 /**	\brief Performs string encoding.
  *
  * 	This function transcodes a string from any given encoding to another. It transcodes srcBytes bytes from
@@ -75,11 +99,43 @@ enum Encoding
  * 		errors are ERR_INVALID_PARAMETERS, ERR_INVALID_SEQUENCE or ERR_INSUFFICIENT_BUFFER. The latter means
  * 		that dest isn't large enough for the transcoded string. If this is the case, dest will be filled
  * 		with as much bytes as fit in (CAUTION: This can lead to truncated unicode sequences!)
+ * 	Conversions between encodings supported by TranscodeNative() are done by that function. Only the others
+ * 	(currently WINDOWS1252) use iconv or the WinAPI.
+ *
  * 	@see Encoding
  */
 int Transcode(char* src, int srcBytes, char* dest, int destBytes, Encoding srcEnc, Encoding destEnc);
 
 
+/**	\brief Returns whether TranscodeNative() supports transcoding from srcEnc to destEnc.
+ *
+ * 	This is the case for every pair of ASCII, UTF8, UTF16, ISO8859_1, GXT8 and GXT16. Other encodings are only
+ * 	available through Transcode(), which falls back to the platform's conversion functions for them.
+ */
+bool IsNativeTranscodeSupported(Encoding srcEnc, Encoding destEnc);
+
+
+/**	\brief Transcodes a string without going through the platform's conversion functions.
+ *
+ * 	The source is decoded and encoded in a single pass, including the GXT table lookups. Runs of ASCII
+ * 	characters are converted with the SIMD routines from strsimd.h. UTF-8 is decoded strictly: Overlong
+ * 	encodings, surrogates and code points above U+10FFFF are invalid, as are unpaired surrogates in UTF-16.
+ *
+ * 	Transcoding stops at the first character that can't be read or written, and everything before it is
+ * 	written to dest. This makes it possible to continue with more input or a larger buffer.
+ *
+ * 	@param src The buffer to read from.
+ * 	@param srcBytes The number of bytes to read from src.
+ * 	@param dest The buffer to transcode to.
+ * 	@param destBytes The maximum number of bytes to be written to dest.
+ * 	@param srcEnc The encoding of the string in src. Must be supported by IsNativeTranscodeSupported().
+ * 	@param destEnc The encoding to be used in dest. Must be supported by IsNativeTranscodeSupported().
+ * 	@return The status and the number of bytes read and written.
+ */
+TranscodeResult TranscodeNative(const char* src, size_t srcBytes, char* dest, size_t destBytes,
+		Encoding srcEnc, Encoding destEnc);
+
+
 /**	\brief Returns a buffer size sufficient for transcoding.
  *
  * 	This function returns a buffer size which is guaranteed to be sufficient for transcoding length bytes
@@ -95,6 +151,77 @@ int Transcode(char* src, int srcBytes, char* dest, int destBytes, Encoding srcEn
 int GetSufficientTranscodeBufferSize(int length, Encoding srcEnc, Encoding destEnc);
 
 
+/**	\brief Stateful transcoder for data that arrives in chunks.
+ *
+ * 	Transcode() needs the whole source in memory. A Transcoder instead accepts the source piece by piece through
+ * 	feed(), so that large files can be converted with bounded memory. Characters that are split across chunk
+ * 	boundaries are kept until the rest of them arrives. The transcoded data is collected in an output buffer,
+ * 	which should be taken with getOutput() and emptied with clearOutput() after every feed().
+ *
+ * 	Any pair of encodings supported by Transcode() can be used. Pairs that aren't supported by
+ * 	TranscodeNative() (i.e. those involving WINDOWS1252) are transcoded through UTF-16, using Transcode() for the
+ * 	WINDOWS1252 side.
+ *
+ * 	@see TranscodingStreambuf and TranscodingReader in stream/TranscodingStream.h
+ */
+class Transcoder
+{
+public:
+	Transcoder(Encoding srcEnc, Encoding destEnc);
+	~Transcoder();
+
+	/**	\brief Transcodes the next chunk of source data and appends the result to the output buffer.
+	 *
+	 * 	@return The number of bytes appended to the output buffer, or ERR_INVALID_SEQUENCE if the source
+	 * 		contains an invalid sequence. Everything before the invalid sequence is still appended. After an
+	 * 		error, the transcoder has to be reset().
+	 */
+	int feed(const char* src, size_t len);
+
+	/**	\brief Signals the end of the source data.
+	 *
+	 * 	@return 0, or ERR_INVALID_SEQUENCE if the source ended in the middle of a character. In both cases,
+	 * 		the transcoder is ready for new source data afterwards.
+	 */
+	int flush();
+
+	/**	\brief Discards the output buffer and any partial character, and clears the error state.
+	 */
+	void reset();
+
+	const char* getOutput() const { return outBuf; }
+	size_t getOutputSize() const { return outSize; }
+	void clearOutput() { outSize = 0; }
+
+	Encoding getSourceEncoding() const { return srcEnc; }
+	Encoding getDestinationEncoding() const { return destEnc; }
+
+private:
+	Transcoder(const Transcoder& other);
+	Transcoder& operator=(const Transcoder& other);
+
+	TranscodeStatus transcodeChunk(const char* src, size_t len, size_t& consumed);
+
+private:
+	Encoding srcEnc;
+	Encoding destEnc;
+
+	char* outBuf;
+	size_t outSize;
+	size_t outCapacity;
+
+	// Holds UTF-16 data when transcoding to WINDOWS1252 through UTF-16
+	char* pivotBuf;
+	size_t pivotCapacity;
+
+	// The beginning of a character that was split across chunks. No character is longer than 4 bytes.
+	char pending[4];
+	size_t pendingLen;
+
+	bool failed;
+};
+
+
 /**	\brief Returns the number of characters (not bytes) in the null-terminated UTF-16 string.
  *
  *	@param str A null-terminated UTF-16 encoded string.
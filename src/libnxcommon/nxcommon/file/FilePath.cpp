@@ -80,7 +80,7 @@ FilePath::~FilePath()
 }
 
 
-CString FilePath::getExtension() const
+CStringView FilePath::getExtensionView() const
 {
 	const char* cpath = path.get();
 	const char* fnameBack = cpath + path.length() - 1;
@@ -88,18 +88,17 @@ CString FilePath::getExtension() const
 
 	while (cptr != cpath-1  &&  *cptr != '/') {
 		if (*cptr == '.') {
-			//printf("path.substr(%u, %u) @ %u\n", cptr-cpath+1, fnameBack-cptr, path.length());
-			return path.substr(cptr-cpath+1, fnameBack-cptr);
+			return CStringView(path, cptr-cpath+1, fnameBack-cptr);
 		}
 
 		cptr--;
 	}
 
-	return CString("");
+	return CStringView(CString(""));
 }
 
 
-CString FilePath::getFullExtension() const
+CStringView FilePath::getFullExtensionView() const
 {
 	const char* cpath = path.get();
 	const char* fnameBack = cpath + path.length() - 1;
@@ -116,20 +115,20 @@ CString FilePath::getFullExtension() const
 	}
 
 	if (extStart) {
-		return path.substr(extStart-cpath, fnameBack-extStart+1);
+		return CStringView(path, extStart-cpath, fnameBack-extStart+1);
 	}
 
-	return CString("");
+	return CStringView(CString(""));
 }
 
 
-CString FilePath::getFileName() const
+CStringView FilePath::getFileNameView() const
 {
 	size_t plen = path.length();
 
 	if (plen == 0) {
 		// Empty path means current path
-		return CString(".");
+		return CStringView(CString("."));
 	}
 
 	const char* cpath = path.get();
@@ -142,11 +141,11 @@ CString FilePath::getFileName() const
 
 		if (syntax == Unix) {
 			// That's the root directory!
-			return CString("/");
+			return CStringView(CString("/"));
 		} else {
 			// Well, I guess that's just the current directory plus nothing.
 			// TODO Confirm/Disprove this
-			return CString(".");
+			return CStringView(CString("."));
 		}
 	}
 
@@ -156,41 +155,37 @@ CString FilePath::getFileName() const
 
 	if (!fnameStart) {
 		// No slashes at all, so the whole path is just the file name
-		return path;
+		return CStringView(path);
 	}
 
 	fnameStart++;
 
 	// Now, fnameStart is the first file name character, and fnameBack is the last
-	return path.substr(fnameStart-cpath, fnameBack-fnameStart+1);
+	return CStringView(path, fnameStart-cpath, fnameBack-fnameStart+1);
 }
 
 
-CString FilePath::getBaseFileName() const
+CStringView FilePath::getBaseFileNameView() const
 {
-	CString fname = getFileName();
-	const char* cfname = fname.get();
-
-	const char* dot = strchr(cfname, '.');
+	CStringView fname = getFileNameView();
+	ptrdiff_t dot = fname.indexOf('.');
 
-	if (!dot)
+	if (dot == -1)
 		return fname;
 
-	return fname.substr(0, dot-cfname);
+	return fname.substr(0, dot);
 }
 
 
-CString FilePath::getFullBaseFileName() const
+CStringView FilePath::getFullBaseFileNameView() const
 {
-	CString fname = getFileName();
-	const char* cfname = fname.get();
-
-	const char* dot = strrchr(cfname, '.');
+	CStringView fname = getFileNameView();
+	ptrdiff_t dot = fname.lastIndexOf('.');
 
-	if (!dot)
+	if (dot == -1)
 		return fname;
 
-	return fname.substr(0, dot-cfname);
+	return fname.substr(0, dot);
 }
 
 
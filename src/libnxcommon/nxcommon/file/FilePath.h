@@ -100,9 +100,9 @@ public:
 	 *
 	 *	@return The file name extension (without the '.').
 	 */
-	CString getExtension() const;
+	CString getExtension() const { return getExtensionView(); }
 
-	CString getFullExtension() const;
+	CString getFullExtension() const { return getFullExtensionView(); }
 
 	/**	\brief Returns the file name.
 	 *
@@ -110,11 +110,27 @@ public:
 	 *
 	 *	@return The file name.
 	 */
-	CString getFileName() const;
+	CString getFileName() const { return getFileNameView(); }
 
-	CString getBaseFileName() const;
+	CString getBaseFileName() const { return getBaseFileNameView(); }
 
-	CString getFullBaseFileName() const;
+	CString getFullBaseFileName() const { return getFullBaseFileNameView(); }
+
+	/**	\brief Returns the file name extension as a view into the path string.
+	 *
+	 * 	The path components can be accessed as views, which doesn't copy any part of the path.
+	 *
+	 * 	@see getExtension()
+	 */
+	CStringView getExtensionView() const;
+
+	CStringView getFullExtensionView() const;
+
+	CStringView getFileNameView() const;
+
+	CStringView getBaseFileNameView() const;
+
+	CStringView getFullBaseFileNameView() const;
 
 	/**	\brief Returns the string representation of this path.
 	 *
@@ -0,0 +1,49 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef WILDCARDFILEFINDER_H_
+#define WILDCARDFILEFINDER_H_
+
+#include <nxcommon/config.h>
+#include "FileFinder.h"
+#include "../WildcardPattern.h"
+
+
+
+/**	\brief A FileFinder that matches file names against a wildcard pattern.
+ *
+ * 	The pattern is compiled once, so this is suitable for searching large directory trees.
+ *
+ * 	@see WildcardPattern
+ */
+class WildcardFileFinder : public FileFinder {
+public:
+	WildcardFileFinder(const char* pattern, bool caseSensitive = true) : pattern(pattern, caseSensitive) {}
+	bool isCaseSensitive() const { return pattern.isCaseSensitive(); }
+	const WildcardPattern& getPattern() const { return pattern; }
+	virtual bool matches(const File& file) { return pattern.match(file.getPath().getFileNameView()); }
+
+private:
+	WildcardPattern pattern;
+};
+
+#endif /* WILDCARDFILEFINDER_H_ */
@@ -1,5 +1,6 @@
 #include "log.h"
 #include "util.h"
+#include "ringbuf.h"
 #include <string.h>
 #include <time.h>
 #include <assert.h>
@@ -14,6 +15,25 @@
 #include <zephyr.h>
 #endif
 
+#if defined(_POSIX_VERSION)  &&  defined(_NX_HAVE_ATOMICS)  &&  !defined(__ZEPHYR__)
+#define LOG_ASYNC_SUPPORTED
+#endif
+
+#ifdef LOG_ASYNC_SUPPORTED
+#include <sys/uio.h>
+#include <signal.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER)
+#define LOG_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__)  &&  __STDC_VERSION__ >= 201112L  &&  !defined(__ZEPHYR__)
+#define LOG_THREAD_LOCAL _Thread_local
+#endif
+
 
 
 FILE* _mainLogfile = NULL;
@@ -30,6 +50,73 @@ pthread_mutex_t _logMutex = PTHREAD_MUTEX_INITIALIZER;
 
 const char* logFormat = "%Y-%m-%d %H:%M:%S";
 bool freeLogFormat = false;
+static unsigned int logFormatGeneration = 0;
+
+
+
+#ifdef LOG_ASYNC_SUPPORTED
+
+// Number of records that the background thread writes with one writev() at most
+#define LOG_ASYNC_BATCH_SIZE 256
+
+#define LOG_ASYNC_CRASH_BATCH_SIZE 16
+
+// Value of _logAsyncNumPending after the crash handler took over the pending records
+#define LOG_ASYNC_BATCH_CLAIMED SIZE_MAX
+
+#if defined(IOV_MAX)  &&  IOV_MAX < LOG_ASYNC_BATCH_SIZE
+#define LOG_ASYNC_IOV_MAX IOV_MAX
+#else
+#define LOG_ASYNC_IOV_MAX LOG_ASYNC_BATCH_SIZE
+#endif
+
+
+/**
+ * A formatted message in the async logging queue. Short messages are stored inline, so that the queue's slots are
+ * the only memory that messages pass through on their way to the background thread.
+ */
+typedef struct LogAsyncRecord
+{
+	char* heapText;			// Text of messages that don't fit into text, or NULL
+	atomic_int* flushDone;	// For the markers sent by FlushLog(): Set to 1 when everything before is written.
+	uint32_t len;
+	int level;
+	char text[256 - 2*sizeof(void*) - sizeof(uint32_t) - sizeof(int)];
+} LogAsyncRecord;
+
+
+static ringbuf_mpmc_t _logAsyncQueue;
+static void* _logAsyncQueueMem = NULL;
+
+static ringbuf_event_t _logAsyncDataEvent;
+static ringbuf_event_t _logAsyncSpaceEvent;
+static ringbuf_event_t _logAsyncFlushEvent;
+
+static atomic_bool _logAsyncActive = false;
+static atomic_bool _logAsyncStopping = false;
+
+// Records taken out of the queue by the background thread, but not written yet. The first _logAsyncNumPending of
+// them may be claimed by the crash handler at any time, after which the background thread must not touch them.
+static LogAsyncRecord _logAsyncBatch[LOG_ASYNC_BATCH_SIZE];
+static atomic_size_t _logAsyncNumPending = 0;
+
+static size_t _logAsyncFlushSize;
+static unsigned int _logAsyncFlushIntervalMs;
+static int _logAsyncFlushLevel;
+
+// Protects starting and stopping of the background thread
+static pthread_mutex_t _logAsyncControlMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t _logAsyncThread;
+static bool _logAsyncThreadRunning = false;
+static bool _logAsyncAtExitRegistered = false;
+
+static const int _logAsyncCrashSignals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+static struct sigaction _logAsyncOldSigActions[sizeof(_logAsyncCrashSignals) / sizeof(int)];
+static bool _logAsyncCrashHandlersInstalled = false;
+static atomic_flag _logAsyncCrashHandled = ATOMIC_FLAG_INIT;
+static LogAsyncRecord _logAsyncCrashBatch[LOG_ASYNC_CRASH_BATCH_SIZE];
+
+#endif
 
 
 
@@ -65,12 +152,19 @@ static void LockMutexUnlock()
 #ifndef __ZEPHYR__
 void OpenLogFile(FILE* file)
 {
+	// Everything logged so far still goes to the old file
+	FlushLog();
+
+	LockMutexLock();
+
 	if (_mainLogfile) {
 		fclose(_mainLogfile);
 	}
 
 	_mainLogfile = file;
 
+	LockMutexUnlock();
+
 	//pthread_mutex_init(&_logMutex, nullptr);
 }
 #endif
@@ -122,167 +216,672 @@ void SetLogTimeFormat(const char* format)
 	logFormat = malloc(strlen(format)+1);
 	strcpy((char*) logFormat, format);
 	freeLogFormat = true;
+	logFormatGeneration++;
 }
 
 
-void _LogMessagevl(int level, const char* fmt, va_list args)
+static const char* GetLogTypeCode(int level)
 {
-	// Don't check for log level. This is done by LogMessage()
-
-#ifndef __ZEPHYR__
-	time_t t = time(NULL);
-#endif
-
-	const char* typeCode = "[???]";
-
 	switch (level) {
 	case LOG_LEVEL_ERROR:
-		typeCode = "[ERR]";
-		break;
+		return "[ERR]";
 	case LOG_LEVEL_WARNING:
-		typeCode = "[WRN]";
-		break;
+		return "[WRN]";
 	case LOG_LEVEL_INFO:
-		typeCode = "[INF]";
-		break;
+		return "[INF]";
 	case LOG_LEVEL_DEBUG:
-		typeCode = "[DBG]";
-		break;
+		return "[DBG]";
 	case LOG_LEVEL_VERBOSE:
-		typeCode = "[VRB]";
-		break;
+		return "[VRB]";
 	}
 
-	char timeStr[64];
+	return "[???]";
+}
+
 
+static void FormatLogTime(char* timeStr, size_t size)
+{
 #ifdef __ZEPHYR__
-	sprintf(timeStr, "(%llu)", (long long unsigned) k_uptime_get());
+	snprintf(timeStr, size, "(%llu)", (long long unsigned) k_uptime_get());
+#else
+	time_t t = time(NULL);
+
+#ifdef LOG_THREAD_LOCAL
+	// localtime() and strftime() are slow compared to the rest of a log call, and most messages are logged in the
+	// same second as the previous one from the same thread.
+	static LOG_THREAD_LOCAL time_t cachedTime = (time_t) -1;
+	static LOG_THREAD_LOCAL unsigned int cachedFormatGeneration = 0;
+	static LOG_THREAD_LOCAL char cachedTimeStr[64];
+
+	if (t != cachedTime  ||  cachedFormatGeneration != logFormatGeneration) {
+		struct tm localTime;
+		localtime_s_nx(&t, &localTime);
+		strftime(cachedTimeStr, sizeof(cachedTimeStr), logFormat, &localTime);
+		cachedTime = t;
+		cachedFormatGeneration = logFormatGeneration;
+	}
+
+	snprintf(timeStr, size, "%s", cachedTimeStr);
 #else
 	struct tm localTime;
 	localtime_s_nx(&t, &localTime);
-	strftime(timeStr, sizeof(timeStr), logFormat, &localTime);
+	strftime(timeStr, size, logFormat, &localTime);
+#endif
 #endif
+}
 
-	FILE* outStreams[] = { _mainLogfile, stderr };
 
-	for (size_t i = 0 ; i < sizeof(outStreams) / sizeof(FILE*) ; i++) {
-		FILE* out = outStreams[i];
+// Copies str to buf+pos as far as it fits, and returns the position after str (even if it didn't fit).
+static size_t AppendLogText(char* buf, size_t size, size_t pos, const char* str, size_t len)
+{
+	if (pos < size) {
+		size_t num = len < size-pos ? len : size-pos;
+		memcpy(buf+pos, str, num);
+	}
+	return pos + len;
+}
 
-		if (out) {
-			LockMutexLock();
 
-			fprintf(out, "%s %s - ", typeCode, timeStr);
+// Formats a complete log message, including prefix and trailing newline, into buf, in the same way as snprintf():
+// Returns the full length of the message, and writes at most size-1 characters plus a terminating null character.
+// In multi-line mode, each line of the message gets its own prefix.
+static size_t FormatLogMessage(char* buf, size_t size, int level, bool multi, const char* timeStr, const char* fmt,
+		va_list args)
+{
+	char prefix[128];
+	int prefixLen = snprintf(prefix, sizeof(prefix), "%s %s - ", GetLogTypeCode(level), timeStr);
+
+	if (prefixLen < 0) {
+		prefixLen = 0;
+	} else if ((size_t) prefixLen >= sizeof(prefix)) {
+		prefixLen = sizeof(prefix)-1;
+	}
+
+	size_t pos = AppendLogText(buf, size, 0, prefix, prefixLen);
+
+	va_list argsCpy;
+
+	if (!multi) {
+		va_copy(argsCpy, args);
+		int msgLen = vsnprintf(pos < size ? buf+pos : NULL, pos < size ? size-pos : 0, fmt, argsCpy);
+		va_end(argsCpy);
+
+		pos += msgLen > 0 ? (size_t) msgLen : 0;
+	} else {
+		char staticMsgBuf[256];
+		char* msgBuf = staticMsgBuf;
+
+		va_copy(argsCpy, args);
+		int msgLen = vsnprintf(staticMsgBuf, sizeof(staticMsgBuf), fmt, argsCpy);
+		va_end(argsCpy);
+
+		if (msgLen < 0) {
+			msgLen = 0;
+			staticMsgBuf[0] = '\0';
+		} else if ((size_t) msgLen >= sizeof(staticMsgBuf)) {
+			msgBuf = malloc(msgLen+1);
 
-			va_list argsCpy;
 			va_copy(argsCpy, args);
-			vfprintf(out, fmt, argsCpy);
+			vsnprintf(msgBuf, msgLen+1, fmt, argsCpy);
 			va_end(argsCpy);
+		}
 
-			fprintf(out, "\n");
+		const char* lineBegin = msgBuf;
+		const char* nlPos;
 
-			LockMutexUnlock();
+		while ((nlPos = strchr(lineBegin, '\n')) != NULL) {
+			pos = AppendLogText(buf, size, pos, lineBegin, nlPos+1 - lineBegin);
+			pos = AppendLogText(buf, size, pos, prefix, prefixLen);
+			lineBegin = nlPos+1;
+		}
 
-			fflush(out);
+		pos = AppendLogText(buf, size, pos, lineBegin, strlen(lineBegin));
+
+		if (msgBuf != staticMsgBuf) {
+			free(msgBuf);
+		}
+	}
+
+	pos = AppendLogText(buf, size, pos, "\n", 1);
+
+	if (size != 0) {
+		buf[pos < size ? pos : size-1] = '\0';
+	}
+
+	return pos;
+}
+
+
+
+
+#ifdef LOG_ASYNC_SUPPORTED
+
+static int64_t GetLogAsyncTimeMs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static bool LogAsyncHasWork(void* arg)
+{
+	(void) arg;
+	return ringbuf_mpmc_get_read_count(&_logAsyncQueue) != 0
+			||  atomic_load_explicit(&_logAsyncStopping, memory_order_acquire);
+}
+
+
+static bool LogAsyncHasSpace(void* arg)
+{
+	(void) arg;
+	return ringbuf_mpmc_get_read_count(&_logAsyncQueue) < _logAsyncQueue.capacity
+			||  !atomic_load_explicit(&_logAsyncActive, memory_order_acquire);
+}
+
+
+static bool LogAsyncIsFlushDone(void* done)
+{
+	return atomic_load_explicit((atomic_int*) done, memory_order_acquire) != 0;
+}
+
+
+// Writes all of iov to fd, with as few syscalls as possible. Only uses async-signal-safe functions.
+static void LogWriteFully(int fd, const struct iovec* iov, int numIov)
+{
+	struct iovec chunk[LOG_ASYNC_IOV_MAX];
+	int idx = 0;
+
+	while (idx < numIov) {
+		int num = numIov-idx < LOG_ASYNC_IOV_MAX ? numIov-idx : LOG_ASYNC_IOV_MAX;
+		memcpy(chunk, iov+idx, num*sizeof(struct iovec));
+
+		int first = 0;
+
+		while (first < num) {
+			ssize_t written = writev(fd, chunk+first, num-first);
+
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				// Nothing we can do about it. We can't even log it.
+				return;
+			}
+
+			while (first < num  &&  (size_t) written >= chunk[first].iov_len) {
+				written -= chunk[first].iov_len;
+				first++;
+			}
+			if (first < num) {
+				chunk[first].iov_base = ((char*) chunk[first].iov_base) + written;
+				chunk[first].iov_len -= written;
+			}
 		}
+
+		idx += num;
 	}
 }
 
 
-void _LogMessageMultivl(int level, const char* fmt, va_list args)
+// Writes the text of the records to the log file and stderr. Must be called with the log mutex locked, except from the
+// crash handler.
+static void LogAsyncWriteRecords(const LogAsyncRecord* recs, size_t numRecs)
 {
-	// Don't check for log level. This is done by LogMessageMulti()
+	struct iovec iov[LOG_ASYNC_BATCH_SIZE];
+	int numIov = 0;
+
+	for (size_t i = 0 ; i < numRecs ; i++) {
+		if (recs[i].len != 0) {
+			iov[numIov].iov_base = recs[i].heapText ? recs[i].heapText : (char*) recs[i].text;
+			iov[numIov].iov_len = recs[i].len;
+			numIov++;
+		}
+	}
+
+	if (numIov == 0) {
+		return;
+	}
+
+	if (_mainLogfile) {
+		LogWriteFully(fileno(_mainLogfile), iov, numIov);
+	}
+	LogWriteFully(STDERR_FILENO, iov, numIov);
+}
+
+
+// Frees the records after they were written, and completes any FlushLog() calls waiting for them.
+static void LogAsyncReleaseRecords(const LogAsyncRecord* recs, size_t numRecs)
+{
+	bool flushed = false;
+
+	for (size_t i = 0 ; i < numRecs ; i++) {
+		free(recs[i].heapText);
+
+		if (recs[i].flushDone) {
+			atomic_store_explicit(recs[i].flushDone, 1, memory_order_release);
+			flushed = true;
+		}
+	}
+
+	if (flushed) {
+		ringbuf_event_notify(&_logAsyncFlushEvent);
+	}
+}
+
+
+// Writes whatever is in the queue from the calling thread. Used when the background thread is gone.
+static void LogAsyncDrainSync()
+{
+	LogAsyncRecord recs[16];
+	size_t numRecs;
+
+	LockMutexLock();
+
+	while ((numRecs = ringbuf_mpmc_read(&_logAsyncQueue, recs, sizeof(recs) / sizeof(LogAsyncRecord))) != 0) {
+		LogAsyncWriteRecords(recs, numRecs);
+		LogAsyncReleaseRecords(recs, numRecs);
+	}
+
+	LockMutexUnlock();
+
+	ringbuf_event_notify(&_logAsyncSpaceEvent);
+}
+
+
+static void LogAsyncEnqueue(const LogAsyncRecord* rec)
+{
+	while (ringbuf_mpmc_write(&_logAsyncQueue, rec, 1) == 0) {
+		// The queue is full. This is the only case where logging blocks in async mode.
+		if (!atomic_load_explicit(&_logAsyncActive, memory_order_acquire)) {
+			LogAsyncDrainSync();
+		} else {
+			ringbuf_event_notify(&_logAsyncDataEvent);
+			ringbuf_event_wait(&_logAsyncSpaceEvent, LogAsyncHasSpace, NULL, 10000);
+		}
+	}
+
+	// Wakes the background thread if it is sleeping. The fence in ringbuf_event_notify() also orders the write above
+	// before the load of _logAsyncActive below, which pairs with the fence in StopAsyncLogging(): Either we see that
+	// async mode was stopped and drain the queue ourselves, or StopAsyncLogging() sees our record in its final drain.
+	ringbuf_event_notify(&_logAsyncDataEvent);
+
+	if (!atomic_load_explicit(&_logAsyncActive, memory_order_relaxed)) {
+		LogAsyncDrainSync();
+	}
+}
+
+
+static void LogAsyncMessage(int level, bool multi, const char* timeStr, const char* fmt, va_list args)
+{
+	// The record on our stack is the per-thread formatting buffer. Only messages that don't fit into it need the heap.
+	LogAsyncRecord rec;
+	rec.heapText = NULL;
+	rec.flushDone = NULL;
+	rec.level = level;
+
+	size_t len = FormatLogMessage(rec.text, sizeof(rec.text), level, multi, timeStr, fmt, args);
+
+	if (len >= sizeof(rec.text)) {
+		rec.heapText = malloc(len+1);
+		len = FormatLogMessage(rec.heapText, len+1, level, multi, timeStr, fmt, args);
+	}
+
+	rec.len = (uint32_t) len;
+
+	LogAsyncEnqueue(&rec);
+}
+
+
+static void* LogAsyncThreadMain(void* arg)
+{
+	(void) arg;
+
+	size_t numPending = 0;
+	size_t pendingBytes = 0;
+	int64_t firstPendingTime = 0;
+	bool flushNow = false;
+
+	for (;;) {
+		bool stopping = atomic_load_explicit(&_logAsyncStopping, memory_order_acquire);
+
+		if (!stopping) {
+			int64_t timeoutUs = -1;
+
+			if (numPending != 0) {
+				int64_t remaining = firstPendingTime + _logAsyncFlushIntervalMs - GetLogAsyncTimeMs();
+				timeoutUs = remaining > 0 ? remaining*1000 : 0;
+			}
+
+			ringbuf_event_wait(&_logAsyncDataEvent, LogAsyncHasWork, NULL, timeoutUs);
+		}
+
+		size_t numRead = ringbuf_mpmc_read(&_logAsyncQueue, _logAsyncBatch + numPending,
+				LOG_ASYNC_BATCH_SIZE - numPending);
+
+		if (numRead != 0) {
+			if (numPending == 0) {
+				firstPendingTime = GetLogAsyncTimeMs();
+			}
+
+			for (size_t i = numPending ; i < numPending+numRead ; i++) {
+				const LogAsyncRecord* rec = &_logAsyncBatch[i];
+				pendingBytes += rec->len;
+
+				if (rec->flushDone  ||  (rec->level != LOG_LEVEL_NONE  &&  rec->level <= _logAsyncFlushLevel)) {
+					flushNow = true;
+				}
+			}
+
+			// Lets the crash handler see the records we took out of the queue
+			size_t expected = numPending;
+			numPending += numRead;
+
+			if (!atomic_compare_exchange_strong_explicit(&_logAsyncNumPending, &expected, numPending,
+					memory_order_release, memory_order_relaxed)) {
+				// The crash handler has claimed the batch
+				return NULL;
+			}
+
+			ringbuf_event_notify(&_logAsyncSpaceEvent);
+		}
+
+		bool queueEmpty = ringbuf_mpmc_get_read_count(&_logAsyncQueue) == 0;
+
+		if (numPending != 0) {
+			bool flush = flushNow  ||  stopping  ||  numPending == LOG_ASYNC_BATCH_SIZE
+					||  pendingBytes >= _logAsyncFlushSize
+					||  GetLogAsyncTimeMs() - firstPendingTime >= _logAsyncFlushIntervalMs;
+
+			if (flush) {
+				LockMutexLock();
+				LogAsyncWriteRecords(_logAsyncBatch, numPending);
+				LockMutexUnlock();
+
+				// Take the records back before freeing them, unless the crash handler has claimed them in the meantime
+				if (atomic_exchange_explicit(&_logAsyncNumPending, 0, memory_order_acq_rel) == LOG_ASYNC_BATCH_CLAIMED) {
+					return NULL;
+				}
+
+				LogAsyncReleaseRecords(_logAsyncBatch, numPending);
+
+				numPending = 0;
+				pendingBytes = 0;
+				flushNow = false;
+			}
+		} else if (stopping  &&  queueEmpty) {
+			break;
+		}
+
+		if (numRead == 0  &&  !queueEmpty) {
+			// A writer has claimed the next slot, but hasn't filled it yet
+			sched_yield();
+		}
+	}
+
+	return NULL;
+}
+
+
+static void LogAsyncCrashHandler(int sig)
+{
+	if (!atomic_flag_test_and_set(&_logAsyncCrashHandled)) {
+		// Write what the background thread has taken out of the queue but not written yet. Claiming the batch stops
+		// the background thread from freeing or refilling these records. If it was just writing them, some lines may
+		// appear twice, but that's better than losing the last messages before a crash.
+		size_t numPending = atomic_exchange_explicit(&_logAsyncNumPending, LOG_ASYNC_BATCH_CLAIMED,
+				memory_order_acq_rel);
+		if (numPending != LOG_ASYNC_BATCH_CLAIMED) {
+			LogAsyncWriteRecords(_logAsyncBatch, numPending);
+		}
+
+		// The queue supports multiple readers, so we can safely drain it here, even if the background thread is
+		// still running. Nothing is freed, since we can't call free() from a signal handler.
+		size_t numRecs;
+		while ((numRecs = ringbuf_mpmc_read(&_logAsyncQueue, _logAsyncCrashBatch, LOG_ASYNC_CRASH_BATCH_SIZE)) != 0) {
+			LogAsyncWriteRecords(_logAsyncCrashBatch, numRecs);
+		}
+	}
+
+	// Let the previous handler (or the default action) deal with the signal
+	for (size_t i = 0 ; i < sizeof(_logAsyncCrashSignals) / sizeof(int) ; i++) {
+		if (_logAsyncCrashSignals[i] == sig) {
+			sigaction(sig, &_logAsyncOldSigActions[i], NULL);
+		}
+	}
+
+	raise(sig);
+}
+
+
+static void InstallLogAsyncCrashHandlers()
+{
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = LogAsyncCrashHandler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_ONSTACK;
+
+	for (size_t i = 0 ; i < sizeof(_logAsyncCrashSignals) / sizeof(int) ; i++) {
+		sigaction(_logAsyncCrashSignals[i], &sa, &_logAsyncOldSigActions[i]);
+	}
+}
 
-#ifndef __ZEPHYR__
-	time_t t = time(NULL);
 #endif
 
-	const char* typeCode = "[???]";
 
-	switch (level) {
-	case LOG_LEVEL_ERROR:
-		typeCode = "[ERR]";
-		break;
-	case LOG_LEVEL_WARNING:
-		typeCode = "[WRN]";
-		break;
-	case LOG_LEVEL_INFO:
-		typeCode = "[INF]";
-		break;
-	case LOG_LEVEL_DEBUG:
-		typeCode = "[DBG]";
-		break;
-	case LOG_LEVEL_VERBOSE:
-		typeCode = "[VRB]";
-		break;
+void GetDefaultLogAsyncConfig(LogAsyncConfig* config)
+{
+	config->queueCapacity = 1024;
+	config->flushSize = 32*1024;
+	config->flushIntervalMs = 100;
+	config->flushLevel = LOG_LEVEL_ERROR;
+	config->installCrashHandlers = false;
+}
+
+
+bool StartAsyncLogging(const LogAsyncConfig* config)
+{
+#ifdef LOG_ASYNC_SUPPORTED
+	LogAsyncConfig defaultConfig;
+
+	if (!config) {
+		GetDefaultLogAsyncConfig(&defaultConfig);
+		config = &defaultConfig;
 	}
 
-	char timeStr[64];
+	pthread_mutex_lock(&_logAsyncControlMutex);
 
-#ifdef __ZEPHYR__
-	sprintf(timeStr, "(%llu)", (long long unsigned) k_uptime_get());
+	if (_logAsyncThreadRunning) {
+		pthread_mutex_unlock(&_logAsyncControlMutex);
+		return true;
+	}
+
+	if (!_logAsyncQueueMem) {
+		// Late producers may still use the queue after StopAsyncLogging(), so it is never freed.
+		size_t capacity = 2;
+		while (capacity < config->queueCapacity) {
+			capacity *= 2;
+		}
+
+		_logAsyncQueueMem = malloc(ringbuf_mpmc_get_buffer_size(sizeof(LogAsyncRecord), capacity));
+		ringbuf_mpmc_create(&_logAsyncQueue, _logAsyncQueueMem, sizeof(LogAsyncRecord), capacity);
+
+		ringbuf_event_init(&_logAsyncDataEvent);
+		ringbuf_event_init(&_logAsyncSpaceEvent);
+		ringbuf_event_init(&_logAsyncFlushEvent);
+	}
+
+	// Only read by the background thread, which pthread_create() synchronizes with
+	_logAsyncFlushSize = config->flushSize;
+	_logAsyncFlushIntervalMs = config->flushIntervalMs;
+	_logAsyncFlushLevel = config->flushLevel;
+
+	// The background thread writes to the file descriptors directly, so nothing may be left in the stdio buffers.
+	LockMutexLock();
+	if (_mainLogfile) {
+		fflush(_mainLogfile);
+	}
+	fflush(stderr);
+	LockMutexUnlock();
+
+	atomic_store_explicit(&_logAsyncStopping, false, memory_order_relaxed);
+
+	if (pthread_create(&_logAsyncThread, NULL, LogAsyncThreadMain, NULL) != 0) {
+		pthread_mutex_unlock(&_logAsyncControlMutex);
+		return false;
+	}
+
+	_logAsyncThreadRunning = true;
+	atomic_store_explicit(&_logAsyncActive, true, memory_order_seq_cst);
+
+	if (config->installCrashHandlers  &&  !_logAsyncCrashHandlersInstalled) {
+		InstallLogAsyncCrashHandlers();
+		_logAsyncCrashHandlersInstalled = true;
+	}
+
+	if (!_logAsyncAtExitRegistered) {
+		atexit(StopAsyncLogging);
+		_logAsyncAtExitRegistered = true;
+	}
+
+	pthread_mutex_unlock(&_logAsyncControlMutex);
+
+	return true;
 #else
-	struct tm localTime;
-	localtime_s_nx(&t, &localTime);
-	strftime(timeStr, sizeof(timeStr), logFormat, &localTime);
+	(void) config;
+	return false;
 #endif
+}
 
-	FILE* outStreams[] = { _mainLogfile, stderr };
 
-	char staticMsgBuf[256];
-	char* msgBuf = staticMsgBuf;
+void StopAsyncLogging()
+{
+#ifdef LOG_ASYNC_SUPPORTED
+	pthread_mutex_lock(&_logAsyncControlMutex);
 
-	va_list argsCpy;
-	va_copy(argsCpy, args);
-	int msgLen = vsnprintf(NULL, 0, fmt, argsCpy);
-	va_end(argsCpy);
+	if (!_logAsyncThreadRunning) {
+		pthread_mutex_unlock(&_logAsyncControlMutex);
+		return;
+	}
+
+	// New messages are written synchronously from now on. See LogAsyncEnqueue() for the fence.
+	atomic_store_explicit(&_logAsyncActive, false, memory_order_seq_cst);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	atomic_store_explicit(&_logAsyncStopping, true, memory_order_release);
+	ringbuf_event_notify(&_logAsyncDataEvent);
+	ringbuf_event_notify(&_logAsyncSpaceEvent);
 
-	if (msgLen >= sizeof(staticMsgBuf)) {
-		msgBuf = malloc(msgLen+1);
+	// The background thread drains the queue before it exits
+	pthread_join(_logAsyncThread, NULL);
+	_logAsyncThreadRunning = false;
+
+	// Messages from threads that raced with us
+	LogAsyncDrainSync();
+
+	pthread_mutex_unlock(&_logAsyncControlMutex);
+#endif
+}
+
+
+bool IsAsyncLoggingActive()
+{
+#ifdef LOG_ASYNC_SUPPORTED
+	return atomic_load_explicit(&_logAsyncActive, memory_order_acquire);
+#else
+	return false;
+#endif
+}
+
+
+void FlushLog()
+{
+#ifdef LOG_ASYNC_SUPPORTED
+	if (atomic_load_explicit(&_logAsyncActive, memory_order_acquire)) {
+		// Send a marker through the queue, and wait until the background thread has written everything before it
+		atomic_int done;
+		atomic_init(&done, 0);
+
+		LogAsyncRecord rec;
+		rec.heapText = NULL;
+		rec.flushDone = &done;
+		rec.len = 0;
+		rec.level = LOG_LEVEL_NONE;
+
+		LogAsyncEnqueue(&rec);
+
+		ringbuf_event_wait(&_logAsyncFlushEvent, LogAsyncIsFlushDone, &done, -1);
+		return;
 	}
+#endif
 
-	va_copy(argsCpy, args);
-	int actualMsgLen = vsnprintf(msgBuf, msgLen+1, fmt, argsCpy);
-	va_end(argsCpy);
+	LockMutexLock();
+	if (_mainLogfile) {
+		fflush(_mainLogfile);
+	}
+	fflush(stderr);
+	LockMutexUnlock();
+}
 
-	assert(actualMsgLen == msgLen);
 
-	for (size_t i = 0 ; i < sizeof(outStreams) / sizeof(FILE*) ; i++) {
-		FILE* out = outStreams[i];
+static void LogMessageImpl(int level, bool multi, const char* fmt, va_list args)
+{
+	char timeStr[64];
+	FormatLogTime(timeStr, sizeof(timeStr));
 
-		if (out) {
-			LockMutexLock();
+#ifdef LOG_ASYNC_SUPPORTED
+	if (atomic_load_explicit(&_logAsyncActive, memory_order_acquire)) {
+		LogAsyncMessage(level, multi, timeStr, fmt, args);
+		return;
+	}
+#endif
 
-			char* bufBegin = msgBuf;
+	char staticMsgBuf[512];
+	char* msgBuf = staticMsgBuf;
 
-			do {
-				fprintf(out, "%s %s - ", typeCode, timeStr);
+	size_t len = FormatLogMessage(staticMsgBuf, sizeof(staticMsgBuf), level, multi, timeStr, fmt, args);
 
-				char* nlPos = strchr(bufBegin, '\n');
+	if (len >= sizeof(staticMsgBuf)) {
+		msgBuf = malloc(len+1);
+		len = FormatLogMessage(msgBuf, len+1, level, multi, timeStr, fmt, args);
+	}
 
-				if (nlPos) {
-                    char tmpChar = *nlPos;
-					*nlPos = '\0';
-					fprintf(out, "%s\n", bufBegin);
-					bufBegin = nlPos+1;
-                    *nlPos = tmpChar;
-				} else {
-					fprintf(out, "%s\n", bufBegin);
-					bufBegin = NULL;
-				}
-			} while (bufBegin != NULL);
+	LockMutexLock();
 
-			LockMutexUnlock();
+	FILE* outStreams[] = { _mainLogfile, stderr };
 
+	for (size_t i = 0 ; i < sizeof(outStreams) / sizeof(FILE*) ; i++) {
+		FILE* out = outStreams[i];
+
+		if (out) {
+			fwrite(msgBuf, 1, len, out);
 			fflush(out);
 		}
 	}
 
+	LockMutexUnlock();
+
 	if (msgBuf != staticMsgBuf) {
 		free(msgBuf);
 	}
 }
 
 
+void _LogMessagevl(int level, const char* fmt, va_list args)
+{
+	// Don't check for log level. This is done by LogMessage()
+	LogMessageImpl(level, false, fmt, args);
+}
+
+
+void _LogMessageMultivl(int level, const char* fmt, va_list args)
+{
+	// Don't check for log level. This is done by LogMessageMulti()
+	LogMessageImpl(level, true, fmt, args);
+}
+
+
 bool _LuaIsLogLevelActive(int level)
 {
 	return IsLogLevelActive(level);
@@ -44,6 +44,75 @@ LUASYS_EXPORT const char* GetLogLevelName(int level);
 LUASYS_EXPORT void SetLogTimeFormat(const char* format);
 
 
+#ifndef GENERATE_LUAJIT_FFI_CDEF
+
+/**
+ * Settings for StartAsyncLogging(). Use GetDefaultLogAsyncConfig() to initialize it.
+ */
+typedef struct LogAsyncConfig
+{
+	/**
+	 * Number of messages that can be queued before logging threads have to wait for the background thread. It is
+	 * rounded up to a power of two. Each queue slot takes 256 bytes. Only used by the first StartAsyncLogging().
+	 */
+	size_t queueCapacity;
+
+	/**
+	 * The background thread writes its pending messages once they add up to this many bytes...
+	 */
+	size_t flushSize;
+
+	/**
+	 * ... or once the oldest one has waited for this long...
+	 */
+	unsigned int flushIntervalMs;
+
+	/**
+	 * ... or immediately when a message of this level or a more severe one arrives.
+	 */
+	int flushLevel;
+
+	/**
+	 * If true, handlers for SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT are installed that write all queued messages
+	 * before passing the signal on to the previously installed handler. Off by default, since it replaces the
+	 * application's own handlers for these signals.
+	 */
+	bool installCrashHandlers;
+} LogAsyncConfig;
+
+
+void GetDefaultLogAsyncConfig(LogAsyncConfig* config);
+
+/**
+ * Switches logging to asynchronous mode.
+ *
+ * In async mode, the logging thread only formats the message into a queue slot and enqueues it into a lock-free
+ * queue. A background thread takes the messages from the queue and writes them to the log file and stderr in
+ * batches with writev(), according to the flush policy in config. Messages of a single thread keep their order.
+ *
+ * Pending messages are written by StopAsyncLogging(), which is also registered with atexit(), and by FlushLog().
+ *
+ * @param config The settings, or NULL for the defaults.
+ * @return true if async mode is active. Returns false if it is not supported on this platform (currently, it needs
+ * 		POSIX and C11 atomics) or the background thread could not be started.
+ */
+bool StartAsyncLogging(const LogAsyncConfig* config);
+
+/**
+ * Writes all pending messages, stops the background thread and switches back to synchronous logging.
+ */
+void StopAsyncLogging();
+
+bool IsAsyncLoggingActive();
+
+/**
+ * Blocks until all messages logged by any thread before this call have been written.
+ */
+void FlushLog();
+
+#endif
+
+
 #define LogError(...) LogMessage(LOG_LEVEL_ERROR, __VA_ARGS__)
 #define LogWarning(...) LogMessage(LOG_LEVEL_WARNING, __VA_ARGS__)
 #define LogInfo(...) LogMessage(LOG_LEVEL_INFO, __VA_ARGS__)
@@ -1,7 +1,17 @@
 #include "ringbuf.h"
+#include "util.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 
 static inline size_t min_size(size_t a, size_t b) { return a < b ? a : b; }
@@ -22,6 +32,122 @@ static inline size_t min_size(size_t a, size_t b) { return a < b ? a : b; }
 
 
 
+#ifdef _NX_HAVE_ATOMICS
+
+static int64_t ringbuf_event_get_time_us()
+{
+#if defined(_POSIX_VERSION)  &&  defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+	return (int64_t) GetTickcountMicroseconds();
+#endif
+}
+
+
+// Sleeps until the value of *addr is no longer expected, or timeout_us has passed. May return early for no reason.
+static void ringbuf_event_park(atomic_uint* addr, unsigned int expected, int64_t timeout_us)
+{
+#ifdef __linux__
+	struct timespec ts;
+	struct timespec* tsp = NULL;
+
+	if (timeout_us >= 0) {
+		ts.tv_sec = (time_t) (timeout_us / 1000000);
+		ts.tv_nsec = (long) (timeout_us % 1000000) * 1000;
+		tsp = &ts;
+	}
+
+	syscall(SYS_futex, (unsigned int*) addr, FUTEX_WAIT_PRIVATE, expected, tsp, NULL, 0);
+#else
+	if (atomic_load_explicit(addr, memory_order_acquire) == expected) {
+		SleepMilliseconds((timeout_us >= 0  &&  timeout_us < 1000) ? 0 : 1);
+	}
+#endif
+}
+
+
+static void ringbuf_event_wake_all(atomic_uint* addr)
+{
+#ifdef __linux__
+	syscall(SYS_futex, (unsigned int*) addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+	(void) addr;
+#endif
+}
+
+
+void ringbuf_event_init(ringbuf_event_t* event)
+{
+	atomic_init(&event->seq, 0);
+	atomic_init(&event->num_waiters, 0);
+}
+
+
+bool ringbuf_event_wait(ringbuf_event_t* event, bool (*cond)(void*), void* cond_arg, int64_t timeout_us)
+{
+	if (cond(cond_arg)) {
+		return true;
+	}
+	if (timeout_us == 0) {
+		return false;
+	}
+
+	int64_t deadline = timeout_us > 0 ? ringbuf_event_get_time_us() + timeout_us : -1;
+
+	for (;;) {
+		atomic_fetch_add_explicit(&event->num_waiters, 1, memory_order_relaxed);
+
+		// Read seq before re-checking the condition: A notification that happens after the check bumps seq, so the
+		// park below returns immediately instead of missing it.
+		unsigned int seq = atomic_load_explicit(&event->seq, memory_order_acquire);
+
+		// Pairs with the fence in ringbuf_event_notify(): Either we see the notifier's change in cond(), or it sees
+		// our registration in num_waiters.
+		atomic_thread_fence(memory_order_seq_cst);
+
+		bool res = cond(cond_arg);
+
+		if (!res) {
+			int64_t remaining = -1;
+
+			if (deadline >= 0) {
+				remaining = deadline - ringbuf_event_get_time_us();
+			}
+
+			if (deadline < 0  ||  remaining > 0) {
+				ringbuf_event_park(&event->seq, seq, remaining);
+				res = cond(cond_arg);
+			}
+		}
+
+		atomic_fetch_sub_explicit(&event->num_waiters, 1, memory_order_relaxed);
+
+		if (res) {
+			return true;
+		}
+		if (deadline >= 0  &&  ringbuf_event_get_time_us() >= deadline) {
+			return false;
+		}
+	}
+}
+
+
+void ringbuf_event_notify(ringbuf_event_t* event)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (atomic_load_explicit(&event->num_waiters, memory_order_relaxed) != 0) {
+		atomic_fetch_add_explicit(&event->seq, 1, memory_order_release);
+		ringbuf_event_wake_all(&event->seq);
+	}
+}
+
+#endif
+
+
+
 void ringbuf_create(ringbuf_t* rbuf, void* buffer, size_t elem_size, size_t capacity)
 {
 	rbuf->buffer = buffer;
@@ -30,6 +156,11 @@ void ringbuf_create(ringbuf_t* rbuf, void* buffer, size_t elem_size, size_t capa
 	rbuf->read_offs = 0;
 	rbuf->write_offs = 0;
 	rbuf->count = 0;
+
+#ifdef _NX_HAVE_ATOMICS
+	ringbuf_event_init(&rbuf->read_event);
+	ringbuf_event_init(&rbuf->write_event);
+#endif
 }
 
 
@@ -57,6 +188,32 @@ bool ringbuf_is_full(ringbuf_t* rbuf)
 }
 
 
+// Publishes num_elems written elements, and wakes a waiting reader if the buffer was empty.
+static inline void ringbuf_commit_write(ringbuf_t* rbuf, size_t num_elems)
+{
+#ifdef _NX_HAVE_ATOMICS
+	if (_size_atomic_fetch_add(&rbuf->count, num_elems) == 0  &&  num_elems != 0) {
+		ringbuf_event_notify(&rbuf->read_event);
+	}
+#else
+	_size_atomic_fetch_add(&rbuf->count, num_elems);
+#endif
+}
+
+
+// Releases num_elems read elements, and wakes a waiting writer if the buffer was full.
+static inline void ringbuf_commit_read(ringbuf_t* rbuf, size_t num_elems)
+{
+#ifdef _NX_HAVE_ATOMICS
+	if (_size_atomic_fetch_sub(&rbuf->count, num_elems) == rbuf->capacity  &&  num_elems != 0) {
+		ringbuf_event_notify(&rbuf->write_event);
+	}
+#else
+	_size_atomic_fetch_sub(&rbuf->count, num_elems);
+#endif
+}
+
+
 size_t ringbuf_write(ringbuf_t* rbuf, const void* elems, size_t num_elems)
 {
 	num_elems = min_size(num_elems, ringbuf_get_write_count(rbuf));
@@ -68,7 +225,7 @@ size_t ringbuf_write(ringbuf_t* rbuf, const void* elems, size_t num_elems)
 	memcpy(rbuf->buffer, ((char*) elems) + len1*rbuf->elem_size, len2*rbuf->elem_size);
 
 	rbuf->write_offs = (rbuf->write_offs + num_elems) % rbuf->capacity;
-	_size_atomic_fetch_add(&rbuf->count, num_elems);
+	ringbuf_commit_write(rbuf, num_elems);
 
 	return num_elems;
 }
@@ -79,7 +236,7 @@ size_t ringbuf_advance_write(ringbuf_t* rbuf, size_t num_elems)
 	num_elems = min_size(num_elems, ringbuf_get_write_count(rbuf));
 
 	rbuf->write_offs = (rbuf->write_offs + num_elems) % rbuf->capacity;
-	_size_atomic_fetch_add(&rbuf->count, num_elems);
+	ringbuf_commit_write(rbuf, num_elems);
 
 	return num_elems;
 }
@@ -90,7 +247,7 @@ size_t ringbuf_read(ringbuf_t* rbuf, void* elems, size_t num_elems)
 	num_elems = ringbuf_peek(rbuf, elems, num_elems);
 
 	rbuf->read_offs = (rbuf->read_offs + num_elems) % rbuf->capacity;
-	_size_atomic_fetch_sub(&rbuf->count, num_elems);
+	ringbuf_commit_read(rbuf, num_elems);
 
 	return num_elems;
 }
@@ -101,7 +258,7 @@ size_t ringbuf_advance_read(ringbuf_t* rbuf, size_t num_elems)
 	num_elems = min_size(num_elems, ringbuf_get_read_count(rbuf));
 
 	rbuf->read_offs = (rbuf->read_offs + num_elems) % rbuf->capacity;
-	_size_atomic_fetch_sub(&rbuf->count, num_elems);
+	ringbuf_commit_read(rbuf, num_elems);
 
 	return num_elems;
 }
@@ -126,7 +283,342 @@ void ringbuf_clear(ringbuf_t* rbuf)
 	rbuf->read_offs = 0;
 	rbuf->write_offs = 0;
 	_size_atomic_store(&rbuf->count, 0);
+
+#ifdef _NX_HAVE_ATOMICS
+	ringbuf_event_notify(&rbuf->write_event);
+#endif
+}
+
+
+#ifdef _NX_HAVE_ATOMICS
+
+static bool ringbuf_can_read(void* rbuf)
+{
+	return !ringbuf_is_empty((ringbuf_t*) rbuf);
+}
+
+
+static bool ringbuf_can_write(void* rbuf)
+{
+	return !ringbuf_is_full((ringbuf_t*) rbuf);
+}
+
+
+bool ringbuf_read_wait(ringbuf_t* rbuf, int64_t timeout_us)
+{
+	return ringbuf_event_wait(&rbuf->read_event, ringbuf_can_read, rbuf, timeout_us);
+}
+
+
+bool ringbuf_write_wait(ringbuf_t* rbuf, int64_t timeout_us)
+{
+	return ringbuf_event_wait(&rbuf->write_event, ringbuf_can_write, rbuf, timeout_us);
+}
+
+#endif
+
+
+
+#ifdef _NX_HAVE_ATOMICS
+
+// Positions are in [0, 2*capacity), so that a full buffer can be told apart from an empty one.
+
+static inline size_t ringbuf_spsc_pos_diff(ringbuf_spsc_t* rbuf, size_t a, size_t b)
+{
+	return a >= b ? a - b : a + 2*rbuf->capacity - b;
+}
+
+
+static inline size_t ringbuf_spsc_pos_add(ringbuf_spsc_t* rbuf, size_t pos, size_t num)
+{
+	pos += num;
+	return pos >= 2*rbuf->capacity ? pos - 2*rbuf->capacity : pos;
+}
+
+
+static inline size_t ringbuf_spsc_pos_index(ringbuf_spsc_t* rbuf, size_t pos)
+{
+	return pos >= rbuf->capacity ? pos - rbuf->capacity : pos;
+}
+
+
+void ringbuf_spsc_create(ringbuf_spsc_t* rbuf, void* buffer, size_t elem_size, size_t capacity)
+{
+	rbuf->buffer = (char*) buffer;
+	rbuf->elem_size = elem_size;
+	rbuf->capacity = capacity;
+	atomic_init(&rbuf->write_pos, 0);
+	rbuf->cached_read_pos = 0;
+	atomic_init(&rbuf->read_pos, 0);
+	rbuf->cached_write_pos = 0;
+}
+
+
+size_t ringbuf_spsc_get_read_count(ringbuf_spsc_t* rbuf)
+{
+	size_t read_pos = atomic_load_explicit(&rbuf->read_pos, memory_order_acquire);
+	size_t write_pos = atomic_load_explicit(&rbuf->write_pos, memory_order_acquire);
+	return ringbuf_spsc_pos_diff(rbuf, write_pos, read_pos);
+}
+
+
+size_t ringbuf_spsc_get_write_count(ringbuf_spsc_t* rbuf)
+{
+	return rbuf->capacity - ringbuf_spsc_get_read_count(rbuf);
+}
+
+
+bool ringbuf_spsc_is_empty(ringbuf_spsc_t* rbuf)
+{
+	return ringbuf_spsc_get_read_count(rbuf) == 0;
+}
+
+
+bool ringbuf_spsc_is_full(ringbuf_spsc_t* rbuf)
+{
+	return ringbuf_spsc_get_read_count(rbuf) == rbuf->capacity;
 }
 
 
+// Called by the writer. Returns the write position and limits *num_elems to the free space, reloading the read
+// position only if the cached one doesn't leave enough room.
+static inline size_t ringbuf_spsc_prepare_write(ringbuf_spsc_t* rbuf, size_t* num_elems)
+{
+	size_t write_pos = atomic_load_explicit(&rbuf->write_pos, memory_order_relaxed);
+	size_t free_count = rbuf->capacity - ringbuf_spsc_pos_diff(rbuf, write_pos, rbuf->cached_read_pos);
+
+	if (free_count < *num_elems) {
+		rbuf->cached_read_pos = atomic_load_explicit(&rbuf->read_pos, memory_order_acquire);
+		free_count = rbuf->capacity - ringbuf_spsc_pos_diff(rbuf, write_pos, rbuf->cached_read_pos);
+	}
+
+	*num_elems = min_size(*num_elems, free_count);
+	return write_pos;
+}
+
+
+// Called by the reader. Same as ringbuf_spsc_prepare_write() for the other side.
+static inline size_t ringbuf_spsc_prepare_read(ringbuf_spsc_t* rbuf, size_t* num_elems)
+{
+	size_t read_pos = atomic_load_explicit(&rbuf->read_pos, memory_order_relaxed);
+	size_t count = ringbuf_spsc_pos_diff(rbuf, rbuf->cached_write_pos, read_pos);
 
+	if (count < *num_elems) {
+		rbuf->cached_write_pos = atomic_load_explicit(&rbuf->write_pos, memory_order_acquire);
+		count = ringbuf_spsc_pos_diff(rbuf, rbuf->cached_write_pos, read_pos);
+	}
+
+	*num_elems = min_size(*num_elems, count);
+	return read_pos;
+}
+
+
+size_t ringbuf_spsc_write(ringbuf_spsc_t* rbuf, const void* elems, size_t num_elems)
+{
+	size_t write_pos = ringbuf_spsc_prepare_write(rbuf, &num_elems);
+	size_t offs = ringbuf_spsc_pos_index(rbuf, write_pos);
+
+	size_t len1 = min_size(num_elems, rbuf->capacity - offs);
+	size_t len2 = num_elems - len1;
+
+	memcpy(rbuf->buffer + offs*rbuf->elem_size, elems, len1*rbuf->elem_size);
+	memcpy(rbuf->buffer, ((const char*) elems) + len1*rbuf->elem_size, len2*rbuf->elem_size);
+
+	atomic_store_explicit(&rbuf->write_pos, ringbuf_spsc_pos_add(rbuf, write_pos, num_elems), memory_order_release);
+
+	return num_elems;
+}
+
+
+size_t ringbuf_spsc_advance_write(ringbuf_spsc_t* rbuf, size_t num_elems)
+{
+	size_t write_pos = ringbuf_spsc_prepare_write(rbuf, &num_elems);
+	atomic_store_explicit(&rbuf->write_pos, ringbuf_spsc_pos_add(rbuf, write_pos, num_elems), memory_order_release);
+	return num_elems;
+}
+
+
+size_t ringbuf_spsc_peek(ringbuf_spsc_t* rbuf, void* elems, size_t num_elems)
+{
+	size_t read_pos = ringbuf_spsc_prepare_read(rbuf, &num_elems);
+	size_t offs = ringbuf_spsc_pos_index(rbuf, read_pos);
+
+	size_t len1 = min_size(num_elems, rbuf->capacity - offs);
+	size_t len2 = num_elems - len1;
+
+	memcpy(elems, rbuf->buffer + offs*rbuf->elem_size, len1*rbuf->elem_size);
+	memcpy(((char*) elems) + len1*rbuf->elem_size, rbuf->buffer, len2*rbuf->elem_size);
+
+	return num_elems;
+}
+
+
+size_t ringbuf_spsc_read(ringbuf_spsc_t* rbuf, void* elems, size_t num_elems)
+{
+	num_elems = ringbuf_spsc_peek(rbuf, elems, num_elems);
+
+	size_t read_pos = atomic_load_explicit(&rbuf->read_pos, memory_order_relaxed);
+	atomic_store_explicit(&rbuf->read_pos, ringbuf_spsc_pos_add(rbuf, read_pos, num_elems), memory_order_release);
+
+	return num_elems;
+}
+
+
+size_t ringbuf_spsc_advance_read(ringbuf_spsc_t* rbuf, size_t num_elems)
+{
+	size_t read_pos = ringbuf_spsc_prepare_read(rbuf, &num_elems);
+	atomic_store_explicit(&rbuf->read_pos, ringbuf_spsc_pos_add(rbuf, read_pos, num_elems), memory_order_release);
+	return num_elems;
+}
+
+
+
+size_t ringbuf_mpmc_get_buffer_size(size_t elem_size, size_t capacity)
+{
+	return capacity*sizeof(atomic_size_t) + capacity*elem_size;
+}
+
+
+bool ringbuf_mpmc_create(ringbuf_mpmc_t* rbuf, void* buffer, size_t elem_size, size_t capacity)
+{
+	if (capacity < 2  ||  (capacity & (capacity-1)) != 0) {
+		return false;
+	}
+
+	rbuf->seqs = (atomic_size_t*) buffer;
+	rbuf->elems = ((char*) buffer) + capacity*sizeof(atomic_size_t);
+	rbuf->elem_size = elem_size;
+	rbuf->capacity = capacity;
+	rbuf->mask = capacity-1;
+
+	// Slot i is ready to be written at position i
+	for (size_t i = 0 ; i < capacity ; i++) {
+		atomic_init(&rbuf->seqs[i], i);
+	}
+
+	atomic_init(&rbuf->write_pos, 0);
+	atomic_init(&rbuf->read_pos, 0);
+
+	return true;
+}
+
+
+size_t ringbuf_mpmc_get_read_count(ringbuf_mpmc_t* rbuf)
+{
+	size_t read_pos = atomic_load_explicit(&rbuf->read_pos, memory_order_relaxed);
+	size_t write_pos = atomic_load_explicit(&rbuf->write_pos, memory_order_relaxed);
+
+	// Both are loaded separately, so write_pos might lag behind
+	return write_pos > read_pos ? min_size(write_pos - read_pos, rbuf->capacity) : 0;
+}
+
+
+// Copies num_elems elements between elems and the slots starting at pos, wrapping around at the end.
+static void ringbuf_mpmc_copy(ringbuf_mpmc_t* rbuf, size_t pos, void* elems, size_t num_elems, bool to_slots)
+{
+	size_t offs = pos & rbuf->mask;
+	size_t len1 = min_size(num_elems, rbuf->capacity - offs);
+	size_t len2 = num_elems - len1;
+	char* slots = rbuf->elems + offs*rbuf->elem_size;
+	char* celems = (char*) elems;
+
+	if (to_slots) {
+		memcpy(slots, celems, len1*rbuf->elem_size);
+		memcpy(rbuf->elems, celems + len1*rbuf->elem_size, len2*rbuf->elem_size);
+	} else {
+		memcpy(celems, slots, len1*rbuf->elem_size);
+		memcpy(celems + len1*rbuf->elem_size, rbuf->elems, len2*rbuf->elem_size);
+	}
+}
+
+
+// Claims up to num_elems slots at the position pos_var for which the sequence number equals position + seq_offs,
+// i.e. that are free (seq_offs = 0) or filled (seq_offs = 1) in the current round. Returns the number of slots
+// claimed, and the first claimed position in *claimed_pos.
+static size_t ringbuf_mpmc_claim(ringbuf_mpmc_t* rbuf, atomic_size_t* pos_var, size_t seq_offs, size_t num_elems,
+		size_t* claimed_pos)
+{
+	size_t pos = atomic_load_explicit(pos_var, memory_order_relaxed);
+
+	while (true) {
+		size_t num_ready = 0;
+
+		while (num_ready < num_elems) {
+			size_t p = pos + num_ready;
+			size_t seq = atomic_load_explicit(&rbuf->seqs[p & rbuf->mask], memory_order_acquire);
+			if (seq != p + seq_offs) {
+				break;
+			}
+			num_ready++;
+		}
+
+		if (num_ready == 0) {
+			size_t p = pos;
+			size_t seq = atomic_load_explicit(&rbuf->seqs[p & rbuf->mask], memory_order_acquire);
+
+			if ((ptrdiff_t) (seq - (p + seq_offs)) < 0) {
+				// The slot is still in the previous round: Buffer full (for writers) or empty (for readers)
+				return 0;
+			}
+
+			if (seq == p + seq_offs) {
+				// Became ready since we checked it
+				continue;
+			}
+
+			// Another thread claimed pos in the meantime
+			pos = atomic_load_explicit(pos_var, memory_order_relaxed);
+			continue;
+		}
+
+		// The slots between pos and pos+num_ready can only change once another thread has advanced pos_var
+		// past them, in which case the CAS fails.
+		if (atomic_compare_exchange_weak_explicit(pos_var, &pos, pos + num_ready, memory_order_relaxed,
+				memory_order_relaxed)) {
+			*claimed_pos = pos;
+			return num_ready;
+		}
+	}
+}
+
+
+size_t ringbuf_mpmc_write(ringbuf_mpmc_t* rbuf, const void* elems, size_t num_elems)
+{
+	if (num_elems == 0) {
+		return 0;
+	}
+
+	size_t pos;
+	num_elems = ringbuf_mpmc_claim(rbuf, &rbuf->write_pos, 0, num_elems, &pos);
+
+	ringbuf_mpmc_copy(rbuf, pos, (void*) elems, num_elems, true);
+
+	// Publish the slots to readers
+	for (size_t i = 0 ; i < num_elems ; i++) {
+		atomic_store_explicit(&rbuf->seqs[(pos+i) & rbuf->mask], pos+i+1, memory_order_release);
+	}
+
+	return num_elems;
+}
+
+
+size_t ringbuf_mpmc_read(ringbuf_mpmc_t* rbuf, void* elems, size_t num_elems)
+{
+	if (num_elems == 0) {
+		return 0;
+	}
+
+	size_t pos;
+	num_elems = ringbuf_mpmc_claim(rbuf, &rbuf->read_pos, 1, num_elems, &pos);
+
+	ringbuf_mpmc_copy(rbuf, pos, elems, num_elems, false);
+
+	// Hand the slots back to writers for the next round
+	for (size_t i = 0 ; i < num_elems ; i++) {
+		atomic_store_explicit(&rbuf->seqs[(pos+i) & rbuf->mask], pos+i+rbuf->capacity, memory_order_release);
+	}
+
+	return num_elems;
+}
+
+#endif
@@ -24,6 +24,8 @@
 #define RINGBUF_IS_THREADSAFE
 #endif
 
+#define RINGBUF_CACHE_LINE_SIZE 64
+
 
 
 #ifdef __cplusplus
@@ -31,6 +33,44 @@ extern "C" {
 #endif
 
 
+#ifdef _NX_HAVE_ATOMICS
+
+/**
+ * An event count that lets threads sleep until a condition becomes true, without putting any locks or syscalls
+ * into the path of the threads that make it true.
+ *
+ * A waiter registers itself, re-checks its condition and then parks on the seq word (a futex on Linux). A notifier
+ * only has to check whether anyone is registered, so ringbuf_event_notify() is a fence and a load when nobody waits.
+ * Notifiers are expected to call it only when the condition may have changed from false to true (e.g. when a buffer
+ * goes from empty to non-empty), not on every state change.
+ *
+ * On platforms without futexes, waiters fall back to sleeping in steps of one millisecond.
+ */
+typedef struct ringbuf_event_t
+{
+	atomic_uint seq;
+	atomic_uint num_waiters;
+} ringbuf_event_t;
+
+
+void ringbuf_event_init(ringbuf_event_t* event);
+
+/**
+ * Waits until cond(cond_arg) returns true, or the timeout expires. A negative timeout waits forever, a timeout of 0
+ * just checks the condition once.
+ *
+ * Returns the last result of cond(cond_arg).
+ */
+bool ringbuf_event_wait(ringbuf_event_t* event, bool (*cond)(void*), void* cond_arg, int64_t timeout_us);
+
+/**
+ * Wakes all threads waiting on the event. Must be called after the change that may make their condition true.
+ */
+void ringbuf_event_notify(ringbuf_event_t* event);
+
+#endif
+
+
 typedef struct ringbuf_t
 {
 	void* buffer;
@@ -40,6 +80,8 @@ typedef struct ringbuf_t
 	size_t write_offs;
 #ifdef _NX_HAVE_ATOMICS
 	atomic_size_t count;
+	ringbuf_event_t read_event;
+	ringbuf_event_t write_event;
 #else
 	size_t count;
 #endif
@@ -64,6 +106,136 @@ size_t ringbuf_peek(ringbuf_t* rbuf, void* elems, size_t num_elems);
 
 void ringbuf_clear(ringbuf_t* rbuf);
 
+#ifdef _NX_HAVE_ATOMICS
+
+/**
+ * Blocks until there is at least one element to read, or the timeout (in microseconds, negative for none) expires.
+ * Returns true if there is something to read.
+ *
+ * The writer only wakes the reader when the buffer goes from empty to non-empty, so ringbuf_write() stays
+ * lock-free and syscall-free as long as the reader is not waiting.
+ */
+bool ringbuf_read_wait(ringbuf_t* rbuf, int64_t timeout_us);
+
+/**
+ * Blocks until there is space for at least one element, or the timeout (in microseconds, negative for none) expires.
+ * Returns true if there is space to write.
+ *
+ * The reader only wakes the writer when the buffer goes from full to non-full.
+ */
+bool ringbuf_write_wait(ringbuf_t* rbuf, int64_t timeout_us);
+
+#endif
+
+
+
+#ifdef _NX_HAVE_ATOMICS
+
+/**
+ * High-throughput variant of ringbuf_t for exactly one reader and one writer (single-producer/single-consumer).
+ *
+ * ringbuf_t synchronizes through a shared element count that both sides modify on every call, so the cache line
+ * holding it moves between the reader's and writer's cores all the time. Here, the writer owns the write position
+ * and the reader owns the read position, each on its own cache line. Each side also keeps a cached copy of the
+ * other side's position and only reloads it when the cached value says that the buffer is full (or empty).
+ *
+ * Positions run from 0 to 2*capacity-1 and wrap around with a subtraction, so capacity doesn't need to be a power
+ * of two and no division is needed.
+ */
+typedef struct ringbuf_spsc_t
+{
+	char* buffer;
+	size_t elem_size;
+	size_t capacity;
+
+	char pad1[RINGBUF_CACHE_LINE_SIZE];
+	atomic_size_t write_pos;
+	size_t cached_read_pos;
+	char pad2[RINGBUF_CACHE_LINE_SIZE - sizeof(atomic_size_t) - sizeof(size_t)];
+	atomic_size_t read_pos;
+	size_t cached_write_pos;
+	char pad3[RINGBUF_CACHE_LINE_SIZE - sizeof(atomic_size_t) - sizeof(size_t)];
+} ringbuf_spsc_t;
+
+
+void ringbuf_spsc_create(ringbuf_spsc_t* rbuf, void* buffer, size_t elem_size, size_t capacity);
+
+size_t ringbuf_spsc_get_read_count(ringbuf_spsc_t* rbuf);
+size_t ringbuf_spsc_get_write_count(ringbuf_spsc_t* rbuf);
+
+bool ringbuf_spsc_is_empty(ringbuf_spsc_t* rbuf);
+bool ringbuf_spsc_is_full(ringbuf_spsc_t* rbuf);
+
+/**
+ * Must only be called by the writer.
+ */
+size_t ringbuf_spsc_write(ringbuf_spsc_t* rbuf, const void* elems, size_t num_elems);
+size_t ringbuf_spsc_advance_write(ringbuf_spsc_t* rbuf, size_t num_elems);
+
+/**
+ * Must only be called by the reader.
+ */
+size_t ringbuf_spsc_read(ringbuf_spsc_t* rbuf, void* elems, size_t num_elems);
+size_t ringbuf_spsc_advance_read(ringbuf_spsc_t* rbuf, size_t num_elems);
+size_t ringbuf_spsc_peek(ringbuf_spsc_t* rbuf, void* elems, size_t num_elems);
+
+
+
+/**
+ * Bounded ring buffer that allows any number of parallel readers and writers (multi-producer/multi-consumer),
+ * using the algorithm by Dmitry Vyukov: Every slot has a sequence number that tells whether it is ready to be
+ * written or read in the current round, and readers and writers claim slots by advancing the read or write
+ * position with a CAS. No locks are taken, and readers and writers only contend among themselves.
+ *
+ * The read and write positions are kept on separate cache lines.
+ *
+ * The buffer passed to ringbuf_mpmc_create() must be at least ringbuf_mpmc_get_buffer_size() bytes large, and
+ * suitably aligned for atomic_size_t.
+ */
+typedef struct ringbuf_mpmc_t
+{
+	atomic_size_t* seqs;
+	char* elems;
+	size_t elem_size;
+	size_t capacity;
+	size_t mask;
+
+	char pad1[RINGBUF_CACHE_LINE_SIZE];
+	atomic_size_t write_pos;
+	char pad2[RINGBUF_CACHE_LINE_SIZE - sizeof(atomic_size_t)];
+	atomic_size_t read_pos;
+	char pad3[RINGBUF_CACHE_LINE_SIZE - sizeof(atomic_size_t)];
+} ringbuf_mpmc_t;
+
+
+size_t ringbuf_mpmc_get_buffer_size(size_t elem_size, size_t capacity);
+
+/**
+ * capacity must be a power of two (and at least 2). Returns false if it isn't.
+ */
+bool ringbuf_mpmc_create(ringbuf_mpmc_t* rbuf, void* buffer, size_t elem_size, size_t capacity);
+
+/**
+ * Number of elements in the buffer. With parallel readers or writers, this is only a snapshot.
+ */
+size_t ringbuf_mpmc_get_read_count(ringbuf_mpmc_t* rbuf);
+
+/**
+ * Writes up to num_elems elements as one batch, which is claimed with a single CAS. The elements of a batch are
+ * consecutive in the queue, but readers may see the first ones before the last ones are written.
+ *
+ * Returns the number of elements written, which is less than num_elems if the buffer is (nearly) full.
+ */
+size_t ringbuf_mpmc_write(ringbuf_mpmc_t* rbuf, const void* elems, size_t num_elems);
+
+/**
+ * Reads up to num_elems consecutive elements as one batch. Returns the number of elements read, which is less
+ * than num_elems if fewer elements are ready.
+ */
+size_t ringbuf_mpmc_read(ringbuf_mpmc_t* rbuf, void* elems, size_t num_elems);
+
+#endif
+
 
 #ifdef __cplusplus
 } // extern "C"
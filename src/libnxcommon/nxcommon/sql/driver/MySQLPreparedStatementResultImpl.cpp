@@ -65,7 +65,7 @@ MySQLPreparedStatementResultImpl::MySQLPreparedStatementResultImpl(
 		vfield.isFloat = false;
 		vfield.num.ui64 = 0;
 
-		fieldIndexByNameMap.insert(pair<CString, int>(CString(vfield.name).lower(), i));
+		fieldIndexByNameMap.insert(pair<CString, int>(CString(vfield.name).lower().intern(), i));
 
 		// TODO: Maybe make BLOB the default for unknown data types
 		switch (field->type) {
@@ -188,7 +188,7 @@ void MySQLResultImpl::ensureFieldNameIndexMapAvailable() const
 		unsigned int cc = getColumnCount();
 
 		for (unsigned int i = 0 ; i < cc ; i++) {
-			ncThis->fieldIndicesByName.insert(pair<CString, int>(CString(fields[i].name).lower(), i));
+			ncThis->fieldIndicesByName.insert(pair<CString, int>(CString(fields[i].name).lower().intern(), i));
 		}
 
 		ncThis->fieldIndicesByNameAvailable = true;
@@ -233,7 +233,7 @@ void SQLiteResultImpl::ensureColumnIndexByNameMapValid() const
 		unsigned int cc = getColumnCount();
 
 		for (unsigned int i = 0 ; i < cc ; i++) {
-			ncThis->columnIndexByNameMap.insert(pair<CString, int>(getColumnName(i).lower(), i));
+			ncThis->columnIndexByNameMap.insert(pair<CString, int>(getColumnName(i).lower().intern(), i));
 		}
 
 		ncThis->columnIndexByNameMapValid = true;
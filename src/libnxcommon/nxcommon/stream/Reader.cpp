@@ -28,9 +28,9 @@
 CString Reader::readFixedLengthString(size_t len)
 {
 	char* buf = new char[len+1];
-	buf[len] = '\0';
 	size_t numRead = read(buf, len);
-	return CString::from(buf, len+1);
+	buf[numRead] = '\0';
+	return CString::from(buf, numRead, len+1);
 }
 
 
@@ -42,21 +42,26 @@ CString Reader::readNullTerminatedString(bool* terminatorFound)
 	char buf[4096];
 
 	bool terminated = false;
-	size_t numRead;
+	bool eof = false;
 
 	char* bufEnd = buf+sizeof(buf);
 
 	do {
 		char* dest;
-		for (dest = buf ; dest != bufEnd  &&  !terminated  &&  numRead == 1 ; dest++) {
-			numRead = read(dest, 1);
+		for (dest = buf ; dest != bufEnd ; dest++) {
+			if (read(dest, 1) == 0) {
+				eof = true;
+				break;
+			}
 
-			if (*dest == '\0')
+			if (*dest == '\0') {
 				terminated = true;
+				break;
+			}
 		}
 
 		str.append(CString(buf, dest-buf));
-	} while (!terminated  &&  numRead == 1);
+	} while (!terminated  &&  !eof);
 
 	if (terminatorFound)
 		*terminatorFound = terminated;
@@ -0,0 +1,84 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef __ANDROID__
+
+#include "TranscodingStream.h"
+#include "IOException.h"
+
+
+
+TranscodingStreambuf::TranscodingStreambuf(istream* backend, Encoding srcEnc, Encoding destEnc,
+		bool autoDeleteBackend, size_t chunkSize)
+		: backend(backend), autoDeleteBackend(autoDeleteBackend), transcoder(srcEnc, destEnc),
+		  inBuf(new char[chunkSize]), chunkSize(chunkSize), backendEnded(false)
+{
+}
+
+
+TranscodingStreambuf::~TranscodingStreambuf()
+{
+	delete[] inBuf;
+
+	if (autoDeleteBackend)
+		delete backend;
+}
+
+
+TranscodingStreambuf::int_type TranscodingStreambuf::underflow()
+{
+	if (gptr() < egptr()) {
+		return traits_type::to_int_type(*gptr());
+	}
+
+	transcoder.clearOutput();
+
+	// A chunk might consist of nothing but the beginning of a character, so read until there's some output
+	while (transcoder.getOutputSize() == 0) {
+		if (backendEnded) {
+			setg(NULL, NULL, NULL);
+			return traits_type::eof();
+		}
+
+		backend->read(inBuf, chunkSize);
+		streamsize numRead = backend->gcount();
+
+		if (numRead > 0  &&  transcoder.feed(inBuf, numRead) < 0) {
+			throw IOException("Invalid character sequence in transcoded stream", __FILE__, __LINE__);
+		}
+
+		if ((size_t) numRead < chunkSize) {
+			backendEnded = true;
+
+			if (transcoder.flush() < 0) {
+				throw IOException("Transcoded stream ends in the middle of a character", __FILE__, __LINE__);
+			}
+		}
+	}
+
+	char* out = const_cast<char*>(transcoder.getOutput());
+	setg(out, out, out + transcoder.getOutputSize());
+
+	return traits_type::to_int_type(*gptr());
+}
+
+#endif /* #ifndef __ANDROID__ */
@@ -0,0 +1,105 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_TRANSCODINGSTREAM_H_
+#define NXCOMMON_TRANSCODINGSTREAM_H_
+
+#include <nxcommon/config.h>
+#include "../encoding.h"
+#include "Reader.h"
+#include <istream>
+#include <streambuf>
+
+using std::istream;
+using std::streambuf;
+using std::streamsize;
+
+
+
+/**	\brief A read-only streambuf that transcodes the data of another stream on the fly.
+ *
+ * 	The backend stream is read in chunks of chunkSize bytes, so memory use is bounded no matter how large the
+ * 	stream is. Invalid sequences and a stream that ends in the middle of a character are reported by throwing
+ * 	an IOException, which istream turns into badbit.
+ */
+class TranscodingStreambuf : public streambuf
+{
+public:
+	TranscodingStreambuf(istream* backend, Encoding srcEnc, Encoding destEnc, bool autoDeleteBackend = false,
+			size_t chunkSize = 65536);
+	~TranscodingStreambuf();
+
+protected:
+	virtual int_type underflow();
+
+private:
+	istream* backend;
+	bool autoDeleteBackend;
+	Transcoder transcoder;
+	char* inBuf;
+	size_t chunkSize;
+	bool backendEnded;
+};
+
+
+/**	\brief An istream that reads the data of another stream in a different encoding.
+ *
+ * 	This can be used with File::openInputStream() to convert files while they are read, e.g.:
+ *
+ * 	\code
+ * 	TranscodingIstream in(file.openInputStream(), WINDOWS1252, UTF8, true);
+ * 	\endcode
+ *
+ * 	@see TranscodingStreambuf
+ */
+class TranscodingIstream : public istream
+{
+public:
+	TranscodingIstream(istream* backend, Encoding srcEnc, Encoding destEnc, bool autoDeleteBackend = false,
+			size_t chunkSize = 65536)
+			: istream(NULL), buf(backend, srcEnc, destEnc, autoDeleteBackend, chunkSize) { rdbuf(&buf); }
+
+private:
+	TranscodingStreambuf buf;
+};
+
+
+/**	\brief A Reader that reads the data of a stream in a different encoding.
+ *
+ * 	read() throws an IOException if the stream contains invalid sequences.
+ *
+ * 	@see TranscodingStreambuf
+ */
+class TranscodingReader : public Reader
+{
+public:
+	TranscodingReader(istream* backend, Encoding srcEnc, Encoding destEnc, bool autoDeleteBackend = false,
+			size_t chunkSize = 65536)
+			: buf(backend, srcEnc, destEnc, autoDeleteBackend, chunkSize) {}
+
+	virtual size_t read(char* dest, size_t len) { return (size_t) buf.sgetn(dest, (streamsize) len); }
+
+private:
+	TranscodingStreambuf buf;
+};
+
+#endif /* NXCOMMON_TRANSCODINGSTREAM_H_ */
@@ -0,0 +1,1213 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "strsimd.h"
+#include <atomic>
+#include <cstring>
+
+#if defined(__x86_64__)  ||  defined(__i386__)  ||  defined(_M_X64)  ||  defined(_M_IX86)
+#define STRSIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__)  ||  defined(__clang__)
+#define STRSIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define STRSIMD_TARGET(isa)
+#endif
+
+
+
+
+// **********************************************************
+// *                                                        *
+// *                        Helpers                         *
+// *                                                        *
+// **********************************************************
+
+static inline unsigned int CountTrailingZeros(uint32_t v)
+{
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward(&idx, v);
+	return idx;
+#else
+	return __builtin_ctz(v);
+#endif
+}
+
+
+static inline unsigned int HighestBit(uint32_t v)
+{
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanReverse(&idx, v);
+	return idx;
+#else
+	return 31 - __builtin_clz(v);
+#endif
+}
+
+
+static inline char AsciiLowerChar(char c)
+{
+	return (c >= 'A'  &&  c <= 'Z') ? (char) (c | 0x20) : c;
+}
+
+
+static inline char AsciiUpperChar(char c)
+{
+	return (c >= 'a'  &&  c <= 'z') ? (char) (c & ~0x20) : c;
+}
+
+
+
+
+StrCharSet::StrCharSet(const char* chrs)
+		: numChars(0)
+{
+	memset(bitmap, 0, sizeof(bitmap));
+
+	bool vectorizable = true;
+	const char* c = chrs;
+
+	do {
+		if (!contains(*c)) {
+			bitmap[(unsigned char) *c >> 5] |= 1u << ((unsigned char) *c & 31);
+
+			if (numChars < sizeof(chars)) {
+				chars[numChars++] = *c;
+			} else {
+				vectorizable = false;
+			}
+		}
+	} while (*c++ != '\0');
+
+	if (!vectorizable) {
+		numChars = 0;
+	}
+}
+
+
+
+
+// **********************************************************
+// *                                                        *
+// *                     Scalar versions                    *
+// *                                                        *
+// **********************************************************
+
+static const char* FindCharScalar(const char* beg, const char* end, char c)
+{
+	const char* res = (const char*) memchr(beg, c, end-beg);
+	return res ? res : end;
+}
+
+
+static const char16_t* FindChar16Scalar(const char16_t* beg, const char16_t* end, char16_t c)
+{
+	while (beg != end  &&  *beg != c) {
+		beg++;
+	}
+	return beg;
+}
+
+
+static const char* FindSubstringScalar(const char* beg, const char* end, const char* needle, size_t needleLen)
+{
+	char first = needle[0];
+
+	while ((size_t) (end-beg) >= needleLen) {
+		beg = FindCharScalar(beg, end - needleLen + 1, first);
+
+		if (beg == end - needleLen + 1) {
+			break;
+		}
+		if (memcmp(beg+1, needle+1, needleLen-1) == 0) {
+			return beg;
+		}
+
+		beg++;
+	}
+
+	return end;
+}
+
+
+static const char* FindFirstOfScalar(const char* beg, const char* end, const StrCharSet& set)
+{
+	while (beg != end  &&  !set.contains(*beg)) {
+		beg++;
+	}
+	return beg;
+}
+
+
+static const char* FindLastOfScalar(const char* beg, const char* end, const StrCharSet& set)
+{
+	while (end != beg) {
+		if (set.contains(*--end)) {
+			return end;
+		}
+	}
+	return NULL;
+}
+
+
+static const char* FindLastNotOfScalar(const char* beg, const char* end, const StrCharSet& set)
+{
+	while (end != beg) {
+		if (!set.contains(*--end)) {
+			return end;
+		}
+	}
+	return NULL;
+}
+
+
+static size_t AsciiToLowerScalar(char* dest, const char* src, size_t len)
+{
+	size_t i;
+	for (i = 0 ; i < len  &&  src[i] != '\0' ; i++) {
+		dest[i] = AsciiLowerChar(src[i]);
+	}
+	return i;
+}
+
+
+static size_t AsciiToUpperScalar(char* dest, const char* src, size_t len)
+{
+	size_t i;
+	for (i = 0 ; i < len  &&  src[i] != '\0' ; i++) {
+		dest[i] = AsciiUpperChar(src[i]);
+	}
+	return i;
+}
+
+
+static size_t FindNonASCIIScalar(const char* str, size_t len)
+{
+	size_t i = 0;
+
+	for (; len-i >= 8 ; i += 8) {
+		uint64_t v;
+		memcpy(&v, str+i, 8);
+		if ((v & 0x8080808080808080ULL) != 0) {
+			break;
+		}
+	}
+
+	for (; i < len  &&  (signed char) str[i] >= 0 ; i++);
+	return i;
+}
+
+
+static void WidenToUTF16LEScalar(char* dest, const char* src, size_t len)
+{
+	for (size_t i = 0 ; i < len ; i++) {
+		dest[i*2] = src[i];
+		dest[i*2+1] = '\0';
+	}
+}
+
+
+static size_t NarrowFromUTF16LEScalar(char* dest, const char* src, size_t numUnits, unsigned int limit)
+{
+	for (size_t i = 0 ; i < numUnits ; i++) {
+		unsigned int u = (unsigned char) src[i*2] | ((unsigned int) (unsigned char) src[i*2+1] << 8);
+		if (u >= limit) {
+			return i;
+		}
+		dest[i] = (char) u;
+	}
+	return numUnits;
+}
+
+
+// Returns the length of the valid UTF-8 sequence at s, or 0 if it is invalid or truncated. The ranges of the second
+// byte exclude overlong encodings, surrogates and code points above U+10FFFF (see table 3-7 of the Unicode standard).
+static inline size_t GetValidUTF8SequenceLength(const unsigned char* s, size_t len)
+{
+	unsigned char b0 = s[0];
+
+	if (b0 < 0x80) {
+		return 1;
+	} else if (b0 < 0xC2) {
+		return 0;
+	} else if (b0 < 0xE0) {
+		return (len >= 2  &&  (s[1] & 0xC0) == 0x80) ? 2 : 0;
+	} else if (b0 < 0xF0) {
+		unsigned char lo = (b0 == 0xE0) ? 0xA0 : 0x80;
+		unsigned char hi = (b0 == 0xED) ? 0x9F : 0xBF;
+		return (len >= 3  &&  s[1] >= lo  &&  s[1] <= hi  &&  (s[2] & 0xC0) == 0x80) ? 3 : 0;
+	} else if (b0 < 0xF5) {
+		unsigned char lo = (b0 == 0xF0) ? 0x90 : 0x80;
+		unsigned char hi = (b0 == 0xF4) ? 0x8F : 0xBF;
+		return (len >= 4  &&  s[1] >= lo  &&  s[1] <= hi  &&  (s[2] & 0xC0) == 0x80  &&  (s[3] & 0xC0) == 0x80)
+				? 4 : 0;
+	}
+
+	return 0;
+}
+
+
+// Validates sequence by sequence, skipping runs of ASCII characters with findNonASCII.
+template <size_t (*findNonASCII)(const char*, size_t)>
+static inline bool ValidateUTF8BySequence(const char* str, size_t len)
+{
+	size_t i = 0;
+
+	while (i < len) {
+		if ((signed char) str[i] >= 0) {
+			i += findNonASCII(str+i, len-i);
+			continue;
+		}
+
+		size_t seqLen = GetValidUTF8SequenceLength((const unsigned char*) str+i, len-i);
+		if (seqLen == 0) {
+			return false;
+		}
+		i += seqLen;
+	}
+
+	return true;
+}
+
+
+static bool ValidateUTF8Scalar(const char* str, size_t len)
+{
+	return ValidateUTF8BySequence<&FindNonASCIIScalar>(str, len);
+}
+
+
+
+
+#ifdef STRSIMD_X86
+
+// **********************************************************
+// *                                                        *
+// *                      SSE2 versions                     *
+// *                                                        *
+// **********************************************************
+
+STRSIMD_TARGET("sse2")
+static const char* FindCharSSE2(const char* beg, const char* end, char c)
+{
+	__m128i vc = _mm_set1_epi8(c);
+
+	// Check 64 bytes per iteration, and only find the exact position once there is a match
+	for (; end-beg >= 64 ; beg += 64) {
+		__m128i m0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) beg), vc);
+		__m128i m1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (beg+16)), vc);
+		__m128i m2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (beg+32)), vc);
+		__m128i m3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (beg+48)), vc);
+
+		if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(m0, m1), _mm_or_si128(m2, m3))) != 0) {
+			break;
+		}
+	}
+
+	for (; end-beg >= 16 ; beg += 16) {
+		uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) beg), vc));
+
+		if (mask != 0) {
+			return beg + CountTrailingZeros(mask);
+		}
+	}
+
+	while (beg != end  &&  *beg != c) {
+		beg++;
+	}
+	return beg;
+}
+
+
+STRSIMD_TARGET("sse2")
+static const char16_t* FindChar16SSE2(const char16_t* beg, const char16_t* end, char16_t c)
+{
+	__m128i vc = _mm_set1_epi16((short) c);
+
+	for (; end-beg >= 8 ; beg += 8) {
+		uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*) beg), vc));
+
+		if (mask != 0) {
+			return beg + CountTrailingZeros(mask)/2;
+		}
+	}
+
+	return FindChar16Scalar(beg, end, c);
+}
+
+
+// Checks the first and the last character of the needle for 16 positions at once, and only compares the rest of the
+// needle where both match (see http://0x80.pl/articles/simd-strfind.html).
+STRSIMD_TARGET("sse2")
+static const char* FindSubstringSSE2(const char* beg, const char* end, const char* needle, size_t needleLen)
+{
+	if ((size_t) (end-beg) < needleLen) {
+		return end;
+	}
+
+	__m128i vfirst = _mm_set1_epi8(needle[0]);
+	__m128i vlast = _mm_set1_epi8(needle[needleLen-1]);
+
+	const char* s = beg;
+	const char* blockEnd = end - needleLen + 1;
+
+	for (; blockEnd-s >= 16 ; s += 16) {
+		__m128i bfirst = _mm_loadu_si128((const __m128i*) s);
+		__m128i blast = _mm_loadu_si128((const __m128i*) (s + needleLen-1));
+		uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(bfirst, vfirst), _mm_cmpeq_epi8(blast, vlast)));
+
+		while (mask != 0) {
+			unsigned int idx = CountTrailingZeros(mask);
+
+			if (memcmp(s + idx + 1, needle + 1, needleLen-1) == 0) {
+				return s + idx;
+			}
+
+			mask &= mask-1;
+		}
+	}
+
+	const char* res = FindSubstringScalar(s, end, needle, needleLen);
+	return res;
+}
+
+
+STRSIMD_TARGET("sse2")
+static inline __m128i SetMatchMaskSSE2(__m128i v, const StrCharSet& set)
+{
+	__m128i m = _mm_cmpeq_epi8(v, _mm_set1_epi8(set.chars[0]));
+
+	for (unsigned int i = 1 ; i < set.numChars ; i++) {
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(set.chars[i])));
+	}
+
+	return m;
+}
+
+
+STRSIMD_TARGET("sse2")
+static const char* FindFirstOfSSE2(const char* beg, const char* end, const StrCharSet& set)
+{
+	if (set.numChars != 0) {
+		for (; end-beg >= 16 ; beg += 16) {
+			uint32_t mask = _mm_movemask_epi8(SetMatchMaskSSE2(_mm_loadu_si128((const __m128i*) beg), set));
+
+			if (mask != 0) {
+				return beg + CountTrailingZeros(mask);
+			}
+		}
+	}
+
+	return FindFirstOfScalar(beg, end, set);
+}
+
+
+STRSIMD_TARGET("sse2")
+static const char* FindLastOfSSE2(const char* beg, const char* end, const StrCharSet& set)
+{
+	if (set.numChars != 0) {
+		for (; end-beg >= 16 ; end -= 16) {
+			uint32_t mask = _mm_movemask_epi8(SetMatchMaskSSE2(_mm_loadu_si128((const __m128i*) (end-16)), set));
+
+			if (mask != 0) {
+				return end - 16 + HighestBit(mask);
+			}
+		}
+	}
+
+	return FindLastOfScalar(beg, end, set);
+}
+
+
+STRSIMD_TARGET("sse2")
+static const char* FindLastNotOfSSE2(const char* beg, const char* end, const StrCharSet& set)
+{
+	if (set.numChars != 0) {
+		for (; end-beg >= 16 ; end -= 16) {
+			uint32_t mask = _mm_movemask_epi8(SetMatchMaskSSE2(_mm_loadu_si128((const __m128i*) (end-16)), set)) ^ 0xFFFF;
+
+			if (mask != 0) {
+				return end - 16 + HighestBit(mask);
+			}
+		}
+	}
+
+	return FindLastNotOfScalar(beg, end, set);
+}
+
+
+// Flips bit 5 of all characters in [lo, hi]. The range check uses a single signed comparison by moving lo to -128.
+template <char lo, char hi>
+STRSIMD_TARGET("sse2")
+static inline size_t AsciiConvertCaseSSE2(char* dest, const char* src, size_t len)
+{
+	const __m128i shift = _mm_set1_epi8((char) (-128 - lo));
+	const __m128i limit = _mm_set1_epi8((char) (-128 + (hi-lo) + 1));
+	const __m128i flip = _mm_set1_epi8(0x20);
+	const __m128i zero = _mm_setzero_si128();
+
+	size_t i = 0;
+
+	for (; len-i >= 16 ; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (src+i));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0) {
+			break;
+		}
+
+		__m128i inRange = _mm_cmplt_epi8(_mm_add_epi8(v, shift), limit);
+		_mm_storeu_si128((__m128i*) (dest+i), _mm_xor_si128(v, _mm_and_si128(inRange, flip)));
+	}
+
+	if (lo == 'A') {
+		return i + AsciiToLowerScalar(dest+i, src+i, len-i);
+	} else {
+		return i + AsciiToUpperScalar(dest+i, src+i, len-i);
+	}
+}
+
+
+STRSIMD_TARGET("sse2")
+static size_t AsciiToLowerSSE2(char* dest, const char* src, size_t len)
+{
+	return AsciiConvertCaseSSE2<'A', 'Z'>(dest, src, len);
+}
+
+
+STRSIMD_TARGET("sse2")
+static size_t AsciiToUpperSSE2(char* dest, const char* src, size_t len)
+{
+	return AsciiConvertCaseSSE2<'a', 'z'>(dest, src, len);
+}
+
+
+STRSIMD_TARGET("sse2")
+static size_t FindNonASCIISSE2(const char* str, size_t len)
+{
+	size_t i = 0;
+
+	for (; len-i >= 64 ; i += 64) {
+		__m128i v0 = _mm_loadu_si128((const __m128i*) (str+i));
+		__m128i v1 = _mm_loadu_si128((const __m128i*) (str+i+16));
+		__m128i v2 = _mm_loadu_si128((const __m128i*) (str+i+32));
+		__m128i v3 = _mm_loadu_si128((const __m128i*) (str+i+48));
+
+		if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(v0, v1), _mm_or_si128(v2, v3))) != 0) {
+			break;
+		}
+	}
+
+	for (; len-i >= 16 ; i += 16) {
+		int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) (str+i)));
+		if (mask != 0) {
+			return i + CountTrailingZeros((uint32_t) mask);
+		}
+	}
+
+	return i + FindNonASCIIScalar(str+i, len-i);
+}
+
+
+STRSIMD_TARGET("sse2")
+static void WidenToUTF16LESSE2(char* dest, const char* src, size_t len)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+
+	for (; len-i >= 16 ; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (src+i));
+		_mm_storeu_si128((__m128i*) (dest + i*2), _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128((__m128i*) (dest + i*2 + 16), _mm_unpackhi_epi8(v, zero));
+	}
+
+	WidenToUTF16LEScalar(dest + i*2, src+i, len-i);
+}
+
+
+STRSIMD_TARGET("sse2")
+static size_t NarrowFromUTF16LESSE2(char* dest, const char* src, size_t numUnits, unsigned int limit)
+{
+	// limit is a power of two, so a unit is in range if none of the bits at and above it are set
+	const __m128i outOfRange = _mm_set1_epi16((short) (0x10000 - limit));
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+
+	for (; numUnits-i >= 16 ; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*) (src + i*2));
+		__m128i b = _mm_loadu_si128((const __m128i*) (src + i*2 + 16));
+
+		__m128i high = _mm_and_si128(_mm_or_si128(a, b), outOfRange);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xFFFF) {
+			break;
+		}
+
+		_mm_storeu_si128((__m128i*) (dest+i), _mm_packus_epi16(a, b));
+	}
+
+	return i + NarrowFromUTF16LEScalar(dest+i, src + i*2, numUnits-i, limit);
+}
+
+
+STRSIMD_TARGET("sse2")
+static bool ValidateUTF8SSE2(const char* str, size_t len)
+{
+	return ValidateUTF8BySequence<&FindNonASCIISSE2>(str, len);
+}
+
+
+
+
+// **********************************************************
+// *                                                        *
+// *                      AVX2 versions                     *
+// *                                                        *
+// **********************************************************
+
+// The AVX2 versions hand the remainder to the SSE2 versions. They have to clear the upper halves of the YMM registers
+// before, because compilers don't always do so before tail calls, and legacy SSE code running with dirty upper halves is
+// extremely slow on many CPUs.
+
+STRSIMD_TARGET("avx2")
+static const char* FindCharAVX2(const char* beg, const char* end, char c)
+{
+	__m256i vc = _mm256_set1_epi8(c);
+
+	for (; end-beg >= 128 ; beg += 128) {
+		__m256i m0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) beg), vc);
+		__m256i m1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (beg+32)), vc);
+		__m256i m2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (beg+64)), vc);
+		__m256i m3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (beg+96)), vc);
+
+		if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(m0, m1), _mm256_or_si256(m2, m3))) != 0) {
+			break;
+		}
+	}
+
+	for (; end-beg >= 32 ; beg += 32) {
+		uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) beg), vc));
+
+		if (mask != 0) {
+			return beg + CountTrailingZeros(mask);
+		}
+	}
+
+	_mm256_zeroupper();
+	return FindCharSSE2(beg, end, c);
+}
+
+
+STRSIMD_TARGET("avx2")
+static const char16_t* FindChar16AVX2(const char16_t* beg, const char16_t* end, char16_t c)
+{
+	__m256i vc = _mm256_set1_epi16((short) c);
+
+	for (; end-beg >= 16 ; beg += 16) {
+		uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*) beg), vc));
+
+		if (mask != 0) {
+			return beg + CountTrailingZeros(mask)/2;
+		}
+	}
+
+	_mm256_zeroupper();
+	return FindChar16SSE2(beg, end, c);
+}
+
+
+STRSIMD_TARGET("avx2")
+static const char* FindSubstringAVX2(const char* beg, const char* end, const char* needle, size_t needleLen)
+{
+	if ((size_t) (end-beg) < needleLen) {
+		return end;
+	}
+
+	__m256i vfirst = _mm256_set1_epi8(needle[0]);
+	__m256i vlast = _mm256_set1_epi8(needle[needleLen-1]);
+
+	const char* s = beg;
+	const char* blockEnd = end - needleLen + 1;
+
+	for (; blockEnd-s >= 32 ; s += 32) {
+		__m256i bfirst = _mm256_loadu_si256((const __m256i*) s);
+		__m256i blast = _mm256_loadu_si256((const __m256i*) (s + needleLen-1));
+		uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(bfirst, vfirst),
+				_mm256_cmpeq_epi8(blast, vlast)));
+
+		while (mask != 0) {
+			unsigned int idx = CountTrailingZeros(mask);
+
+			if (memcmp(s + idx + 1, needle + 1, needleLen-1) == 0) {
+				return s + idx;
+			}
+
+			mask &= mask-1;
+		}
+	}
+
+	_mm256_zeroupper();
+	return FindSubstringSSE2(s, end, needle, needleLen);
+}
+
+
+STRSIMD_TARGET("avx2")
+static inline __m256i SetMatchMaskAVX2(__m256i v, const StrCharSet& set)
+{
+	__m256i m = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(set.chars[0]));
+
+	for (unsigned int i = 1 ; i < set.numChars ; i++) {
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(set.chars[i])));
+	}
+
+	return m;
+}
+
+
+STRSIMD_TARGET("avx2")
+static const char* FindFirstOfAVX2(const char* beg, const char* end, const StrCharSet& set)
+{
+	if (set.numChars != 0) {
+		for (; end-beg >= 32 ; beg += 32) {
+			uint32_t mask = _mm256_movemask_epi8(SetMatchMaskAVX2(_mm256_loadu_si256((const __m256i*) beg), set));
+
+			if (mask != 0) {
+				return beg + CountTrailingZeros(mask);
+			}
+		}
+	}
+
+	_mm256_zeroupper();
+	return FindFirstOfSSE2(beg, end, set);
+}
+
+
+STRSIMD_TARGET("avx2")
+static const char* FindLastOfAVX2(const char* beg, const char* end, const StrCharSet& set)
+{
+	if (set.numChars != 0) {
+		for (; end-beg >= 32 ; end -= 32) {
+			uint32_t mask = _mm256_movemask_epi8(SetMatchMaskAVX2(_mm256_loadu_si256((const __m256i*) (end-32)), set));
+
+			if (mask != 0) {
+				return end - 32 + HighestBit(mask);
+			}
+		}
+	}
+
+	_mm256_zeroupper();
+	return FindLastOfSSE2(beg, end, set);
+}
+
+
+STRSIMD_TARGET("avx2")
+static const char* FindLastNotOfAVX2(const char* beg, const char* end, const StrCharSet& set)
+{
+	if (set.numChars != 0) {
+		for (; end-beg >= 32 ; end -= 32) {
+			uint32_t mask = ~(uint32_t) _mm256_movemask_epi8(SetMatchMaskAVX2(_mm256_loadu_si256((const __m256i*) (end-32)),
+					set));
+
+			if (mask != 0) {
+				return end - 32 + HighestBit(mask);
+			}
+		}
+	}
+
+	_mm256_zeroupper();
+	return FindLastNotOfSSE2(beg, end, set);
+}
+
+
+template <char lo, char hi>
+STRSIMD_TARGET("avx2")
+static inline size_t AsciiConvertCaseAVX2(char* dest, const char* src, size_t len)
+{
+	const __m256i shift = _mm256_set1_epi8((char) (-128 - lo));
+	const __m256i limit = _mm256_set1_epi8((char) (-128 + (hi-lo) + 1));
+	const __m256i flip = _mm256_set1_epi8(0x20);
+	const __m256i zero = _mm256_setzero_si256();
+
+	size_t i = 0;
+
+	for (; len-i >= 32 ; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (src+i));
+
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)) != 0) {
+			break;
+		}
+
+		__m256i inRange = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(v, shift));
+		_mm256_storeu_si256((__m256i*) (dest+i), _mm256_xor_si256(v, _mm256_and_si256(inRange, flip)));
+	}
+
+	_mm256_zeroupper();
+	return i + AsciiConvertCaseSSE2<lo, hi>(dest+i, src+i, len-i);
+}
+
+
+STRSIMD_TARGET("avx2")
+static size_t AsciiToLowerAVX2(char* dest, const char* src, size_t len)
+{
+	return AsciiConvertCaseAVX2<'A', 'Z'>(dest, src, len);
+}
+
+
+STRSIMD_TARGET("avx2")
+static size_t AsciiToUpperAVX2(char* dest, const char* src, size_t len)
+{
+	return AsciiConvertCaseAVX2<'a', 'z'>(dest, src, len);
+}
+
+
+STRSIMD_TARGET("avx2")
+static size_t FindNonASCIIAVX2(const char* str, size_t len)
+{
+	size_t i = 0;
+
+	for (; len-i >= 64 ; i += 64) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i*) (str+i));
+		__m256i v1 = _mm256_loadu_si256((const __m256i*) (str+i+32));
+
+		if (_mm256_movemask_epi8(_mm256_or_si256(v0, v1)) != 0) {
+			break;
+		}
+	}
+
+	for (; len-i >= 32 ; i += 32) {
+		int mask = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*) (str+i)));
+		if (mask != 0) {
+			_mm256_zeroupper();
+			return i + CountTrailingZeros((uint32_t) mask);
+		}
+	}
+
+	_mm256_zeroupper();
+	return i + FindNonASCIISSE2(str+i, len-i);
+}
+
+
+STRSIMD_TARGET("avx2")
+static void WidenToUTF16LEAVX2(char* dest, const char* src, size_t len)
+{
+	size_t i = 0;
+
+	for (; len-i >= 32 ; i += 32) {
+		__m256i lo = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (src+i)));
+		__m256i hi = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (src+i+16)));
+		_mm256_storeu_si256((__m256i*) (dest + i*2), lo);
+		_mm256_storeu_si256((__m256i*) (dest + i*2 + 32), hi);
+	}
+
+	_mm256_zeroupper();
+	WidenToUTF16LESSE2(dest + i*2, src+i, len-i);
+}
+
+
+STRSIMD_TARGET("avx2")
+static size_t NarrowFromUTF16LEAVX2(char* dest, const char* src, size_t numUnits, unsigned int limit)
+{
+	const __m256i outOfRange = _mm256_set1_epi16((short) (0x10000 - limit));
+	size_t i = 0;
+
+	for (; numUnits-i >= 32 ; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i*) (src + i*2));
+		__m256i b = _mm256_loadu_si256((const __m256i*) (src + i*2 + 32));
+
+		if (!_mm256_testz_si256(_mm256_or_si256(a, b), outOfRange)) {
+			break;
+		}
+
+		// packus works within 128-bit lanes, so the 64-bit quarters have to be put back in order
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+		_mm256_storeu_si256((__m256i*) (dest+i), packed);
+	}
+
+	_mm256_zeroupper();
+	return i + NarrowFromUTF16LESSE2(dest+i, src + i*2, numUnits-i, limit);
+}
+
+
+// Returns the bytes of the 64 byte window [prev, input] that precede each byte of input by n positions.
+template <int n>
+STRSIMD_TARGET("avx2")
+static inline __m256i GetPrecedingBytesAVX2(__m256i input, __m256i prev)
+{
+	return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16-n);
+}
+
+
+// The lookup algorithm by John Keiser and Daniel Lemire ("Validating UTF-8 In Less Than One Instruction Per Byte",
+// 2021). Each error class is a bit, and three table lookups on the nibbles of each byte and the byte before it yield
+// the classes that the pair might belong to. Only errors that all three lookups agree on are real. Continuation bytes
+// that must follow a three or four byte lead are checked separately.
+STRSIMD_TARGET("avx2")
+static inline __m256i CheckUTF8BlockAVX2(__m256i input, __m256i prevInput)
+{
+	const uint8_t TooShort = 1 << 0;		// Lead byte or ASCII after a lead byte
+	const uint8_t TooLong = 1 << 1;			// Continuation byte after ASCII
+	const uint8_t Overlong3 = 1 << 2;		// E0 80..9F
+	const uint8_t TooLarge = 1 << 3;		// F4 90..BF and F5..FF
+	const uint8_t Surrogate = 1 << 4;		// ED A0..BF
+	const uint8_t Overlong2 = 1 << 5;		// C0..C1
+	const uint8_t TooLarge1000 = 1 << 6;	// F5..FF 80..8F
+	const uint8_t Overlong4 = 1 << 6;		// F0 80..8F
+	const uint8_t TwoConts = 1 << 7;		// Continuation byte after continuation byte (might still be valid)
+	const uint8_t Carry = TooShort | TooLong | TwoConts;
+
+	const __m256i byte1HighTable = _mm256_setr_epi8(
+			TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong,
+			TwoConts, TwoConts, TwoConts, TwoConts,
+			TooShort | Overlong2, TooShort, TooShort | Overlong3 | Surrogate,
+			TooShort | TooLarge | TooLarge1000 | Overlong4,
+			TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong,
+			TwoConts, TwoConts, TwoConts, TwoConts,
+			TooShort | Overlong2, TooShort, TooShort | Overlong3 | Surrogate,
+			TooShort | TooLarge | TooLarge1000 | Overlong4);
+	const __m256i byte1LowTable = _mm256_setr_epi8(
+			Carry | Overlong3 | Overlong2 | Overlong4, Carry | Overlong2, Carry, Carry,
+			Carry | TooLarge, Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000,
+			Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000,
+			Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000,
+			Carry | TooLarge | TooLarge1000 | Surrogate, Carry | TooLarge | TooLarge1000,
+			Carry | TooLarge | TooLarge1000,
+			Carry | Overlong3 | Overlong2 | Overlong4, Carry | Overlong2, Carry, Carry,
+			Carry | TooLarge, Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000,
+			Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000,
+			Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000, Carry | TooLarge | TooLarge1000,
+			Carry | TooLarge | TooLarge1000 | Surrogate, Carry | TooLarge | TooLarge1000,
+			Carry | TooLarge | TooLarge1000);
+	const __m256i byte2HighTable = _mm256_setr_epi8(
+			TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort,
+			TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge1000 | Overlong4,
+			TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge,
+			TooLong | Overlong2 | TwoConts | Surrogate | TooLarge,
+			TooLong | Overlong2 | TwoConts | Surrogate | TooLarge,
+			TooShort, TooShort, TooShort, TooShort,
+			TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort,
+			TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge1000 | Overlong4,
+			TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge,
+			TooLong | Overlong2 | TwoConts | Surrogate | TooLarge,
+			TooLong | Overlong2 | TwoConts | Surrogate | TooLarge,
+			TooShort, TooShort, TooShort, TooShort);
+
+	const __m256i lowNibble = _mm256_set1_epi8(0x0F);
+
+	__m256i prev1 = GetPrecedingBytesAVX2<1>(input, prevInput);
+	__m256i byte1High = _mm256_shuffle_epi8(byte1HighTable, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), lowNibble));
+	__m256i byte1Low = _mm256_shuffle_epi8(byte1LowTable, _mm256_and_si256(prev1, lowNibble));
+	__m256i byte2High = _mm256_shuffle_epi8(byte2HighTable, _mm256_and_si256(_mm256_srli_epi16(input, 4), lowNibble));
+	__m256i special = _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+
+	// Bytes two or three positions after a three or four byte lead must be continuation bytes. TwoConts is set exactly
+	// for those continuation bytes that aren't the first one, so the two must agree.
+	__m256i prev2 = GetPrecedingBytesAVX2<2>(input, prevInput);
+	__m256i prev3 = GetPrecedingBytesAVX2<3>(input, prevInput);
+	__m256i isThirdByte = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char) (0xE0-0x80)));
+	__m256i isFourthByte = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char) (0xF0-0x80)));
+	__m256i must23 = _mm256_and_si256(_mm256_or_si256(isThirdByte, isFourthByte), _mm256_set1_epi8((char) 0x80));
+
+	return _mm256_xor_si256(must23, special);
+}
+
+
+STRSIMD_TARGET("avx2")
+static bool ValidateUTF8AVX2(const char* str, size_t len)
+{
+	// Non-zero for lead bytes in the last three positions that need more bytes than are left in the block
+	const __m256i incompleteLimit = _mm256_setr_epi8(
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+			-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char) (0xF0-1), (char) (0xE0-1), (char) (0xC0-1));
+
+	__m256i error = _mm256_setzero_si256();
+	__m256i prevInput = _mm256_setzero_si256();
+	__m256i prevIncomplete = _mm256_setzero_si256();
+
+	size_t i = 0;
+
+	for (; len-i >= 32 ; i += 32) {
+		__m256i input = _mm256_loadu_si256((const __m256i*) (str+i));
+
+		if (_mm256_movemask_epi8(input) == 0) {
+			// Pure ASCII is only an error if the previous block ended in the middle of a sequence
+			error = _mm256_or_si256(error, prevIncomplete);
+			prevIncomplete = _mm256_setzero_si256();
+		} else {
+			error = _mm256_or_si256(error, CheckUTF8BlockAVX2(input, prevInput));
+			prevIncomplete = _mm256_subs_epu8(input, incompleteLimit);
+		}
+
+		prevInput = input;
+	}
+
+	if (i < len) {
+		// The zero padding makes sequences that are cut off at the end invalid
+		char buf[32] = {0};
+		memcpy(buf, str+i, len-i);
+		__m256i input = _mm256_loadu_si256((const __m256i*) buf);
+		error = _mm256_or_si256(error, CheckUTF8BlockAVX2(input, prevInput));
+		prevIncomplete = _mm256_setzero_si256();
+	}
+
+	error = _mm256_or_si256(error, prevIncomplete);
+	bool valid = _mm256_testz_si256(error, error) != 0;
+
+	_mm256_zeroupper();
+	return valid;
+}
+
+#endif
+
+
+
+
+// **********************************************************
+// *                                                        *
+// *                   Runtime dispatching                  *
+// *                                                        *
+// **********************************************************
+
+struct StrSimdFuncs
+{
+	StrSimdLevel level;
+	const char* (*findChar)(const char*, const char*, char);
+	const char16_t* (*findChar16)(const char16_t*, const char16_t*, char16_t);
+	const char* (*findSubstring)(const char*, const char*, const char*, size_t);
+	const char* (*findFirstOf)(const char*, const char*, const StrCharSet&);
+	const char* (*findLastOf)(const char*, const char*, const StrCharSet&);
+	const char* (*findLastNotOf)(const char*, const char*, const StrCharSet&);
+	size_t (*asciiToLower)(char*, const char*, size_t);
+	size_t (*asciiToUpper)(char*, const char*, size_t);
+	size_t (*findNonASCII)(const char*, size_t);
+	bool (*validateUTF8)(const char*, size_t);
+	void (*widenToUTF16LE)(char*, const char*, size_t);
+	size_t (*narrowFromUTF16LE)(char*, const char*, size_t, unsigned int);
+};
+
+
+static const StrSimdFuncs StrSimdFuncsByLevel[] = {
+		{
+				StrSimdScalar, &FindCharScalar, &FindChar16Scalar, &FindSubstringScalar, &FindFirstOfScalar,
+				&FindLastOfScalar, &FindLastNotOfScalar, &AsciiToLowerScalar, &AsciiToUpperScalar,
+				&FindNonASCIIScalar, &ValidateUTF8Scalar, &WidenToUTF16LEScalar, &NarrowFromUTF16LEScalar
+		},
+#ifdef STRSIMD_X86
+		{
+				StrSimdSSE2, &FindCharSSE2, &FindChar16SSE2, &FindSubstringSSE2, &FindFirstOfSSE2,
+				&FindLastOfSSE2, &FindLastNotOfSSE2, &AsciiToLowerSSE2, &AsciiToUpperSSE2,
+				&FindNonASCIISSE2, &ValidateUTF8SSE2, &WidenToUTF16LESSE2, &NarrowFromUTF16LESSE2
+		},
+		{
+				StrSimdAVX2, &FindCharAVX2, &FindChar16AVX2, &FindSubstringAVX2, &FindFirstOfAVX2,
+				&FindLastOfAVX2, &FindLastNotOfAVX2, &AsciiToLowerAVX2, &AsciiToUpperAVX2,
+				&FindNonASCIIAVX2, &ValidateUTF8AVX2, &WidenToUTF16LEAVX2, &NarrowFromUTF16LEAVX2
+		}
+#endif
+};
+
+
+static StrSimdLevel DetectStrSimdLevel()
+{
+#if defined(STRSIMD_X86)  &&  defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+
+	if (maxLeaf >= 7  &&  osxsave  &&  avx  &&  (_xgetbv(0) & 6) == 6) {
+		__cpuidex(info, 7, 0);
+
+		if ((info[1] & (1 << 5)) != 0) {
+			return StrSimdAVX2;
+		}
+	}
+
+	return sse2 ? StrSimdSSE2 : StrSimdScalar;
+#elif defined(STRSIMD_X86)
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		return StrSimdAVX2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		return StrSimdSSE2;
+	}
+
+	return StrSimdScalar;
+#else
+	return StrSimdScalar;
+#endif
+}
+
+
+static std::atomic<const StrSimdFuncs*> StrSimdActiveFuncs(NULL);
+
+
+static inline const StrSimdFuncs* GetStrSimdFuncs()
+{
+	const StrSimdFuncs* funcs = StrSimdActiveFuncs.load(std::memory_order_relaxed);
+
+	if (!funcs) {
+		// Racing threads will all store the same value
+		funcs = &StrSimdFuncsByLevel[GetStrSimdMaxLevel()];
+		StrSimdActiveFuncs.store(funcs, std::memory_order_relaxed);
+	}
+
+	return funcs;
+}
+
+
+StrSimdLevel GetStrSimdMaxLevel()
+{
+	static const StrSimdLevel maxLevel = DetectStrSimdLevel();
+	return maxLevel;
+}
+
+
+StrSimdLevel GetStrSimdLevel()
+{
+	return GetStrSimdFuncs()->level;
+}
+
+
+StrSimdLevel SetStrSimdLevel(StrSimdLevel level)
+{
+	if (level > GetStrSimdMaxLevel()) {
+		level = GetStrSimdMaxLevel();
+	}
+
+	StrSimdActiveFuncs.store(&StrSimdFuncsByLevel[level], std::memory_order_relaxed);
+	return level;
+}
+
+
+const char* StrSimdLevelName(StrSimdLevel level)
+{
+	switch (level) {
+	case StrSimdScalar:
+		return "scalar";
+	case StrSimdSSE2:
+		return "SSE2";
+	case StrSimdAVX2:
+		return "AVX2";
+	}
+
+	return "unknown";
+}
+
+
+
+
+// **********************************************************
+// *                                                        *
+// *                     Public functions                   *
+// *                                                        *
+// **********************************************************
+
+const char* FindChar(const char* beg, const char* end, char c)
+{
+	// memchr() is already vectorized in common C libraries, and hard to beat for longer inputs
+	if (end-beg >= 256) {
+		return FindCharScalar(beg, end, c);
+	}
+
+	return GetStrSimdFuncs()->findChar(beg, end, c);
+}
+
+
+const char16_t* FindChar16(const char16_t* beg, const char16_t* end, char16_t c)
+{
+	return GetStrSimdFuncs()->findChar16(beg, end, c);
+}
+
+
+const char* FindSubstring(const char* beg, const char* end, const char* needle, size_t needleLen)
+{
+	if (needleLen == 0) {
+		return beg;
+	} else if (needleLen == 1) {
+		return FindChar(beg, end, needle[0]);
+	}
+
+	return GetStrSimdFuncs()->findSubstring(beg, end, needle, needleLen);
+}
+
+
+const char* FindFirstOf(const char* beg, const char* end, const StrCharSet& set)
+{
+	return GetStrSimdFuncs()->findFirstOf(beg, end, set);
+}
+
+
+const char* FindLastOf(const char* beg, const char* end, const StrCharSet& set)
+{
+	return GetStrSimdFuncs()->findLastOf(beg, end, set);
+}
+
+
+const char* FindLastNotOf(const char* beg, const char* end, const StrCharSet& set)
+{
+	return GetStrSimdFuncs()->findLastNotOf(beg, end, set);
+}
+
+
+size_t AsciiToLower(char* dest, const char* src, size_t len)
+{
+	return GetStrSimdFuncs()->asciiToLower(dest, src, len);
+}
+
+
+size_t AsciiToUpper(char* dest, const char* src, size_t len)
+{
+	return GetStrSimdFuncs()->asciiToUpper(dest, src, len);
+}
+
+
+size_t FindNonASCII(const char* str, size_t len)
+{
+	return GetStrSimdFuncs()->findNonASCII(str, len);
+}
+
+
+bool ValidateUTF8(const char* str, size_t len)
+{
+	return GetStrSimdFuncs()->validateUTF8(str, len);
+}
+
+
+void WidenToUTF16LE(char* dest, const char* src, size_t len)
+{
+	GetStrSimdFuncs()->widenToUTF16LE(dest, src, len);
+}
+
+
+size_t NarrowFromUTF16LE(char* dest, const char* src, size_t numUnits, unsigned int limit)
+{
+	return GetStrSimdFuncs()->narrowFromUTF16LE(dest, src, numUnits, limit);
+}
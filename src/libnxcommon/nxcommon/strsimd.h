@@ -0,0 +1,147 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_STRSIMD_H_
+#define NXCOMMON_STRSIMD_H_
+
+#include <nxcommon/config.h>
+#include <cstddef>
+
+
+
+/**	\brief Instruction set levels that the string search and conversion functions below can use.
+ *
+ * 	The best level supported by the CPU is selected automatically at runtime. Lower levels can be forced with
+ * 	SetStrSimdLevel(), which is mainly useful for testing and benchmarking.
+ */
+enum StrSimdLevel
+{
+	StrSimdScalar = 0,	///< Portable C++ code
+	StrSimdSSE2 = 1,	///< 16-byte SSE2 vectors
+	StrSimdAVX2 = 2		///< 32-byte AVX2 vectors
+};
+
+
+/**	\brief Return the level that is currently used.
+ */
+StrSimdLevel GetStrSimdLevel();
+
+/**	\brief Return the best level that is supported by both the CPU and the build.
+ */
+StrSimdLevel GetStrSimdMaxLevel();
+
+/**	\brief Select the level to use, and return the level that was actually selected.
+ *
+ * 	Levels not supported by the CPU are lowered to the best supported one. This affects all threads, so it should only be
+ * 	called while no other thread is using these functions.
+ */
+StrSimdLevel SetStrSimdLevel(StrSimdLevel level);
+
+const char* StrSimdLevelName(StrSimdLevel level);
+
+
+
+/**	\brief A set of characters prepared for FindFirstOf(), FindLastOf() and FindLastNotOf().
+ *
+ * 	Like with strchr(), the terminating null character of the string the set was built from is always part of the set.
+ */
+struct StrCharSet
+{
+	StrCharSet(const char* chrs);
+
+	bool contains(char c) const { return (bitmap[(unsigned char) c >> 5] & (1u << ((unsigned char) c & 31))) != 0; }
+
+	uint32_t bitmap[8];
+
+	// The members of the set, if there are at most 16 of them. Otherwise numChars is 0.
+	char chars[16];
+	unsigned int numChars;
+};
+
+
+
+/**	\brief Find the first occurrence of c in [beg, end), returning end if there is none.
+ */
+const char* FindChar(const char* beg, const char* end, char c);
+
+/**	\brief Find the first occurrence of the 16-bit unit c in [beg, end), returning end if there is none.
+ */
+const char16_t* FindChar16(const char16_t* beg, const char16_t* end, char16_t c);
+
+/**	\brief Find the first occurrence of needle in [beg, end), returning end if there is none.
+ *
+ * 	An empty needle is found at beg.
+ */
+const char* FindSubstring(const char* beg, const char* end, const char* needle, size_t needleLen);
+
+/**	\brief Find the first character in [beg, end) that is part of the set, returning end if there is none.
+ */
+const char* FindFirstOf(const char* beg, const char* end, const StrCharSet& set);
+
+/**	\brief Find the last character in [beg, end) that is part of the set, returning NULL if there is none.
+ */
+const char* FindLastOf(const char* beg, const char* end, const StrCharSet& set);
+
+/**	\brief Find the last character in [beg, end) that is not part of the set, returning NULL if there is none.
+ */
+const char* FindLastNotOf(const char* beg, const char* end, const StrCharSet& set);
+
+/**	\brief Convert the ASCII letters in src to lower case, stopping after len characters or at a null character.
+ *
+ * 	dest may be the same as src. Non-ASCII characters are copied unchanged.
+ *
+ * 	@return The number of characters converted.
+ */
+size_t AsciiToLower(char* dest, const char* src, size_t len);
+
+/**	\brief Convert the ASCII letters in src to upper case, stopping after len characters or at a null character.
+ *
+ * 	@see AsciiToLower()
+ */
+size_t AsciiToUpper(char* dest, const char* src, size_t len);
+
+/**	\brief Return the index of the first byte in str that is not ASCII (>= 0x80), or len if there is none.
+ */
+size_t FindNonASCII(const char* str, size_t len);
+
+/**	\brief Determine whether str is valid UTF-8.
+ *
+ * 	Overlong encodings, surrogates, code points above U+10FFFF and sequences cut off at the end are invalid. Runs of
+ * 	ASCII characters are skipped in bulk.
+ */
+bool ValidateUTF8(const char* str, size_t len);
+
+/**	\brief Widen len bytes to 16-bit little endian units, e.g. to convert ISO-8859-1 to UTF-16LE.
+ *
+ * 	dest must have room for 2*len bytes. It doesn't have to be aligned.
+ */
+void WidenToUTF16LE(char* dest, const char* src, size_t len);
+
+/**	\brief Narrow 16-bit little endian units to bytes, stopping at the first unit that is >= limit.
+ *
+ * 	@param limit The first value that can't be narrowed. Must be a power of two not greater than 0x100, e.g. 0x80 for
+ * 		ASCII or 0x100 for ISO-8859-1.
+ * 	@return The number of units that were narrowed.
+ */
+size_t NarrowFromUTF16LE(char* dest, const char* src, size_t numUnits, unsigned int limit);
+
+#endif /* NXCOMMON_STRSIMD_H_ */
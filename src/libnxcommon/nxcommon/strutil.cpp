@@ -27,6 +27,9 @@
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
+#include <rapidjson/internal/itoa.h>
+#include <rapidjson/internal/dtoa.h>
+#include <rapidjson/internal/strtod.h>
 
 using std::string;
 
@@ -36,41 +39,26 @@ using std::string;
 
 void strtolower(char* dest, const char* src, size_t len)
 {
-	size_t i;
-	for (i = 0 ; i < len  &&  src[i] != '\0' ; i++) {
-		dest[i] = tolower(src[i]);
-	}
+	AsciiToLower(dest, src, len);
 }
 
 
 void strtoupper(char* dest, const char* src, size_t len)
 {
-	size_t i;
-	for (i = 0 ; i < len  &&  src[i] != '\0' ; i++) {
-		dest[i] = toupper(src[i]);
-	}
+	AsciiToUpper(dest, src, len);
 }
 
 
 const char* FindLastOccurrence(const char* str, const char* from, const char* chrs)
 {
-	while (from != str  &&  strchr(chrs, *from) == NULL)
-		from--;
-
-	if (from == str  &&  strchr(chrs, *from) == NULL)
-		return NULL;
-
-	return from;
+	return FindLastOf(str, from+1, StrCharSet(chrs));
 }
 
 
 const char* rtrimfind(const char* str, const char* rbegin, const char* chrs)
 {
-	while (rbegin != str-1  &&  strchr(chrs, *rbegin)  !=  NULL) {
-		rbegin--;
-	}
-
-	return rbegin+1;
+	const char* last = FindLastNotOf(str, rbegin+1, StrCharSet(chrs));
+	return last ? last+1 : str;
 }
 
 
@@ -234,57 +222,198 @@ char* indent(const char* src, const char* indStr, bool indentStart, const char*
 
 bool WildcardMatch(const char* pattern, const char* text)
 {
-	bool escaped = false;
+	// When a mismatch happens after a star, it's enough to retry from the last star with one more character consumed by
+	// it: a later star can match everything that an earlier one could.
+	const char* starPattern = NULL;
+	const char* starText = NULL;
+
 	while (*text != '\0') {
-		if (escaped) {
-			if (*text != *pattern) {
-				return false;
+		if (*pattern == '*') {
+			do {
+				pattern++;
+			} while (*pattern == '*');
+
+			if (*pattern == '\0') {
+				return true;
 			}
-			escaped = false;
+
+			starPattern = pattern;
+			starText = text;
+			continue;
+		}
+
+		const char* next = pattern+1;
+		bool matches;
+
+		switch (*pattern) {
+		case '?':
+			matches = true;
+			break;
+		case '\\':
+			// A trailing backslash escapes the terminator, which never matches.
+			matches = pattern[1] != '\0'  &&  pattern[1] == *text;
+			next = pattern+2;
+			break;
+		default:
+			matches = *pattern == *text;
+			break;
+		}
+
+		if (matches) {
+			pattern = next;
+			text++;
+		} else if (starPattern) {
+			pattern = starPattern;
+			text = ++starText;
 		} else {
-			switch (*pattern) {
-			case '?':
-				break;
-			case '*':
-				do {
-					pattern++;
-				} while(*pattern == '*');
-				if (*pattern == '\0') {
-					return true;
-				}
-				while (*text != '\0') {
-					if (WildcardMatch(pattern, text)) {
-						return true;
-					}
-					text++;
-				}
-				return false;
-			case '\\':
-				escaped = true;
-				text--;
-				break;
-			default:
-				if (*pattern != *text) {
-					return false;
-				}
-				break;
-			}
+			return false;
 		}
-		text++;
-		pattern++;
 	}
+
 	while (*pattern == '*') pattern++;
 	return *pattern == '\0';
 }
 
 
-hash_t LowerHash(const char* str, size_t len)
+// The hash functions below are a variant of wyhash (final version 4), which is in the public domain.
+
+static const uint64_t HashSecret[] = {
+		0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+
+static inline void HashMultiply(uint64_t* a, uint64_t* b)
 {
-	char* lStr = new char[len];
-	strtolower(lStr, str, len);
-	hash_t hash = Hash(lStr, len);
-	delete[] lStr;
-	return hash;
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = *a;
+	r *= *b;
+	*a = (uint64_t) r;
+	*b = (uint64_t) (r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t) *a, lb = (uint32_t) *b;
+	uint64_t rh = ha*hb, rm0 = ha*lb, rm1 = hb*la, rl = la*lb;
+	uint64_t t = rl + (rm0 << 32);
+	uint64_t c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+
+static inline uint64_t HashMix(uint64_t a, uint64_t b)
+{
+	HashMultiply(&a, &b);
+	return a ^ b;
+}
+
+
+// Converts all ASCII uppercase letters in the bytes of v to lowercase, without branching.
+static inline uint64_t HashLowerWord(uint64_t v)
+{
+	const uint64_t ones = 0x0101010101010101ULL;
+	uint64_t heptets = v & (0x7F*ones);
+
+	// The high bit of each byte is set iff the byte is >= 'A' or > 'Z', respectively. No carries between bytes are
+	// possible, because each heptet is < 0x80.
+	uint64_t geA = heptets + (0x80 - 'A')*ones;
+	uint64_t gtZ = heptets + (0x80 - 'Z' - 1)*ones;
+	uint64_t upper = (geA ^ gtZ) & ~v & (0x80*ones);
+
+	return v | (upper >> 2);
+}
+
+
+template <bool lower>
+static inline uint64_t HashRead8(const char* p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return lower ? HashLowerWord(v) : v;
+}
+
+
+template <bool lower>
+static inline uint64_t HashRead4(const char* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return lower ? HashLowerWord(v) : v;
+}
+
+
+template <bool lower>
+static inline uint64_t HashRead3(const char* p, size_t len)
+{
+	uint64_t v = (((uint64_t) (uint8_t) p[0]) << 16) | (((uint64_t) (uint8_t) p[len >> 1]) << 8) | (uint8_t) p[len-1];
+	return lower ? HashLowerWord(v) : v;
+}
+
+
+template <bool lower>
+static inline hash_t HashImpl(const char* p, size_t len, uint64_t seed)
+{
+	const uint64_t* s = HashSecret;
+	seed ^= HashMix(seed ^ s[0], s[1]);
+
+	uint64_t a, b;
+
+	if (len <= 16) {
+		if (len >= 4) {
+			size_t off = (len >> 3) << 2;
+			a = (HashRead4<lower>(p) << 32) | HashRead4<lower>(p + off);
+			b = (HashRead4<lower>(p + len - 4) << 32) | HashRead4<lower>(p + len - 4 - off);
+		} else if (len > 0) {
+			a = HashRead3<lower>(p, len);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = len;
+
+		if (i > 48) {
+			uint64_t seed1 = seed, seed2 = seed;
+
+			do {
+				seed = HashMix(HashRead8<lower>(p) ^ s[1], HashRead8<lower>(p + 8) ^ seed);
+				seed1 = HashMix(HashRead8<lower>(p + 16) ^ s[2], HashRead8<lower>(p + 24) ^ seed1);
+				seed2 = HashMix(HashRead8<lower>(p + 32) ^ s[3], HashRead8<lower>(p + 40) ^ seed2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+
+			seed ^= seed1 ^ seed2;
+		}
+
+		while (i > 16) {
+			seed = HashMix(HashRead8<lower>(p) ^ s[1], HashRead8<lower>(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+
+		a = HashRead8<lower>(p + i - 16);
+		b = HashRead8<lower>(p + i - 8);
+	}
+
+	a ^= s[1];
+	b ^= seed;
+	HashMultiply(&a, &b);
+
+	return (hash_t) HashMix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+
+hash_t Hash(const char* str, size_t len, uint64_t seed)
+{
+	return HashImpl<false>(str, len, seed);
+}
+
+
+hash_t LowerHash(const char* str, size_t len, uint64_t seed)
+{
+	return HashImpl<true>(str, len, seed);
 }
 
 
@@ -311,16 +440,24 @@ size_t EscapeString(char* dest, const char* src, size_t srcLen, size_t destLen,
 	const char* srcEnd = src+srcLen;
 	char* destEnd = dest+destLen - 1;
 
+	StrCharSet escSet(charsToEscape);
+
 	while (src != srcEnd  &&  dest != destEnd) {
-		char c = *src++;
+		// Copy everything up to the next character to escape in one go
+		const char* esc = FindFirstOf(src, srcEnd, escSet);
+		size_t copyLen = std::min((size_t) (esc-src), (size_t) (destEnd-dest));
+		memcpy(dest, src, copyLen);
+		dest += copyLen;
+		src += copyLen;
+
+		if (src == srcEnd  ||  dest == destEnd) {
+			break;
+		}
 
-		if (strchr(charsToEscape, c) != NULL) {
-			*dest++ = escapeChar;
+		char c = *src++;
+		*dest++ = escapeChar;
 
-			if (dest != destEnd) {
-				*dest++ = c;
-			}
-		} else {
+		if (dest != destEnd) {
 			*dest++ = c;
 		}
 	}
@@ -351,177 +488,228 @@ size_t nxstrnlen(const char* s, size_t maxlen)
 }
 
 
-template <typename T, bool allowSigned, T maxValue>
-T _StringToIntTExtended(const char* str, size_t len, int base, bool* success)
+// Checks whether all 8 characters in v are decimal digits.
+static inline bool IsEightDigits(uint64_t v)
 {
-	if (len == 0) {
-		if (success) {
-			*success = false;
-		}
-
-		return 0;
-	}
+	return ((v & 0xF0F0F0F0F0F0F0F0ULL) | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+			== 0x3333333333333333ULL;
+}
 
-	if (base > 36) {
-		if (success) {
-			*success = false;
-		}
 
-		return 0;
-	}
+// Converts 8 decimal digits loaded in little endian order to their value, combining pairs of digits, then quadruples, then
+// the two halves with only three multiplications.
+static inline uint32_t ParseEightDigits(uint64_t v)
+{
+	const uint64_t mask = 0x000000FF000000FFULL;
+	const uint64_t mul1 = 100 + (1000000ULL << 32);
+	const uint64_t mul2 = 1 + (10000ULL << 32);
 
-	int signMultiplier = 1;
+	v -= 0x3030303030303030ULL;
+	v = (v * 10) + (v >> 8);
+	return (uint32_t) ((((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32);
+}
 
-	// First, see if there is a plus or minus sign in the beginning
 
-	if (*str == '+') {
+// Parses an unsigned decimal number of len characters (all of which must be digits) that is at most limit.
+static bool ParseDecimalDigits(const char* str, size_t len, uint64_t limit, uint64_t* result)
+{
+	while (len > 1  &&  *str == '0') {
 		str++;
 		len--;
-	} else if (*str == '-') {
-		if (allowSigned) {
-			signMultiplier = -1;
-			str++;
-			len--;
-		} else {
-			if (success) {
-				*success = false;
-			}
+	}
 
-			return 0;
-		}
+	// 2^64 has 20 decimal digits
+	if (len > 20) {
+		return false;
 	}
 
-	// Now, see if there are any base specifiers at the beginning
+	uint64_t value = 0;
+	size_t i = 0;
 
-	if (*str == '0') {
-		if (base == 0  ||  base == 8) {
-			// For base 0 (auto-determine) or 8, a leading zero means an octal value
-			base = 8;
+#ifdef NXCOMMON_LITTLE_ENDIAN
+	// At most 16 digits this way, so that the remaining ones can be added without overflow checks up to the 19th.
+	for (; len-i >= 8  &&  i < 16 ; i += 8) {
+		uint64_t chunk;
+		memcpy(&chunk, str+i, 8);
+
+		if (!IsEightDigits(chunk)) {
+			return false;
 		}
 
-		// For all other fixed bases, it's just ignored.
-		str++;
-		len--;
+		value = value * 100000000 + ParseEightDigits(chunk);
 	}
-	if (len >= 2  &&  str[0] == '0'  &&  str[1] == 'x') {
-		if (base == 0  ||  base == 16) {
-			// For base 0 (auto-determine) or 16, a leading '0x' signals a hexadecimal value
-			base = 16;
-		} else {
-			// For all other fixed bases, it is invalid (because of the 'x').
+#endif
 
-			if (success) {
-				*success = false;
-			}
+	for (; i < len ; i++) {
+		unsigned int digit = (unsigned char) str[i] - '0';
+
+		if (digit > 9) {
+			return false;
+		}
 
-			return 0;
+		if (i >= 19  &&  value > (UINT64_MAX - digit) / 10) {
+			return false;
 		}
 
-		str += 2;
-		len -= 2;
+		value = value * 10 + digit;
 	}
 
-	if (base == 0) {
-		// If base is still 0 here, no base prefix was found, so we assume decimal numbers.
-		base = 10;
+	if (value > limit) {
+		return false;
 	}
 
-	T value = 0;
-	T digitMultiplier = signMultiplier;
+	*result = value;
+	return true;
+}
 
-	const char* cstr = str + len;
 
-	do {
-		cstr--;
-
-		char c = *cstr;
+static bool ParseDigits(const char* str, size_t len, unsigned int base, uint64_t limit, uint64_t* result)
+{
+	uint64_t cutoff = limit / base;
+	unsigned int cutlim = (unsigned int) (limit % base);
+	uint64_t value = 0;
 
-		T unitVal = std::numeric_limits<T>::max(); // Anything invalid initially
+	for (size_t i = 0 ; i < len ; i++) {
+		char c = str[i];
+		unsigned int digit;
 
 		if (c >= '0'  &&  c <= '9') {
-			unitVal = c-'0';
+			digit = c-'0';
 		} else if (c >= 'A'  &&  c <= 'Z') {
-			unitVal = c-'A' + 10;
+			digit = c-'A' + 10;
 		} else if (c >= 'a'  &&  c <= 'z') {
-			unitVal = c-'a' + 10;
+			digit = c-'a' + 10;
+		} else {
+			return false;
 		}
 
-		if (unitVal >= (T) base) {
-			if (success) {
-				*success = false;
-			}
+		if (digit >= base  ||  value > cutoff  ||  (value == cutoff  &&  digit > cutlim)) {
+			return false;
+		}
+
+		value = value * base + digit;
+	}
+
+	*result = value;
+	return true;
+}
+
+
+template <typename T>
+T _StringToIntT(const char* str, size_t len, int base, bool* success)
+{
+	bool negative = false;
+
+	if (len != 0  &&  (*str == '+'  ||  *str == '-')) {
+		negative = *str == '-';
+		str++;
+		len--;
+	}
+
+	bool valid = len != 0  &&  base >= 0  &&  base != 1  &&  base <= 36;
+	valid = valid  &&  !(negative  &&  !std::numeric_limits<T>::is_signed);
 
-			return 0;
+	if (valid) {
+		// Base prefixes: "0x" means hexadecimal for base 0 and 16, a leading zero means octal for base 0.
+		if (len >= 2  &&  str[0] == '0'  &&  (str[1] == 'x'  ||  str[1] == 'X')  &&  (base == 0  ||  base == 16)) {
+			base = 16;
+			str += 2;
+			len -= 2;
+			valid = len != 0;
+		} else if (base == 0) {
+			base = (str[0] == '0'  &&  len > 1) ? 8 : 10;
 		}
+	}
 
-		value += unitVal * digitMultiplier;
+	uint64_t magnitude = 0;
 
-		digitMultiplier *= base;
-	} while (cstr != str);
+	if (valid) {
+		uint64_t limit = (uint64_t) std::numeric_limits<T>::max() + (negative ? 1 : 0);
+
+		if (base == 10) {
+			valid = ParseDecimalDigits(str, len, limit, &magnitude);
+		} else {
+			valid = ParseDigits(str, len, (unsigned int) base, limit, &magnitude);
+		}
+	}
 
 	if (success) {
-		*success = true;
+		*success = valid;
+	}
+
+	if (!valid) {
+		return 0;
 	}
 
-	return value;
+	return negative ? (T) (0 - magnitude) : (T) magnitude;
 }
 
 
 uint8_t StringToUInt8(const char* str, size_t len, int base, bool* success)
 {
-	return _StringToIntTExtended<uint8_t, false, UINT8_MAX>(str, len, base, success);
+	return _StringToIntT<uint8_t>(str, len, base, success);
 }
 
 
 int8_t StringToInt8(const char* str, size_t len, int base, bool* success)
 {
-	return _StringToIntTExtended<int8_t, true, INT8_MAX>(str, len, base, success);
+	return _StringToIntT<int8_t>(str, len, base, success);
 }
 
 
 uint16_t StringToUInt16(const char* str, size_t len, int base, bool* success)
 {
-	return _StringToIntTExtended<uint16_t, false, UINT16_MAX>(str, len, base, success);
+	return _StringToIntT<uint16_t>(str, len, base, success);
 }
 
 
 int16_t StringToInt16(const char* str, size_t len, int base, bool* success)
 {
-	return _StringToIntTExtended<int16_t, true, INT16_MAX>(str, len, base, success);
+	return _StringToIntT<int16_t>(str, len, base, success);
 }
 
 
 uint32_t StringToUInt32(const char* str, size_t len, int base, bool* success)
 {
-	return _StringToIntTExtended<uint32_t, false, UINT32_MAX>(str, len, base, success);
+	return _StringToIntT<uint32_t>(str, len, base, success);
 }
 
 
 int32_t StringToInt32(const char* str, size_t len, int base, bool* success)
 {
-	return _StringToIntTExtended<int32_t, true, INT32_MAX>(str, len, base, success);
+	return _StringToIntT<int32_t>(str, len, base, success);
 }
 
 
 uint64_t StringToUInt64(const char* str, size_t len, int base, bool* success)
 {
-	return _StringToIntTExtended<uint64_t, false, UINT64_MAX>(str, len, base, success);
+	return _StringToIntT<uint64_t>(str, len, base, success);
 }
 
 
 int64_t StringToInt64(const char* str, size_t len, int base, bool* success)
 {
-	return _StringToIntTExtended<int64_t, true, INT64_MAX>(str, len, base, success);
+	return _StringToIntT<int64_t>(str, len, base, success);
 }
 
 
-double StringToDouble(const char* str, bool* success)
+// Fallback for the number formats that the fast parser doesn't handle (hexadecimal floats, infinity and NaN).
+static double StringToDoubleStrtod(const char* str, size_t len, bool* success)
 {
+	char buf[128];
+	char* termStr = len < sizeof(buf) ? buf : new char[len+1];
+	memcpy(termStr, str, len);
+	termStr[len] = '\0';
+
 	char* endPtr;
-	double val = strtod(str, &endPtr);
+	double val = strtod(termStr, &endPtr);
 
 	if (success) {
-		*success = (*endPtr == '\0')  &&  (*str != '\0');
+		*success = (*endPtr == '\0')  &&  (len != 0);
+	}
+
+	if (termStr != buf) {
+		delete[] termStr;
 	}
 
 	return val;
@@ -530,12 +718,149 @@ double StringToDouble(const char* str, bool* success)
 
 double StringToDouble(const char* str, size_t len, bool* success)
 {
-	char* termStr = new char[len+1];
-	termStr[len] = '\0';
-	memcpy(termStr, str, len);
-	double val = StringToDouble(termStr, success);
-	delete[] termStr;
-	return val;
+	const char* end = str + len;
+	const char* s = str;
+
+	bool negative = false;
+
+	if (s != end  &&  (*s == '+'  ||  *s == '-')) {
+		negative = *s == '-';
+		s++;
+	}
+
+	if (s == end  ||  !((*s >= '0'  &&  *s <= '9')  ||  *s == '.')  ||  (end-s >= 2  &&  s[0] == '0'
+			&&  (s[1] == 'x'  ||  s[1] == 'X'))) {
+		return StringToDoubleStrtod(str, len, success);
+	}
+
+	// Collect the significant digits without the decimal point, so that they can be passed to rapidjson's parser if
+	// the fast path can't be taken.
+	char digitBuf[64];
+	char* digits = digitBuf;
+	size_t numDigits = 0;
+	size_t maxDigits = sizeof(digitBuf);
+	ptrdiff_t intDigits = 0;
+	bool seenPoint = false;
+	bool anyDigit = false;
+
+	uint64_t mantissa = 0;
+
+	for (; s != end ; s++) {
+		char c = *s;
+
+		if (c >= '0'  &&  c <= '9') {
+			anyDigit = true;
+
+			if (numDigits == 0  &&  c == '0') {
+				// Leading zeros aren't significant, but those after the decimal point shift the value.
+				if (seenPoint) {
+					intDigits--;
+				}
+				continue;
+			}
+
+			if (numDigits == maxDigits) {
+				char* newDigits = new char[maxDigits*2];
+				memcpy(newDigits, digits, numDigits);
+				if (digits != digitBuf) {
+					delete[] digits;
+				}
+				digits = newDigits;
+				maxDigits *= 2;
+			}
+
+			digits[numDigits++] = c;
+
+			if (numDigits <= 19) {
+				mantissa = mantissa*10 + (c-'0');
+			}
+			if (!seenPoint) {
+				intDigits++;
+			}
+		} else if (c == '.'  &&  !seenPoint) {
+			seenPoint = true;
+		} else {
+			break;
+		}
+	}
+
+	bool valid = anyDigit;
+	int exp = 0;
+
+	if (valid  &&  s != end  &&  (*s == 'e'  ||  *s == 'E')) {
+		s++;
+		bool expNegative = false;
+
+		if (s != end  &&  (*s == '+'  ||  *s == '-')) {
+			expNegative = *s == '-';
+			s++;
+		}
+
+		valid = s != end;
+
+		for (; s != end  &&  *s >= '0'  &&  *s <= '9' ; s++) {
+			// Clamp huge exponents, the result is zero or infinity anyway.
+			if (exp < 100000) {
+				exp = exp*10 + (*s - '0');
+			}
+		}
+
+		if (expNegative) {
+			exp = -exp;
+		}
+	}
+
+	valid = valid  &&  s == end;
+
+	double val = 0.0;
+
+	if (valid  &&  numDigits != 0) {
+		// The value is digits * 10^(intDigits - numDigits + exp), and the decimal point is at intDigits+exp relative
+		// to the first significant digit.
+		ptrdiff_t pointPos = intDigits + exp;
+
+		// DBL_MAX is 0.17976931348623157e309, so anything with a larger point position overflows.
+		if (pointPos > 309) {
+			val = std::numeric_limits<double>::infinity();
+		} else if (pointPos < -330) {
+			val = 0.0;
+		} else {
+			int p = (int) (pointPos - (ptrdiff_t) numDigits);
+			double d = numDigits <= 19 ? (double) mantissa : std::numeric_limits<double>::infinity();
+
+			if (numDigits <= 19  &&  mantissa <= (1ULL << 53)  &&  p >= -22  &&  p <= 22) {
+				// Both the mantissa and the power of ten are exact doubles, so a single operation rounds correctly.
+				val = rapidjson::internal::FastPath(d, p);
+			} else if (numDigits > 768  ||  pointPos < -306  ||  pointPos == 309) {
+				// rapidjson truncates long inputs, doesn't always round subnormals correctly and doesn't handle overflow
+				// for values close to DBL_MAX. All of these are rare enough to just use strtod(), and without a decimal
+				// point its result doesn't depend on the locale.
+				std::string intStr(digits, numDigits);
+				char expBuf[16];
+				snprintf(expBuf, sizeof(expBuf), "e%d", p);
+				intStr.append(expBuf);
+				val = strtod(intStr.c_str(), NULL);
+			} else {
+				val = rapidjson::internal::StrtodFullPrecision(d, p, digits, numDigits, numDigits, p);
+			}
+		}
+	}
+
+	if (digits != digitBuf) {
+		delete[] digits;
+	}
+
+	if (success) {
+		*success = valid;
+	}
+
+	return negative ? -val : val;
+}
+
+
+double StringToDouble(const char* str, bool* success)
+{
+	return StringToDouble(str, strlen(str), success);
 }
 
 
@@ -549,3 +874,34 @@ float StringToFloat(const char* str, size_t len, bool* success)
 {
 	return (float) StringToDouble(str, len, success);
 }
+
+
+size_t ULongLongToString(char* str, unsigned long long value, unsigned int base)
+{
+	if (base != 10) {
+		return ULongLongToString<char>(str, value, base);
+	}
+
+	char* end = rapidjson::internal::u64toa((uint64_t) value, str);
+	*end = '\0';
+	return end-str;
+}
+
+
+size_t DoubleToString(char* str, double value)
+{
+	char* end;
+
+	if (value != value) {
+		end = str + sprintf(str, "nan");
+	} else if (value == std::numeric_limits<double>::infinity()) {
+		end = str + sprintf(str, "inf");
+	} else if (value == -std::numeric_limits<double>::infinity()) {
+		end = str + sprintf(str, "-inf");
+	} else {
+		end = rapidjson::internal::dtoa(value, str);
+	}
+
+	*end = '\0';
+	return end-str;
+}
@@ -25,6 +25,7 @@
 
 #include <nxcommon/config.h>
 #include <nxcommon/util.h>
+#include <nxcommon/strsimd.h>
 #include <locale>
 #include <cstring>
 #include <cstdio>
@@ -37,6 +38,11 @@ using std::use_facet;
 typedef long hash_t;
 
 
+/**	\brief The seed used by Hash() and LowerHash() when none is given explicitly.
+ */
+const uint64_t HashDefaultSeed = 0x2d358dccaa6c78a5ULL;
+
+
 
 // These arrays are indexed by a numeric base between 2 and 36 (0 and 1 are invalid) and contain the maximum power of that base that
 // fits in an unsigned long long type.
@@ -203,14 +209,28 @@ char* wrapText(const char* src, size_t cpl);
 char* indent(const char* src, const char* indStr, bool indentStart = false, const char* newline = "\n");
 
 
+/**	\brief Check whether text matches a wildcard pattern.
+ *
+ * 	'?' matches any single character, '*' matches any sequence of characters and '\' makes the following character match
+ * 	literally. This takes O(pattern length * text length) time in the worst case, but no memory. To match the same
+ * 	pattern against many strings, use WildcardPattern.
+ */
 bool WildcardMatch(const char* pattern, const char* text);
 
 
 
-inline hash_t Hash(const char* str, size_t len)
-{
-	return use_facet< collate<char> >(locale()).hash(str, str+len);
-}
+/**	\brief Computes a fast 64-bit hash of a byte string.
+ *
+ * 	The hash function is a variant of wyhash. It reads the input in 8-byte words and doesn't depend on the current
+ * 	locale. Hash values are stable within a process for a given seed, but are not guaranteed to be the same across
+ * 	platforms or versions of this library, so they shouldn't be persisted.
+ *
+ * 	@param str The string to hash. It may contain null bytes.
+ * 	@param len The length of str in bytes.
+ * 	@param seed The seed for the hash function.
+ * 	@return The hash value.
+ */
+hash_t Hash(const char* str, size_t len, uint64_t seed = HashDefaultSeed);
 
 
 inline hash_t Hash(const char* str)
@@ -219,7 +239,13 @@ inline hash_t Hash(const char* str)
 }
 
 
-hash_t LowerHash(const char* str, size_t len);
+/**	\brief Computes the hash of the lowercase version of a string.
+ *
+ * 	The result is the same as calling Hash() on the string with all ASCII letters converted to lowercase, but the
+ * 	conversion is done on the fly, so no memory is allocated. Only ASCII letters are folded, independently of the
+ * 	current locale.
+ */
+hash_t LowerHash(const char* str, size_t len, uint64_t seed = HashDefaultSeed);
 
 inline hash_t LowerHash(const char* str)
 {
@@ -263,8 +289,14 @@ inline uint64_t StringToUInt64(const char* str, int base = 0, bool* success = NU
 inline int64_t StringToInt64(const char* str, int base = 0, bool* success = NULL)
 		{ return StringToInt64(str, strlen(str), base, success); }
 
-double StringToDouble(const char* str, bool* success = NULL);
+/**	\brief Parses a decimal floating point number.
+ *
+ * 	Parsing does not depend on the current locale, so the decimal separator is always '.'. Plain decimal numbers are
+ * 	parsed without allocation and rounded correctly, other formats accepted by strtod() (hexadecimal, "inf", "nan",
+ * 	leading whitespace) are passed to strtod().
+ */
 double StringToDouble(const char* str, size_t len, bool* success = NULL);
+double StringToDouble(const char* str, bool* success = NULL);
 
 float StringToFloat(const char* str, bool* success = NULL);
 float StringToFloat(const char* str, size_t len, bool* success = NULL);
@@ -328,5 +360,20 @@ size_t ULongLongToString(CharT* str, unsigned long long value, unsigned int base
 	return str-origStr;*/
 }
 
+/**	\brief Fast narrow-string version of ULongLongToString().
+ *
+ * 	Base 10 is converted two digits at a time, other bases fall back to the generic template.
+ */
+size_t ULongLongToString(char* str, unsigned long long value, unsigned int base = 10);
+
+/**	\brief Converts a double to the shortest string that parses back to the same value.
+ *
+ * 	The output does not depend on the current locale. Infinity and NaN are written as "inf", "-inf" and "nan".
+ *
+ * 	@param str The output buffer. Must have room for at least 32 characters.
+ * 	@return The length of the string, not including the null-terminator.
+ */
+size_t DoubleToString(char* str, double value);
+
 
 #endif /* NXCOMMON_STRUTIL_H_ */
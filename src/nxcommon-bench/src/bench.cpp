@@ -0,0 +1,142 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "bench.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+
+
+bool benchQuick = false;
+
+static std::atomic<uint64_t> benchNumAllocs(0);
+static std::atomic<uint64_t> benchLiveBytes(0);
+
+
+
+// Every allocation is prefixed with its size, so that live bytes can be counted without relying on sized
+// deallocation. 16 bytes keep the alignment that malloc() guarantees.
+static const size_t BenchAllocHeaderSize = 16;
+
+
+static void* BenchAlloc(size_t size)
+{
+	void* p = malloc(size + BenchAllocHeaderSize);
+
+	if (!p) {
+		throw std::bad_alloc();
+	}
+
+	*((size_t*) p) = size;
+	benchNumAllocs.fetch_add(1, std::memory_order_relaxed);
+	benchLiveBytes.fetch_add(size, std::memory_order_relaxed);
+
+	return (char*) p + BenchAllocHeaderSize;
+}
+
+
+static void BenchFree(void* p)
+{
+	if (!p) {
+		return;
+	}
+
+	void* base = (char*) p - BenchAllocHeaderSize;
+	benchLiveBytes.fetch_sub(*((size_t*) base), std::memory_order_relaxed);
+	free(base);
+}
+
+
+void* operator new(size_t size) { return BenchAlloc(size); }
+void* operator new[](size_t size) { return BenchAlloc(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+		{ try { return BenchAlloc(size); } catch (std::bad_alloc&) { return NULL; } }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+		{ try { return BenchAlloc(size); } catch (std::bad_alloc&) { return NULL; } }
+void operator delete(void* p) noexcept { BenchFree(p); }
+void operator delete[](void* p) noexcept { BenchFree(p); }
+void operator delete(void* p, size_t) noexcept { BenchFree(p); }
+void operator delete[](void* p, size_t) noexcept { BenchFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { BenchFree(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { BenchFree(p); }
+
+
+
+BenchAllocStats BenchGetAllocStats()
+{
+	BenchAllocStats stats;
+	stats.numAllocs = benchNumAllocs.load(std::memory_order_relaxed);
+	stats.liveBytes = benchLiveBytes.load(std::memory_order_relaxed);
+	return stats;
+}
+
+
+
+vector<Benchmark>& GetBenchmarks()
+{
+	static vector<Benchmark> benchmarks;
+	return benchmarks;
+}
+
+
+BenchmarkRegistrar::BenchmarkRegistrar(const char* group, const char* name, BenchmarkFunc func)
+{
+	Benchmark bench;
+	bench.group = group;
+	bench.name = name;
+	bench.func = func;
+	GetBenchmarks().push_back(bench);
+}
+
+
+double BenchRunThreads(unsigned int numThreads, const std::function<void (unsigned int)>& func)
+{
+	std::atomic<unsigned int> ready(0);
+	std::atomic<bool> go(false);
+
+	vector<std::thread> threads;
+	threads.reserve(numThreads);
+
+	for (unsigned int i = 0 ; i < numThreads ; i++) {
+		threads.emplace_back([&, i]() {
+			ready.fetch_add(1);
+			while (!go.load(std::memory_order_acquire)) {
+				std::this_thread::yield();
+			}
+			func(i);
+		});
+	}
+
+	while (ready.load() != numThreads) {
+		std::this_thread::yield();
+	}
+
+	BenchTimer timer;
+	go.store(true, std::memory_order_release);
+
+	for (std::thread& t : threads) {
+		t.join();
+	}
+
+	return timer.elapsedSeconds();
+}
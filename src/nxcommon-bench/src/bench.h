@@ -0,0 +1,141 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#ifndef NXCOMMON_BENCH_BENCH_H_
+#define NXCOMMON_BENCH_BENCH_H_
+
+#include <nxcommon/config.h>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <cstdio>
+#include <algorithm>
+
+using std::vector;
+
+
+
+
+typedef void (*BenchmarkFunc)();
+
+
+struct Benchmark
+{
+	const char* group;
+	const char* name;
+	BenchmarkFunc func;
+};
+
+
+/**	\brief Registers a benchmark function at static initialization time.
+ *
+ * 	Don't use this directly, use the BENCHMARK() macro instead.
+ */
+class BenchmarkRegistrar
+{
+public:
+	BenchmarkRegistrar(const char* group, const char* name, BenchmarkFunc func);
+};
+
+
+/**	\brief Defines a benchmark function.
+ *
+ * 	Benchmarks are identified by "group.name" and can be selected with the --filter option of nxcommon-bench.
+ * 	They print their own results, usually one line per measured configuration.
+ */
+#define BENCHMARK(group, name) \
+	static void _Bench_##group##_##name(); \
+	static BenchmarkRegistrar _BenchReg_##group##_##name(#group, #name, &_Bench_##group##_##name); \
+	static void _Bench_##group##_##name()
+
+
+vector<Benchmark>& GetBenchmarks();
+
+
+/**	\brief If true, benchmarks should use smaller iteration counts (--quick option).
+ */
+extern bool benchQuick;
+
+
+/**	\brief Scales an iteration count down when running in quick mode.
+ */
+inline size_t BenchIterations(size_t n) { return benchQuick ? std::max(n / 20, (size_t) 1) : n; }
+
+
+/**	\brief Prevents the compiler from optimizing away the computation of a value.
+ */
+template <typename T>
+inline void BenchKeep(const T& val)
+{
+#if defined(__GNUC__)
+	asm volatile("" : : "r,m"(val) : "memory");
+#else
+	static volatile const void* sink;
+	sink = &val;
+#endif
+}
+
+
+class BenchTimer
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+public:
+	BenchTimer() : start(Clock::now()) {}
+	void reset() { start = Clock::now(); }
+	double elapsedSeconds() const { return std::chrono::duration<double>(Clock::now() - start).count(); }
+	uint64_t elapsedNanoseconds() const
+			{ return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count(); }
+
+private:
+	Clock::time_point start;
+};
+
+
+/**	\brief Counters of the global operator new, which nxcommon-bench replaces.
+ */
+struct BenchAllocStats
+{
+	uint64_t numAllocs;		//!< Number of calls to operator new since program start.
+	uint64_t liveBytes;		//!< Number of bytes currently allocated through operator new.
+};
+
+
+/**	\brief Returns the current operator new counters.
+ *
+ * 	To measure a piece of code, take the difference of the values before and after it.
+ */
+BenchAllocStats BenchGetAllocStats();
+
+
+/**	\brief Runs a function in numThreads threads in parallel and returns the wall-clock time in seconds.
+ *
+ * 	All threads are started before the clock starts, and they are released at the same time.
+ *
+ * 	@param numThreads The number of threads.
+ * 	@param func The function to run. Its argument is the thread index in [0, numThreads).
+ */
+double BenchRunThreads(unsigned int numThreads, const std::function<void (unsigned int)>& func);
+
+#endif /* NXCOMMON_BENCH_BENCH_H_ */
@@ -0,0 +1,334 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "bench.h"
+#include <nxcommon/Cache.h>
+#include <nxcommon/ConcurrentCache.h>
+#include <nxcommon/FlatCache.h>
+#include <nxcommon/CacheStats.h>
+#include <mutex>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+
+
+static const unsigned int CacheBenchNumKeys = 100000;
+static const unsigned int CacheBenchThreadCounts[] = { 1, 2, 4, 8, 16, 32 };
+
+
+
+template <typename LookupFunc>
+static double MeasureLookupsPerSecond(unsigned int numThreads, LookupFunc lookup)
+{
+	size_t numLookups = BenchIterations(2000000);
+
+	double secs = BenchRunThreads(numThreads, [&](unsigned int threadIdx) {
+		std::minstd_rand rng(threadIdx+1);
+		size_t hits = 0;
+
+		for (size_t i = 0 ; i < numLookups ; i++) {
+			if (lookup(rng() % CacheBenchNumKeys)) {
+				hits++;
+			}
+		}
+
+		BenchKeep(hits);
+	});
+
+	return (numLookups * numThreads) / secs;
+}
+
+
+BENCHMARK(Cache, ConcurrentLookupScaling)
+{
+	typedef Cache<unsigned int, unsigned int> LockedCache;
+	typedef ConcurrentCache<unsigned int, unsigned int> ShardedCache;
+
+	LockedCache lockedCache(CacheBenchNumKeys);
+	std::mutex lockedCacheMtx;
+
+	ShardedCache shardedCache(CacheBenchNumKeys);
+
+	for (unsigned int i = 0 ; i < CacheBenchNumKeys ; i++) {
+		lockedCache.insert(i, new unsigned int(i), 1);
+		shardedCache.insert(i, new unsigned int(i), 1);
+	}
+
+	printf("%8s  %20s  %20s\n", "threads", "Cache+mutex [op/s]", "ConcurrentCache [op/s]");
+
+	for (unsigned int numThreads : CacheBenchThreadCounts) {
+		double lockedRate = MeasureLookupsPerSecond(numThreads, [&](unsigned int key) {
+			std::lock_guard<std::mutex> lock(lockedCacheMtx);
+			return lockedCache.item(key) != NULL;
+		});
+		double shardedRate = MeasureLookupsPerSecond(numThreads, [&](unsigned int key) {
+			return shardedCache.visit(key, [](unsigned int& v) { BenchKeep(v); });
+		});
+
+		printf("%8u  %20.0f  %20.0f\n", numThreads, lockedRate, shardedRate);
+	}
+}
+
+
+
+
+/**	\brief Generates a key trace where key popularity follows a Zipf distribution.
+ */
+static vector<unsigned int> GenerateZipfTrace(size_t len, unsigned int numKeys, double skew, unsigned int seed)
+{
+	vector<double> cdf(numKeys);
+	double sum = 0.0;
+
+	for (unsigned int i = 0 ; i < numKeys ; i++) {
+		sum += 1.0 / pow((double) (i+1), skew);
+		cdf[i] = sum;
+	}
+
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> dist(0.0, sum);
+
+	// Scatter ranks over the key space, so that popular keys are not neighbors
+	vector<unsigned int> perm(numKeys);
+	for (unsigned int i = 0 ; i < numKeys ; i++) {
+		perm[i] = i;
+	}
+	std::shuffle(perm.begin(), perm.end(), rng);
+
+	vector<unsigned int> trace(len);
+	for (size_t i = 0 ; i < len ; i++) {
+		size_t rank = std::lower_bound(cdf.begin(), cdf.end(), dist(rng)) - cdf.begin();
+		trace[i] = perm[std::min(rank, (size_t) numKeys-1)];
+	}
+
+	return trace;
+}
+
+
+/**	\brief Inserts a sequential scan over never-repeating keys into a trace at regular intervals.
+ */
+static vector<unsigned int> AddScans(const vector<unsigned int>& trace, size_t interval, unsigned int scanLen)
+{
+	vector<unsigned int> res;
+	unsigned int scanKey = 0x80000000;
+
+	for (size_t i = 0 ; i < trace.size() ; i++) {
+		if (i != 0  &&  i % interval == 0) {
+			for (unsigned int j = 0 ; j < scanLen ; j++) {
+				res.push_back(scanKey++);
+			}
+		}
+		res.push_back(trace[i]);
+	}
+
+	return res;
+}
+
+
+static vector<unsigned int> GenerateLoopTrace(size_t len, unsigned int loopLen)
+{
+	vector<unsigned int> trace(len);
+	for (size_t i = 0 ; i < len ; i++) {
+		trace[i] = (unsigned int) (i % loopLen);
+	}
+	return trace;
+}
+
+
+template <template<class, class, class> class EvictionPolicy>
+static void ReplayTrace(const char* policyName, const vector<unsigned int>& trace, unsigned int capacity)
+{
+	Cache<unsigned int, unsigned int, less<unsigned int>, CXX11Hash<unsigned int>, equal_to<unsigned int>,
+			EvictionPolicy> cache(capacity);
+
+	size_t hits = 0;
+
+	BenchTimer timer;
+
+	for (unsigned int key : trace) {
+		if (cache.item(key)) {
+			hits++;
+		} else {
+			cache.insert(key, new unsigned int(key), 1);
+		}
+	}
+
+	double ns = (double) timer.elapsedNanoseconds() / trace.size();
+
+	printf("    %-12s  hit ratio %6.2f%%  %8.1f ns/op\n", policyName, 100.0 * hits / trace.size(), ns);
+}
+
+
+static void ReplayTraceAllPolicies(const char* traceName, const vector<unsigned int>& trace, unsigned int capacity)
+{
+	printf("%s (%u accesses, capacity %u)\n", traceName, (unsigned int) trace.size(), capacity);
+
+	ReplayTrace<LRUEvictionPolicy>("LRU", trace, capacity);
+	ReplayTrace<TwoQueueEvictionPolicy>("2Q", trace, capacity);
+	ReplayTrace<ARCEvictionPolicy>("ARC", trace, capacity);
+	ReplayTrace<TinyLFUEvictionPolicy>("W-TinyLFU", trace, capacity);
+	ReplayTrace<GDSFEvictionPolicy>("GDSF", trace, capacity);
+}
+
+
+BENCHMARK(Cache, EvictionPolicyTraceReplay)
+{
+	size_t len = BenchIterations(2000000);
+	unsigned int numKeys = 200000;
+	unsigned int capacity = 5000;
+
+	vector<unsigned int> zipf = GenerateZipfTrace(len, numKeys, 0.9, 1337);
+
+	ReplayTraceAllPolicies("Zipf(0.9)", zipf, capacity);
+	ReplayTraceAllPolicies("Zipf(0.9) + scans", AddScans(zipf, len/20, 4*capacity), capacity);
+	ReplayTraceAllPolicies("Loop", GenerateLoopTrace(len, capacity + capacity/5), capacity);
+}
+
+
+
+template <class CacheT, typename InsertFunc>
+static void MeasureCacheLayout(const char* name, unsigned int numEntries, unsigned int keyStride, InsertFunc insert)
+{
+	BenchAllocStats before = BenchGetAllocStats();
+
+	CacheT* cache = new CacheT(numEntries);
+
+	for (unsigned int i = 0 ; i < numEntries ; i++) {
+		insert(*cache, i*keyStride, i);
+	}
+
+	BenchAllocStats after = BenchGetAllocStats();
+
+	// Random hits, so that the lookups are not just walking memory in order
+	size_t numLookups = BenchIterations(10000000);
+	std::minstd_rand rng(1337);
+	vector<unsigned int> keys(1 << 20);
+	for (unsigned int& key : keys) {
+		key = (rng() % numEntries) * keyStride;
+	}
+
+	uint64_t sum = 0;
+	BenchTimer timer;
+
+	for (size_t i = 0 ; i < numLookups ; i++) {
+		sum += *cache->item(keys[i & ((1 << 20) - 1)]);
+	}
+
+	double ns = timer.elapsedNanoseconds() / (double) numLookups;
+	BenchKeep(sum);
+
+	printf("%-28s  %12.1f  %12.2f  %14.1f\n", name, (after.liveBytes - before.liveBytes) / (double) numEntries,
+			(after.numAllocs - before.numAllocs) / (double) numEntries, ns);
+
+	delete cache;
+}
+
+
+BENCHMARK(Cache, FlatLayout)
+{
+	typedef Cache<unsigned int, uint64_t> NodeCache;
+	typedef FlatCache<unsigned int, uint64_t> PtrFlatCache;
+	typedef FlatCache<unsigned int, uint64_t, CXX11Hash<unsigned int>, equal_to<unsigned int>, true> InlineFlatCache;
+
+	// Sequential keys are the best case for std::hash, which is the identity for integers.
+	struct KeyPattern { const char* name; unsigned int stride; };
+	KeyPattern patterns[] = { { "sequential", 1 }, { "scattered", 2654435761u } };
+
+	for (unsigned int numEntries : { 10000u, 1000000u }) {
+		if (benchQuick) {
+			numEntries /= 10;
+		}
+
+		for (const KeyPattern& pattern : patterns) {
+			printf("%u entries of <uint32, uint64>, %s keys:\n", numEntries, pattern.name);
+			printf("%-28s  %12s  %12s  %14s\n", "", "bytes/entry", "allocs/entry", "lookup [ns]");
+
+			MeasureCacheLayout<NodeCache>("Cache", numEntries, pattern.stride,
+					[](NodeCache& c, unsigned int key, unsigned int val) {
+				c.insert(key, new uint64_t(val), 1);
+			});
+			MeasureCacheLayout<PtrFlatCache>("FlatCache", numEntries, pattern.stride,
+					[](PtrFlatCache& c, unsigned int key, unsigned int val) {
+				c.insert(key, new uint64_t(val), 1);
+			});
+			MeasureCacheLayout<InlineFlatCache>("FlatCache (inline values)", numEntries, pattern.stride,
+					[](InlineFlatCache& c, unsigned int key, unsigned int val) {
+				c.emplace(key, (uint64_t) val, 1);
+			});
+		}
+	}
+}
+
+
+
+BENCHMARK(Cache, StatsOverhead)
+{
+	const unsigned int numKeys = 10000;
+	size_t numLookups = BenchIterations(20000000);
+
+	std::minstd_rand rng(1337);
+	vector<unsigned int> keys(1 << 16);
+	for (unsigned int& key : keys) {
+		// About 10% misses
+		key = rng() % (numKeys + numKeys/10);
+	}
+
+	printf("%-28s  %14s\n", "", "lookup [ns]");
+
+	for (int mode = 0 ; mode < 4 ; mode++) {
+		// The stats must outlive the caches, which count their final evictions.
+		CacheStats stats;
+		CacheStats otherStats;
+		Cache<unsigned int, uint64_t> cache(numKeys);
+		Cache<unsigned int, uint64_t> otherCache(numKeys);
+
+		for (unsigned int i = 0 ; i < numKeys ; i++) {
+			cache.insert(i, new uint64_t(i), 1);
+			otherCache.insert(i, new uint64_t(i), 1);
+		}
+
+		if (mode == 1  ||  mode == 3) {
+			cache.setStats(&stats);
+			otherCache.setStats(&otherStats);
+		} else if (mode == 2) {
+			cache.setStats(&stats, [](unsigned int key) { return key < 100 ? CString("hot") : CString("cold"); });
+		}
+
+		// In mode 3, lookups alternate between two caches with their own stats.
+		Cache<unsigned int, uint64_t>* caches[] = { &cache, mode == 3 ? &otherCache : &cache };
+
+		uint64_t sum = 0;
+		BenchTimer timer;
+
+		for (size_t i = 0 ; i < numLookups ; i++) {
+			uint64_t* val = caches[i & 1]->item(keys[i & ((1 << 16) - 1)]);
+			sum += val ? *val : 0;
+		}
+
+		double ns = timer.elapsedNanoseconds() / (double) numLookups;
+		BenchKeep(sum);
+
+		const char* names[] = { "no stats", "stats", "stats + key classes", "stats, 2 caches alternating" };
+		printf("%-28s  %14.1f\n", names[mode], ns);
+	}
+}
@@ -0,0 +1,224 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "bench.h"
+#include <nxcommon/encoding.h>
+#include <nxcommon/strsimd.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef _HAVE_ICONV
+#include <iconv.h>
+#endif
+
+
+
+static const size_t EncodingBenchLengths[] = { 64, 4096, 65536 };
+
+
+
+static void AppendUTF8(std::string& str, uint32_t cp)
+{
+	char buf[8];
+	char utf16[4] = { (char) (cp & 0xFF), (char) (cp >> 8) };
+	int len = Transcode(utf16, 2, buf, sizeof(buf), UTF16, UTF8);
+	str.append(buf, len);
+}
+
+
+// Generates about len bytes of UTF-8 text. Each character is taken from nonAsciiChars with the given probability,
+// and is ASCII otherwise.
+static std::string GenerateEncodingBenchText(size_t len, int nonAsciiPercent, const std::vector<uint32_t>& nonAsciiChars)
+{
+	static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ     ,.";
+	std::minstd_rand rng(17);
+	std::string text;
+
+	while (text.size() < len) {
+		if ((int) (rng() % 100) < nonAsciiPercent) {
+			AppendUTF8(text, nonAsciiChars[rng() % nonAsciiChars.size()]);
+		} else {
+			text += alphabet[rng() % (sizeof(alphabet)-1)];
+		}
+	}
+
+	return text;
+}
+
+
+struct EncodingBenchText
+{
+	const char* name;
+	int nonAsciiPercent;
+	std::vector<uint32_t> nonAsciiChars;
+};
+
+
+static const EncodingBenchText EncodingBenchTexts[] = {
+		{ "ASCII", 0, { 0 } },
+		{ "Latin", 5, { 0xE4, 0xF6, 0xFC, 0xDF, 0xE9, 0xE8 } },
+		{ "CJK", 100, { 0x65E5, 0x672C, 0x8A9E, 0x4E2D, 0x6587, 0x5B57 } }
+};
+
+
+// Runs func on each of the bench texts and lengths, once through iconv (the way Transcode() worked before) and once
+// for each supported SIMD level, and prints the throughput in GB/s of UTF-8 input. func gets the text in UTF-8 and in
+// the source encoding of the conversion.
+template <typename IconvFunc, typename NativeFunc>
+static void RunEncodingBench(const char* what, Encoding srcEnc, IconvFunc iconvFunc, NativeFunc native)
+{
+	StrSimdLevel origLevel = GetStrSimdLevel();
+
+	printf("%s\n%6s  %8s  %10s", what, "text", "length", "iconv");
+	for (int level = StrSimdScalar ; level <= GetStrSimdMaxLevel() ; level++) {
+		printf("  %10s", StrSimdLevelName((StrSimdLevel) level));
+	}
+	printf("   [GB/s]\n");
+
+	for (const EncodingBenchText& benchText : EncodingBenchTexts) {
+		for (size_t len : EncodingBenchLengths) {
+			std::string utf8 = GenerateEncodingBenchText(len, benchText.nonAsciiPercent, benchText.nonAsciiChars);
+			std::string src(utf8.size()*2, '\0');
+			src.resize(Transcode(&utf8[0], (int) utf8.size(), &src[0], (int) src.size(), UTF8, srcEnc));
+			std::string dest(utf8.size()*2 + 16, '\0');
+
+			size_t numIterations = BenchIterations((size_t) 1 << 26) / (utf8.size() + 32) + 1;
+
+			printf("%6s  %8u", benchText.name, (unsigned int) utf8.size());
+
+			for (int level = -1 ; level <= GetStrSimdMaxLevel() ; level++) {
+				size_t sum = 0;
+				BenchTimer timer;
+
+				if (level < 0) {
+#ifdef _HAVE_ICONV
+					for (size_t i = 0 ; i < numIterations ; i++) {
+						sum += iconvFunc(src, dest);
+					}
+#else
+					printf("  %10s", "-");
+					continue;
+#endif
+				} else {
+					SetStrSimdLevel((StrSimdLevel) level);
+
+					for (size_t i = 0 ; i < numIterations ; i++) {
+						sum += native(src, dest);
+					}
+				}
+
+				double secs = timer.elapsedSeconds();
+				BenchKeep(sum);
+
+				printf("  %10.2f", (numIterations * utf8.size()) / secs / 1e9);
+			}
+
+			printf("\n");
+		}
+	}
+
+	SetStrSimdLevel(origLevel);
+}
+
+
+#ifdef _HAVE_ICONV
+
+static size_t IconvConvert(iconv_t ic, std::string& src, std::string& dest)
+{
+	char* in = &src[0];
+	char* out = &dest[0];
+	size_t inLeft = src.size();
+	size_t outLeft = dest.size();
+	iconv(ic, NULL, NULL, NULL, NULL);
+	iconv(ic, &in, &inLeft, &out, &outLeft);
+	return dest.size() - outLeft;
+}
+
+#endif
+
+
+BENCHMARK(Encoding, UTF8ToUTF16)
+{
+#ifdef _HAVE_ICONV
+	iconv_t ic = iconv_open("UTF-16LE", "UTF-8");
+#endif
+
+	RunEncodingBench("UTF-8 -> UTF-16", UTF8, [&](std::string& src, std::string& dest) {
+#ifdef _HAVE_ICONV
+		return IconvConvert(ic, src, dest);
+#else
+		return (size_t) 0;
+#endif
+	}, [](std::string& src, std::string& dest) {
+		return TranscodeNative(src.data(), src.size(), &dest[0], dest.size(), UTF8, UTF16).destBytes;
+	});
+
+#ifdef _HAVE_ICONV
+	iconv_close(ic);
+#endif
+}
+
+
+BENCHMARK(Encoding, UTF16ToUTF8)
+{
+#ifdef _HAVE_ICONV
+	iconv_t ic = iconv_open("UTF-8", "UTF-16LE");
+#endif
+
+	RunEncodingBench("UTF-16 -> UTF-8", UTF16, [&](std::string& src, std::string& dest) {
+#ifdef _HAVE_ICONV
+		return IconvConvert(ic, src, dest);
+#else
+		return (size_t) 0;
+#endif
+	}, [](std::string& src, std::string& dest) {
+		return TranscodeNative(src.data(), src.size(), &dest[0], dest.size(), UTF16, UTF8).destBytes;
+	});
+
+#ifdef _HAVE_ICONV
+	iconv_close(ic);
+#endif
+}
+
+
+BENCHMARK(Encoding, ValidateUTF8)
+{
+	// iconv has no validation-only mode, so it is measured converting to UTF-16
+#ifdef _HAVE_ICONV
+	iconv_t ic = iconv_open("UTF-16LE", "UTF-8");
+#endif
+
+	RunEncodingBench("ValidateUTF8()", UTF8, [&](std::string& src, std::string& dest) {
+#ifdef _HAVE_ICONV
+		return IconvConvert(ic, src, dest);
+#else
+		return (size_t) 0;
+#endif
+	}, [](std::string& src, std::string& /* dest */) {
+		return (size_t) ValidateUTF8(src.data(), src.size());
+	});
+
+#ifdef _HAVE_ICONV
+	iconv_close(ic);
+#endif
+}
@@ -0,0 +1,102 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "bench.h"
+#include <nxcommon/log.h>
+
+#ifdef _POSIX_VERSION
+#include <unistd.h>
+#endif
+
+
+
+#ifdef _POSIX_VERSION
+
+static const unsigned int LogBenchThreadCounts[] = { 1, 2, 4, 8 };
+
+
+// Logs from numThreads threads at once and returns the number of messages per second, including the time until all
+// of them are written.
+static double MeasureLogThroughput(unsigned int numThreads)
+{
+	size_t numPerThread = BenchIterations(200000) / numThreads;
+
+	double secs = BenchRunThreads(numThreads, [&](unsigned int threadIdx) {
+		for (size_t i = 0 ; i < numPerThread ; i++) {
+			LogInfo("Processed request %u of thread %u in %d ms: %s", (unsigned int) i, threadIdx, 42, "OK");
+		}
+
+		if (threadIdx == 0) {
+			FlushLog();
+		}
+	});
+
+	// FlushLog() in thread 0 may have happened before the other threads were done
+	BenchTimer timer;
+	FlushLog();
+
+	return (numPerThread * numThreads) / (secs + timer.elapsedSeconds());
+}
+
+
+BENCHMARK(Log, Throughput)
+{
+	int oldLevel = GetLogLevel();
+	SetLogLevel(LOG_LEVEL_INFO);
+
+	// Messages go to a temporary log file, and stderr is discarded
+	fflush(stderr);
+	int oldStderr = dup(STDERR_FILENO);
+	FILE* nullFile = fopen("/dev/null", "w");
+	dup2(fileno(nullFile), STDERR_FILENO);
+
+	OpenLogFile(tmpfile());
+
+	LogAsyncConfig config;
+	GetDefaultLogAsyncConfig(&config);
+	config.installCrashHandlers = false;
+
+	printf("%8s  %16s  %16s   [messages/s]\n", "threads", "sync", "async");
+
+	for (unsigned int numThreads : LogBenchThreadCounts) {
+		double syncRate = MeasureLogThroughput(numThreads);
+
+		double asyncRate = 0.0;
+		if (StartAsyncLogging(&config)) {
+			asyncRate = MeasureLogThroughput(numThreads);
+			StopAsyncLogging();
+		}
+
+		printf("%8u  %16.0f  %16.0f\n", numThreads, syncRate, asyncRate);
+	}
+
+	OpenLogFile(NULL);
+
+	fflush(stderr);
+	dup2(oldStderr, STDERR_FILENO);
+	close(oldStderr);
+	fclose(nullFile);
+
+	SetLogLevel(oldLevel);
+}
+
+#endif
@@ -0,0 +1,85 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "bench.h"
+#include <nxcommon/CLIParser.h>
+#include <nxcommon/CString.h>
+#include <cstdlib>
+
+
+
+int main(int argc, char** argv)
+{
+	CLIParser cli;
+
+	int helpOpt = cli.addOption('h', "help", "Print help", false);
+	int listOpt = cli.addOption('l', "list", "List all benchmarks and exit", false);
+	int filterOpt = cli.addOption('f', "filter", "Only run benchmarks whose name (GROUP.NAME) contains %a",
+			true, "PATTERN");
+	int quickOpt = cli.addOption('q', "quick", "Use smaller iteration counts (useful as a smoke test)", false);
+
+	argv++;
+	argc--;
+
+	int opt;
+	char* arg;
+
+	bool list = false;
+	CString filter;
+
+	while ((opt = cli.parse(argc, argv, arg))  >=  0) {
+		if (opt == helpOpt) {
+			cli.printOptions();
+			exit(0);
+		} else if (opt == listOpt) {
+			list = true;
+		} else if (opt == filterOpt) {
+			filter = CString(arg);
+		} else if (opt == quickOpt) {
+			benchQuick = true;
+		}
+	}
+
+	for (const Benchmark& bench : GetBenchmarks()) {
+		CString fullName = CString(bench.group) << "." << bench.name;
+
+		if (!filter.isNull()  &&  fullName.indexOf(filter) < 0) {
+			continue;
+		}
+
+		if (list) {
+			printf("%s\n", fullName.get());
+			continue;
+		}
+
+		printf("[ RUN      ] %s\n", fullName.get());
+		fflush(stdout);
+
+		BenchTimer timer;
+		bench.func();
+
+		printf("[     DONE ] %s (%.2f s)\n\n", fullName.get(), timer.elapsedSeconds());
+		fflush(stdout);
+	}
+
+	return 0;
+}
@@ -0,0 +1,283 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "bench.h"
+#include <nxcommon/ringbuf.h>
+#include <nxcommon/RingBuffer.h>
+#include <nxcommon/MPMCRingBuffer.h>
+#include <nxcommon/SPSCRingBuffer.h>
+#include <nxcommon/util.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <ctime>
+
+
+
+static const unsigned int RingBufferBenchThreadCounts[] = { 1, 2, 4, 8 };
+static const size_t RingBufferBenchCapacity = 1024;
+
+
+
+// Runs numThreads producers and numThreads consumers that pass elements through a queue in batches of batchSize,
+// and returns the number of elements passed per second.
+template <typename WriteFunc, typename ReadFunc>
+static double MeasureQueueThroughput(unsigned int numThreads, size_t batchSize, WriteFunc writeFunc, ReadFunc readFunc)
+{
+	size_t numPerProducer = BenchIterations(1000000) / numThreads;
+	size_t total = numPerProducer * numThreads;
+	std::atomic<size_t> numConsumed(0);
+
+	double secs = BenchRunThreads(numThreads*2, [&](unsigned int threadIdx) {
+		uint64_t buf[64];
+
+		if (threadIdx < numThreads) {
+			size_t numWritten = 0;
+
+			while (numWritten < numPerProducer) {
+				size_t len = std::min(batchSize, numPerProducer - numWritten);
+				for (size_t i = 0 ; i < len ; i++) {
+					buf[i] = numWritten + i;
+				}
+
+				size_t num = writeFunc(buf, len);
+				if (num == 0) {
+					std::this_thread::yield();
+				}
+				numWritten += num;
+			}
+		} else {
+			uint64_t sum = 0;
+
+			while (numConsumed.load(std::memory_order_relaxed) < total) {
+				size_t num = readFunc(buf, batchSize);
+				if (num == 0) {
+					std::this_thread::yield();
+					continue;
+				}
+				for (size_t i = 0 ; i < num ; i++) {
+					sum += buf[i];
+				}
+				numConsumed.fetch_add(num, std::memory_order_relaxed);
+			}
+
+			BenchKeep(sum);
+		}
+	});
+
+	return total / secs;
+}
+
+
+BENCHMARK(RingBuffer, MPMCContention)
+{
+	// The way many-producer queues were built before: An SPSC RingBuffer with one mutex per side
+	RingBuffer<uint64_t> lockedBuf(RingBufferBenchCapacity);
+	std::mutex writeMtx, readMtx;
+
+	MPMCRingBuffer<uint64_t> mpmcBuf(RingBufferBenchCapacity);
+
+	std::vector<char> cMem(ringbuf_mpmc_get_buffer_size(sizeof(uint64_t), RingBufferBenchCapacity));
+	ringbuf_mpmc_t cBuf;
+	ringbuf_mpmc_create(&cBuf, cMem.data(), sizeof(uint64_t), RingBufferBenchCapacity);
+
+	for (size_t batchSize : { (size_t) 1, (size_t) 16 }) {
+		printf("batch size %u\n%8s  %22s  %22s  %22s\n", (unsigned int) batchSize, "threads",
+				"RingBuffer+mutex [e/s]", "MPMCRingBuffer [e/s]", "ringbuf_mpmc_t [e/s]");
+
+		for (unsigned int numThreads : RingBufferBenchThreadCounts) {
+			double lockedRate = MeasureQueueThroughput(numThreads, batchSize, [&](uint64_t* data, size_t len) {
+				std::lock_guard<std::mutex> lock(writeMtx);
+				return lockedBuf.write(data, len);
+			}, [&](uint64_t* data, size_t len) {
+				std::lock_guard<std::mutex> lock(readMtx);
+				return lockedBuf.read(data, len);
+			});
+			double mpmcRate = MeasureQueueThroughput(numThreads, batchSize, [&](uint64_t* data, size_t len) {
+				return mpmcBuf.write(data, len);
+			}, [&](uint64_t* data, size_t len) {
+				return mpmcBuf.read(data, len);
+			});
+			double cRate = MeasureQueueThroughput(numThreads, batchSize, [&](uint64_t* data, size_t len) {
+				return ringbuf_mpmc_write(&cBuf, data, len);
+			}, [&](uint64_t* data, size_t len) {
+				return ringbuf_mpmc_read(&cBuf, data, len);
+			});
+
+			printf("%8u  %22.0f  %22.0f  %22.0f\n", numThreads, lockedRate, mpmcRate, cRate);
+		}
+	}
+}
+
+
+
+
+// Passes elements from one writer thread to one reader thread in batches of batchSize, and returns the number of
+// elements passed per second.
+template <typename WriteFunc, typename ReadFunc>
+static double MeasureSPSCThroughput(size_t batchSize, WriteFunc writeFunc, ReadFunc readFunc)
+{
+	size_t total = BenchIterations(20000000);
+
+	double secs = BenchRunThreads(2, [&](unsigned int threadIdx) {
+		uint64_t buf[64];
+		size_t done = 0;
+
+		if (threadIdx == 0) {
+			while (done < total) {
+				size_t len = std::min(batchSize, total - done);
+				for (size_t i = 0 ; i < len ; i++) {
+					buf[i] = done + i;
+				}
+				size_t num = writeFunc(buf, len);
+				if (num == 0) {
+					std::this_thread::yield();
+				}
+				done += num;
+			}
+		} else {
+			uint64_t sum = 0;
+			while (done < total) {
+				size_t num = readFunc(buf, batchSize);
+				if (num == 0) {
+					std::this_thread::yield();
+				}
+				for (size_t i = 0 ; i < num ; i++) {
+					sum += buf[i];
+				}
+				done += num;
+			}
+			BenchKeep(sum);
+		}
+	});
+
+	return total / secs;
+}
+
+
+BENCHMARK(RingBuffer, SPSCThroughput)
+{
+	RingBuffer<uint64_t> ringBuffer(RingBufferBenchCapacity);
+	SPSCRingBuffer<uint64_t> spscBuffer(RingBufferBenchCapacity);
+	SPSCRingBuffer<uint64_t, size_t, true> spscPow2Buffer(RingBufferBenchCapacity);
+
+	std::vector<uint64_t> cMem(RingBufferBenchCapacity);
+	ringbuf_t cBuf;
+	ringbuf_create(&cBuf, cMem.data(), sizeof(uint64_t), RingBufferBenchCapacity);
+
+	std::vector<uint64_t> cSpscMem(RingBufferBenchCapacity);
+	ringbuf_spsc_t cSpscBuf;
+	ringbuf_spsc_create(&cSpscBuf, cSpscMem.data(), sizeof(uint64_t), RingBufferBenchCapacity);
+
+	printf("%6s  %14s  %14s  %14s  %14s  %14s   [M elements/s]\n", "batch", "RingBuffer", "ringbuf_t",
+			"SPSCRingBuffer", "SPSC pow2", "ringbuf_spsc_t");
+
+	for (size_t batchSize : { (size_t) 1, (size_t) 4, (size_t) 32 }) {
+		double ringRate = MeasureSPSCThroughput(batchSize, [&](uint64_t* data, size_t len) {
+			return ringBuffer.write(data, len);
+		}, [&](uint64_t* data, size_t len) {
+			return ringBuffer.read(data, len);
+		});
+		double cRate = MeasureSPSCThroughput(batchSize, [&](uint64_t* data, size_t len) {
+			return ringbuf_write(&cBuf, data, len);
+		}, [&](uint64_t* data, size_t len) {
+			return ringbuf_read(&cBuf, data, len);
+		});
+		double spscRate = MeasureSPSCThroughput(batchSize, [&](uint64_t* data, size_t len) {
+			return spscBuffer.write(data, len);
+		}, [&](uint64_t* data, size_t len) {
+			return spscBuffer.read(data, len);
+		});
+		double spscPow2Rate = MeasureSPSCThroughput(batchSize, [&](uint64_t* data, size_t len) {
+			return spscPow2Buffer.write(data, len);
+		}, [&](uint64_t* data, size_t len) {
+			return spscPow2Buffer.read(data, len);
+		});
+		double cSpscRate = MeasureSPSCThroughput(batchSize, [&](uint64_t* data, size_t len) {
+			return ringbuf_spsc_write(&cSpscBuf, data, len);
+		}, [&](uint64_t* data, size_t len) {
+			return ringbuf_spsc_read(&cSpscBuf, data, len);
+		});
+
+		printf("%6u  %14.1f  %14.1f  %14.1f  %14.1f  %14.1f\n", (unsigned int) batchSize, ringRate / 1e6, cRate / 1e6,
+				spscRate / 1e6, spscPow2Rate / 1e6, cSpscRate / 1e6);
+	}
+}
+
+
+
+
+// Sends timestamps from one thread to another with a pause between them, so that the reader is idle whenever a new
+// element arrives. Prints the percentiles of the time from write() to the reader getting the element, and the CPU
+// time used by the process relative to the wall-clock time.
+template <typename WaitFunc>
+static void MeasureHandoffLatency(const char* name, size_t numSamples, WaitFunc waitFunc)
+{
+	RingBuffer<uint64_t> rbuf(RingBufferBenchCapacity);
+	vector<uint64_t> latencies(numSamples);
+	BenchTimer clock;
+
+	std::clock_t cpuStart = std::clock();
+
+	double secs = BenchRunThreads(2, [&](unsigned int threadIdx) {
+		if (threadIdx == 0) {
+			for (size_t i = 0 ; i < numSamples ; i++) {
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+				rbuf.write(clock.elapsedNanoseconds());
+			}
+		} else {
+			for (size_t i = 0 ; i < numSamples ; i++) {
+				waitFunc(rbuf);
+				latencies[i] = clock.elapsedNanoseconds() - rbuf.read();
+			}
+		}
+	});
+
+	double cpuSecs = (double) (std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+	std::sort(latencies.begin(), latencies.end());
+
+	printf("%-22s  %10.1f  %10.1f  %10.1f  %8.0f\n", name, latencies[numSamples/2] / 1000.0,
+			latencies[numSamples*99/100] / 1000.0, latencies[numSamples-1] / 1000.0, 100.0 * cpuSecs / secs);
+}
+
+
+BENCHMARK(RingBuffer, HandoffLatency)
+{
+	size_t numSamples = BenchIterations(4000);
+
+	printf("%-22s  %10s  %10s  %10s  %8s\n", "", "p50 [us]", "p99 [us]", "max [us]", "cpu [%]");
+
+	MeasureHandoffLatency("SleepMilliseconds(1)", numSamples, [](RingBuffer<uint64_t>& rbuf) {
+		while (rbuf.isEmpty()) {
+			SleepMilliseconds(1);
+		}
+	});
+	MeasureHandoffLatency("yield", numSamples, [](RingBuffer<uint64_t>& rbuf) {
+		while (rbuf.isEmpty()) {
+			std::this_thread::yield();
+		}
+	});
+	MeasureHandoffLatency("readWait()", numSamples, [](RingBuffer<uint64_t>& rbuf) {
+		rbuf.readWait();
+	});
+}
@@ -0,0 +1,474 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "bench.h"
+#include <nxcommon/CString.h>
+#include <nxcommon/strutil.h>
+#include <nxcommon/BufferArena.h>
+#include <nxcommon/CStringBuilder.h>
+#include <nxcommon/WildcardPattern.h>
+#include <string>
+#include <random>
+#include <vector>
+#include <unordered_map>
+
+
+
+static const size_t StringBenchLengths[] = { 8, 16, 32, 64, 256, 4096 };
+
+
+
+static vector<CString> GenerateRandomStrings(size_t num, size_t len, unsigned int seed)
+{
+	std::minstd_rand rng(seed);
+	vector<CString> strs;
+	strs.reserve(num);
+
+	for (size_t i = 0 ; i < num ; i++) {
+		CString s(len);
+		for (size_t j = 0 ; j < len ; j++) {
+			s.append((char) ('A' + rng() % 58));
+		}
+		strs.push_back(s);
+	}
+
+	return strs;
+}
+
+
+template <typename HashFunc>
+static double MeasureHashThroughput(const vector<CString>& strs, HashFunc hash)
+{
+	// Hash roughly the same number of bytes for all string lengths
+	size_t numIterations = BenchIterations((size_t) 1 << 26) / (strs.size() * (strs[0].length() + 16)) + 1;
+	size_t sum = 0;
+
+	BenchTimer timer;
+
+	for (size_t i = 0 ; i < numIterations ; i++) {
+		for (const CString& s : strs) {
+			sum += hash(s);
+		}
+	}
+
+	double secs = timer.elapsedSeconds();
+	BenchKeep(sum);
+
+	return (numIterations * strs.size()) / secs;
+}
+
+
+BENCHMARK(String, Hash)
+{
+	printf("%8s  %16s  %16s  %16s  %16s\n", "length", "std::string [h/s]", "Hash() [h/s]",
+			"LowerHash() [h/s]", "copy+lower [h/s]");
+
+	for (size_t len : StringBenchLengths) {
+		vector<CString> strs = GenerateRandomStrings(std::max((size_t) 1, 65536 / len), len, 1337);
+
+		double stdRate = MeasureHashThroughput(strs, [](const CString& s) {
+			return std::hash<std::string>()(std::string(s.get(), s.length()));
+		});
+		double hashRate = MeasureHashThroughput(strs, [](const CString& s) {
+			return (size_t) Hash(s.get(), s.length());
+		});
+		double lowerHashRate = MeasureHashThroughput(strs, [](const CString& s) {
+			return (size_t) LowerHash(s.get(), s.length());
+		});
+		double copyLowerRate = MeasureHashThroughput(strs, [](const CString& s) {
+			char* l = new char[s.length()];
+			strtolower(l, s.get(), s.length());
+			size_t h = (size_t) Hash(l, s.length());
+			delete[] l;
+			return h;
+		});
+
+		printf("%8u  %16.0f  %16.0f  %16.0f  %16.0f\n", (unsigned int) len, stdRate, hashRate, lowerHashRate, copyLowerRate);
+	}
+}
+
+
+BENCHMARK(String, HashMapLookup)
+{
+	size_t numKeys = 10000;
+
+	printf("%8s  %20s\n", "length", "lookups [op/s]");
+
+	for (size_t len : StringBenchLengths) {
+		vector<CString> keys = GenerateRandomStrings(numKeys, len, 42);
+
+		std::unordered_map<CString, size_t> map;
+		for (size_t i = 0 ; i < keys.size() ; i++) {
+			map[keys[i]] = i;
+		}
+
+		double rate = MeasureHashThroughput(keys, [&](const CString& s) {
+			return map.find(s)->second;
+		});
+
+		printf("%8u  %20.0f\n", (unsigned int) len, rate);
+	}
+}
+
+
+BENCHMARK(String, SplitLines)
+{
+	size_t numLines = BenchIterations(1000000);
+
+	std::minstd_rand rng(7);
+	CString text;
+	for (size_t i = 0 ; i < numLines ; i++) {
+		size_t len = 10 + rng() % 70;
+		for (size_t j = 0 ; j < len ; j++) {
+			text.append((char) ('a' + rng() % 26));
+		}
+		text.append('\n');
+	}
+
+	printf("%12s  %12s  %14s\n", "method", "time [ms]", "allocations");
+
+	{
+		BenchAllocStats before = BenchGetAllocStats();
+		BenchTimer timer;
+		vector<CString> lines = text.split('\n');
+		double ms = timer.elapsedSeconds() * 1000.0;
+		BenchAllocStats after = BenchGetAllocStats();
+		BenchKeep(lines.size());
+		printf("%12s  %12.1f  %14llu\n", "CString", ms, (unsigned long long) (after.numAllocs - before.numAllocs));
+	}
+
+	{
+		BenchAllocStats before = BenchGetAllocStats();
+		BenchTimer timer;
+		vector<CStringView> lines = CStringView(text).split('\n');
+		double ms = timer.elapsedSeconds() * 1000.0;
+		BenchAllocStats after = BenchGetAllocStats();
+		BenchKeep(lines.size());
+		printf("%12s  %12.1f  %14llu\n", "CStringView", ms, (unsigned long long) (after.numAllocs - before.numAllocs));
+	}
+}
+
+
+// Simulates a request handler that builds an SQL query and a log line from request parameters, producing lots of
+// short-lived medium-sized strings.
+static size_t BuildRequest(const vector<CString>& params, size_t reqIdx)
+{
+	CString query("SELECT id, name, value, created FROM entries WHERE ");
+
+	for (size_t i = 0 ; i < params.size() ; i++) {
+		if (i != 0) {
+			query.append(" AND ");
+		}
+		CString cond = CString::format("param%u = '%s'", (unsigned int) i, params[i].get());
+		query.append(cond);
+	}
+
+	query.append(" ORDER BY created DESC LIMIT 100");
+
+	CString logLine = CString::format("[request %u] executing query of length %u: %s", (unsigned int) reqIdx,
+			(unsigned int) query.length(), query.get());
+
+	vector<CStringView> parts = CStringView(query).split(' ');
+
+	return logLine.length() + parts.size();
+}
+
+
+BENCHMARK(String, ArenaRequestBuilding)
+{
+	size_t numRequests = BenchIterations(200000);
+	vector<CString> params = GenerateRandomStrings(8, 40, 99);
+
+	printf("%12s  %14s  %16s\n", "method", "requests/s", "allocs/request");
+
+	for (int useArena = 0 ; useArena < 2 ; useArena++) {
+		size_t sum = 0;
+
+		BenchAllocStats before = BenchGetAllocStats();
+		BenchTimer timer;
+
+		for (size_t i = 0 ; i < numRequests ; i++) {
+			if (useArena) {
+				BufferArena scope;
+				sum += BuildRequest(params, i);
+			} else {
+				sum += BuildRequest(params, i);
+			}
+		}
+
+		double secs = timer.elapsedSeconds();
+		BenchAllocStats after = BenchGetAllocStats();
+		BenchKeep(sum);
+
+		printf("%12s  %14.0f  %16.2f\n", useArena ? "BufferArena" : "heap", numRequests / secs,
+				(double) (after.numAllocs - before.numAllocs) / numRequests);
+	}
+}
+
+
+BENCHMARK(String, BuilderLargeOutput)
+{
+	size_t numRows = BenchIterations(400000);
+	vector<CString> names = GenerateRandomStrings(64, 24, 5);
+
+	printf("%16s  %12s  %12s  %14s\n", "method", "size [MiB]", "time [ms]", "allocations");
+
+	for (int method = 0 ; method < 3 ; method++) {
+		BenchAllocStats before = BenchGetAllocStats();
+		BenchTimer timer;
+		size_t size;
+
+		if (method == 0) {
+			CString out;
+			for (size_t i = 0 ; i < numRows ; i++) {
+				out << "INSERT INTO entries (id, name) VALUES (" << (unsigned int) i << ", '" << names[i % names.size()]
+						<< "');\n";
+			}
+			size = out.length();
+			BenchKeep(out.get()[size/2]);
+		} else {
+			CStringBuilder out;
+			for (size_t i = 0 ; i < numRows ; i++) {
+				out << "INSERT INTO entries (id, name) VALUES (" << (unsigned int) i << ", '" << names[i % names.size()]
+						<< "');\n";
+			}
+			size = out.length();
+
+			if (method == 2) {
+				CString flat = out.toCString();
+				BenchKeep(flat.get()[size/2]);
+			} else {
+				BenchKeep(out.getChunkCount());
+			}
+		}
+
+		double ms = timer.elapsedSeconds() * 1000.0;
+		BenchAllocStats after = BenchGetAllocStats();
+
+		const char* names[] = { "CString", "CStringBuilder", "+toCString()" };
+		printf("%16s  %12.1f  %12.1f  %14llu\n", names[method], size / (1024.0*1024.0), ms,
+				(unsigned long long) (after.numAllocs - before.numAllocs));
+	}
+}
+
+
+BENCHMARK(String, WildcardMatch)
+{
+	static const char* extensions[] = { "txt", "png", "dff", "txd", "ipl", "ide", "col", "ifp" };
+
+	size_t numNames = 200000;
+	std::minstd_rand rng(31337);
+	vector<CString> names;
+
+	for (size_t i = 0 ; i < numNames ; i++) {
+		names.push_back(CString::format("%s_%05u_%s.%s", (rng() % 2) ? "model" : "texture", (unsigned int) (rng() % 100000),
+				GenerateRandomStrings(1, 4 + rng() % 12, rng())[0].get(), extensions[rng() % 8]));
+	}
+
+	static const char* patterns[] = { "*.txd", "model_1*5_*.d?f", "*a*b*c*.ipl", "texture_0000?_*" };
+
+	size_t numIterations = BenchIterations(10);
+
+	printf("%20s  %20s  %20s\n", "pattern", "WildcardMatch [n/s]", "WildcardPattern [n/s]");
+
+	for (const char* pattern : patterns) {
+		size_t sum = 0;
+
+		BenchTimer timer;
+		for (size_t i = 0 ; i < numIterations ; i++) {
+			for (const CString& name : names) {
+				sum += WildcardMatch(pattern, name.get()) ? 1 : 0;
+			}
+		}
+		double matchSecs = timer.elapsedSeconds();
+
+		timer.reset();
+		WildcardPattern compiled(pattern);
+		bool* results = new bool[names.size()];
+		for (size_t i = 0 ; i < numIterations ; i++) {
+			sum += compiled.matchAll(names.data(), names.size(), results);
+		}
+		double patternSecs = timer.elapsedSeconds();
+		delete[] results;
+
+		BenchKeep(sum);
+
+		printf("%20s  %20.0f  %20.0f\n", pattern, numIterations * numNames / matchSecs,
+				numIterations * numNames / patternSecs);
+	}
+}
+
+
+BENCHMARK(String, NumberParsing)
+{
+	size_t numValues = 1000000;
+	std::mt19937_64 rng(4711);
+
+	// Typical column values of a text protocol result set
+	vector<CString> ints, doubles;
+	for (size_t i = 0 ; i < numValues ; i++) {
+		ints.push_back(CString::format("%u", (unsigned int) (rng() >> (rng() % 64)) ));
+		doubles.push_back(CString::format("%.*f", (int) (rng() % 7), (double) (rng() % 100000000) / 997.0));
+	}
+
+	size_t numIterations = BenchIterations(5);
+
+	printf("%10s  %20s  %20s\n", "type", "libc [M/s]", "nxcommon [M/s]");
+
+	for (int type = 0 ; type < 2 ; type++) {
+		const vector<CString>& values = type == 0 ? ints : doubles;
+		double sum = 0.0;
+
+		BenchTimer timer;
+		for (size_t i = 0 ; i < numIterations ; i++) {
+			for (const CString& val : values) {
+				char* end;
+				sum += type == 0 ? (double) strtoul(val.get(), &end, 10) : strtod(val.get(), &end);
+				sum += *end == '\0' ? 0.0 : 1.0;
+			}
+		}
+		double libcSecs = timer.elapsedSeconds();
+
+		timer.reset();
+		for (size_t i = 0 ; i < numIterations ; i++) {
+			for (const CString& val : values) {
+				bool ok;
+				sum += type == 0 ? (double) StringToUInt32(val.get(), val.length(), 10, &ok)
+						: StringToDouble(val.get(), val.length(), &ok);
+				sum += ok ? 0.0 : 1.0;
+			}
+		}
+		double nxSecs = timer.elapsedSeconds();
+
+		BenchKeep((size_t) sum);
+
+		printf("%10s  %20.1f  %20.1f\n", type == 0 ? "uint32" : "double",
+				numIterations * numValues / libcSecs / 1e6, numIterations * numValues / nxSecs / 1e6);
+	}
+}
+
+
+BENCHMARK(String, NumberFormatting)
+{
+	size_t numValues = 1000000;
+	std::mt19937_64 rng(4711);
+
+	vector<uint64_t> ints;
+	vector<double> doubles;
+	for (size_t i = 0 ; i < numValues ; i++) {
+		ints.push_back(rng() >> (rng() % 64));
+		doubles.push_back((double) (rng() % 100000000) / 997.0);
+	}
+
+	size_t numIterations = BenchIterations(5);
+
+	printf("%10s  %20s  %20s\n", "type", "snprintf [M/s]", "nxcommon [M/s]");
+
+	for (int type = 0 ; type < 2 ; type++) {
+		size_t sum = 0;
+		char buf[64];
+
+		BenchTimer timer;
+		for (size_t i = 0 ; i < numIterations ; i++) {
+			for (size_t j = 0 ; j < numValues ; j++) {
+				if (type == 0) {
+					sum += snprintf(buf, sizeof(buf), "%llu", (unsigned long long) ints[j]);
+				} else {
+					sum += snprintf(buf, sizeof(buf), "%.17g", doubles[j]);
+				}
+			}
+		}
+		double libcSecs = timer.elapsedSeconds();
+
+		timer.reset();
+		for (size_t i = 0 ; i < numIterations ; i++) {
+			for (size_t j = 0 ; j < numValues ; j++) {
+				if (type == 0) {
+					sum += ULongLongToString(buf, ints[j]);
+				} else {
+					sum += DoubleToString(buf, doubles[j]);
+				}
+			}
+		}
+		double nxSecs = timer.elapsedSeconds();
+
+		BenchKeep(sum);
+
+		printf("%10s  %20.1f  %20.1f\n", type == 0 ? "uint64" : "double",
+				numIterations * numValues / libcSecs / 1e6, numIterations * numValues / nxSecs / 1e6);
+	}
+}
+
+
+BENCHMARK(String, InternedKeys)
+{
+	// Column name maps of many result sets with the same long column names, as built by the SQL drivers
+	size_t numColumns = 24;
+	size_t numResults = BenchIterations(20000);
+
+	vector<CString> columnNames;
+	for (size_t i = 0 ; i < numColumns ; i++) {
+		columnNames.push_back(CString::format("customer_account_billing_address_field_%02u", (unsigned int) i));
+	}
+
+	printf("%10s  %14s  %14s  %16s\n", "keys", "build [ms]", "retained [MB]", "lookups [op/s]");
+
+	for (int interned = 0 ; interned < 2 ; interned++) {
+		vector<std::unordered_map<CString, int>> maps(numResults);
+
+		BenchAllocStats before = BenchGetAllocStats();
+		BenchTimer timer;
+
+		for (size_t r = 0 ; r < numResults ; r++) {
+			for (size_t i = 0 ; i < numColumns ; i++) {
+				// The driver gets a fresh C string from the client library for each result
+				CString name(columnNames[i].get(), columnNames[i].length());
+				maps[r][interned ? name.intern() : name] = (int) i;
+			}
+		}
+
+		double buildMs = timer.elapsedSeconds() * 1000.0;
+		BenchAllocStats after = BenchGetAllocStats();
+
+		// Look up with keys that are interned (or not) themselves, e.g. from a prepared list of column names
+		vector<CString> queries;
+		for (const CString& name : columnNames) {
+			queries.push_back(interned ? name.intern() : CString(name.get(), name.length()));
+		}
+
+		size_t numLookups = 0;
+		size_t sum = 0;
+		timer.reset();
+		for (size_t r = 0 ; r < numResults ; r++) {
+			for (const CString& query : queries) {
+				sum += maps[r].find(query)->second;
+				numLookups++;
+			}
+		}
+		double lookupSecs = timer.elapsedSeconds();
+
+		BenchKeep(sum);
+
+		printf("%10s  %14.1f  %14.1f  %16.0f\n", interned ? "interned" : "plain", buildMs,
+				(after.liveBytes - before.liveBytes) / (1024.0*1024.0), numLookups / lookupSecs);
+	}
+}
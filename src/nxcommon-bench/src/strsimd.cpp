@@ -0,0 +1,179 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "bench.h"
+#include <nxcommon/strsimd.h>
+#include <nxcommon/strutil.h>
+#include <random>
+#include <string>
+
+
+
+static const size_t StrSimdBenchLengths[] = { 16, 64, 256, 4096, 65536 };
+
+
+
+// Generates text that resembles ordinary prose, with a few rare characters mixed in.
+static std::string GenerateBenchText(size_t len, unsigned int seed)
+{
+	static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ     ,.";
+	std::minstd_rand rng(seed);
+	std::string text;
+
+	for (size_t i = 0 ; i < len ; i++) {
+		text += alphabet[rng() % (sizeof(alphabet)-1)];
+	}
+
+	return text;
+}
+
+
+// Runs func on strings of each of the benchmark lengths, once for a plain byte-by-byte loop (the way these functions were
+// written before) and once for each supported SIMD level, and prints the throughput in GB/s. If fill is not zero, the
+// strings consist only of that character.
+template <typename ByteLoopFunc, typename SimdFunc>
+static void RunStrSimdBench(const char* what, ByteLoopFunc byteLoop, SimdFunc simd, char fill = '\0')
+{
+	StrSimdLevel origLevel = GetStrSimdLevel();
+
+	printf("%s\n%8s  %10s", what, "length", "byte loop");
+	for (int level = StrSimdScalar ; level <= GetStrSimdMaxLevel() ; level++) {
+		printf("  %10s", StrSimdLevelName((StrSimdLevel) level));
+	}
+	printf("   [GB/s]\n");
+
+	for (size_t len : StrSimdBenchLengths) {
+		std::string text = fill ? std::string(len, fill) : GenerateBenchText(len, 17);
+		size_t numIterations = BenchIterations((size_t) 1 << 27) / (len + 32) + 1;
+
+		printf("%8u", (unsigned int) len);
+
+		for (int level = -1 ; level <= GetStrSimdMaxLevel() ; level++) {
+			size_t sum = 0;
+			BenchTimer timer;
+
+			if (level < 0) {
+				for (size_t i = 0 ; i < numIterations ; i++) {
+					sum += byteLoop(text);
+				}
+			} else {
+				SetStrSimdLevel((StrSimdLevel) level);
+
+				for (size_t i = 0 ; i < numIterations ; i++) {
+					sum += simd(text);
+				}
+			}
+
+			double secs = timer.elapsedSeconds();
+			BenchKeep(sum);
+
+			printf("  %10.2f", (numIterations * len) / secs / 1e9);
+		}
+
+		printf("\n");
+	}
+
+	SetStrSimdLevel(origLevel);
+}
+
+
+BENCHMARK(StrSimd, FindChar)
+{
+	// The searched character doesn't occur, so the whole string is scanned
+	RunStrSimdBench("FindChar()", [](std::string& s) {
+		const char* p = s.c_str();
+		const char* end = p + s.length();
+		while (p != end  &&  *p != '#') p++;
+		return (size_t) (p - s.c_str());
+	}, [](std::string& s) {
+		return (size_t) (FindChar(s.c_str(), s.c_str() + s.length(), '#') - s.c_str());
+	});
+}
+
+
+BENCHMARK(StrSimd, FindSubstring)
+{
+	// Prefixes of the needle occur frequently, but the needle itself doesn't
+	const char* needle = "the quick";
+	size_t needleLen = strlen(needle);
+
+	RunStrSimdBench("FindSubstring()", [&](std::string& s) {
+		const char* p = s.c_str();
+		const char* end = p + s.length();
+		for (; (size_t) (end-p) >= needleLen ; p++) {
+			if (*p == needle[0]  &&  memcmp(p, needle, needleLen) == 0) {
+				return (size_t) (p - s.c_str());
+			}
+		}
+		return s.length();
+	}, [&](std::string& s) {
+		return (size_t) (FindSubstring(s.c_str(), s.c_str() + s.length(), needle, needleLen) - s.c_str());
+	});
+}
+
+
+BENCHMARK(StrSimd, ToLower)
+{
+	RunStrSimdBench("strtolower()", [](std::string& s) {
+		char* p = &s[0];
+		for (size_t i = 0 ; i < s.length()  &&  p[i] != '\0' ; i++) {
+			p[i] = tolower(p[i]);
+		}
+		return (size_t) p[0];
+	}, [](std::string& s) {
+		strtolower(&s[0], s.c_str(), s.length());
+		return (size_t) s[0];
+	});
+}
+
+
+BENCHMARK(StrSimd, EscapeString)
+{
+	const char* toEscape = "\"\\'";
+	std::string dest(65536*2 + 1, '\0');
+
+	RunStrSimdBench("EscapeString() (no characters to escape)", [&](std::string& s) {
+		char* d = &dest[0];
+		for (char c : s) {
+			if (strchr(toEscape, c) != NULL) {
+				*d++ = '\\';
+			}
+			*d++ = c;
+		}
+		return (size_t) (d - dest.c_str());
+	}, [&](std::string& s) {
+		return EscapeString(&dest[0], s.c_str(), s.length(), dest.length(), toEscape);
+	});
+}
+
+
+BENCHMARK(StrSimd, RTrim)
+{
+	// Trims a long run of trailing whitespace
+	RunStrSimdBench("rtrimfind() (whitespace-only string)", [](std::string& s) {
+		const char* p = s.c_str() + s.length() - 1;
+		while (p != s.c_str()-1  &&  strchr(" \t\r\n", *p) != NULL) p--;
+		return (size_t) (p+1 - s.c_str());
+	}, [](std::string& s) {
+		return (size_t) (rtrimfind(s.c_str(), " \t\r\n") - s.c_str());
+	}, ' ');
+}
@@ -24,6 +24,7 @@
 #include <nxcommon/ByteArray.h>
 #include <nxcommon/CString.h>
 #include <cstdlib>
+#include <vector>
 
 #ifdef NXCOMMON_UNICODE_ENABLED
 #include <nxcommon/UString.h>
@@ -146,11 +147,20 @@ TEST(ByteArrayTest, MainByteArrayTest)
 		EXPECT_TRUE(cstr1.isNull());
 		EXPECT_TRUE(barr1.isNull());
 
-		CString cstr2("Hello World");
+		CString cstr2("Hello World, this is not stored inline");
 		ByteArray barr2(cstr2);
 		EXPECT_FALSE(cstr2.isNull());
 		EXPECT_FALSE(barr2.isNull());
 		EXPECT_EQ(cstr2.get(), (const char*) barr2.get()); // Should be using read-aliasing instead of copy
+
+		// Inline strings are copied
+		CString cstr3("Hello World");
+		ByteArray barr3(cstr3);
+		EXPECT_TRUE(cstr3.isInline());
+		EXPECT_TRUE(barr3.isInline());
+		EXPECT_EQ(cstr3.length(), barr3.length());
+		EXPECT_EQ(0, memcmp(cstr3.get(), barr3.get(), cstr3.length()));
+		EXPECT_EQ(cstr3, CString(barr3));
 	}
 
 	{
@@ -159,7 +169,7 @@ TEST(ByteArrayTest, MainByteArrayTest)
 		{
 			CString cstr2;
 			{
-				CString cstr1("Hello World");
+				CString cstr1("Hello World, this is not stored inline");
 				cstr1Ptr = cstr1.get();
 				cstr2 = cstr1;
 				barr1 = cstr1;
@@ -169,11 +179,54 @@ TEST(ByteArrayTest, MainByteArrayTest)
 
 			// Should still be valid because cstr2 keeps a shared reference
 			EXPECT_EQ(cstr1Ptr, cstr2.get());
-			EXPECT_EQ(CString("Hello World"), cstr2);
+			EXPECT_EQ(CString("Hello World, this is not stored inline"), cstr2);
 		}
 
 		// Should still be valid because barr1 keeps a shared reference (conversion uses read-aliasing)
 		EXPECT_EQ(cstr1Ptr, (const char*) barr1.get());
-		EXPECT_TRUE(strcmp("Hello World", (const char*) barr1.get()) == 0); // Should still have cstr1's null terminator
+		EXPECT_TRUE(strcmp("Hello World, this is not stored inline", (const char*) barr1.get()) == 0); // Should still have cstr1's null terminator
+	}
+}
+
+
+
+TEST(ByteArrayTest, ViewTest)
+{
+	uint8_t data[64];
+	for (size_t i = 0 ; i < sizeof(data) ; i++) {
+		data[i] = (i % 16 == 15) ? 0xFF : (uint8_t) i;
+	}
+
+	ByteArray barr(data, sizeof(data));
+	ByteArrayView view(barr);
+
+	std::vector<ByteArrayView> records = view.split(0xFF);
+	ASSERT_EQ(5, records.size());
+
+	for (size_t i = 0 ; i < 4 ; i++) {
+		EXPECT_EQ(15, records[i].length());
+		EXPECT_EQ(barr.get() + i*16, records[i].get());
+		EXPECT_EQ((uint8_t) (i*16), records[i][0]);
 	}
+	EXPECT_TRUE(records[4].isEmpty());
+
+	// ByteArrays aren't terminated, so any part of a heap buffer can be converted without copying
+	ByteArray middle = view.substr(8, 40);
+	EXPECT_EQ(barr.get() + 8, middle.get());
+	EXPECT_EQ(40, middle.length());
+	EXPECT_EQ(0, memcmp(data + 8, middle.get(), 40));
+
+	middle.append((uint8_t) 0x42);
+	EXPECT_NE(barr.get() + 8, middle.get());
+	EXPECT_EQ(41, middle.length());
+	EXPECT_EQ(0, memcmp(data, barr.get(), sizeof(data)));
+
+	// Short parts are copied into inline storage
+	ByteArray shortPart = view.substr(1, 4);
+	EXPECT_TRUE(shortPart.isInline());
+	EXPECT_EQ(0, memcmp(data + 1, shortPart.get(), 4));
+
+	EXPECT_EQ(ByteArrayView(barr, 16, 15), records[1]);
+	EXPECT_TRUE(view.startsWith(records[0]));
+	EXPECT_EQ(16, view.indexOf(records[1]));
 }
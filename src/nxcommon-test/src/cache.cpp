@@ -0,0 +1,1135 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "global.h"
+#include <nxcommon/Cache.h>
+#include <nxcommon/ConcurrentCache.h>
+#include <nxcommon/FlatCache.h>
+#include <nxcommon/ResourceCache.h>
+#include <nxcommon/DiskCache.h>
+#include <nxcommon/file/File.h>
+#include <nxcommon/ThreadPool.h>
+#include <nxcommon/CacheStats.h>
+#include <nxcommon/CacheTimingWheel.h>
+#include <rapidjson/document.h>
+#include <atomic>
+#include <stdexcept>
+#include <random>
+#include <thread>
+#include <vector>
+
+using std::vector;
+
+
+
+
+TEST(CacheTest, BasicCacheTest)
+{
+	Cache<int, int> cache(10);
+
+	EXPECT_TRUE(cache.insert(1, new int(1), 4));
+	EXPECT_TRUE(cache.insert(2, new int(2), 4));
+	EXPECT_EQ(8, cache.getOccupiedSize());
+
+	// Touch 1 so that 2 becomes the least recently used entry
+	ASSERT_NE((int*) NULL, cache.item(1));
+
+	EXPECT_TRUE(cache.insert(3, new int(3), 4));
+	EXPECT_EQ(8, cache.getOccupiedSize());
+	EXPECT_TRUE(cache.contains(1));
+	EXPECT_FALSE(cache.contains(2));
+	EXPECT_TRUE(cache.contains(3));
+
+	EXPECT_FALSE(cache.insert(4, new int(4), 11));
+	EXPECT_FALSE(cache.remove(1337));
+
+	EXPECT_TRUE(cache.remove(1));
+	EXPECT_EQ(4, cache.getOccupiedSize());
+
+	// Inserting an existing key replaces the entry, unless it is locked
+	EXPECT_TRUE(cache.insert(3, new int(33), 2));
+	EXPECT_EQ(2, cache.getOccupiedSize());
+	EXPECT_EQ(33, *cache.item(3));
+
+	EXPECT_TRUE(cache.insert(5, new int(5), 4, true));
+	EXPECT_FALSE(cache.insert(5, new int(55), 1));
+	EXPECT_EQ(6, cache.getOccupiedSize());
+	EXPECT_EQ(5, *cache.unlock(5));
+}
+
+
+TEST(CacheTest, LockedCacheTest)
+{
+	Cache<int, int> cache(10);
+
+	EXPECT_TRUE(cache.insert(1, new int(1), 8, true));
+	EXPECT_FALSE(cache.insert(2, new int(2), 8));
+	EXPECT_TRUE(cache.insert(3, new int(3), 8, true));
+	EXPECT_TRUE(cache.isOverfilled());
+	EXPECT_FALSE(cache.remove(1));
+
+	EXPECT_EQ((int*) NULL, cache.unlock(1));
+	EXPECT_FALSE(cache.contains(1));
+	EXPECT_FALSE(cache.isOverfilled());
+
+	ASSERT_NE((int*) NULL, cache.unlock(3));
+	EXPECT_TRUE(cache.contains(3));
+}
+
+
+template <bool InlineValues>
+static void TestFlatCache()
+{
+	FlatCache<int, int, CXX11Hash<int>, equal_to<int>, InlineValues> cache(10);
+
+	EXPECT_TRUE(cache.insert(1, new int(1), 4));
+	EXPECT_TRUE(cache.emplace(2, 2, 4));
+	EXPECT_EQ(8, cache.getOccupiedSize());
+
+	ASSERT_NE((int*) NULL, cache.item(1));
+	EXPECT_EQ(1, *cache.item(1));
+
+	EXPECT_TRUE(cache.insert(3, new int(3), 4));
+	EXPECT_EQ(8, cache.getOccupiedSize());
+	EXPECT_TRUE(cache.contains(1));
+	EXPECT_FALSE(cache.contains(2));
+	EXPECT_TRUE(cache.contains(3));
+
+	EXPECT_FALSE(cache.insert(4, new int(4), 11));
+	EXPECT_FALSE(cache.remove(1337));
+
+	// Replacing an existing key
+	EXPECT_TRUE(cache.emplace(3, 33, 2));
+	EXPECT_EQ(33, *cache.item(3));
+	EXPECT_EQ(6, cache.getOccupiedSize());
+
+	EXPECT_TRUE(cache.remove(1));
+	EXPECT_TRUE(cache.remove(3));
+	EXPECT_EQ(0, cache.getOccupiedSize());
+
+	EXPECT_TRUE(cache.insert(1, new int(1), 8, true));
+	EXPECT_FALSE(cache.insert(2, new int(2), 8));
+	EXPECT_TRUE(cache.insert(3, new int(3), 8, true));
+	EXPECT_TRUE(cache.isOverfilled());
+	EXPECT_FALSE(cache.remove(1));
+	EXPECT_FALSE(cache.emplace(1, 11, 1));
+
+	EXPECT_EQ((int*) NULL, cache.unlock(1));
+	EXPECT_FALSE(cache.contains(1));
+	EXPECT_FALSE(cache.isOverfilled());
+
+	ASSERT_NE((int*) NULL, cache.unlock(3));
+	EXPECT_TRUE(cache.contains(3));
+	EXPECT_EQ(1, cache.getEntryCount());
+}
+
+
+template <bool InlineValues>
+static void TestFlatCacheAgainstCache()
+{
+	// Both are strict LRU, so they must always contain the same entries.
+	Cache<int, int> ref(500);
+	FlatCache<int, int, CXX11Hash<int>, equal_to<int>, InlineValues> cache(500);
+
+	std::minstd_rand rng(42);
+
+	for (int i = 0 ; i < 100000 ; i++) {
+		int key = rng() % 2000;
+		unsigned int op = rng() % 10;
+
+		if (op < 5) {
+			int* refVal = ref.item(key);
+			int* val = cache.item(key);
+			ASSERT_EQ(refVal == NULL, val == NULL);
+			if (val) {
+				ASSERT_EQ(*refVal, *val);
+			}
+		} else if (op < 9) {
+			if (!ref.contains(key)) {
+				cachesize_t size = rng() % 8 + 1;
+				ASSERT_EQ(ref.insert(key, new int(i), size), cache.insert(key, new int(i), size));
+			}
+		} else {
+			ASSERT_EQ(ref.remove(key), cache.remove(key));
+		}
+
+		ASSERT_EQ(ref.getOccupiedSize(), cache.getOccupiedSize());
+	}
+
+	for (int key = 0 ; key < 2000 ; key++) {
+		ASSERT_EQ(ref.contains(key), cache.contains(key));
+	}
+}
+
+
+TEST(CacheTest, FlatCacheTest)
+{
+	TestFlatCache<false>();
+	TestFlatCache<true>();
+	TestFlatCacheAgainstCache<false>();
+	TestFlatCacheAgainstCache<true>();
+}
+
+
+TEST(CacheTest, ConcurrentCacheTest)
+{
+	ConcurrentCache<int, int> cache(10, 4);
+
+	EXPECT_EQ(4, cache.getShardCount());
+
+	EXPECT_TRUE(cache.insert(1, new int(1), 4));
+	EXPECT_TRUE(cache.insert(2, new int(2), 4));
+	EXPECT_EQ(8, cache.getOccupiedSize());
+
+	// Inserting an existing key replaces the entry, and the old entry's size counts as free space
+	EXPECT_TRUE(cache.insert(2, new int(22), 6));
+	EXPECT_EQ(10, cache.getOccupiedSize());
+	EXPECT_TRUE(cache.contains(1));
+
+	int val = 0;
+	EXPECT_TRUE(cache.visit(2, [&](int& v) { val = v; }));
+	EXPECT_EQ(22, val);
+	EXPECT_FALSE(cache.visit(1337, [&](int& v) { val = v; }));
+
+	// The global budget is respected, even though the entries may live in different shards
+	EXPECT_TRUE(cache.insert(3, new int(3), 4));
+	EXPECT_LE(cache.getOccupiedSize(), 10);
+	EXPECT_TRUE(cache.contains(3));
+
+	EXPECT_FALSE(cache.insert(4, new int(4), 11));
+
+	EXPECT_TRUE(cache.insert(5, new int(5), 8, true));
+	EXPECT_TRUE(cache.insert(6, new int(6), 8, true));
+	EXPECT_TRUE(cache.isOverfilled());
+	EXPECT_FALSE(cache.remove(5));
+
+	EXPECT_EQ((int*) NULL, cache.unlock(5));
+	EXPECT_FALSE(cache.contains(5));
+	EXPECT_FALSE(cache.isOverfilled());
+
+	ASSERT_NE((int*) NULL, cache.unlock(6));
+	EXPECT_TRUE(cache.clear());
+	EXPECT_EQ(0, cache.getOccupiedSize());
+
+	// A locked entry can't be replaced, and the rejected insert must not evict anything
+	EXPECT_TRUE(cache.insert(7, new int(7), 4, true));
+	EXPECT_TRUE(cache.insert(8, new int(8), 6));
+	EXPECT_FALSE(cache.insert(7, new int(77), 4));
+	EXPECT_EQ(10, cache.getOccupiedSize());
+	EXPECT_TRUE(cache.contains(8));
+
+	ASSERT_NE((int*) NULL, cache.unlock(7));
+	EXPECT_TRUE(cache.clear());
+}
+
+
+TEST(CacheTest, ConcurrentCacheThreadTest)
+{
+	ConcurrentCache<int, int> cache(500);
+
+	vector<std::thread> threads;
+
+	for (int t = 0 ; t < 8 ; t++) {
+		threads.emplace_back([&cache, t]() {
+			for (int i = 0 ; i < 20000 ; i++) {
+				int key = (i*7 + t) % 1000;
+
+				if (i % 3 == 0) {
+					cache.insert(key, new int(key), 1);
+				} else if (i % 17 == 0) {
+					cache.remove(key);
+				} else {
+					cache.visit(key, [key](int& v) { EXPECT_EQ(key, v); });
+				}
+			}
+		});
+	}
+
+	for (std::thread& t : threads) {
+		t.join();
+	}
+
+	EXPECT_LE(cache.getOccupiedSize(), 500);
+	EXPECT_TRUE(cache.clear());
+	EXPECT_EQ(0, cache.getOccupiedSize());
+}
+
+
+template <template<class, class, class> class EvictionPolicy>
+static void TestScanResistance()
+{
+	Cache<int, int, less<int>, CXX11Hash<int>, equal_to<int>, EvictionPolicy> cache(100);
+
+	// Establish a hot working set that is accessed often, interleaved with keys that are used only once
+	int coldKey = 100000;
+	for (int round = 0 ; round < 10 ; round++) {
+		for (int i = 0 ; i < 50 ; i++) {
+			if (!cache.item(i)) {
+				cache.insert(i, new int(i), 1);
+			}
+			if (i % 2 == 0) {
+				if (!cache.item(coldKey)) {
+					cache.insert(coldKey, new int(coldKey), 1);
+				}
+				coldKey++;
+			}
+		}
+	}
+
+	// A long sequential scan over keys that are never used again
+	for (int i = 1000 ; i < 1500 ; i++) {
+		if (!cache.item(i)) {
+			cache.insert(i, new int(i), 1);
+		}
+	}
+
+	int hotLeft = 0;
+	for (int i = 0 ; i < 50 ; i++) {
+		if (cache.contains(i)) {
+			hotLeft++;
+		}
+	}
+
+	EXPECT_LE(cache.getOccupiedSize(), 100);
+	EXPECT_GE(hotLeft, 40);
+}
+
+
+TEST(CacheTest, EvictionPolicyTest)
+{
+	{
+		SCOPED_TRACE("2Q");
+		TestScanResistance<TwoQueueEvictionPolicy>();
+	}
+	{
+		SCOPED_TRACE("ARC");
+		TestScanResistance<ARCEvictionPolicy>();
+	}
+	{
+		SCOPED_TRACE("W-TinyLFU");
+		TestScanResistance<TinyLFUEvictionPolicy>();
+	}
+
+	// Plain LRU is not scan-resistant
+	Cache<int, int> lru(100);
+	for (int i = 0 ; i < 50 ; i++) {
+		lru.insert(i, new int(i), 1);
+	}
+	for (int i = 1000 ; i < 1500 ; i++) {
+		lru.insert(i, new int(i), 1);
+	}
+	for (int i = 0 ; i < 50 ; i++) {
+		EXPECT_FALSE(lru.contains(i));
+	}
+}
+
+
+template <template<class, class, class> class EvictionPolicy>
+static void TestLockedEviction()
+{
+	Cache<int, int, less<int>, CXX11Hash<int>, equal_to<int>, EvictionPolicy> cache(10);
+
+	for (int i = 0 ; i < 5 ; i++) {
+		EXPECT_TRUE(cache.insert(i, new int(i), 1, true));
+	}
+	for (int i = 100 ; i < 200 ; i++) {
+		cache.insert(i, new int(i), 1);
+		cache.item(i);
+	}
+	for (int i = 0 ; i < 5 ; i++) {
+		EXPECT_TRUE(cache.contains(i));
+		EXPECT_NE((int*) NULL, cache.unlock(i));
+	}
+
+	EXPECT_LE(cache.getOccupiedSize(), 10);
+	EXPECT_TRUE(cache.clear());
+	EXPECT_EQ(0, cache.getOccupiedSize());
+}
+
+
+TEST(CacheTest, EvictionPolicyLockTest)
+{
+	TestLockedEviction<LRUEvictionPolicy>();
+	TestLockedEviction<TwoQueueEvictionPolicy>();
+	TestLockedEviction<ARCEvictionPolicy>();
+	TestLockedEviction<TinyLFUEvictionPolicy>();
+}
+
+
+
+
+TEST(CacheTest, GDSFEvictionPolicyTest)
+{
+	Cache<int, int, less<int>, CXX11Hash<int>, equal_to<int>, GDSFEvictionPolicy> cache(100);
+
+	// Same popularity, but the large entry has a much lower value per byte.
+	EXPECT_TRUE(cache.insert(0, new int(0), 50));
+	for (int i = 1 ; i <= 5 ; i++) {
+		EXPECT_TRUE(cache.insert(i, new int(i), 5));
+	}
+	for (int i = 0 ; i <= 5 ; i++) {
+		cache.item(i);
+	}
+
+	EXPECT_TRUE(cache.insert(6, new int(6), 30));
+	EXPECT_FALSE(cache.contains(0));
+	for (int i = 1 ; i <= 6 ; i++) {
+		EXPECT_TRUE(cache.contains(i));
+	}
+
+	// Frequently used entries survive even when they are large.
+	for (int i = 0 ; i < 20 ; i++) {
+		cache.item(6);
+	}
+	for (int i = 100 ; i < 130 ; i++) {
+		cache.insert(i, new int(i), 5);
+	}
+	EXPECT_TRUE(cache.contains(6));
+	EXPECT_GT(cache.getEvictionPolicy().getInflation(), 0.0);
+
+	// With a value function, expensive entries are kept.
+	Cache<int, int, less<int>, CXX11Hash<int>, equal_to<int>, GDSFEvictionPolicy> valued(10);
+	valued.getEvictionPolicy().setValueFunction([](int key) { return key == 0 ? 100.0 : 1.0; });
+	valued.insert(0, new int(0), 5);
+	for (int i = 1 ; i < 20 ; i++) {
+		valued.insert(i, new int(i), 1);
+	}
+	EXPECT_TRUE(valued.contains(0));
+
+	TestLockedEviction<GDSFEvictionPolicy>();
+}
+
+
+TEST(CacheTest, CacheTimingWheelTest)
+{
+	struct TestTimer : public CacheTimerNode
+	{
+		uint64_t expiredAt;
+	};
+
+	CacheTimingWheel wheel;
+	std::mt19937 rng(1337);
+	vector<TestTimer> timers(2000);
+
+	uint64_t now = 0;
+	for (size_t i = 0 ; i < timers.size() ; i++) {
+		TestTimer& timer = timers[i];
+		timer.expiredAt = UINT64_MAX;
+
+		// Deadlines on all levels, and some beyond the span of the whole wheel
+		unsigned int bits = rng() % 30;
+		wheel.schedule(&timer, now + (rng() & ((1u << bits) - 1)));
+
+		if (i % 10 == 0) {
+			wheel.advance(now, [now](CacheTimerNode* node) { static_cast<TestTimer*>(node)->expiredAt = now; });
+			now += rng() % 100;
+		}
+	}
+
+	// Unscheduled timers must never expire.
+	for (size_t i = 0 ; i < timers.size() ; i += 7) {
+		wheel.unschedule(&timers[i]);
+	}
+
+	while (wheel.getTimerCount() != 0) {
+		now += rng() % 1000000;
+		wheel.advance(now, [now](CacheTimerNode* node) { static_cast<TestTimer*>(node)->expiredAt = now; });
+	}
+
+	for (size_t i = 0 ; i < timers.size() ; i++) {
+		if (i % 7 == 0) {
+			continue;
+		}
+		ASSERT_NE(UINT64_MAX, timers[i].expiredAt) << i;
+		ASSERT_LE(timers[i].deadline, timers[i].expiredAt) << i;
+	}
+
+	// Exactness for single-tick steps on all levels
+	TestTimer a, b, c;
+	uint64_t start = wheel.getCurrentTick();
+	wheel.schedule(&a, start + 10);
+	wheel.schedule(&b, start + 1000);
+	wheel.schedule(&c, start + 300000);
+
+	for (uint64_t t = start ; wheel.getTimerCount() != 0 ; t++) {
+		wheel.advance(t, [t](CacheTimerNode* node) { static_cast<TestTimer*>(node)->expiredAt = t; });
+	}
+
+	EXPECT_EQ(start + 10, a.expiredAt);
+	EXPECT_EQ(start + 1000, b.expiredAt);
+	EXPECT_EQ(start + 300000, c.expiredAt);
+}
+
+
+TEST(CacheTest, CacheExpiryTest)
+{
+	typedef Cache<int, int> TestCache;
+
+	TestCache::Clock::time_point now;
+	CacheStats stats;
+
+	TestCache cache(100);
+	cache.setTimeSource([&now]() { return now; });
+	cache.setStats(&stats);
+
+	EXPECT_TRUE(cache.insert(1, new int(1), 1, std::chrono::seconds(10)));
+	EXPECT_TRUE(cache.insert(2, new int(2), 1, std::chrono::seconds(20)));
+	EXPECT_TRUE(cache.insert(3, new int(3), 1, std::chrono::seconds(20), true));
+	EXPECT_TRUE(cache.insert(4, new int(4), 1));
+	EXPECT_THROW(cache.setExpiryResolution(std::chrono::seconds(1)), InvalidStateException);
+
+	now += std::chrono::milliseconds(9999);
+	EXPECT_NE((int*) NULL, cache.item(1));
+	EXPECT_EQ(0u, cache.expire());
+
+	now += std::chrono::milliseconds(1);
+	EXPECT_FALSE(cache.contains(1));
+	EXPECT_EQ((int*) NULL, cache.item(1));
+	EXPECT_EQ(3, cache.getOccupiedSize());
+
+	// Expired entries are reclaimed without being accessed.
+	now += std::chrono::seconds(10);
+	EXPECT_EQ(1u, cache.expire());
+	EXPECT_EQ(2, cache.getOccupiedSize());
+
+	// Locked entries stay until they are unlocked.
+	EXPECT_NE((int*) NULL, cache.item(3));
+	EXPECT_EQ((int*) NULL, cache.unlock(3));
+	EXPECT_FALSE(cache.contains(3));
+
+	// Entries without a time-to-live never expire.
+	now += std::chrono::hours(24*365);
+	EXPECT_EQ(0u, cache.expire());
+	EXPECT_NE((int*) NULL, cache.item(4));
+
+	// Expired entries are reclaimed before live ones are evicted.
+	for (int i = 100 ; i < 149 ; i++) {
+		cache.insert(i, new int(i), 1, std::chrono::minutes(1));
+	}
+	for (int i = 200 ; i < 250 ; i++) {
+		cache.insert(i, new int(i), 1);
+	}
+	now += std::chrono::minutes(1);
+	for (int i = 300 ; i < 349 ; i++) {
+		cache.insert(i, new int(i), 1);
+	}
+	for (int i = 200 ; i < 250 ; i++) {
+		EXPECT_TRUE(cache.contains(i));
+	}
+
+	CacheStats::Snapshot snap = stats.getSnapshot();
+	EXPECT_EQ(52u, snap.getExpirations());
+	EXPECT_EQ(0u, snap.getEvictions());
+}
+
+
+template <class CacheT>
+class TestResourceEntry : public CacheT::Entry
+{
+public:
+	TestResourceEntry(int val) : val(val) {}
+	virtual cachesize_t getSize() const { return 1; }
+
+public:
+	int val;
+};
+
+
+template <template<class, class, class> class EvictionPolicy>
+static void TestResourceCache()
+{
+	typedef ResourceCache<int, less<int>, CXX11Hash<int>, equal_to<int>, EvictionPolicy> TestCache;
+	typedef TestResourceEntry<TestCache> TestEntry;
+
+	int numLoads = 0;
+
+	TestCache cache(new typename TestCache::SimpleEntryLoader([&numLoads](int key) {
+		numLoads++;
+		return key < 0 ? NULL : new TestEntry(key*2);
+	}), 4);
+
+	typename TestCache::Pointer ptr = cache.getEntryPointer(21);
+	ASSERT_TRUE(ptr.isValid());
+	EXPECT_EQ(42, ((TestEntry*) ptr.getEntry())->val);
+	EXPECT_EQ(42, ((TestEntry*) ptr.getEntry())->val);
+	EXPECT_EQ(1, numLoads);
+
+	EXPECT_EQ(NULL, cache.getEntryPointer(-1).getEntry());
+
+	ptr.getEntry(true);
+
+	for (int i = 100 ; i < 110 ; i++) {
+		cache.getEntryPointer(i).getEntry();
+	}
+
+	EXPECT_EQ(42, ((TestEntry*) ptr.getEntry())->val);
+	EXPECT_EQ(12, numLoads);
+
+	ptr.release();
+}
+
+
+TEST(CacheTest, ResourceCacheTest)
+{
+	TestResourceCache<LRUEvictionPolicy>();
+	TestResourceCache<TwoQueueEvictionPolicy>();
+	TestResourceCache<ARCEvictionPolicy>();
+	TestResourceCache<TinyLFUEvictionPolicy>();
+}
+
+
+TEST(CacheTest, ResourceCacheAsyncTest)
+{
+	typedef ResourceCache<int> TestCache;
+	typedef TestResourceEntry<TestCache> TestEntry;
+
+	std::atomic<int> numLoads(0);
+	std::atomic<bool> gateOpen(false);
+
+	TestCache cache(new TestCache::SimpleEntryLoader([&](int key) -> TestCache::Entry* {
+		numLoads++;
+		while (!gateOpen) {
+			std::this_thread::yield();
+		}
+		if (key < 0) {
+			throw std::runtime_error("Invalid key");
+		}
+		return new TestEntry(key*2);
+	}), 16);
+
+	ThreadPool pool(4);
+	cache.setThreadPool(&pool);
+
+	TestCache::Pointer ptr = cache.getEntryPointer(21);
+
+	// All of these requests must be collapsed into a single load.
+	vector<shared_future<TestCache::Entry*> > futures;
+	for (int i = 0 ; i < 8 ; i++) {
+		futures.push_back(cache.getEntryPointer(21).getEntryAsync());
+	}
+
+	vector<std::thread> threads;
+	vector<TestCache::Entry*> syncResults(4);
+	for (int i = 0 ; i < 4 ; i++) {
+		threads.push_back(std::thread([&cache, &syncResults, i]() {
+			syncResults[i] = cache.getEntryPointer(21).getEntry();
+		}));
+	}
+
+	gateOpen = true;
+
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	TestCache::Entry* entry = futures[0].get();
+	ASSERT_TRUE(entry != NULL);
+	EXPECT_EQ(42, ((TestEntry*) entry)->val);
+
+	for (shared_future<TestCache::Entry*>& future : futures) {
+		EXPECT_EQ(entry, future.get());
+	}
+	for (TestCache::Entry* syncResult : syncResults) {
+		EXPECT_EQ(entry, syncResult);
+	}
+
+	EXPECT_EQ(1, numLoads);
+
+	// Cached entries are returned right away, locked or not.
+	shared_future<TestCache::Entry*> lockedFuture = ptr.getEntryAsync(true);
+	EXPECT_EQ(std::future_status::ready, lockedFuture.wait_for(std::chrono::seconds(0)));
+	EXPECT_EQ(entry, lockedFuture.get());
+	EXPECT_EQ(1, numLoads);
+
+	for (int i = 100 ; i < 120 ; i++) {
+		EXPECT_EQ(i*2, ((TestEntry*) cache.getEntryPointer(i).getEntryAsync().get())->val);
+	}
+
+	EXPECT_EQ(entry, ptr.getEntry());
+	ptr.release();
+
+	// Exceptions thrown by the loader are stored in the future.
+	shared_future<TestCache::Entry*> failedFuture = cache.getEntryPointer(-1).getEntryAsync();
+	EXPECT_THROW(failedFuture.get(), std::runtime_error);
+}
+
+
+TEST(CacheTest, ResourceCachePrefetchTest)
+{
+	typedef ResourceCache<int> TestCache;
+	typedef TestResourceEntry<TestCache> TestEntry;
+
+	std::atomic<int> numLoads(0);
+
+	TestCache cache(new TestCache::SimpleEntryLoader([&numLoads](int key) {
+		numLoads++;
+		return new TestEntry(key*2);
+	}), 4);
+
+	ThreadPool pool(2);
+	cache.setThreadPool(&pool);
+
+	// Accessing a key predicts the next one.
+	cache.setAccessPredictor(new TestCache::SimpleAccessPredictor([](int key, vector<int>& predicted) {
+		predicted.push_back(key+1);
+	}));
+
+	TestCache::Pointer ptr1 = cache.getEntryPointer(1);
+	ptr1.getEntry(true);
+	pool.waitIdle();
+	EXPECT_EQ(2, numLoads);
+
+	EXPECT_EQ(4, ((TestEntry*) cache.getEntryPointer(2).getEntry())->val);
+	pool.waitIdle();
+	EXPECT_EQ(3, numLoads);
+	EXPECT_EQ(1, cache.getPrefetchHitCount());
+	EXPECT_EQ(0, cache.getWastedPrefetchCount());
+
+	cache.setAccessPredictor(NULL);
+
+	cache.prefetch(10);
+	pool.waitIdle();
+	EXPECT_EQ(4, numLoads);
+	EXPECT_EQ(4, cache.getOccupiedSize());
+
+	// The cache is full now, so further prefetches must not evict anything.
+	vector<int> keys = { 20, 21, 22 };
+	cache.prefetch(keys.begin(), keys.end());
+	pool.waitIdle();
+	EXPECT_EQ(4, numLoads);
+
+	// Loading on demand has to evict the never-accessed prefetched entry 10, because all others are locked.
+	TestCache::Pointer ptr2 = cache.getEntryPointer(2);
+	TestCache::Pointer ptr3 = cache.getEntryPointer(3);
+	ptr2.getEntry(true);
+	ptr3.getEntry(true);
+	EXPECT_EQ(60, ((TestEntry*) cache.getEntryPointer(30).getEntry())->val);
+	EXPECT_EQ(1, cache.getWastedPrefetchCount());
+	EXPECT_EQ(2, cache.getPrefetchHitCount());
+	EXPECT_EQ(2, ((TestEntry*) ptr1.getEntry())->val);
+
+	ptr3.release();
+	ptr2.release();
+	ptr1.release();
+}
+
+
+TEST(CacheTest, ResourceCacheQueuedPrefetchTest)
+{
+	typedef ResourceCache<int> TestCache;
+	typedef TestResourceEntry<TestCache> TestEntry;
+
+	std::atomic<int> numLoads(0);
+
+	TestCache cache(new TestCache::SimpleEntryLoader([&numLoads](int key) {
+		numLoads++;
+		return new TestEntry(key*2);
+	}), 4);
+
+	ThreadPool pool(1);
+	cache.setThreadPool(&pool);
+
+	// Keep the only pool thread busy, so that the prefetch stays queued
+	std::atomic<bool> gateOpen(false);
+	pool.submit([&gateOpen]() {
+		while (!gateOpen) {
+			std::this_thread::yield();
+		}
+	});
+
+	cache.prefetch(1);
+
+	// The normal-priority task runs before the low-priority prefetch. It must take the load over instead of
+	// waiting for the prefetch, which would never run.
+	TestCache::Pointer ptr = cache.getEntryPointer(1);
+	shared_future<TestCache::Entry*> future = ptr.getEntryAsync(true);
+
+	gateOpen = true;
+
+	ASSERT_EQ(std::future_status::ready, future.wait_for(std::chrono::seconds(10)));
+	EXPECT_EQ(2, ((TestEntry*) future.get())->val);
+
+	pool.waitIdle();
+	EXPECT_EQ(1, numLoads);
+	EXPECT_EQ(1, cache.getPrefetchHitCount());
+
+	// Same for a synchronous load while the prefetch is queued
+	gateOpen = false;
+	pool.submit([&gateOpen]() {
+		while (!gateOpen) {
+			std::this_thread::yield();
+		}
+	});
+
+	cache.prefetch(2);
+	EXPECT_EQ(4, ((TestEntry*) cache.getEntryPointer(2).getEntry())->val);
+	EXPECT_EQ(2, numLoads);
+
+	gateOpen = true;
+	pool.waitIdle();
+	EXPECT_EQ(2, numLoads);
+
+	ptr.release();
+}
+
+
+TEST(CacheTest, ResourceCacheFailedPrefetchTest)
+{
+	typedef ResourceCache<int> TestCache;
+	typedef TestResourceEntry<TestCache> TestEntry;
+
+	ThreadPool pool(1);
+
+	{
+		TestCache cache(new TestCache::SimpleEntryLoader([](int key) -> TestCache::Entry* {
+			if (key == 7) {
+				throw std::runtime_error("Invalid key");
+			}
+			return new TestEntry(key*2);
+		}), 4);
+		cache.setThreadPool(&pool);
+
+		cache.prefetch(7);
+		pool.waitIdle();
+
+		// The failed prefetch must not be counted as a running task anymore, or this would hang.
+	}
+}
+
+
+TEST(CacheTest, ResourceCacheFailedLoadTest)
+{
+	typedef ResourceCache<int> TestCache;
+
+	std::atomic<int> numLoads(0);
+	std::atomic<bool> gateOpen(false);
+	CacheStats stats;
+
+	TestCache cache(new TestCache::SimpleEntryLoader([&](int /* key */) -> TestCache::Entry* {
+		numLoads++;
+		while (!gateOpen) {
+			std::this_thread::yield();
+		}
+		throw std::runtime_error("Invalid key");
+	}), 4);
+	cache.setStats(&stats);
+
+	vector<std::thread> threads;
+	std::atomic<int> numThrown(0);
+	for (int i = 0 ; i < 2 ; i++) {
+		threads.push_back(std::thread([&cache, &numThrown]() {
+			try {
+				cache.getEntryPointer(1).getEntry();
+			} catch (std::runtime_error&) {
+				numThrown++;
+			}
+		}));
+	}
+
+	// Once both lookups missed, one thread runs the load and the other one waits for it.
+	while (stats.getSnapshot().getMisses() < 2) {
+		std::this_thread::yield();
+	}
+
+	gateOpen = true;
+
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	// The waiting thread must see the loader's exception too, instead of a NULL entry.
+	EXPECT_EQ(1, numLoads);
+	EXPECT_EQ(2, numThrown);
+}
+
+
+
+TEST(CacheTest, DiskCacheTest)
+{
+	File tmpFile = File::createTemporaryFile();
+	CString path = tmpFile.getPath().toString();
+
+	{
+		DiskCache dcache(path, 4096);
+
+		EXPECT_TRUE(dcache.put(ByteArray((const uint8_t*) "a", 1), ByteArray((const uint8_t*) "Apple", 5)));
+		EXPECT_TRUE(dcache.put(ByteArray((const uint8_t*) "b", 1), ByteArray((const uint8_t*) "Banana", 6)));
+		EXPECT_TRUE(dcache.put(ByteArray((const uint8_t*) "a", 1), ByteArray((const uint8_t*) "Apricot", 7)));
+		EXPECT_TRUE(dcache.remove(ByteArray((const uint8_t*) "b", 1)));
+		EXPECT_FALSE(dcache.remove(ByteArray((const uint8_t*) "b", 1)));
+
+		ByteArray val;
+		ASSERT_TRUE(dcache.get(ByteArray((const uint8_t*) "a", 1), val));
+		EXPECT_EQ(CString("Apricot"), CString((const char*) val.get(), val.length()));
+		EXPECT_FALSE(dcache.get(ByteArray((const uint8_t*) "b", 1), val));
+
+		// Too large for the file
+		ByteArray hugeVal(8192);
+		hugeVal.resize(8192);
+		EXPECT_FALSE(dcache.put(ByteArray((const uint8_t*) "c", 1), hugeVal));
+	}
+
+	{
+		// Contents must survive reopening.
+		DiskCache dcache(path, 4096);
+		EXPECT_EQ(1, dcache.getEntryCount());
+
+		ByteArray val;
+		ASSERT_TRUE(dcache.get(ByteArray((const uint8_t*) "a", 1), val));
+		EXPECT_EQ(CString("Apricot"), CString((const char*) val.get(), val.length()));
+
+		dcache.compact();
+		EXPECT_EQ(dcache.getLiveSize() + 16, dcache.getFileSize());
+		ASSERT_TRUE(dcache.get(ByteArray((const uint8_t*) "a", 1), val));
+		EXPECT_EQ(CString("Apricot"), CString((const char*) val.get(), val.length()));
+
+		// Writing way more than fits must keep the file bounded, and keep the newest records.
+		ByteArray payload(100);
+		payload.resize(100);
+		for (int i = 0 ; i < 200 ; i++) {
+			EXPECT_TRUE(dcache.put(ByteArray((const uint8_t*) &i, sizeof(i)), payload));
+			EXPECT_LE(dcache.getFileSize(), 4096u);
+		}
+
+		int last = 199;
+		EXPECT_TRUE(dcache.contains(ByteArray((const uint8_t*) &last, sizeof(last))));
+		EXPECT_FALSE(dcache.contains(ByteArray((const uint8_t*) "a", 1)));
+	}
+
+	{
+		// A truncated record at the end must be dropped.
+		FILE* f = fopen(path.get(), "ab");
+		fwrite("garbage", 1, 7, f);
+		fclose(f);
+
+		DiskCache dcache(path, 4096);
+		int last = 199;
+		EXPECT_TRUE(dcache.contains(ByteArray((const uint8_t*) &last, sizeof(last))));
+		EXPECT_TRUE(dcache.put(ByteArray((const uint8_t*) "x", 1), ByteArray((const uint8_t*) "y", 1)));
+	}
+
+	{
+		DiskCache dcache(path, 4096);
+		EXPECT_TRUE(dcache.contains(ByteArray((const uint8_t*) "x", 1)));
+	}
+
+	tmpFile.remove();
+}
+
+
+template <class CacheT>
+class TestSerializableEntry : public TestResourceEntry<CacheT>
+{
+public:
+	TestSerializableEntry(int val) : TestResourceEntry<CacheT>(val) {}
+	virtual bool serialize(ByteArray& data) const
+			{ data = ByteArray((const uint8_t*) &this->val, sizeof(int)); return true; }
+};
+
+
+TEST(CacheTest, ResourceCacheDiskCacheTest)
+{
+	typedef ResourceCache<int> TestCache;
+	typedef TestSerializableEntry<TestCache> TestEntry;
+
+	File tmpFile = File::createTemporaryFile();
+	DiskCache dcache(tmpFile.getPath().toString(), 1024*1024);
+
+	int numLoads = 0;
+	int numDeserializations = 0;
+
+	auto createLoader = [&]() {
+		return new TestCache::SimpleEntryLoader (
+				[&numLoads](int key) {
+					numLoads++;
+					return new TestEntry(key*2);
+				},
+				[&numDeserializations](int /* key */, const ByteArray& data) {
+					numDeserializations++;
+					return new TestEntry(*((const int*) data.get()));
+				});
+	};
+
+	{
+		TestCache cache(createLoader(), 2);
+		cache.setDiskCache(&dcache);
+
+		for (int i = 0 ; i < 4 ; i++) {
+			EXPECT_EQ(i*2, ((TestEntry*) cache.getEntryPointer(i).getEntry())->val);
+		}
+
+		EXPECT_EQ(4, numLoads);
+		EXPECT_EQ(2, dcache.getEntryCount());
+
+		// Evicted entries come back from the disk cache.
+		EXPECT_EQ(0, ((TestEntry*) cache.getEntryPointer(0).getEntry())->val);
+		EXPECT_EQ(4, numLoads);
+		EXPECT_EQ(1, numDeserializations);
+	}
+
+	// Everything was written on destruction, so a new cache can start warm.
+	EXPECT_EQ(4, dcache.getEntryCount());
+
+	{
+		TestCache cache(createLoader(), 2);
+		cache.setDiskCache(&dcache);
+
+		for (int i = 0 ; i < 4 ; i++) {
+			EXPECT_EQ(i*2, ((TestEntry*) cache.getEntryPointer(i).getEntry())->val);
+		}
+
+		EXPECT_EQ(4, numLoads);
+		EXPECT_EQ(5, numDeserializations);
+	}
+
+	tmpFile.remove();
+}
+
+
+TEST(CacheTest, LatencyHistogramTest)
+{
+	for (unsigned int i = 1 ; i < LatencyHistogram::BucketCount ; i++) {
+		ASSERT_EQ(LatencyHistogram::getBucketUpperBound(i-1) + 1, LatencyHistogram::getBucketLowerBound(i));
+		ASSERT_EQ(i, LatencyHistogram::getBucketIndex(LatencyHistogram::getBucketLowerBound(i)));
+		ASSERT_EQ(i, LatencyHistogram::getBucketIndex(LatencyHistogram::getBucketUpperBound(i)));
+	}
+	EXPECT_EQ(UINT64_MAX, LatencyHistogram::getBucketUpperBound(LatencyHistogram::BucketCount-1));
+
+	LatencyHistogram hist;
+
+	for (uint64_t i = 1 ; i <= 1000 ; i++) {
+		hist.record(i * 1000);
+	}
+
+	EXPECT_EQ(1000u, hist.getCount());
+	EXPECT_EQ(1000u, hist.getMin());
+	EXPECT_EQ(1000000u, hist.getMax());
+	EXPECT_DOUBLE_EQ(500500.0, hist.getMean());
+
+	// At most 12.5% off
+	EXPECT_NEAR(500000.0, (double) hist.getPercentile(50.0), 500000.0 * 0.125);
+	EXPECT_NEAR(990000.0, (double) hist.getPercentile(99.0), 990000.0 * 0.125);
+	EXPECT_EQ(1000000u, hist.getPercentile(100.0));
+
+	LatencyHistogram other;
+	other.record(5);
+	hist.merge(other);
+	EXPECT_EQ(1001u, hist.getCount());
+	EXPECT_EQ(5u, hist.getMin());
+}
+
+
+TEST(CacheTest, CacheStatsTest)
+{
+	CacheStats stats;
+
+	{
+		Cache<int, int> cache(10);
+		cache.setStats(&stats, [](int key) { return key < 100 ? CString("small") : CString("large"); });
+
+		EXPECT_TRUE(cache.insert(1, new int(1), 4));
+		EXPECT_TRUE(cache.insert(100, new int(100), 4));
+		EXPECT_NE((int*) NULL, cache.item(1));
+		EXPECT_EQ((int*) NULL, cache.item(2));
+		EXPECT_TRUE(cache.insert(3, new int(3), 4));
+		EXPECT_TRUE(cache.insert(4, new int(4), 8, true));
+		EXPECT_TRUE(cache.insert(5, new int(5), 4, true));
+
+		CacheStats::Snapshot snap = stats.getSnapshot();
+		EXPECT_EQ(1u, snap.getHits());
+		EXPECT_EQ(1u, snap.getMisses());
+		EXPECT_DOUBLE_EQ(0.5, snap.getHitRatio());
+		EXPECT_EQ(5u, snap.getInserts());
+		EXPECT_EQ(3u, snap.getEvictions());
+		EXPECT_EQ(1u, snap.getOverfills());
+		EXPECT_EQ(12, snap.occupied);
+		EXPECT_EQ(10u, snap.capacity);
+		EXPECT_EQ(12, snap.occupiedPerClass["small"]);
+		EXPECT_EQ(0, snap.occupiedPerClass["large"]);
+
+		cache.unlock(4);
+		cache.unlock(5);
+	}
+
+	// Counts from multiple threads are merged.
+	stats.reset();
+
+	vector<std::thread> threads;
+	for (int i = 0 ; i < 4 ; i++) {
+		threads.push_back(std::thread([&stats]() {
+			for (int j = 0 ; j < 1000 ; j++) {
+				stats.count(CacheStats::CounterHits);
+				stats.recordLoad(j, true);
+			}
+		}));
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	CacheStats::Snapshot snap = stats.getSnapshot();
+	EXPECT_EQ(4000u, snap.getHits());
+	EXPECT_EQ(0u, snap.getMisses());
+	EXPECT_EQ(4000u, snap.getLoads());
+	EXPECT_EQ(4000u, snap.loadLatency.getCount());
+	EXPECT_EQ(999u, snap.loadLatency.getMax());
+
+	rapidjson::Document doc;
+	CString json = snap.toJSON();
+	doc.Parse(json.get());
+	ASSERT_FALSE(doc.HasParseError());
+	EXPECT_EQ(4000u, doc["hits"].GetUint64());
+	EXPECT_EQ(4000u, doc["loadLatencyNs"]["count"].GetUint64());
+	EXPECT_TRUE(doc["loadLatencyNs"]["buckets"].IsArray());
+}
+
+
+TEST(CacheTest, ResourceCacheStatsTest)
+{
+	typedef ResourceCache<int> TestCache;
+	typedef TestResourceEntry<TestCache> TestEntry;
+
+	CacheStats stats;
+
+	TestCache cache(new TestCache::SimpleEntryLoader([](int key) {
+		return key < 0 ? NULL : new TestEntry(key);
+	}), 2);
+	cache.setStats(&stats);
+
+	TestCache::Pointer ptr = cache.getEntryPointer(1);
+	ptr.getEntry();
+	ptr.getEntry();
+	ptr.getEntry(true);
+	cache.getEntryPointer(-1).getEntry();
+	cache.getEntryPointer(2).getEntry();
+	cache.getEntryPointer(3).getEntryAsync().get();
+	ptr.release();
+
+	CacheStats::Snapshot snap = stats.getSnapshot();
+	EXPECT_EQ(2u, snap.getHits());
+	EXPECT_EQ(4u, snap.getMisses());
+	EXPECT_EQ(3u, snap.getLoads());
+	EXPECT_EQ(1u, snap.getFailedLoads());
+	EXPECT_EQ(4u, snap.loadLatency.getCount());
+	EXPECT_EQ(1u, snap.getEvictions());
+	EXPECT_EQ(2, snap.occupied);
+}
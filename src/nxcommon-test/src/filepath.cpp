@@ -113,7 +113,21 @@ TEST(FilePathTest, PathComponentsTest)
 		EXPECT_EQ(test.baseFname, path.getBaseFileName()) << "getBaseFileName() test #" << i << " failed!";
 		EXPECT_EQ(test.fullBaseFname, path.getFullBaseFileName()) << "getFullBaseFileName() test #" << i << " failed!";
 		EXPECT_EQ(test.dirpath, path.getDirectoryPath().toString()) << "getDirectoryPath() test #" << i << " failed!";
+
+		EXPECT_EQ(CStringView(test.ext), path.getExtensionView()) << "getExtensionView() test #" << i << " failed!";
+		EXPECT_EQ(CStringView(test.fullExt), path.getFullExtensionView()) << "getFullExtensionView() test #" << i << " failed!";
+		EXPECT_EQ(CStringView(test.fname), path.getFileNameView()) << "getFileNameView() test #" << i << " failed!";
+		EXPECT_EQ(CStringView(test.baseFname), path.getBaseFileNameView()) << "getBaseFileNameView() test #" << i << " failed!";
+		EXPECT_EQ(CStringView(test.fullBaseFname), path.getFullBaseFileNameView())
+				<< "getFullBaseFileNameView() test #" << i << " failed!";
 	}
+
+	// Component views point into the path string
+	FilePath longPath(CString("/some/rather/long/directory/name/archive.tar.gz"));
+	CString longPathStr = longPath.toString();
+	EXPECT_EQ(longPathStr.get() + longPathStr.length() - 2, longPath.getExtensionView().get());
+	EXPECT_EQ(longPathStr.get() + longPathStr.length() - 14, longPath.getFileNameView().get());
+	EXPECT_EQ(longPathStr.get() + longPathStr.length() - 14, longPath.getBaseFileNameView().get());
 }
 
 
@@ -0,0 +1,224 @@
+/*
+	Copyright 2010-2013 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "global.h"
+#include <nxcommon/log.h>
+#include <nxcommon/util.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <sstream>
+
+#ifdef _POSIX_VERSION
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+using std::vector;
+
+
+
+static string ReadWholeFile(FILE* file)
+{
+	string content;
+	char buf[4096];
+	size_t len;
+
+	fflush(file);
+	fseek(file, 0, SEEK_SET);
+
+	while ((len = fread(buf, 1, sizeof(buf), file)) != 0) {
+		content.append(buf, len);
+	}
+
+	return content;
+}
+
+
+// Returns the lines of a log file without their "[XXX] <time> - " prefixes
+static vector<string> GetLogLines(const string& content)
+{
+	vector<string> lines;
+	std::istringstream in(content);
+	string line;
+
+	while (std::getline(in, line)) {
+		size_t sepPos = line.find(" - ");
+		lines.push_back(sepPos == string::npos ? line : line.substr(sepPos+3));
+	}
+
+	return lines;
+}
+
+
+#ifdef _POSIX_VERSION
+
+TEST(LogTest, AsyncTest)
+{
+	int oldLevel = GetLogLevel();
+	SetLogLevel(LOG_LEVEL_INFO);
+
+	// Keep the test output clean
+	fflush(stderr);
+	int oldStderr = dup(STDERR_FILENO);
+	FILE* nullFile = fopen("/dev/null", "w");
+	ASSERT_TRUE(nullFile != NULL);
+	dup2(fileno(nullFile), STDERR_FILENO);
+
+	FILE* logFile = tmpfile();
+	ASSERT_TRUE(logFile != NULL);
+	OpenLogFile(logFile);
+
+	// Synchronous mode
+	LogInfo("sync %d", 1);
+	LogMultiWarning("multi\nline");
+
+	string content = ReadWholeFile(logFile);
+	EXPECT_EQ(0u, content.find("[INF] "));
+	EXPECT_NE(string::npos, content.find("\n[WRN] "));
+	vector<string> lines = GetLogLines(content);
+	ASSERT_EQ(3u, lines.size());
+	EXPECT_EQ("sync 1", lines[0]);
+	EXPECT_EQ("multi", lines[1]);
+	EXPECT_EQ("line", lines[2]);
+
+	LogAsyncConfig config;
+	GetDefaultLogAsyncConfig(&config);
+	config.queueCapacity = 64;
+	config.flushIntervalMs = 60000;
+	config.flushSize = 1024*1024;
+	config.installCrashHandlers = false;
+
+	if (!StartAsyncLogging(&config)) {
+		// Not supported here
+		EXPECT_FALSE(IsAsyncLoggingActive());
+	} else {
+		EXPECT_TRUE(IsAsyncLoggingActive());
+
+		// Messages stay pending until something triggers a flush
+		LogInfo("async %d", 2);
+		SleepMilliseconds(20);
+		EXPECT_EQ(content, ReadWholeFile(logFile));
+
+		// Errors are written right away
+		LogError("error %d", 3);
+		for (int i = 0 ; i < 1000  &&  ReadWholeFile(logFile).size() == content.size() ; i++) {
+			SleepMilliseconds(1);
+		}
+
+		lines = GetLogLines(ReadWholeFile(logFile));
+		ASSERT_EQ(5u, lines.size());
+		EXPECT_EQ("async 2", lines[3]);
+		EXPECT_EQ("error 3", lines[4]);
+
+		// Many threads against a small queue, with some messages too long for a queue slot
+		const int numThreads = 4;
+		const int numPerThread = 2000;
+		string longText(1000, 'x');
+
+		vector<std::thread> threads;
+		for (int t = 0 ; t < numThreads ; t++) {
+			threads.emplace_back([&, t]() {
+				for (int i = 0 ; i < numPerThread ; i++) {
+					if (i % 100 == 0) {
+						LogMultiInfo("thread %d msg %d\n%s", t, i, longText.c_str());
+					} else {
+						LogInfo("thread %d msg %d", t, i);
+					}
+				}
+			});
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+
+		FlushLog();
+
+		lines = GetLogLines(ReadWholeFile(logFile));
+		EXPECT_EQ(5u + numThreads*numPerThread + numThreads*numPerThread/100, lines.size());
+
+		// Per-thread order is kept
+		int next[numThreads] = { 0 };
+		bool ok = true;
+		for (size_t i = 5 ; i < lines.size() ; i++) {
+			int t, msg;
+			if (sscanf(lines[i].c_str(), "thread %d msg %d", &t, &msg) == 2) {
+				ok = ok  &&  t >= 0  &&  t < numThreads  &&  msg == next[t]++;
+				if (msg % 100 == 0) {
+					ok = ok  &&  i+1 < lines.size()  &&  lines[i+1] == longText;
+				}
+			} else {
+				ok = ok  &&  lines[i] == longText;
+			}
+		}
+		EXPECT_TRUE(ok);
+
+		LogInfo("before stop");
+		StopAsyncLogging();
+		EXPECT_FALSE(IsAsyncLoggingActive());
+		LogInfo("after stop");
+
+		lines = GetLogLines(ReadWholeFile(logFile));
+		ASSERT_LE(2u, lines.size());
+		EXPECT_EQ("before stop", lines[lines.size()-2]);
+		EXPECT_EQ("after stop", lines[lines.size()-1]);
+
+		// Queued messages must survive a crash
+		FILE* crashLogFile = tmpfile();
+		ASSERT_TRUE(crashLogFile != NULL);
+
+		fflush(NULL);
+		pid_t pid = fork();
+		ASSERT_NE(-1, pid);
+
+		if (pid == 0) {
+			OpenLogFile(crashLogFile);
+			config.installCrashHandlers = true;
+			StartAsyncLogging(&config);
+			LogInfo("last words");
+			abort();
+		}
+
+		int status;
+		waitpid(pid, &status, 0);
+		EXPECT_TRUE(WIFSIGNALED(status)  &&  WTERMSIG(status) == SIGABRT);
+
+		lines = GetLogLines(ReadWholeFile(crashLogFile));
+		ASSERT_EQ(1u, lines.size());
+		EXPECT_EQ("last words", lines[0]);
+		fclose(crashLogFile);
+	}
+
+	OpenLogFile(NULL);
+
+	fflush(stderr);
+	dup2(oldStderr, STDERR_FILENO);
+	close(oldStderr);
+	fclose(nullFile);
+
+	SetLogLevel(oldLevel);
+}
+
+#endif
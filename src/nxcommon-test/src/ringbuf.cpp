@@ -0,0 +1,523 @@
+/*
+	Copyright 2010-2014 David "Alemarius Nexus" Lerch
+
+	This file is part of nxcommon.
+
+	nxcommon is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	nxcommon is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with nxcommon.  If not, see <http://www.gnu.org/licenses/>.
+
+	Additional permissions are granted, which are listed in the file
+	GPLADDITIONS.
+ */
+
+#include "global.h"
+#include <nxcommon/ringbuf.h>
+#include <nxcommon/RingBuffer.h>
+#include <nxcommon/MPMCRingBuffer.h>
+#include <nxcommon/SPSCRingBuffer.h>
+#include <nxcommon/util.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <memory>
+
+using std::vector;
+
+
+
+// Passes numElems consecutive values from one writer thread to one reader thread, with varying batch sizes, and
+// checks that they arrive in order.
+template <typename WriteFunc, typename ReadFunc>
+static void RunSPSCStressTest(uint64_t numElems, WriteFunc writeFunc, ReadFunc readFunc)
+{
+	std::thread writer([&]() {
+		uint64_t buf[13];
+		uint64_t next = 0;
+		size_t batch = 1;
+		while (next < numElems) {
+			size_t len = std::min((uint64_t) batch, numElems - next);
+			for (size_t i = 0 ; i < len ; i++) {
+				buf[i] = next+i;
+			}
+			size_t written = writeFunc(buf, len);
+			next += written;
+			if (written == 0) {
+				std::this_thread::yield();
+			}
+			batch = batch % 13 + 1;
+		}
+	});
+
+	uint64_t buf[11];
+	uint64_t expected = 0;
+	bool ok = true;
+	size_t batch = 1;
+	while (expected < numElems) {
+		size_t numRead = readFunc(buf, batch);
+		for (size_t i = 0 ; i < numRead ; i++) {
+			ok = ok  &&  buf[i] == expected++;
+		}
+		if (numRead == 0) {
+			std::this_thread::yield();
+		}
+		batch = batch % 11 + 1;
+	}
+
+	writer.join();
+	EXPECT_TRUE(ok);
+}
+
+
+// Runs numProducers threads that write the values 0..numPerProducer-1 (tagged with the producer index in the upper
+// bits) in batches of varying size, and numConsumers threads that read them. Checks that every value arrives
+// exactly once, and in order per producer for a single consumer.
+template <typename WriteFunc, typename ReadFunc>
+static void RunMPMCStressTest(int numProducers, int numConsumers, uint64_t numPerProducer, WriteFunc writeFunc,
+		ReadFunc readFunc)
+{
+	std::atomic<uint64_t> numReceived(0);
+	uint64_t total = numProducers * numPerProducer;
+	vector<std::unique_ptr<std::atomic<uint8_t>[]>> seen;
+	for (int i = 0 ; i < numProducers ; i++) {
+		seen.emplace_back(new std::atomic<uint8_t>[numPerProducer]());
+	}
+	std::atomic<bool> orderOk(true);
+
+	vector<std::thread> threads;
+
+	for (int p = 0 ; p < numProducers ; p++) {
+		threads.emplace_back([&, p]() {
+			uint64_t buf[7];
+			uint64_t next = 0;
+			size_t batch = 1;
+			while (next < numPerProducer) {
+				size_t len = std::min((uint64_t) batch, numPerProducer - next);
+				for (size_t i = 0 ; i < len ; i++) {
+					buf[i] = ((uint64_t) p << 48) | (next+i);
+				}
+				size_t written = writeFunc(buf, len);
+				next += written;
+				if (written == 0) {
+					std::this_thread::yield();
+				}
+				batch = batch % 7 + 1;
+			}
+		});
+	}
+
+	for (int c = 0 ; c < numConsumers ; c++) {
+		threads.emplace_back([&]() {
+			uint64_t buf[5];
+			vector<int64_t> lastPerProducer(numProducers, -1);
+			size_t batch = 1;
+			while (numReceived.load() < total) {
+				size_t numRead = readFunc(buf, batch);
+				for (size_t i = 0 ; i < numRead ; i++) {
+					int p = (int) (buf[i] >> 48);
+					uint64_t v = buf[i] & 0xFFFFFFFFFFFFULL;
+					seen[p][v].fetch_add(1);
+					if ((int64_t) v <= lastPerProducer[p]) {
+						orderOk = false;
+					}
+					lastPerProducer[p] = v;
+				}
+				numReceived += numRead;
+				if (numRead == 0) {
+					std::this_thread::yield();
+				}
+				batch = batch % 5 + 1;
+			}
+		});
+	}
+
+	for (std::thread& t : threads) {
+		t.join();
+	}
+
+	EXPECT_EQ(total, numReceived.load());
+
+	bool allOnce = true;
+	for (int p = 0 ; p < numProducers ; p++) {
+		for (uint64_t i = 0 ; i < numPerProducer ; i++) {
+			allOnce = allOnce  &&  seen[p][i].load() == 1;
+		}
+	}
+	EXPECT_TRUE(allOnce);
+
+	// Writes of one producer are claimed in order, and a single consumer reads them in that order
+	if (numConsumers == 1) {
+		EXPECT_TRUE(orderOk.load());
+	}
+}
+
+
+TEST(RingBufferTest, SPSCCTest)
+{
+	ringbuf_spsc_t rbuf;
+	int mem[7];
+	ringbuf_spsc_create(&rbuf, mem, sizeof(int), 7);
+
+	int in[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+	int out[16];
+
+	EXPECT_TRUE(ringbuf_spsc_is_empty(&rbuf));
+	EXPECT_EQ(0, ringbuf_spsc_read(&rbuf, out, 1));
+
+	// Go around a few times, so that positions wrap at 2*capacity
+	for (int round = 0 ; round < 10 ; round++) {
+		EXPECT_EQ(5, ringbuf_spsc_write(&rbuf, in, 5));
+		EXPECT_EQ(5, ringbuf_spsc_get_read_count(&rbuf));
+		EXPECT_EQ(2, ringbuf_spsc_get_write_count(&rbuf));
+		EXPECT_EQ(2, ringbuf_spsc_write(&rbuf, in+5, 4));
+		EXPECT_TRUE(ringbuf_spsc_is_full(&rbuf));
+		EXPECT_EQ(0, ringbuf_spsc_write(&rbuf, in, 1));
+
+		EXPECT_EQ(3, ringbuf_spsc_peek(&rbuf, out, 3));
+		EXPECT_EQ(1, out[0]);
+		EXPECT_EQ(2, ringbuf_spsc_advance_read(&rbuf, 2));
+		EXPECT_EQ(5, ringbuf_spsc_read(&rbuf, out, 16));
+		EXPECT_EQ(3, out[0]);
+		EXPECT_EQ(7, out[4]);
+		EXPECT_TRUE(ringbuf_spsc_is_empty(&rbuf));
+
+		EXPECT_EQ(3, ringbuf_spsc_advance_write(&rbuf, 3));
+		EXPECT_EQ(3, ringbuf_spsc_advance_read(&rbuf, 5));
+	}
+
+	uint64_t stressMem[37];
+	ringbuf_spsc_t stressBuf;
+	ringbuf_spsc_create(&stressBuf, stressMem, sizeof(uint64_t), 37);
+
+	RunSPSCStressTest(200000, [&](uint64_t* data, size_t len) {
+		return ringbuf_spsc_write(&stressBuf, data, len);
+	}, [&](uint64_t* data, size_t len) {
+		return ringbuf_spsc_read(&stressBuf, data, len);
+	});
+}
+
+
+TEST(RingBufferTest, SPSCTemplateTest)
+{
+	SPSCRingBuffer<int> rbuf(7);
+	SPSCRingBuffer<int, uint8_t, true> pow2Buf(7);
+
+	EXPECT_EQ(7, rbuf.capacity());
+	EXPECT_EQ(8, pow2Buf.capacity());
+
+	int in[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+	int out[16];
+
+	// The 8-bit size type of pow2Buf wraps around, too
+	for (int round = 0 ; round < 100 ; round++) {
+		EXPECT_EQ(7, rbuf.write(in, 9));
+		EXPECT_TRUE(rbuf.isFull());
+		EXPECT_FALSE(rbuf.write(in[0]));
+		EXPECT_EQ(1, rbuf.read());
+		EXPECT_EQ(6, rbuf.readSize());
+		EXPECT_EQ(2, rbuf.skip(2));
+		EXPECT_EQ(4, rbuf.read(out, 16));
+		EXPECT_EQ(4, out[0]);
+		EXPECT_EQ(7, out[3]);
+		EXPECT_TRUE(rbuf.isEmpty());
+		EXPECT_EQ(round % 5, rbuf.advanceWrite(round % 5));
+		EXPECT_EQ(round % 5, rbuf.advanceRead(16));
+
+		EXPECT_EQ(8, pow2Buf.write(in, 9));
+		EXPECT_EQ(0, pow2Buf.writeSize());
+		EXPECT_EQ(3, pow2Buf.peek(out, 3));
+		EXPECT_EQ(3, out[2]);
+		EXPECT_EQ(8, pow2Buf.read(out, 16));
+		EXPECT_EQ(8, out[7]);
+		EXPECT_EQ(round % 3, pow2Buf.advanceWrite(round % 3));
+		EXPECT_EQ(round % 3, pow2Buf.advanceRead(round % 3));
+	}
+
+	SPSCRingBuffer<uint64_t> stressBuf(37);
+	RunSPSCStressTest(200000, [&](uint64_t* data, size_t len) {
+		return stressBuf.write(data, len);
+	}, [&](uint64_t* data, size_t len) {
+		return stressBuf.read(data, len);
+	});
+
+	SPSCRingBuffer<uint64_t, uint16_t, true> pow2StressBuf(64);
+	RunSPSCStressTest(200000, [&](uint64_t* data, size_t len) {
+		return pow2StressBuf.write(data, (uint16_t) len);
+	}, [&](uint64_t* data, size_t len) {
+		return pow2StressBuf.read(data, (uint16_t) len);
+	});
+}
+
+
+TEST(RingBufferTest, MPMCCTest)
+{
+	ringbuf_mpmc_t rbuf;
+	vector<char> mem(ringbuf_mpmc_get_buffer_size(sizeof(int), 8));
+
+	EXPECT_FALSE(ringbuf_mpmc_create(&rbuf, mem.data(), sizeof(int), 6));
+	EXPECT_FALSE(ringbuf_mpmc_create(&rbuf, mem.data(), sizeof(int), 1));
+	ASSERT_TRUE(ringbuf_mpmc_create(&rbuf, mem.data(), sizeof(int), 8));
+
+	int in[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+	int out[10];
+
+	EXPECT_EQ(0, ringbuf_mpmc_read(&rbuf, out, 1));
+	EXPECT_EQ(5, ringbuf_mpmc_write(&rbuf, in, 5));
+	EXPECT_EQ(5, ringbuf_mpmc_get_read_count(&rbuf));
+	EXPECT_EQ(3, ringbuf_mpmc_read(&rbuf, out, 3));
+	EXPECT_EQ(1, out[0]);
+	EXPECT_EQ(3, out[2]);
+
+	// Wraps around, and stops when full
+	EXPECT_EQ(6, ringbuf_mpmc_write(&rbuf, in+5, 10));
+	EXPECT_EQ(8, ringbuf_mpmc_get_read_count(&rbuf));
+	EXPECT_EQ(0, ringbuf_mpmc_write(&rbuf, in, 1));
+	EXPECT_EQ(8, ringbuf_mpmc_read(&rbuf, out, 10));
+	for (int i = 0 ; i < 8 ; i++) {
+		EXPECT_EQ(i+4, out[i]);
+	}
+	EXPECT_EQ(0, ringbuf_mpmc_read(&rbuf, out, 10));
+	EXPECT_EQ(0, ringbuf_mpmc_get_read_count(&rbuf));
+
+	vector<char> stressMem(ringbuf_mpmc_get_buffer_size(sizeof(uint64_t), 64));
+	ringbuf_mpmc_t stressBuf;
+	ASSERT_TRUE(ringbuf_mpmc_create(&stressBuf, stressMem.data(), sizeof(uint64_t), 64));
+
+	RunMPMCStressTest(4, 3, 20000, [&](uint64_t* data, size_t len) {
+		return ringbuf_mpmc_write(&stressBuf, data, len);
+	}, [&](uint64_t* data, size_t len) {
+		return ringbuf_mpmc_read(&stressBuf, data, len);
+	});
+}
+
+
+TEST(RingBufferTest, MPMCTemplateTest)
+{
+	MPMCRingBuffer<std::string> rbuf(5);
+	EXPECT_EQ(8, rbuf.capacity());
+	EXPECT_TRUE(rbuf.isEmpty());
+
+	std::string str;
+	EXPECT_FALSE(rbuf.read(str));
+
+	for (int i = 0 ; i < 8 ; i++) {
+		EXPECT_TRUE(rbuf.write(std::string(40, 'a'+i)));
+	}
+	EXPECT_FALSE(rbuf.write(std::string("full")));
+	EXPECT_EQ(8, rbuf.readSize());
+
+	std::string out[3];
+	EXPECT_EQ(3, rbuf.read(out, 3));
+	EXPECT_EQ(std::string(40, 'c'), out[2]);
+
+	std::string moved(50, 'x');
+	EXPECT_TRUE(rbuf.write(std::move(moved)));
+	EXPECT_EQ(2, rbuf.write(out, 3));
+
+	for (int i = 3 ; i < 8 ; i++) {
+		EXPECT_TRUE(rbuf.read(str));
+		EXPECT_EQ(std::string(40, 'a'+i), str);
+	}
+	EXPECT_TRUE(rbuf.read(str));
+	EXPECT_EQ(std::string(50, 'x'), str);
+	EXPECT_EQ(2, rbuf.read(out, 3));
+	EXPECT_EQ(std::string(40, 'b'), out[1]);
+	EXPECT_TRUE(rbuf.isEmpty());
+
+	// Small size type, so that positions wrap around during the test
+	MPMCRingBuffer<uint64_t, uint16_t> stressBuf(64);
+
+	for (int numConsumers : { 1, 4 }) {
+		RunMPMCStressTest(4, numConsumers, 20000, [&](uint64_t* data, size_t len) {
+			return stressBuf.write(data, (uint16_t) len);
+		}, [&](uint64_t* data, size_t len) {
+			return stressBuf.read(data, (uint16_t) len);
+		});
+	}
+}
+
+
+TEST(RingBufferTest, ReserveCommitTest)
+{
+	RingBuffer<int> rbuf(7);
+
+	EXPECT_FALSE(rbuf.isMirrored());
+
+	RingBuffer<int>::Span span = rbuf.reserveWrite(5);
+	ASSERT_EQ(5, span.size());
+	for (int i = 0 ; i < 5 ; i++) {
+		span[i] = i+1;
+	}
+	EXPECT_EQ(0, rbuf.readSize());
+	EXPECT_EQ(3, rbuf.commitWrite(3));
+	EXPECT_EQ(3, rbuf.readSize());
+
+	span = rbuf.peekRead();
+	ASSERT_EQ(3, span.size());
+	EXPECT_EQ(1, span[0]);
+	EXPECT_EQ(3, span[2]);
+	EXPECT_EQ(2, rbuf.commitRead(2));
+
+	// The free space now wraps around, so it takes two spans to fill it
+	span = rbuf.reserveWrite();
+	EXPECT_EQ(4, span.size());
+	for (int& v : span) {
+		v = 100;
+	}
+	EXPECT_EQ(4, rbuf.commitWrite(span.size()));
+
+	span = rbuf.reserveWrite();
+	EXPECT_EQ(2, span.size());
+	EXPECT_EQ(2, rbuf.commitWrite(2));
+	EXPECT_TRUE(rbuf.isFull());
+	EXPECT_TRUE(rbuf.reserveWrite().isEmpty());
+
+	span = rbuf.peekRead(100);
+	EXPECT_EQ(5, span.size());
+	EXPECT_EQ(3, span[0]);
+	EXPECT_EQ(100, span[4]);
+	EXPECT_EQ(5, rbuf.commitRead(span.size()));
+
+	EXPECT_EQ(2, rbuf.peekRead().size());
+	EXPECT_EQ(2, rbuf.commitRead(100));
+	EXPECT_TRUE(rbuf.isEmpty());
+	EXPECT_TRUE(rbuf.peekRead().isEmpty());
+}
+
+
+TEST(RingBufferTest, MirroredTest)
+{
+	RingBuffer<uint32_t> rbuf = RingBuffer<uint32_t>::createMirrored(1000);
+
+	EXPECT_LE(1000, rbuf.capacity());
+
+	if (!rbuf.isMirrored()) {
+		// Not supported on this platform. The buffer must still work normally.
+		EXPECT_EQ(1000, rbuf.capacity());
+		return;
+	}
+
+	uint32_t cap = rbuf.capacity();
+
+	// Move the positions close to the end
+	EXPECT_EQ(cap-10, rbuf.commitWrite(cap-10));
+	EXPECT_EQ(cap-10, rbuf.commitRead(cap-10));
+
+	// Spans cross the wrap point in one piece
+	RingBuffer<uint32_t>::Span span = rbuf.reserveWrite();
+	ASSERT_EQ(cap, span.size());
+	for (uint32_t i = 0 ; i < cap ; i++) {
+		span[i] = i;
+	}
+	EXPECT_EQ(cap, rbuf.commitWrite(cap));
+
+	// Both halves see the same memory
+	uint32_t* mem = span.data() - (cap-10);
+	EXPECT_EQ(15, mem[5]);
+	EXPECT_EQ(15, mem[cap+5]);
+
+	span = rbuf.peekRead();
+	ASSERT_EQ(cap, span.size());
+	bool ok = true;
+	for (uint32_t i = 0 ; i < cap ; i++) {
+		ok = ok  &&  span[i] == i;
+	}
+	EXPECT_TRUE(ok);
+
+	// The copying interface works across the mirror, too
+	uint32_t out[20];
+	EXPECT_EQ(20, rbuf.read(out, 20));
+	EXPECT_EQ(19, out[19]);
+	EXPECT_EQ(20, rbuf.write(out, 20));
+	EXPECT_EQ(cap-20, rbuf.commitRead(cap-20));
+	EXPECT_EQ(20, rbuf.peekRead().size());
+	EXPECT_EQ(19, rbuf.peekRead()[19]);
+
+	RingBuffer<uint32_t> moved(std::move(rbuf));
+	EXPECT_TRUE(moved.isMirrored());
+	EXPECT_FALSE(rbuf.isMirrored());
+	EXPECT_EQ(20, moved.readSize());
+
+	// Rounding up to a page would overflow the size type, so we get a normal buffer
+	RingBuffer<uint8_t, uint8_t> smallBuf = RingBuffer<uint8_t, uint8_t>::createMirrored(100);
+	EXPECT_FALSE(smallBuf.isMirrored());
+	EXPECT_EQ(100, smallBuf.capacity());
+}
+
+
+TEST(RingBufferTest, WaitTest)
+{
+	RingBuffer<int> rbuf(4);
+
+	EXPECT_FALSE(rbuf.readWait(0));
+	EXPECT_FALSE(rbuf.readWait(1000));
+	EXPECT_TRUE(rbuf.writeWait(0));
+
+	std::thread writer([&]() {
+		for (int i = 0 ; i < 10 ; i++) {
+			SleepMilliseconds(2);
+			rbuf.writeWait();
+			rbuf.write(i);
+		}
+		SleepMilliseconds(2);
+		int in[4] = { 10, 11, 12, 13 };
+		EXPECT_EQ(4, rbuf.write(in, 4));
+		rbuf.writeWait();
+		rbuf.write(14);
+	});
+
+	for (int i = 0 ; i < 10 ; i++) {
+		EXPECT_TRUE(rbuf.readWait());
+		EXPECT_EQ(i, rbuf.read());
+	}
+
+	// Let the writer fill the buffer and block in writeWait()
+	while (!rbuf.isFull()) {
+		rbuf.readWait();
+		SleepMilliseconds(1);
+	}
+	SleepMilliseconds(5);
+	EXPECT_FALSE(rbuf.writeWait(0));
+	EXPECT_EQ(10, rbuf.read());
+
+	writer.join();
+	int out[4];
+	EXPECT_EQ(4, rbuf.read(out, 4));
+	EXPECT_EQ(14, out[3]);
+
+	// Stress test for lost wakeups: Both sides block as soon as they can't make progress.
+	RingBuffer<uint64_t> stressBuf(5);
+	RunSPSCStressTest(100000, [&](uint64_t* data, size_t len) {
+		stressBuf.writeWait();
+		return stressBuf.write(data, len);
+	}, [&](uint64_t* data, size_t len) {
+		stressBuf.readWait();
+		return stressBuf.read(data, len);
+	});
+
+	// Same for the C version
+	uint64_t cMem[5];
+	ringbuf_t cBuf;
+	ringbuf_create(&cBuf, cMem, sizeof(uint64_t), 5);
+
+	EXPECT_FALSE(ringbuf_read_wait(&cBuf, 100));
+	EXPECT_TRUE(ringbuf_write_wait(&cBuf, 100));
+
+	RunSPSCStressTest(100000, [&](uint64_t* data, size_t len) {
+		ringbuf_write_wait(&cBuf, -1);
+		return ringbuf_write(&cBuf, data, len);
+	}, [&](uint64_t* data, size_t len) {
+		ringbuf_read_wait(&cBuf, -1);
+		return ringbuf_read(&cBuf, data, len);
+	});
+}
@@ -23,9 +23,21 @@
 #include "global.h"
 #include <nxcommon/CString.h>
 #include <nxcommon/strutil.h>
+#include <nxcommon/cxx11hash.h>
+#include <nxcommon/BufferArena.h>
+#include <nxcommon/CStringBuilder.h>
+#include <nxcommon/WildcardPattern.h>
+#include <nxcommon/encoding.h>
+#include <nxcommon/stream/TranscodingStream.h>
+#include <nxcommon/stream/IOException.h>
 #include <vector>
 #include <list>
 #include <set>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <random>
+#include <string>
 
 #ifdef NXCOMMON_UNICODE_ENABLED
 #include <nxcommon/UString.h>
@@ -474,7 +486,8 @@ TEST(StringTest, CheckStrutilAndCString)
 	}
 
 	{
-		CString tstr("Test Blah Blah");
+		// Long enough not to be stored inline, which can't be shared
+		CString tstr("Test Blah Blah Blah Blah Blah Blah Blah");
 
 		ByteArray barr(tstr);
 		EXPECT_EQ(tstr.length(), barr.length());
@@ -586,6 +599,1347 @@ TEST(StringTest, CheckStrutilAndCString)
 }
 
 
+TEST(StringTest, HashTest)
+{
+	const char* text = "The Quick Brown Fox Jumps Over The Lazy Dog, ABCDEFGHIJKLMNOPQRSTUVWXYZ @[`{ 0123456789 \xC4\xD6\xDC";
+	size_t textLen = strlen(text);
+
+	char lowerText[256];
+	for (size_t i = 0 ; i < textLen ; i++) {
+		char c = text[i];
+		lowerText[i] = (c >= 'A'  &&  c <= 'Z') ? c - 'A' + 'a' : c;
+	}
+
+	// Covers all length classes of the hash function
+	for (size_t len = 0 ; len <= textLen ; len++) {
+		EXPECT_EQ(Hash(text, len), Hash(CString(text, len).get(), len)) << "Length " << len;
+		EXPECT_EQ(Hash(lowerText, len), LowerHash(text, len)) << "Length " << len;
+		EXPECT_EQ(Hash(lowerText, len), LowerHash(lowerText, len)) << "Length " << len;
+
+		if (len != 0) {
+			EXPECT_NE(Hash(text, len), Hash(text, len-1)) << "Length " << len;
+			EXPECT_NE(Hash(text, len), Hash(text, len, 1234)) << "Length " << len;
+		}
+	}
+
+	// Null bytes are part of the input
+	EXPECT_NE(Hash("a\0b", 3), Hash("a\0c", 3));
+	EXPECT_NE(Hash("a", 1), Hash("a\0", 2));
+
+	std::hash<CString> strHash;
+
+	CString s1("a string that is too long to be stored inline");
+	CString s2 = s1;
+	CString s3(s1.get());
+	EXPECT_EQ((size_t) Hash(s1.get(), s1.length()), strHash(s1));
+	EXPECT_EQ(strHash(s1), strHash(s2));
+	EXPECT_EQ(strHash(s1), strHash(s3));
+	EXPECT_EQ(strHash(s1), CXX11Hash<CString>()(s1));
+	EXPECT_EQ(strHash(s1), CXX11Hash<const char*>()(s1.get()));
+
+	// The cached hash must be dropped on modification
+	size_t oldHash = strHash(s2);
+	s2.append('!');
+	EXPECT_NE(oldHash, strHash(s2));
+	EXPECT_EQ(oldHash, strHash(s1));
+	EXPECT_EQ(CString(s2.get()).getHash(), s2.getHash());
+
+	s3.upper();
+	EXPECT_EQ(CString(s3.get()).getHash(), strHash(s3));
+	EXPECT_EQ((size_t) LowerHash(s3.get(), s3.length()), strHash(s1));
+
+	char* data = s3.mget();
+	data[0] = 'X';
+	s3.resize(s3.length());
+	EXPECT_EQ(CString(s3.get()).getHash(), strHash(s3));
+
+	CString s4("inline");
+	strHash(s4);
+	s4.lower().rtrim('e');
+	EXPECT_EQ(strHash(CString("inlin")), strHash(s4));
+	s4 = s1;
+	EXPECT_EQ(strHash(s1), strHash(s4));
+}
+
+
+
+TEST(StringTest, ViewTest)
+{
+	CString text("first line\n  second line \n\nfourth line, which is a bit longer than the others\n");
+
+	vector<CStringView> lines = CStringView(text).split('\n');
+	ASSERT_EQ(5, lines.size());
+	EXPECT_EQ(CStringView(CString("first line")), lines[0]);
+	EXPECT_EQ(CStringView(CString("  second line ")), lines[1]);
+	EXPECT_TRUE(lines[2].isEmpty());
+	EXPECT_FALSE(lines[2].isNull());
+	EXPECT_EQ(CStringView(CString("fourth line, which is a bit longer than the others")), lines[3]);
+	EXPECT_TRUE(lines[4].isEmpty());
+
+	// The views point into the original buffer
+	for (const CStringView& line : lines) {
+		EXPECT_GE(line.get(), text.get());
+		EXPECT_LE(line.get() + line.length(), text.get() + text.length());
+	}
+	EXPECT_EQ(text.get() + 11, lines[1].get());
+
+	// Views must stay valid after the original is modified or destroyed
+	CStringView secondLine = lines[1];
+	text.append(CString("more"));
+	text = CString();
+	EXPECT_EQ(CStringView(CString("  second line ")), secondLine);
+
+	EXPECT_EQ(CStringView(CString("second line")), CStringView(secondLine).trim());
+	EXPECT_EQ(CStringView(CString("second line ")), CStringView(secondLine).ltrim());
+	EXPECT_EQ(CStringView(CString("  second line")), CStringView(secondLine).rtrim());
+	EXPECT_EQ(CStringView(CString("econd line ")), CStringView(secondLine).ltrim(" s"));
+	EXPECT_EQ(CStringView(CString("  second")), CStringView(secondLine).rtrim(' ').rtrim(CString("line").get()).rtrim(' '));
+	EXPECT_TRUE(CStringView(CString("   ")).trim().isEmpty());
+
+	CStringView second = secondLine.substr(2, 6);
+	EXPECT_EQ(secondLine.get() + 2, second.get());
+	EXPECT_EQ(CString("second"), (CString) second);
+	EXPECT_EQ(CString("second"), second.toBuffer());
+	EXPECT_EQ('c', second[2]);
+	EXPECT_EQ(3, second.indexOf('o'));
+	EXPECT_EQ(-1, second.indexOf('x'));
+	EXPECT_EQ(2, secondLine.indexOf(CStringView(CString("sec"))));
+	EXPECT_EQ(9, secondLine.lastIndexOf('l'));
+	EXPECT_TRUE(secondLine.startsWith(CString("  sec")));
+	EXPECT_TRUE(secondLine.endsWith(CString("line ")));
+	EXPECT_FALSE(secondLine.endsWith(CString("line")));
+
+	EXPECT_LT(CStringView(CString("abc")), CStringView(CString("abd")));
+	EXPECT_LT(CStringView(CString("ab")), CStringView(CString("abc")));
+	EXPECT_NE(CStringView(CString("abc")), CStringView(CString("abc")).substr(1));
+
+	CString lstr("The view of a long string, which is shared with the buffer instead of copied.");
+	CStringView lview(lstr);
+	EXPECT_EQ(std::hash<CString>()(lstr), std::hash<CStringView>()(lview));
+	EXPECT_EQ(std::hash<CString>()(lstr.substr(4)), std::hash<CStringView>()(lview.substr(4)));
+
+	// Suffixes of heap strings can be converted without copying, other parts must be copied for the terminator
+	CString suffix = lview.substr(4);
+	EXPECT_EQ(lstr.get() + 4, suffix.get());
+	EXPECT_EQ(CString("view of a long string, which is shared with the buffer instead of copied."), suffix);
+	CString infix = lview.substr(4, 50);
+	EXPECT_NE(lstr.get() + 4, infix.get());
+	EXPECT_EQ('\0', infix.get()[50]);
+	EXPECT_EQ(lstr.get(), ((CString) lview).get());
+
+	// Writing to a shared suffix copies it
+	suffix.append('!');
+	EXPECT_NE(lstr.get() + 4, suffix.get());
+	EXPECT_EQ(CString("The view of a long string, which is shared with the buffer instead of copied."), lstr);
+
+	EXPECT_EQ(lstr.get() + 4, lstr.substr(4).get());
+	EXPECT_EQ(CString("view"), lstr.substr(4, 4));
+
+	CStringView nullView;
+	EXPECT_TRUE(nullView.isNull());
+	EXPECT_TRUE(nullView.isEmpty());
+	EXPECT_TRUE(nullView.toBuffer().isNull());
+}
+
+
+
+TEST(StringTest, ConcurrentCopyOnWriteTest)
+{
+	const int numThreads = 8;
+	const int numIterations = 20000;
+
+	vector<CString> sources;
+	for (int i = 0 ; i < 16 ; i++) {
+		sources.push_back(CString::format("Shared source string #%d, long enough to live on the heap", i));
+	}
+
+	// Each thread leaves one copy of its last string here for the next thread
+	vector<CString> handoff(numThreads);
+
+	std::atomic<int> numErrors(0);
+	vector<std::thread> threads;
+
+	for (int t = 0 ; t < numThreads ; t++) {
+		threads.emplace_back([&, t]() {
+			for (int i = 0 ; i < numIterations ; i++) {
+				const CString& src = sources[(i + t) % sources.size()];
+
+				CString copy = src;
+				CString copy2 = copy;
+
+				if (copy.get() != src.get()) {
+					numErrors++;
+				}
+
+				switch (i % 4) {
+				case 0:
+					copy.append('!');
+					break;
+				case 1:
+					copy.upper();
+					break;
+				case 2:
+					copy.ltrim("S");
+					break;
+				case 3:
+					copy = CString(ByteArray(copy)).substr(7);
+					copy.mget()[0] = 'X';
+					break;
+				}
+
+				if (copy.get() == src.get()  ||  copy2.get() != src.get()  ||  copy2 != src) {
+					numErrors++;
+				}
+
+				if (i % 4 == 0  &&  (copy.length() != src.length()+1  ||  !copy.startsWith(src))) {
+					numErrors++;
+				}
+			}
+
+			handoff[t] = sources[t % sources.size()];
+			handoff[t].append(CString::format(" (thread %d)", t));
+		});
+	}
+
+	for (std::thread& t : threads) {
+		t.join();
+	}
+
+	EXPECT_EQ(0, numErrors.load());
+
+	for (int i = 0 ; i < 16 ; i++) {
+		EXPECT_EQ(CString::format("Shared source string #%d, long enough to live on the heap", i), sources[i]);
+	}
+
+	// Modify the handed off strings from other threads
+	threads.clear();
+
+	for (int t = 0 ; t < numThreads ; t++) {
+		threads.emplace_back([&, t]() {
+			CString str = handoff[(t+1) % numThreads];
+			str.upper();
+			handoff[(t+1) % numThreads] = str;
+		});
+	}
+
+	for (std::thread& t : threads) {
+		t.join();
+	}
+
+	for (int t = 0 ; t < numThreads ; t++) {
+		CString expected = CString::format("Shared source string #%d, long enough to live on the heap (thread %d)",
+				t % 16, t).upper();
+		EXPECT_EQ(expected, handoff[t]);
+	}
+}
+
+
+
+TEST(StringTest, InlineStorageTest)
+{
+	CString nullStr;
+	EXPECT_TRUE(nullStr.isNull());
+	EXPECT_TRUE(nullStr.isInline());
+
+	CString s1("Short");
+	EXPECT_TRUE(s1.isInline());
+	EXPECT_EQ(CString::InlineCapacity, s1.getCapacity());
+
+	// Copies of inline strings don't share their data
+	CString s2 = s1;
+	EXPECT_NE(s1.get(), s2.get());
+	EXPECT_EQ(s1, s2);
+	s2.append(" and sweet");
+	EXPECT_EQ(CString("Short"), s1);
+	EXPECT_EQ(CString("Short and sweet"), s2);
+	EXPECT_TRUE(s2.isInline());
+
+	s2.prepend('A').insert(1, CString(" very"));
+	EXPECT_EQ(CString("A veryShort and sweet"), s2);
+	EXPECT_TRUE(s2.isInline());
+
+	// Growing past the inline capacity moves to the heap
+	CString inlineMax(std::string(CString::InlineCapacity, 'x').c_str());
+	EXPECT_TRUE(inlineMax.isInline());
+	inlineMax.append('y');
+	EXPECT_FALSE(inlineMax.isInline());
+	EXPECT_EQ(CString::InlineCapacity+1, inlineMax.length());
+	EXPECT_EQ('y', inlineMax[CString::InlineCapacity]);
+
+	// Heap strings are still shared when copied...
+	CString heapCopy = inlineMax;
+	EXPECT_EQ(inlineMax.get(), heapCopy.get());
+
+	// ... and return to inline storage when squeezed small enough
+	heapCopy.resize(4);
+	heapCopy.squeeze();
+	EXPECT_TRUE(heapCopy.isInline());
+	EXPECT_EQ(CString("xxxx"), heapCopy);
+	EXPECT_EQ(CString::InlineCapacity+1, inlineMax.length());
+
+	// Read aliases stay aliases until written to, even when short
+	const char* raBuf = "alias";
+	CString ra = CString::readAlias(raBuf);
+	EXPECT_FALSE(ra.isInline());
+	EXPECT_EQ(raBuf, ra.get());
+	ra.upper();
+	EXPECT_NE(raBuf, ra.get());
+	EXPECT_EQ(CString("ALIAS"), ra);
+	EXPECT_EQ(0, strcmp(raBuf, "alias"));
+
+	// Write aliases keep writing to the external buffer
+	char waBuf[16] = "abc";
+	CString wa = CString::writeAlias(waBuf, 3, sizeof(waBuf));
+	EXPECT_FALSE(wa.isInline());
+	wa.append("def");
+	EXPECT_EQ(waBuf, wa.get());
+	EXPECT_EQ(0, strcmp(waBuf, "abcdef"));
+
+	// Moving between inline and heap buffers by assignment
+	CString assigned = inlineMax;
+	EXPECT_FALSE(assigned.isInline());
+	assigned = s1;
+	EXPECT_TRUE(assigned.isInline());
+	EXPECT_EQ(s1, assigned);
+	assigned = inlineMax;
+	EXPECT_FALSE(assigned.isInline());
+	EXPECT_EQ(inlineMax.get(), assigned.get());
+
+	ByteArray barr(ByteArray::InlineCapacity);
+	EXPECT_TRUE(barr.isInline());
+	EXPECT_EQ(ByteArray::InlineCapacity, barr.getCapacity());
+}
+
+
+TEST(StringTest, BufferArenaTest)
+{
+	const std::string longText(100, 'a');
+
+	size_t chunksBefore = BufferArena::getLiveChunkCount();
+	EXPECT_EQ(NULL, BufferArena::getCurrent());
+
+	CString escaped;
+	ByteArray escapedBytes;
+
+	{
+		BufferArena arena(4096);
+		EXPECT_EQ(&arena, BufferArena::getCurrent());
+
+		// Heap buffers come from the arena, inline ones don't need it
+		CString inl("short");
+		EXPECT_EQ(0, arena.getAllocatedSize());
+
+		CString s1(longText.c_str());
+		EXPECT_LT(100, arena.getAllocatedSize());
+		EXPECT_EQ(1, arena.getChunkCount());
+		EXPECT_EQ(chunksBefore+1, BufferArena::getLiveChunkCount());
+
+		CString s2 = CString::format("%s-%d", longText.c_str(), 42);
+		EXPECT_EQ(longText + "-42", std::string(s2));
+
+		// Sharing and copy-on-write work as usual
+		CString s3 = s1;
+		EXPECT_EQ(s1.get(), s3.get());
+		s3.append('b');
+		EXPECT_NE(s1.get(), s3.get());
+		EXPECT_EQ(longText, std::string(s1));
+		EXPECT_EQ(longText + "b", std::string(s3));
+
+		// Allocations too large for the arena go to the heap
+		size_t sizeBefore = arena.getAllocatedSize();
+		CString large(std::string(4096, 'x').c_str());
+		EXPECT_EQ(sizeBefore, arena.getAllocatedSize());
+
+		// Nested arenas take over until they are destroyed
+		{
+			BufferArena inner;
+			EXPECT_EQ(&inner, BufferArena::getCurrent());
+			CString innerStr(longText.c_str());
+			EXPECT_LT(0, inner.getAllocatedSize());
+			EXPECT_EQ(sizeBefore, arena.getAllocatedSize());
+		}
+		EXPECT_EQ(&arena, BufferArena::getCurrent());
+
+		// Filling the arena allocates more chunks
+		for (int i = 0 ; i < 100 ; i++) {
+			CString tmp(longText.c_str());
+		}
+		EXPECT_LT(1, arena.getChunkCount());
+
+		escaped = s2;
+		escapedBytes = ByteArray((const uint8_t*) longText.c_str(), longText.length());
+	}
+
+	EXPECT_EQ(NULL, BufferArena::getCurrent());
+
+	// Buffers escaping the arena keep their chunks alive and stay usable
+	EXPECT_LT(chunksBefore, BufferArena::getLiveChunkCount());
+	EXPECT_EQ(longText + "-42", std::string(escaped));
+	EXPECT_EQ(longText.length(), escapedBytes.getSize());
+	EXPECT_EQ(0, memcmp(longText.c_str(), escapedBytes.get(), longText.length()));
+
+	// Copies taken outside of the scope get their own storage instead of keeping the chunk alive
+	CString escapedCopy = escaped;
+	EXPECT_NE(escaped.get(), escapedCopy.get());
+	EXPECT_EQ(escaped, escapedCopy);
+	CString escapedAssigned;
+	escapedAssigned = escaped;
+	EXPECT_NE(escaped.get(), escapedAssigned.get());
+	EXPECT_EQ(escaped, escapedAssigned);
+
+	escaped.append("-escaped");
+	EXPECT_EQ(longText + "-42-escaped", std::string(escaped));
+
+	// ... and may be released in another thread
+	std::thread([&escapedBytes]() {
+		ByteArray moved = escapedBytes;
+		escapedBytes = ByteArray();
+	}).join();
+
+	escaped = CString();
+	EXPECT_EQ(chunksBefore, BufferArena::getLiveChunkCount());
+	EXPECT_EQ(longText + "-42", std::string(escapedCopy));
+	EXPECT_EQ(longText + "-42", std::string(escapedAssigned));
+}
+
+
+
+TEST(StringTest, BuilderTest)
+{
+	CStringBuilder empty;
+	EXPECT_TRUE(empty.isEmpty());
+	EXPECT_EQ(CString(""), empty.toCString());
+
+	CStringBuilder b;
+	b << "Hello" << ' ' << CString("World") << ", " << 42 << " " << -7;
+	b.appendFormat(" [%s:%d]", "fmt", 3);
+	EXPECT_EQ(CString("Hello World, 42 -7 [fmt:3]"), b.toCString());
+	EXPECT_EQ(1, b.getChunkCount());
+
+	// Appending after flattening must not change the flat string handed out before
+	CString flat = b.toCString();
+	b.append("!");
+	EXPECT_EQ(CString("Hello World, 42 -7 [fmt:3]"), flat);
+	EXPECT_EQ(CString("Hello World, 42 -7 [fmt:3]!"), b.toCString());
+
+	// Large outputs are spread across chunks and flattened on demand
+	std::string expected;
+	CStringBuilder large;
+	for (int i = 0 ; i < 20000 ; i++) {
+		large.appendFormat("line %d\n", i);
+		expected += "line " + std::to_string(i) + "\n";
+	}
+	EXPECT_EQ(expected.length(), large.length());
+	EXPECT_LT(1, large.getChunkCount());
+
+	size_t chunkLenSum = 0;
+	for (size_t i = 0 ; i < large.getChunkCount() ; i++) {
+		CStringView chunk = large.getChunk(i);
+		EXPECT_GE(CStringBuilder::MaxChunkSize, chunk.length());
+		chunkLenSum += chunk.length();
+	}
+	EXPECT_EQ(expected.length(), chunkLenSum);
+
+	std::ostringstream out;
+	out << large;
+	EXPECT_EQ(expected, out.str());
+
+	CString largeFlat = large.toCString();
+	EXPECT_EQ(expected, std::string(largeFlat));
+	EXPECT_EQ(1, large.getChunkCount());
+	EXPECT_EQ(largeFlat.get(), large.toCString().get());
+
+	// Long strings are shared instead of copied
+	CString longStr(std::string(CStringBuilder::ShareThreshold, 'x').c_str());
+	CStringBuilder shared;
+	shared.append("a");
+	shared.append(longStr);
+	shared.append("b");
+	EXPECT_EQ(3, shared.getChunkCount());
+	EXPECT_EQ(longStr.get(), shared.getChunk(1).get());
+	EXPECT_EQ(CString("a").append(longStr).append('b'), shared.toCString());
+
+	// Joining and indenting
+	vector<CString> parts = { CString("a"), CString("b"), CString("c") };
+	CStringBuilder joined;
+	joined.appendJoined(CString(", "), parts.begin(), parts.end());
+	EXPECT_EQ(CString("a, b, c"), joined.toCString());
+	EXPECT_EQ(CString("a, b, c"), CString::join(CString(", "), parts.data(), parts.size()));
+
+	CString text("first\nsecond\nthird");
+	CStringBuilder indented;
+	indented.appendIndented(text, CString("  "), true);
+	EXPECT_EQ(text.indented(CString("  "), true), indented.toCString());
+
+	b.clear();
+	EXPECT_TRUE(b.isEmpty());
+	EXPECT_EQ(0, b.getChunkCount());
+
+#ifdef _POSIX_VERSION
+	// Scatter output to a file descriptor
+	FILE* tmp = tmpfile();
+	ASSERT_TRUE(tmp != NULL);
+	CStringBuilder fdOut;
+	for (int i = 0 ; i < 20000 ; i++) {
+		fdOut.appendFormat("line %d\n", i);
+	}
+	fdOut.append(longStr);
+	fdOut.writeTo(fileno(tmp));
+
+	std::string expectedFd = expected + std::string(longStr);
+	std::string readBack(expectedFd.length() + 1, '\0');
+	rewind(tmp);
+	EXPECT_EQ(expectedFd.length(), fread(&readBack[0], 1, readBack.length(), tmp));
+	readBack.resize(expectedFd.length());
+	EXPECT_EQ(expectedFd, readBack);
+	fclose(tmp);
+#endif
+}
+
+
+
+TEST(StringTest, SimdTest)
+{
+	std::minstd_rand rng(1234);
+
+	// Small alphabet, so that matches and partial matches are frequent
+	auto randomString = [&](size_t len) {
+		std::string str;
+		for (size_t i = 0 ; i < len ; i++) {
+			str += "abcAB \t\\"[rng() % 8];
+		}
+		return str;
+	};
+
+	StrSimdLevel origLevel = GetStrSimdLevel();
+
+	for (int level = StrSimdScalar ; level <= GetStrSimdMaxLevel() ; level++) {
+		SCOPED_TRACE(StrSimdLevelName((StrSimdLevel) level));
+		EXPECT_EQ(level, SetStrSimdLevel((StrSimdLevel) level));
+
+		StrCharSet ws(" \t");
+		StrCharSet large("!\"#$%&'()*+,-./:;<=>?@[]^_`{|}~ \t");
+
+		for (size_t len = 0 ; len < 150 ; len++) {
+			std::string str = randomString(len);
+			const char* beg = str.c_str();
+			const char* end = beg + len;
+
+			for (char c : { 'a', 'B', '\\', 'x' }) {
+				size_t idx = str.find(c);
+				EXPECT_EQ(idx == std::string::npos ? end : beg+idx, FindChar(beg, end, c));
+			}
+
+			for (size_t nlen = 1 ; nlen < 6 ; nlen++) {
+				std::string needle = randomString(nlen);
+				size_t idx = str.find(needle);
+				EXPECT_EQ(idx == std::string::npos ? end : beg+idx, FindSubstring(beg, end, needle.c_str(), nlen));
+			}
+			EXPECT_EQ(beg, FindSubstring(beg, end, "", 0));
+
+			for (const StrCharSet* set : { &ws, &large }) {
+				const char* ref = beg;
+				while (ref != end  &&  !set->contains(*ref)) ref++;
+				EXPECT_EQ(ref, FindFirstOf(beg, end, *set));
+
+				const char* refLast = NULL;
+				const char* refLastNot = NULL;
+				for (const char* p = beg ; p != end ; p++) {
+					(set->contains(*p) ? refLast : refLastNot) = p;
+				}
+				EXPECT_EQ(refLast, FindLastOf(beg, end, *set));
+				EXPECT_EQ(refLastNot, FindLastNotOf(beg, end, *set));
+			}
+
+			std::string lower(str), upper(str);
+			for (char& c : lower) c = (c >= 'A'  &&  c <= 'Z') ? c+32 : c;
+			for (char& c : upper) c = (c >= 'a'  &&  c <= 'z') ? c-32 : c;
+			std::string conv(len, '\0');
+			EXPECT_EQ(len, AsciiToLower(&conv[0], beg, len));
+			EXPECT_EQ(lower, conv);
+			EXPECT_EQ(len, AsciiToUpper(&conv[0], beg, len));
+			EXPECT_EQ(upper, conv);
+
+			std::u16string str16(str.begin(), str.end());
+			size_t idx16 = str16.find(u'c');
+			EXPECT_EQ(idx16 == std::u16string::npos ? str16.data()+len : str16.data()+idx16,
+					FindChar16(str16.data(), str16.data()+len, u'c'));
+		}
+
+		// Case conversion stops at null characters, and leaves non-ASCII characters alone
+		char withNull[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ\0ABCDEFGHIJKLMNOPQRSTUVWXYZ\xC4\xD6";
+		EXPECT_EQ(26, AsciiToLower(withNull, withNull, sizeof(withNull)-1));
+		EXPECT_EQ(0, memcmp(withNull, "abcdefghijklmnopqrstuvwxyz\0ABCDEFGHIJKLMNOPQRSTUVWXYZ\xC4\xD6", sizeof(withNull)));
+		EXPECT_EQ(2, AsciiToUpper(withNull+53, withNull+53, 2));
+		EXPECT_EQ(0, memcmp(withNull+53, "\xC4\xD6", 2));
+
+		// The strutil functions built on top of them
+		std::string longWs = std::string("  some text with\ttabs") + std::string(40, ' ') + "\t \t";
+		EXPECT_EQ(longWs.c_str() + 21, rtrimfind(longWs.c_str(), " \t"));
+		EXPECT_EQ(longWs.c_str() + 16, FindLastOccurrence(longWs.c_str(), longWs.c_str() + 21, '\t'));
+		EXPECT_EQ(NULL, FindLastOccurrence(longWs.c_str(), longWs.c_str() + 5, 'x'));
+
+		char escaped[128];
+		const char* toEscape = "He said \"Hello\" to the \\ of \"all\" the \"things\", twice.";
+		EXPECT_EQ(strlen(toEscape)+7, EscapeString(escaped, toEscape, sizeof(escaped), "\"\\"));
+		EXPECT_EQ(std::string("He said \\\"Hello\\\" to the \\\\ of \\\"all\\\" the \\\"things\\\", twice."),
+				std::string(escaped));
+		EXPECT_EQ(9, EscapeString(escaped, toEscape, 10, "\"\\"));
+		EXPECT_EQ(std::string("He said \\"), std::string(escaped));
+
+		CString cstr(longWs.c_str());
+		EXPECT_EQ(16, cstr.indexOf('\t'));
+		EXPECT_EQ(7, cstr.indexOf(CString("text")));
+		EXPECT_EQ(-1, cstr.indexOf(CString("texts")));
+	}
+
+	SetStrSimdLevel(origLevel);
+}
+
+
+// The original recursive implementation of WildcardMatch(), used as a reference
+static bool WildcardMatchReference(const char* pattern, const char* text)
+{
+	bool escaped = false;
+	while (*text != '\0') {
+		if (escaped) {
+			if (*text != *pattern) {
+				return false;
+			}
+			escaped = false;
+		} else {
+			switch (*pattern) {
+			case '?':
+				break;
+			case '*':
+				do {
+					pattern++;
+				} while(*pattern == '*');
+				if (*pattern == '\0') {
+					return true;
+				}
+				while (*text != '\0') {
+					if (WildcardMatchReference(pattern, text)) {
+						return true;
+					}
+					text++;
+				}
+				return false;
+			case '\\':
+				escaped = true;
+				text--;
+				break;
+			default:
+				if (*pattern != *text) {
+					return false;
+				}
+				break;
+			}
+		}
+		text++;
+		pattern++;
+	}
+	while (*pattern == '*') pattern++;
+	return *pattern == '\0';
+}
+
+
+TEST(StringTest, WildcardPatternTest)
+{
+	std::minstd_rand rng(4711);
+
+	auto randomString = [&](const char* alphabet, size_t maxLen) {
+		std::string str;
+		size_t len = rng() % (maxLen+1);
+		for (size_t i = 0 ; i < len ; i++) {
+			str += alphabet[rng() % strlen(alphabet)];
+		}
+		return str;
+	};
+
+	// Random patterns must give the same results as the original implementation
+	for (int i = 0 ; i < 20000 ; i++) {
+		std::string pattern = randomString("ab*?\\", 8);
+		std::string text = randomString("ab*?\\", 12);
+
+		bool expected = WildcardMatchReference(pattern.c_str(), text.c_str());
+
+		EXPECT_EQ(expected, WildcardMatch(pattern.c_str(), text.c_str()))
+				<< "Pattern: " << pattern << ", text: " << text;
+		EXPECT_EQ(expected, WildcardPattern(pattern.c_str()).match(text.c_str()))
+				<< "Pattern: " << pattern << ", text: " << text;
+	}
+
+	// Case-insensitive matching
+	WildcardPattern ci("*.TX?", false);
+	EXPECT_TRUE(ci.match("readme.txt"));
+	EXPECT_TRUE(ci.match("README.TXT"));
+	EXPECT_FALSE(ci.match("readme.doc"));
+	EXPECT_FALSE(WildcardPattern("*.TX?").match("readme.txt"));
+	EXPECT_TRUE(ci.match(CString(std::string(300, 'A').append(".Txt").c_str())));
+
+	WildcardPattern prefixed("data_*_v?.\\*ext*");
+	EXPECT_EQ(CString("data_"), prefixed.getLiteralPrefix());
+	EXPECT_EQ(CString(""), prefixed.getLiteralSuffix());
+	EXPECT_EQ(CString(".txt"), WildcardPattern("*.txt").getLiteralSuffix());
+	EXPECT_EQ(CString("abc"), WildcardPattern("abc?def").getLiteralPrefix());
+	EXPECT_TRUE(prefixed.match("data_x_v1.*ext"));
+	EXPECT_FALSE(prefixed.match("data_x_v1.xext"));
+
+	// Patterns that need exponential time with naive backtracking
+	std::string manyAs(5000, 'a');
+	EXPECT_FALSE(WildcardPattern("*a*a*a*a*a*a*a*a*b").match(manyAs.c_str()));
+	EXPECT_FALSE(WildcardMatch("*a*a*a*a*a*a*a*a*b", manyAs.c_str()));
+	EXPECT_TRUE(WildcardPattern("*a*a*a*a*a*a*a*a*").match(manyAs.c_str()));
+
+	// Batch matching
+	vector<CString> names = { CString("image.png"), CString("notes.txt"), CString("photo.PNG"), CString("png") };
+	vector<size_t> matched = WildcardPattern("*.png", false).matchAll(names);
+	ASSERT_EQ(2, matched.size());
+	EXPECT_EQ(0, matched[0]);
+	EXPECT_EQ(2, matched[1]);
+
+	bool results[4];
+	EXPECT_EQ(1, WildcardPattern("*.png").matchAll(names.data(), names.size(), results));
+	EXPECT_TRUE(results[0]);
+	EXPECT_FALSE(results[1]);
+	EXPECT_FALSE(results[2]);
+	EXPECT_FALSE(results[3]);
+}
+
+
+TEST(StringTest, NumberConversionTest)
+{
+	bool ok;
+
+	// Integer parsing keeps the success semantics, including base prefixes
+	EXPECT_EQ(0, StringToUInt32("0", 0, &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(0, StringToInt32("-0", 10, &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(1234567890u, StringToUInt32("1234567890", 10, &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(42, StringToInt32("+42", 0, &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(0x1F, StringToInt32("0x1f", 0, &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(0xAB, StringToInt32("0XAB", 16, &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(0xAB, StringToInt32("ab", 16, &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(8, StringToInt32("010", 0, &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(10, StringToInt32("010", 10, &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(35, StringToInt32("z", 36, &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(5, StringToInt32("101", 2, &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(-123456789012345678LL, StringToInt64("-00000123456789012345678", 10, &ok));
+	EXPECT_TRUE(ok);
+
+	const char* invalid[] = { "", "-", "+", "0x", "12a", "1 2", " 12", "--1", "0x1g", "1.5", "9" };
+	for (const char* str : invalid) {
+		ok = true;
+		EXPECT_EQ(0, StringToInt32(str, str[0] == '9' ? 8 : 0, &ok)) << str;
+		EXPECT_FALSE(ok) << str;
+	}
+
+	ok = true;
+	StringToUInt32("-1", 10, &ok);
+	EXPECT_FALSE(ok);
+	StringToInt32("1", 37, &ok);
+	EXPECT_FALSE(ok);
+
+	// Range checks at the limits of each type
+	EXPECT_EQ(255, StringToUInt8("255", 10, &ok));
+	EXPECT_TRUE(ok);
+	StringToUInt8("256", 10, &ok);
+	EXPECT_FALSE(ok);
+	EXPECT_EQ(-128, StringToInt8("-128", 10, &ok));
+	EXPECT_TRUE(ok);
+	StringToInt8("128", 10, &ok);
+	EXPECT_FALSE(ok);
+	StringToInt8("-129", 10, &ok);
+	EXPECT_FALSE(ok);
+	EXPECT_EQ(-32768, StringToInt16("-0x8000", 0, &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(UINT64_MAX, StringToUInt64("18446744073709551615", 10, &ok));
+	EXPECT_TRUE(ok);
+	StringToUInt64("18446744073709551616", 10, &ok);
+	EXPECT_FALSE(ok);
+	StringToUInt64("99999999999999999999", 10, &ok);
+	EXPECT_FALSE(ok);
+	StringToUInt64("123456789012345678901", 10, &ok);
+	EXPECT_FALSE(ok);
+	EXPECT_EQ(UINT64_MAX, StringToUInt64("ffffffffffffffff", 16, &ok));
+	EXPECT_TRUE(ok);
+	StringToUInt64("10000000000000000", 16, &ok);
+	EXPECT_FALSE(ok);
+	EXPECT_EQ(INT64_MIN, StringToInt64("-9223372036854775808", 10, &ok));
+	EXPECT_TRUE(ok);
+	StringToInt64("9223372036854775808", 10, &ok);
+	EXPECT_FALSE(ok);
+
+	// Only the given length is parsed
+	EXPECT_EQ(123, StringToInt32("12345", 3, 10, &ok));
+	EXPECT_TRUE(ok);
+
+	std::mt19937_64 rng(1337);
+
+	for (int i = 0 ; i < 10000 ; i++) {
+		uint64_t val = rng() >> (rng() % 64);
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%llu", (unsigned long long) val);
+		EXPECT_EQ(val, StringToUInt64(buf, 10, &ok)) << buf;
+		EXPECT_TRUE(ok);
+
+		EXPECT_EQ(strlen(buf), ULongLongToString(buf, val));
+		EXPECT_EQ(val, strtoull(buf, NULL, 10));
+
+		int64_t sval = (int64_t) val * ((i % 2 == 0) ? -1 : 1);
+		EXPECT_EQ(CString::format("%lld", (long long) sval), CString().append((long long) sval));
+	}
+
+	EXPECT_EQ(CString("-9223372036854775808"), CString().append((long long) INT64_MIN));
+	EXPECT_EQ(CString("FF"), CString().append(255ULL, 16));
+
+	// Double parsing
+	EXPECT_EQ(1.5, StringToDouble("1.5", &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(-0.25, StringToDouble("-.25", &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(100.0, StringToDouble("1e2", &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(1.0, StringToDouble("1.", &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(0.0, StringToDouble("0.000", &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(0.0, StringToDouble("1e-400", &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(std::numeric_limits<double>::infinity(), StringToDouble("1e400", &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(std::numeric_limits<double>::infinity(), StringToDouble("-inf", &ok) * -1);
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(255.0, StringToDouble("0xff", &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(2.5, StringToDouble("2.5xyz", 3, &ok));
+	EXPECT_TRUE(ok);
+	EXPECT_EQ(1.5f, StringToFloat("1.5", &ok));
+	EXPECT_TRUE(ok);
+
+	const char* invalidDoubles[] = { "", "-", ".", "1e", "1e+", "1.5.2", "1,5", "1e5x", "abc" };
+	for (const char* str : invalidDoubles) {
+		ok = true;
+		StringToDouble(str, &ok);
+		EXPECT_FALSE(ok) << str;
+	}
+
+	// Hard cases for correct rounding, compared against strtod in the C locale
+	const char* exact[] = {
+			"2.2250738585072011e-308", "2.2250738585072014e-308", "4.9e-324", "1.7976931348623157e308",
+			"1.7976931348623159e308", "9007199254740993", "0.1", "123456789012345678901234567890",
+			"7.038531e-26", "3.0540412e5", "0.000000000000000000000000000000123",
+			"2.4703282292062327208828439643411068618252990130716238221279284125033775363510437593264991818081799618989828234772285886546332835517796989819938739800539093906315035659515570226392290858392449105184435931802849936536152500319370457678249219365623669863658480757001585769269903706311928279558551332927834338409351978015531246597263579574622766465272827220056374006485499977096599470454020828166226237857393450736339007967761930577506740176324673600968951340535537458516661134223766678604162159680461914467291840300530057530849048765391711386591646239524912623653881879636239373280423891018672348497668235089863388587925628302755995657524455507255189313690836254779186948667994968324049705821028513185451396213837722826145437693412532098591327667236328125e-324",
+	};
+
+	for (const char* str : exact) {
+		EXPECT_EQ(strtod(str, NULL), StringToDouble(str, &ok)) << str;
+		EXPECT_TRUE(ok);
+	}
+
+	// Overflow right around DBL_MAX, including 309-digit integers just below and above it
+	char maxBuf[400];
+	snprintf(maxBuf, sizeof(maxBuf), "%.0f", std::numeric_limits<double>::max());
+	std::string maxStr(maxBuf);
+	std::string aboveMaxStr = maxStr;
+	aboveMaxStr[aboveMaxStr.size()-1]++;
+	std::string overflowStr = "18" + std::string(307, '0');
+
+	std::string overflows[] = { "1e309", "-1e309", "1.8e308", "2e+308", "-2e+308", "10e308", "0.1e310",
+			maxStr, aboveMaxStr, overflowStr, "-" + overflowStr };
+
+	for (const std::string& str : overflows) {
+		EXPECT_EQ(strtod(str.c_str(), NULL), StringToDouble(str.c_str(), &ok)) << str;
+		EXPECT_TRUE(ok);
+	}
+	EXPECT_EQ(-std::numeric_limits<double>::infinity(), StringToDouble("-1e309", &ok));
+	EXPECT_EQ(std::numeric_limits<double>::infinity(), StringToDouble(overflowStr.c_str(), &ok));
+
+	// Random round trips through both the formatter and the parser
+	for (int i = 0 ; i < 10000 ; i++) {
+		uint64_t bits = rng();
+		double val;
+		memcpy(&val, &bits, sizeof(val));
+
+		if (val != val  ||  val == std::numeric_limits<double>::infinity()
+				||  val == -std::numeric_limits<double>::infinity()) {
+			continue;
+		}
+
+		char buf[32];
+		size_t len = DoubleToString(buf, val);
+		EXPECT_EQ(strlen(buf), len);
+		EXPECT_EQ(val, StringToDouble(buf, &ok)) << buf;
+		EXPECT_TRUE(ok);
+		EXPECT_EQ(strtod(buf, NULL), val) << buf;
+
+		snprintf(buf, sizeof(buf), "%.17g", val);
+		EXPECT_EQ(val, StringToDouble(buf, &ok)) << buf;
+
+		snprintf(buf, sizeof(buf), "%.6f", (double) (rng() % 100000000) / 997.0);
+		EXPECT_EQ(strtod(buf, NULL), StringToDouble(buf, &ok)) << buf;
+	}
+
+	// Formatting
+	EXPECT_EQ(CString("0.1"), CString().append(0.1));
+	EXPECT_EQ(CString("-1.5"), CString().append(-1.5));
+	EXPECT_EQ(CString("0.0"), CString().append(0.0));
+	EXPECT_EQ(CString("1e100"), CString().append(1e100));
+	EXPECT_EQ(CString("nan"), CString().append(std::numeric_limits<double>::quiet_NaN()));
+	EXPECT_EQ(CString("-inf"), CString().append(-std::numeric_limits<double>::infinity()));
+	EXPECT_EQ(CString("x=2.5"), CString("x=").append(2.5));
+	EXPECT_EQ(CString("0.25;"), (CStringBuilder() << 0.25 << ';').toCString());
+
+	CString longFormatted = CString::format("%s-%0300d", "x", 7);
+	EXPECT_EQ(302, longFormatted.length());
+	EXPECT_EQ(CString("x-00"), CString(longFormatted.get(), 4));
+}
+
+
+TEST(StringTest, InternTest)
+{
+	size_t baseCount = CString::getInternedCount();
+
+	{
+		CString a = CString::intern("column_name");
+		CString b = CString("column_name").intern();
+		CString c = CString::intern(std::string("xcolumn_name").c_str() + 1);
+
+		// Even short strings share one buffer
+		EXPECT_TRUE(a.isInterned());
+		EXPECT_FALSE(a.isInline());
+		EXPECT_EQ(a.get(), b.get());
+		EXPECT_EQ(a.get(), c.get());
+		EXPECT_EQ(a, b);
+		EXPECT_EQ(CString("column_name"), a);
+		EXPECT_EQ(CString("column_name").getHash(), a.getHash());
+		EXPECT_EQ(baseCount+1, CString::getInternedCount());
+
+		CString other = CString::intern("column_namf");
+		EXPECT_NE(a, other);
+		EXPECT_NE(a.get(), other.get());
+		EXPECT_EQ(baseCount+2, CString::getInternedCount());
+
+		EXPECT_EQ(a.get(), a.intern().get());
+		EXPECT_TRUE(CString().intern().isNull());
+		EXPECT_TRUE(CString::intern("").isInterned());
+
+		// Modification makes a private copy and leaves the canonical instance alone
+		CString d = b;
+		d.append("_2");
+		EXPECT_FALSE(d.isInterned());
+		EXPECT_EQ(CString("column_name_2"), d);
+		EXPECT_EQ(CString("column_name"), b);
+		EXPECT_TRUE(b.isInterned());
+
+		CString e = a;
+		e.mget()[0] = 'C';
+		EXPECT_EQ(CString("Column_name"), e);
+		EXPECT_EQ(CString("column_name"), a);
+
+		// Slices of an interned buffer aren't interned themselves
+		CString longStr = CString::intern("a rather long string that certainly doesn't fit inline");
+		CString slice = longStr.substr(2);
+		EXPECT_FALSE(slice.isInterned());
+		EXPECT_EQ(CString("rather long string that certainly doesn't fit inline"), slice);
+	}
+
+	// Entries are weak, so they are gone when the last reference is
+	EXPECT_EQ(baseCount, CString::getInternedCount());
+
+	// Concurrent interning of overlapping strings, with references dropped and re-created all the time
+	const size_t numThreads = 8;
+	const size_t numNames = 200;
+	vector<vector<CString>> held(numThreads);
+	vector<std::thread> threads;
+
+	for (size_t t = 0 ; t < numThreads ; t++) {
+		threads.emplace_back([&, t]() {
+			std::minstd_rand rng(t+1);
+			vector<CString>& mine = held[t];
+			mine.resize(numNames);
+
+			for (int i = 0 ; i < 20000 ; i++) {
+				size_t idx = rng() % numNames;
+				CString name = CString::format("shared_name_%u", (unsigned int) idx).intern();
+
+				if (rng() % 3 == 0) {
+					mine[idx] = name;
+				} else if (rng() % 3 == 0) {
+					mine[idx] = CString();
+				}
+			}
+		});
+	}
+
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	for (size_t idx = 0 ; idx < numNames ; idx++) {
+		const char* canonical = NULL;
+
+		for (size_t t = 0 ; t < numThreads ; t++) {
+			const CString& name = held[t][idx];
+
+			if (!name.isNull()) {
+				EXPECT_TRUE(name.isInterned());
+				EXPECT_EQ(CString::format("shared_name_%u", (unsigned int) idx), name);
+
+				if (canonical) {
+					EXPECT_EQ(canonical, name.get());
+				} else {
+					canonical = name.get();
+				}
+			}
+		}
+	}
+
+	held.clear();
+	EXPECT_EQ(baseCount, CString::getInternedCount());
+}
+
+
+// Straightforward encoders for code points, used as a reference
+static void AppendUTF8Reference(std::string& str, uint32_t cp)
+{
+	if (cp < 0x80) {
+		str += (char) cp;
+	} else if (cp < 0x800) {
+		str += (char) (0xC0 | (cp >> 6));
+		str += (char) (0x80 | (cp & 0x3F));
+	} else if (cp < 0x10000) {
+		str += (char) (0xE0 | (cp >> 12));
+		str += (char) (0x80 | ((cp >> 6) & 0x3F));
+		str += (char) (0x80 | (cp & 0x3F));
+	} else {
+		str += (char) (0xF0 | (cp >> 18));
+		str += (char) (0x80 | ((cp >> 12) & 0x3F));
+		str += (char) (0x80 | ((cp >> 6) & 0x3F));
+		str += (char) (0x80 | (cp & 0x3F));
+	}
+}
+
+static void AppendUTF16LEReference(std::string& str, uint32_t cp)
+{
+	auto appendUnit = [&](uint32_t u) {
+		str += (char) (u & 0xFF);
+		str += (char) (u >> 8);
+	};
+
+	if (cp < 0x10000) {
+		appendUnit(cp);
+	} else {
+		appendUnit(0xD800 + ((cp - 0x10000) >> 10));
+		appendUnit(0xDC00 + ((cp - 0x10000) & 0x3FF));
+	}
+}
+
+
+TEST(StringTest, TranscodeTest)
+{
+	std::mt19937 rng(1337);
+
+	auto randomCodePoint = [&](int asciiPercent) -> uint32_t {
+		if ((int) (rng() % 100) < asciiPercent) {
+			return 0x20 + rng() % 0x5F;
+		}
+		switch (rng() % 4) {
+		case 0:		return 0x80 + rng() % 0x80;
+		case 1:		return 0x100 + rng() % 0x700;
+		case 2:		{ uint32_t cp = 0x800 + rng() % 0xF800; return (cp >= 0xD800  &&  cp < 0xE000) ? 0xFFFD : cp; }
+		default:	return 0x10000 + rng() % 0x100000;
+		}
+	};
+
+	auto transcode = [](const std::string& src, Encoding srcEnc, Encoding destEnc, TranscodeStatus* status = NULL) {
+		std::string dest(src.size()*2 + 4, '\0');
+		TranscodeResult res = TranscodeNative(src.data(), src.size(), &dest[0], dest.size(), srcEnc, destEnc);
+		if (status) {
+			*status = res.status;
+		} else {
+			EXPECT_EQ(TranscodeOK, res.status);
+			EXPECT_EQ(src.size(), res.srcBytes);
+		}
+		dest.resize(res.destBytes);
+		return dest;
+	};
+
+	StrSimdLevel origLevel = GetStrSimdLevel();
+
+	for (int level = StrSimdScalar ; level <= GetStrSimdMaxLevel() ; level++) {
+		SCOPED_TRACE(StrSimdLevelName((StrSimdLevel) level));
+		EXPECT_EQ(level, SetStrSimdLevel((StrSimdLevel) level));
+
+		// Random round trips, with lengths around the vector widths and different amounts of ASCII
+		for (int asciiPercent : { 100, 95, 50, 0 }) {
+			for (size_t numChars = 0 ; numChars < 140 ; numChars++) {
+				std::string utf8, utf16, latin1;
+				bool isLatin1 = true;
+				for (size_t i = 0 ; i < numChars ; i++) {
+					uint32_t cp = randomCodePoint(asciiPercent);
+					AppendUTF8Reference(utf8, cp);
+					AppendUTF16LEReference(utf16, cp);
+					isLatin1 = isLatin1  &&  cp < 0x100;
+					latin1 += (char) cp;
+				}
+
+				EXPECT_TRUE(ValidateUTF8(utf8.data(), utf8.size()));
+				EXPECT_EQ(utf16, transcode(utf8, UTF8, UTF16));
+				EXPECT_EQ(utf8, transcode(utf16, UTF16, UTF8));
+
+				if (isLatin1) {
+					EXPECT_EQ(utf16, transcode(latin1, ISO8859_1, UTF16));
+					EXPECT_EQ(latin1, transcode(utf16, UTF16, ISO8859_1));
+					EXPECT_EQ(latin1, transcode(utf8, UTF8, ISO8859_1));
+					EXPECT_EQ(utf8, transcode(latin1, ISO8859_1, UTF8));
+				}
+				if (asciiPercent == 100) {
+					EXPECT_EQ(utf8, transcode(utf8, ASCII, UTF8));
+					EXPECT_EQ(utf16, transcode(utf8, ASCII, UTF16));
+					EXPECT_EQ(utf8, transcode(utf16, UTF16, ASCII));
+				} else if (FindNonASCII(utf8.data(), utf8.size()) != utf8.size()) {
+					TranscodeStatus status;
+					transcode(utf16, UTF16, ASCII, &status);
+					EXPECT_EQ(TranscodeInvalid, status);
+				}
+			}
+		}
+
+		// Invalid sequences, at every position relative to the vector boundaries
+		const char* invalidSeqs[] = {
+				"\x80",				// Lone continuation byte
+				"\xC0\x80",			// Overlong
+				"\xC1\xBF",			// Overlong
+				"\xE0\x9F\xBF",		// Overlong
+				"\xF0\x8F\xBF\xBF",	// Overlong
+				"\xED\xA0\x80",		// Surrogate
+				"\xED\xBF\xBF",		// Surrogate
+				"\xF4\x90\x80\x80",	// Above U+10FFFF
+				"\xF5\x80\x80\x80",	// Above U+10FFFF
+				"\xFF",
+				"\xC3",				// Truncated
+				"\xE2\x82",			// Truncated
+				"\xF0\x9F\x98",		// Truncated
+				"\xC3\xA4\xA4",		// Too many continuation bytes (after one valid character)
+				"\xE2\x82\xAC\x80"	// Too many continuation bytes (after one valid character)
+		};
+
+		for (const char* seq : invalidSeqs) {
+			size_t numValidUnits = (strlen(seq) > 2  &&  ValidateUTF8(seq, strlen(seq)-1)) ? 1 : 0;
+			SCOPED_TRACE(testing::PrintToString(std::string(seq)));
+
+			for (size_t pos = 0 ; pos < 70 ; pos++) {
+				for (size_t after : { (size_t) 0, (size_t) 1, (size_t) 40 }) {
+					std::string str = std::string(pos, 'a') + seq + std::string(after, 'b');
+					EXPECT_FALSE(ValidateUTF8(str.data(), str.size()));
+
+					TranscodeStatus status;
+					std::string utf16 = transcode(str, UTF8, UTF16, &status);
+					EXPECT_NE(TranscodeOK, status);
+					EXPECT_EQ((pos+numValidUnits)*2, utf16.size());
+				}
+			}
+		}
+
+		const char* validSeqs[] = { "\x7F", "\xC2\x80", "\xDF\xBF", "\xE0\xA0\x80", "\xED\x9F\xBF",
+				"\xEE\x80\x80", "\xEF\xBF\xBF", "\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF" };
+
+		for (const char* seq : validSeqs) {
+			for (size_t pos = 0 ; pos < 70 ; pos++) {
+				std::string str = std::string(pos, 'a') + seq + "b";
+				EXPECT_TRUE(ValidateUTF8(str.data(), str.size()));
+			}
+		}
+
+		// Random corruption of valid text. The validator and the decoder in TranscodeNative() are independent.
+		for (int i = 0 ; i < 2000 ; i++) {
+			std::string utf8;
+			size_t numChars = rng() % 80;
+			for (size_t j = 0 ; j < numChars ; j++) {
+				AppendUTF8Reference(utf8, randomCodePoint(70));
+			}
+			if (!utf8.empty()) {
+				utf8[rng() % utf8.size()] = (char) (rng() % 256);
+			}
+
+			TranscodeStatus status;
+			transcode(utf8, UTF8, UTF16, &status);
+			EXPECT_EQ(status == TranscodeOK, ValidateUTF8(utf8.data(), utf8.size()));
+		}
+
+		// Unpaired surrogates in UTF-16
+		for (std::string seq : { std::string("\x00\xD8", 2), std::string("\x00\xDC", 2),
+				std::string("\x00\xD8\x41\x00", 4) }) {
+			TranscodeStatus status;
+			std::string utf8 = transcode(std::string(40, '\0') + seq, UTF16, UTF8, &status);
+			EXPECT_NE(TranscodeOK, status);
+			EXPECT_EQ(20, utf8.size());
+		}
+	}
+
+	SetStrSimdLevel(origLevel);
+
+	char buf[64];
+
+	// Incomplete input stops before the partial character, so that it can be continued
+	TranscodeResult res = TranscodeNative("ab\xE2\x82", 4, buf, sizeof(buf), UTF8, UTF16);
+	EXPECT_EQ(TranscodeIncomplete, res.status);
+	EXPECT_EQ(2, res.srcBytes);
+	EXPECT_EQ(4, res.destBytes);
+
+	res = TranscodeNative("ab\xE2\x82\xAC", 5, buf, 5, UTF8, UTF16);
+	EXPECT_EQ(TranscodeDestFull, res.status);
+	EXPECT_EQ(2, res.srcBytes);
+	EXPECT_EQ(4, res.destBytes);
+
+	// Transcode() on top of it
+	char src[] = "H\xC3\xA4llo \xF0\x9F\x98\x80";
+	EXPECT_EQ(16, Transcode(src, 11, buf, sizeof(buf), UTF8, UTF16));
+	EXPECT_EQ(0, memcmp(buf, "H\0\xE4\0l\0l\0o\0 \0\x3D\xD8\x00\xDE", 16));
+	EXPECT_EQ(ERR_INSUFFICIENT_BUFFER, Transcode(src, 11, buf, 8, UTF8, UTF16));
+	EXPECT_EQ(ERR_INVALID_SEQUENCE, Transcode(src, 11, buf, sizeof(buf), UTF8, ASCII));
+	EXPECT_EQ(ERR_INVALID_SEQUENCE, Transcode(src, 2, buf, sizeof(buf), UTF8, UTF16));
+	EXPECT_EQ(ERR_INVALID_PARAMETER, Transcode(src, 11, buf, sizeof(buf), None, UTF16));
+
+	// GXT mappings
+	char gxt8[] = "A\x80\x7C\xF3";
+	EXPECT_EQ(6, Transcode(gxt8, 4, buf, sizeof(buf), GXT8, UTF8));
+	EXPECT_EQ(0, memcmp(buf, "A\xC3\x80\xC2\xBA@", 6));
+	EXPECT_EQ(8, Transcode(gxt8, 4, buf, sizeof(buf), GXT8, GXT16));
+	EXPECT_EQ(0, memcmp(buf, "A\0\x80\0\x7C\0\xF3\0", 8));
+
+	char gxt16[8];
+	memcpy(gxt16, buf, 8);
+	EXPECT_EQ(6, Transcode(gxt16, 8, buf, sizeof(buf), GXT16, UTF8));
+	EXPECT_EQ(0, memcmp(buf, "A\xC3\x80\xC2\xBA@", 6));
+
+	char utf8[] = "A\xC3\x80\xC2\xBA@";
+	EXPECT_EQ(4, Transcode(utf8, 6, buf, sizeof(buf), UTF8, GXT8));
+	EXPECT_EQ(0, memcmp(buf, gxt8, 4));
+	EXPECT_EQ(8, Transcode(utf8, 6, buf, sizeof(buf), UTF8, GXT16));
+	EXPECT_EQ(0, memcmp(buf, gxt16, 8));
+	EXPECT_EQ(ERR_INSUFFICIENT_BUFFER, Transcode(utf8, 6, buf, 5, UTF8, GXT16));
+
+	// Windows-1252 still goes through the platform's conversion functions
+	char cp1252[] = "\x80 5";
+	EXPECT_EQ(5, Transcode(cp1252, 3, buf, sizeof(buf), WINDOWS1252, UTF8));
+	EXPECT_EQ(0, memcmp(buf, "\xE2\x82\xAC 5", 5));
+	EXPECT_EQ(2, Transcode(gxt8, 2, buf, sizeof(buf), GXT8, WINDOWS1252));
+	EXPECT_EQ(0, memcmp(buf, "A\xC0", 2));
+}
+
+
+TEST(StringTest, StreamingTranscodeTest)
+{
+	std::mt19937 rng(4711);
+
+	std::string utf8, utf16;
+	for (int i = 0 ; i < 3000 ; i++) {
+		uint32_t cp;
+		switch (rng() % 5) {
+		case 0:		cp = 0x80 + rng() % 0x780; break;
+		case 1:		cp = 0x3000 + rng() % 0x1000; break;
+		case 2:		cp = 0x10000 + rng() % 0x100000; break;
+		default:	cp = 0x20 + rng() % 0x5F; break;
+		}
+		AppendUTF8Reference(utf8, cp);
+		AppendUTF16LEReference(utf16, cp);
+	}
+
+	auto transcodeInChunks = [](Transcoder& tc, const std::string& src, size_t chunkSize) {
+		std::string out;
+		for (size_t i = 0 ; i < src.size() ; i += chunkSize) {
+			size_t len = std::min(chunkSize, src.size() - i);
+			int res = tc.feed(src.data() + i, len);
+			EXPECT_EQ((int) tc.getOutputSize(), res);
+			out.append(tc.getOutput(), tc.getOutputSize());
+			tc.clearOutput();
+		}
+		EXPECT_EQ(0, tc.flush());
+		return out;
+	};
+
+	// Characters of every length are split at every possible position
+	for (size_t chunkSize : { 1, 2, 3, 5, 7, 64, 1000, 100000 }) {
+		Transcoder toUTF16(UTF8, UTF16);
+		EXPECT_EQ(utf16, transcodeInChunks(toUTF16, utf8, chunkSize));
+
+		Transcoder toUTF8(UTF16, UTF8);
+		EXPECT_EQ(utf8, transcodeInChunks(toUTF8, utf16, chunkSize));
+
+		// Can be reused after flush()
+		EXPECT_EQ(utf8, transcodeInChunks(toUTF8, utf16, chunkSize));
+	}
+
+	// Input that ends in the middle of a character
+	Transcoder tc(UTF8, UTF16);
+	EXPECT_EQ(4, tc.feed("ab\xE2\x82", 4));
+	EXPECT_EQ(ERR_INVALID_SEQUENCE, tc.flush());
+	EXPECT_EQ(std::string("a\0b\0", 4), std::string(tc.getOutput(), tc.getOutputSize()));
+	tc.reset();
+
+	// An invalid sequence that is split across chunks
+	EXPECT_EQ(0, tc.feed("\xE2", 1));
+	EXPECT_EQ(ERR_INVALID_SEQUENCE, tc.feed("(", 1));
+	EXPECT_EQ(ERR_INVALID_SEQUENCE, tc.feed("a", 1));
+	tc.reset();
+	EXPECT_EQ(2, tc.feed("a", 1));
+
+	// Windows-1252 goes through UTF-16
+	Transcoder toCP1252(UTF8, WINDOWS1252);
+	EXPECT_EQ(std::string("\x80 5 \xE4"), transcodeInChunks(toCP1252, "\xE2\x82\xAC 5 \xC3\xA4", 1));
+	Transcoder fromCP1252(WINDOWS1252, UTF8);
+	EXPECT_EQ(std::string("\xE2\x82\xAC 5 \xC3\xA4"), transcodeInChunks(fromCP1252, "\x80 5 \xE4", 2));
+
+	// Stream adapters, with chunk sizes that split characters
+	std::istringstream utf8Stream(utf8);
+	TranscodingIstream in(&utf8Stream, UTF8, UTF16, false, 7);
+	std::string streamed((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EXPECT_EQ(utf16, streamed);
+
+	std::istringstream* utf16Stream = new std::istringstream(utf16);
+	TranscodingReader reader(utf16Stream, UTF16, UTF8, true, 13);
+	std::string readStr;
+	char buf[100];
+	size_t numRead;
+	while ((numRead = reader.read(buf, sizeof(buf))) != 0) {
+		readStr.append(buf, numRead);
+	}
+	EXPECT_EQ(utf8, readStr);
+
+	// Reader's string helpers stop at the end of the stream
+	std::istringstream stringsStream(std::string("ab\0cd", 5));
+	TranscodingReader stringsReader(&stringsStream, UTF8, UTF8);
+	bool terminatorFound;
+	EXPECT_EQ(CString("ab"), stringsReader.readNullTerminatedString(&terminatorFound));
+	EXPECT_TRUE(terminatorFound);
+	EXPECT_EQ(CString("cd"), stringsReader.readNullTerminatedString(&terminatorFound));
+	EXPECT_FALSE(terminatorFound);
+	EXPECT_EQ(CString(""), stringsReader.readFixedLengthString(10));
+
+	std::istringstream invalidStream(utf8.substr(0, 1000) + "\xC0\x80");
+	TranscodingIstream invalidIn(&invalidStream, UTF8, UTF16, false, 64);
+	while (invalidIn.read(buf, sizeof(buf)));
+	EXPECT_TRUE(invalidIn.bad());
+
+	std::istringstream truncatedStream("abc\xF0\x9F");
+	TranscodingReader truncatedReader(&truncatedStream, UTF8, UTF16);
+	EXPECT_THROW(truncatedReader.read(buf, sizeof(buf)), IOException);
+}
+
+
 
 #ifdef NXCOMMON_UNICODE_ENABLED
 